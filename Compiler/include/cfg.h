@@ -0,0 +1,80 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "ir.h"
+
+// Control-flow analysis of an IRFunction: predecessors, dominators,
+// natural loops and register liveness.
+//
+// Dominators use the iterative algorithm of Cooper, Harvey and Kennedy
+// over reverse postorder. Each back edge (latch -> header, where the
+// header dominates the latch) defines a natural loop: the header plus
+// every block that reaches the latch without passing through the header.
+// Loops that share a header are merged.
+//
+// An analysis describes the function as it was; passes that add blocks
+// or edges analyze again before relying on it.
+
+typedef struct {
+    int header;
+    int *blocks;            // Header first
+    int block_count;
+    bool *member;           // Indexed by block
+    int member_size;
+    int *latches;           // In-loop predecessors of the header
+    int latch_count;
+    int preheader;          // See below, or -1
+    int parent;             // Innermost enclosing loop, or -1
+    int depth;              // 1 for an outermost loop
+    bool innermost;
+} Loop;
+
+typedef struct {
+    int block_count;
+    int **preds;
+    int *pred_count;
+    int *rpo;               // Reachable blocks in reverse postorder
+    int rpo_count;
+    int *rpo_index;         // -1 for an unreachable block
+    int *idom;              // The entry's is itself; -1 for an unreachable block
+    Loop *loops;            // Inner loops before the loops around them
+    int loop_count;
+} CFG;
+
+typedef struct {
+    int reg_count;
+    int words;              // Per block
+    uint64_t *in;
+    uint64_t *out;
+} Liveness;
+
+CFG *cfg_analyze(const IRFunction *fn);
+void cfg_free(CFG *cfg);
+
+bool cfg_dominates(const CFG *cfg, int a, int b);
+bool loop_contains(const Loop *loop, int block);
+
+// The preheader is the header's only predecessor outside the loop, when
+// that block's only successor is the header. Code placed at its end runs
+// once each time the loop is entered. Returns false if the loop has none.
+bool loop_has_preheader(const Loop *loop);
+
+// Blocks inside the loop with a successor outside it
+int loop_exiting_blocks(const IRFunction *fn, const Loop *loop, int *out);
+
+// Number of instructions in the loop that write each register; `defs`
+// has reg_count entries
+void loop_count_defs(const IRFunction *fn, const Loop *loop, int *defs);
+
+// A basic induction variable is written once in the loop, by
+// `add i, i, step` or `sub i, i, step` with a constant step. Returns
+// false if `reg` is not one; otherwise gives its step and the update.
+bool loop_induction(const IRFunction *fn, const Loop *loop, const int *defs, int reg,
+                    int64_t *step, int *block, int *pos);
+
+Liveness *liveness_compute(const IRFunction *fn, const CFG *cfg);
+void liveness_free(Liveness *live);
+bool live_in(const Liveness *live, int block, int reg);
+bool live_out(const Liveness *live, int block, int reg);
+
+#endif // CFG_H
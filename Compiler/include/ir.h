@@ -0,0 +1,149 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Three-address intermediate representation the optimizer works on.
+//
+// A function is a list of basic blocks, each a run of instructions that
+// ends in exactly one terminator (jmp, br or ret). Values live in named
+// 64-bit virtual registers, which may be assigned any number of times;
+// the first param_count registers are the parameters. Memory is reached
+// through load and store on 64-bit words: `load d, base, index` reads
+// the word at base + index * 8.
+//
+// The text form is MicroASM-style, one instruction per line:
+//
+//     func sum(a, n)
+//         mov s, 0
+//         mov i, 0
+//     head:
+//         lt c, i, n
+//         br c, body, done
+//     body:
+//         load x, a, i
+//         add s, s, x
+//         add i, i, 1
+//         jmp head
+//     done:
+//         ret s
+//     end
+//
+// Operands are registers or integer literals. A block without a
+// terminator falls through to the next label. `;` starts a comment.
+
+typedef enum {
+    IR_MOV,         // d = a
+    IR_ADD,         // d = a + b
+    IR_SUB,
+    IR_MUL,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_SHL,
+    IR_SHR,         // Arithmetic shift
+    IR_LT,          // d = a < b ? 1 : 0, signed
+    IR_LE,
+    IR_EQ,
+    IR_NE,
+    IR_LOAD,        // d = word at a + b * 8
+    IR_STORE,       // word at a + b * 8 = c
+    IR_JMP,         // goto target[0]
+    IR_BR,          // goto a ? target[0] : target[1]
+    IR_RET,         // return a
+    IR_OP_COUNT
+} IROp;
+
+typedef struct {
+    bool is_imm;
+    int64_t imm;
+    int reg;                // -1 for an immediate or a missing operand
+} IROperand;
+
+typedef struct {
+    IROp op;
+    int dst;                // Register written, or -1
+    IROperand src[3];
+    int target[2];          // Blocks a jmp or br goes to
+} IRInst;
+
+typedef struct {
+    char *label;
+    IRInst *insts;
+    int count;
+    int capacity;
+} IRBlock;
+
+typedef struct {
+    char *name;
+    char **regs;            // Register names
+    int reg_count;
+    int param_count;
+    IRBlock *blocks;        // blocks[0] is the entry; may move when blocks are added
+    int block_count;
+    int block_capacity;
+} IRFunction;
+
+// Dynamic counts from ir_run(). The cost weighs a multiply as three
+// instructions, roughly its latency next to an add.
+typedef struct {
+    uint64_t insts;
+    uint64_t cost;
+    uint64_t branches;
+} IRRunStats;
+
+IRFunction *ir_function_new(const char *name);
+void ir_function_free(IRFunction *fn);
+
+// Register with this name, added if new
+int ir_reg(IRFunction *fn, const char *name);
+// Fresh register named after `hint`
+int ir_new_reg(IRFunction *fn, const char *hint);
+
+// Index of a new, empty block. A NULL or taken label gets a numbered one.
+int ir_block_new(IRFunction *fn, const char *label);
+int ir_block_find(const IRFunction *fn, const char *label);
+// Move a block to index `to`, shifting the ones between and renumbering
+// branch targets. Moving a block to 0 makes it the entry.
+void ir_move_block(IRFunction *fn, int from, int to);
+
+void ir_append(IRFunction *fn, int block, IRInst inst);
+void ir_insert(IRFunction *fn, int block, int pos, IRInst inst);
+void ir_remove(IRFunction *fn, int block, int pos);
+
+// Before the block's terminator
+void ir_insert_before_end(IRFunction *fn, int block, IRInst inst);
+
+IROperand ir_imm(int64_t value);
+IROperand ir_use(int reg);
+IRInst ir_inst(IROp op, int dst, IROperand a, IROperand b);
+IRInst ir_jmp(int target);
+
+const char *ir_op_name(IROp op);
+bool ir_is_terminator(IROp op);
+// No side effects and cannot trap, so safe to move or duplicate
+bool ir_is_pure(IROp op);
+int ir_src_count(IROp op);
+
+// Successor blocks of the block's terminator; returns how many
+int ir_successors(const IRBlock *block, int out[2]);
+const IRInst *ir_terminator(const IRBlock *block);
+
+// Parse the next function from *text, advancing it. NULL at the end of
+// the input, or on an error, which is then described in `error`.
+IRFunction *ir_parse(const char **text, char *error, size_t error_size);
+void ir_print(const IRFunction *fn, FILE *out);
+
+// Every block ends in one terminator, and targets and registers exist.
+// On failure the problem is described in `error`.
+bool ir_verify(const IRFunction *fn, char *error, size_t error_size);
+
+// Interpret the function. Stops with false after `limit` instructions or
+// on a malformed function.
+bool ir_run(const IRFunction *fn, const int64_t *args, int64_t *result,
+            IRRunStats *stats, uint64_t limit);
+
+#endif // IR_H
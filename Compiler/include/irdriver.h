@@ -0,0 +1,19 @@
+#ifndef IRDRIVER_H
+#define IRDRIVER_H
+
+#include <stdbool.h>
+
+// Command-line driver for MicroASM IR files (.mir). Each function is
+// parsed, run through loop_optimize() and printed, as IR or, with -S,
+// as x86-64 NASM source. Flags are those of the compiler (README.md).
+//
+// It needs nothing but the host C library, so `irc` (src/irc.c) can be
+// built and run without MLibc; the compiler hands .mir files to it too.
+
+// True for a path the IR driver reads
+bool ir_driver_accepts(const char *path);
+
+// Process exit status
+int ir_driver_main(int argc, char *argv[]);
+
+#endif // IRDRIVER_H
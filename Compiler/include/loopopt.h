@@ -0,0 +1,58 @@
+#ifndef LOOPOPT_H
+#define LOOPOPT_H
+
+#include "ir.h"
+
+// Loop optimizations on the IR, built on the natural loops found by
+// cfg.h. Each pass returns how many changes it made.
+//
+// - Loop-invariant code motion moves pure instructions whose operands do
+//   not change inside a loop into its preheader. Loads move only out of
+//   loops that store nothing, and only from blocks that run on every
+//   iteration, since a hoisted load runs even when the loop does not.
+// - Strength reduction finds basic induction variables (a register whose
+//   only update in the loop is `add i, i, step`) and replaces `i * k` and
+//   `i << k` with a register that starts at i * k and moves by step * k
+//   next to each update.
+// - Partial unrolling copies the body of an innermost counted loop
+//   (`lt c, i, n` at the header, i stepping by a constant) `factor` times
+//   behind one guard that checks all copies will run. The original loop
+//   stays behind for the leftover iterations.
+//
+// Like C, the passes assume induction variables do not overflow. Loops
+// the backend will vectorize (vectorize.h) are left rolled.
+
+#define LOOP_UNROLL_DEFAULT 4
+#define LOOP_UNROLL_MAX     16
+#define LOOP_UNROLL_BUDGET  256     // Instructions an unrolled body may grow to
+
+typedef struct {
+    bool licm;
+    bool strength_reduce;
+    int unroll_factor;              // 1 leaves loops rolled
+    int vector_width;               // Lanes the backend vectorizes with, or 0
+} LoopOptions;
+
+typedef struct {
+    int preheaders;
+    int hoisted;
+    int reduced;
+    int unrolled;
+} LoopOptStats;
+
+void loop_options_default(LoopOptions *options);
+
+// Give every loop a preheader (see cfg.h)
+int loop_insert_preheaders(IRFunction *fn);
+
+int loop_licm(IRFunction *fn);
+int loop_strength_reduce(IRFunction *fn);
+int loop_unroll(IRFunction *fn, int factor, int vector_width);
+
+// Merge each block into its only predecessor when that ends in a jmp to
+// it, and drop unreachable blocks
+int ir_simplify_cfg(IRFunction *fn);
+
+void loop_optimize(IRFunction *fn, const LoopOptions *options, LoopOptStats *stats);
+
+#endif // LOOPOPT_H
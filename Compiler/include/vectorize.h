@@ -0,0 +1,68 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include "cfg.h"
+
+// Loop vectorization plans for the x86 backend.
+//
+// A loop qualifies when it counts i up by one to an invariant bound and
+// every iteration is independent of the others:
+//
+//     head:
+//         lt c, i, n                  ; or le, and nothing else
+//         br c, body, done
+//     body:                           ; the only other block
+//         load x, a, i                ; a[i], a not written in the loop
+//         add y, x, k                 ; add, sub, and, or, xor, mov,
+//         store b, i, y               ; shl by a constant
+//         add s, s, x                 ; a sum, read nowhere else
+//         add i, i, 1                 ; after the last use of i
+//         jmp head
+//
+// Registers written in the body must be written before they are read and
+// be dead after the loop, so each lane can compute its own copy. Arrays
+// are only indexed by i itself; whether two of them overlap closer than a
+// vector's width is checked at run time.
+//
+// The backend runs `width` iterations at a time in the preheader, then
+// lets the original loop finish the rest as the scalar epilogue.
+
+#define VECTOR_SSE2 2               // 64-bit lanes in an XMM register
+#define VECTOR_AVX2 4               // In a YMM register
+#define VECTOR_REGS 15              // The 16th is scratch
+#define VECTOR_MAX_BASES 8
+
+typedef enum {
+    LANE_SCALAR,                    // Not used as a vector
+    LANE_VALUE,                     // Written in the body, one value per lane
+    LANE_UNIFORM,                   // Same in every lane; broadcast before the loop
+    LANE_SUM                        // Reduction; lanes are added up after the loop
+} LaneKind;
+
+typedef struct {
+    int header;
+    int body;
+    int preheader;
+    int exit;
+    int width;
+    int iv;
+    IROp compare;                   // IR_LT or IR_LE
+    IROperand limit;
+    LaneKind *kinds;                // Per register
+    int bases[VECTOR_MAX_BASES];    // Arrays indexed by i
+    bool stored[VECTOR_MAX_BASES];
+    int base_count;
+    int64_t constants[VECTOR_REGS]; // Immediates used as lane operands
+    int constant_count;
+} VectorLoop;
+
+// Fill in `plan` if the loop can run `width` iterations at a time.
+// A NULL plan only asks the question.
+bool vector_plan_loop(const IRFunction *fn, const Liveness *live, const Loop *loop, int width,
+                      VectorLoop *plan);
+void vector_plan_free(VectorLoop *plan);
+
+// Index of the body instruction that steps i
+int vector_iv_update(const IRFunction *fn, const VectorLoop *plan);
+
+#endif // VECTORIZE_H
@@ -0,0 +1,26 @@
+#ifndef X86GEN_H
+#define X86GEN_H
+
+#include <stdio.h>
+#include "ir.h"
+
+// x86-64 backend for the IR, writing NASM source.
+//
+// Functions follow the System V calling convention, taking up to six
+// parameters in rdi, rsi, rdx, rcx, r8 and r9 and returning in rax.
+// Every IR register lives in a stack slot; instructions load their
+// operands into rax and rcx and store the result back.
+//
+// With a vector width (see vectorize.h), each loop that qualifies gets a
+// vector loop in its preheader that runs `width` iterations at a time:
+// SSE2 for 2 lanes, AVX2 for 4. Whatever it leaves over, and every loop
+// whose arrays overlap too closely, runs in the original scalar loop.
+
+#define X86_MAX_PARAMS 6
+
+// Returns false, with the reason in `error`, for a function it cannot
+// emit
+bool x86_emit_function(const IRFunction *fn, int vector_width, FILE *out,
+                       char *error, size_t error_size);
+
+#endif // X86GEN_H
@@ -0,0 +1,418 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+
+static void *zalloc(size_t count, size_t size) {
+    void *ptr = calloc(count ? count : 1, size);
+    if (!ptr) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void find_preds(const IRFunction *fn, CFG *cfg) {
+    int succ[2];
+
+    cfg->preds = zalloc(fn->block_count, sizeof(int *));
+    cfg->pred_count = zalloc(fn->block_count, sizeof(int));
+    for (int b = 0; b < fn->block_count; b++) {
+        int n = ir_successors(&fn->blocks[b], succ);
+        for (int s = 0; s < n; s++) {
+            cfg->pred_count[succ[s]]++;
+        }
+    }
+    for (int b = 0; b < fn->block_count; b++) {
+        cfg->preds[b] = zalloc(cfg->pred_count[b], sizeof(int));
+        cfg->pred_count[b] = 0;
+    }
+    for (int b = 0; b < fn->block_count; b++) {
+        int n = ir_successors(&fn->blocks[b], succ);
+        for (int s = 0; s < n; s++) {
+            cfg->preds[succ[s]][cfg->pred_count[succ[s]]++] = b;
+        }
+    }
+}
+
+// Depth-first from the entry with an explicit stack; blocks are numbered
+// as they finish, then reversed
+static void find_rpo(const IRFunction *fn, CFG *cfg) {
+    int *stack = zalloc(fn->block_count, sizeof(int));
+    int *next_succ = zalloc(fn->block_count, sizeof(int));
+    bool *seen = zalloc(fn->block_count, sizeof(bool));
+    int *postorder = zalloc(fn->block_count, sizeof(int));
+    int depth = 0, done = 0;
+    int succ[2];
+
+    stack[depth++] = 0;
+    seen[0] = true;
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        int n = ir_successors(&fn->blocks[b], succ);
+        if (next_succ[b] < n) {
+            int s = succ[next_succ[b]++];
+            if (!seen[s]) {
+                seen[s] = true;
+                stack[depth++] = s;
+            }
+        } else {
+            postorder[done++] = b;
+            depth--;
+        }
+    }
+
+    cfg->rpo = zalloc(fn->block_count, sizeof(int));
+    cfg->rpo_index = zalloc(fn->block_count, sizeof(int));
+    cfg->rpo_count = done;
+    for (int b = 0; b < fn->block_count; b++) {
+        cfg->rpo_index[b] = -1;
+    }
+    for (int i = 0; i < done; i++) {
+        cfg->rpo[i] = postorder[done - 1 - i];
+        cfg->rpo_index[cfg->rpo[i]] = i;
+    }
+    free(stack);
+    free(next_succ);
+    free(seen);
+    free(postorder);
+}
+
+static int intersect(const CFG *cfg, int a, int b) {
+    while (a != b) {
+        while (cfg->rpo_index[a] > cfg->rpo_index[b]) {
+            a = cfg->idom[a];
+        }
+        while (cfg->rpo_index[b] > cfg->rpo_index[a]) {
+            b = cfg->idom[b];
+        }
+    }
+    return a;
+}
+
+static void find_dominators(CFG *cfg) {
+    bool changed = true;
+
+    cfg->idom = zalloc(cfg->block_count, sizeof(int));
+    for (int b = 0; b < cfg->block_count; b++) {
+        cfg->idom[b] = -1;
+    }
+    cfg->idom[0] = 0;
+    while (changed) {
+        changed = false;
+        for (int i = 1; i < cfg->rpo_count; i++) {
+            int b = cfg->rpo[i];
+            int idom = -1;
+            for (int p = 0; p < cfg->pred_count[b]; p++) {
+                int pred = cfg->preds[b][p];
+                if (cfg->idom[pred] < 0) {
+                    continue;               // Unreachable or not reached yet
+                }
+                idom = idom < 0 ? pred : intersect(cfg, pred, idom);
+            }
+            if (idom != cfg->idom[b]) {
+                cfg->idom[b] = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool cfg_dominates(const CFG *cfg, int a, int b) {
+    if (b < 0 || b >= cfg->block_count || cfg->idom[b] < 0) {
+        return false;
+    }
+    while (b != a && b != 0) {
+        b = cfg->idom[b];
+    }
+    return b == a;
+}
+
+bool loop_contains(const Loop *loop, int block) {
+    return block >= 0 && block < loop->member_size && loop->member[block];
+}
+
+bool loop_has_preheader(const Loop *loop) {
+    return loop->preheader >= 0;
+}
+
+// Add the blocks that reach `latch` without passing the header
+static void add_body(const CFG *cfg, Loop *loop, int latch) {
+    int *stack = zalloc(cfg->block_count, sizeof(int));
+    int depth = 0;
+
+    if (!loop->member[latch]) {
+        loop->member[latch] = true;
+        stack[depth++] = latch;
+    }
+    while (depth > 0) {
+        int b = stack[--depth];
+        for (int p = 0; p < cfg->pred_count[b]; p++) {
+            int pred = cfg->preds[b][p];
+            if (!loop->member[pred] && cfg->rpo_index[pred] >= 0) {
+                loop->member[pred] = true;
+                stack[depth++] = pred;
+            }
+        }
+    }
+    free(stack);
+}
+
+static Loop *loop_for_header(CFG *cfg, int header) {
+    for (int i = 0; i < cfg->loop_count; i++) {
+        if (cfg->loops[i].header == header) {
+            return &cfg->loops[i];
+        }
+    }
+
+    Loop *loop = &cfg->loops[cfg->loop_count++];
+    memset(loop, 0, sizeof(Loop));
+    loop->header = header;
+    loop->member_size = cfg->block_count;
+    loop->member = zalloc(cfg->block_count, sizeof(bool));
+    loop->member[header] = true;
+    loop->latches = zalloc(cfg->pred_count[header], sizeof(int));
+    loop->preheader = -1;
+    loop->parent = -1;
+    return loop;
+}
+
+static int by_size(const void *a, const void *b) {
+    return ((const Loop *)a)->block_count - ((const Loop *)b)->block_count;
+}
+
+static void find_loops(const IRFunction *fn, CFG *cfg) {
+    cfg->loops = zalloc(cfg->block_count, sizeof(Loop));
+
+    for (int i = 0; i < cfg->rpo_count; i++) {
+        int header = cfg->rpo[i];
+        for (int p = 0; p < cfg->pred_count[header]; p++) {
+            int latch = cfg->preds[header][p];
+            if (cfg_dominates(cfg, header, latch)) {
+                Loop *loop = loop_for_header(cfg, header);
+                loop->latches[loop->latch_count++] = latch;
+                add_body(cfg, loop, latch);
+            }
+        }
+    }
+
+    for (int i = 0; i < cfg->loop_count; i++) {
+        Loop *loop = &cfg->loops[i];
+        loop->blocks = zalloc(cfg->block_count, sizeof(int));
+        loop->blocks[loop->block_count++] = loop->header;
+        for (int r = 0; r < cfg->rpo_count; r++) {
+            int b = cfg->rpo[r];
+            if (b != loop->header && loop->member[b]) {
+                loop->blocks[loop->block_count++] = b;
+            }
+        }
+
+        // A lone outside predecessor that leads only here
+        int outside = -1, outside_count = 0, succ[2];
+        for (int p = 0; p < cfg->pred_count[loop->header]; p++) {
+            int pred = cfg->preds[loop->header][p];
+            if (!loop->member[pred]) {
+                outside = pred;
+                outside_count++;
+            }
+        }
+        if (outside_count == 1 && ir_successors(&fn->blocks[outside], succ) == 1) {
+            loop->preheader = outside;
+        }
+    }
+
+    // A loop strictly inside another has fewer blocks
+    qsort(cfg->loops, cfg->loop_count, sizeof(Loop), by_size);
+    for (int i = 0; i < cfg->loop_count; i++) {
+        Loop *loop = &cfg->loops[i];
+        loop->innermost = true;
+        for (int j = i + 1; j < cfg->loop_count; j++) {
+            if (cfg->loops[j].member[loop->header]) {
+                loop->parent = j;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < cfg->loop_count; i++) {
+        Loop *loop = &cfg->loops[i];
+        if (loop->parent >= 0) {
+            cfg->loops[loop->parent].innermost = false;
+        }
+        loop->depth = 1;
+        for (int p = loop->parent; p >= 0; p = cfg->loops[p].parent) {
+            loop->depth++;
+        }
+    }
+}
+
+CFG *cfg_analyze(const IRFunction *fn) {
+    CFG *cfg = zalloc(1, sizeof(CFG));
+
+    cfg->block_count = fn->block_count;
+    find_preds(fn, cfg);
+    find_rpo(fn, cfg);
+    find_dominators(cfg);
+    find_loops(fn, cfg);
+    return cfg;
+}
+
+void cfg_free(CFG *cfg) {
+    if (!cfg) {
+        return;
+    }
+    for (int b = 0; b < cfg->block_count; b++) {
+        free(cfg->preds[b]);
+    }
+    for (int i = 0; i < cfg->loop_count; i++) {
+        free(cfg->loops[i].blocks);
+        free(cfg->loops[i].member);
+        free(cfg->loops[i].latches);
+    }
+    free(cfg->preds);
+    free(cfg->pred_count);
+    free(cfg->rpo);
+    free(cfg->rpo_index);
+    free(cfg->idom);
+    free(cfg->loops);
+    free(cfg);
+}
+
+int loop_exiting_blocks(const IRFunction *fn, const Loop *loop, int *out) {
+    int count = 0, succ[2];
+
+    for (int i = 0; i < loop->block_count; i++) {
+        int b = loop->blocks[i];
+        int n = ir_successors(&fn->blocks[b], succ);
+        for (int s = 0; s < n; s++) {
+            if (!loop_contains(loop, succ[s])) {
+                out[count++] = b;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+void loop_count_defs(const IRFunction *fn, const Loop *loop, int *defs) {
+    memset(defs, 0, fn->reg_count * sizeof(int));
+    for (int i = 0; i < loop->block_count; i++) {
+        const IRBlock *block = &fn->blocks[loop->blocks[i]];
+        for (int n = 0; n < block->count; n++) {
+            if (block->insts[n].dst >= 0) {
+                defs[block->insts[n].dst]++;
+            }
+        }
+    }
+}
+
+bool loop_induction(const IRFunction *fn, const Loop *loop, const int *defs, int reg,
+                    int64_t *step, int *block, int *pos) {
+    if (reg < 0 || defs[reg] != 1) {
+        return false;
+    }
+    for (int i = 0; i < loop->block_count; i++) {
+        const IRBlock *b = &fn->blocks[loop->blocks[i]];
+        for (int n = 0; n < b->count; n++) {
+            const IRInst *inst = &b->insts[n];
+            if (inst->dst != reg) {
+                continue;
+            }
+
+            const IROperand *x = &inst->src[0], *y = &inst->src[1];
+            if (inst->op == IR_ADD && !x->is_imm && x->reg == reg && y->is_imm) {
+                *step = y->imm;
+            } else if (inst->op == IR_ADD && !y->is_imm && y->reg == reg && x->is_imm) {
+                *step = x->imm;
+            } else if (inst->op == IR_SUB && !x->is_imm && x->reg == reg && y->is_imm) {
+                *step = -y->imm;
+            } else {
+                return false;
+            }
+            *block = loop->blocks[i];
+            *pos = n;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void set_bit(uint64_t *set, int bit) {
+    set[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static bool test_bit(const uint64_t *set, int bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+// Standard backward dataflow: a register is live into a block if the
+// block reads it before writing it, or if it is live out and not written
+Liveness *liveness_compute(const IRFunction *fn, const CFG *cfg) {
+    Liveness *live = zalloc(1, sizeof(Liveness));
+    int words = (fn->reg_count + 63) / 64;
+    uint64_t *use = zalloc((size_t)fn->block_count * words, sizeof(uint64_t));
+    uint64_t *def = zalloc((size_t)fn->block_count * words, sizeof(uint64_t));
+    bool changed = true;
+    int succ[2];
+
+    live->reg_count = fn->reg_count;
+    live->words = words;
+    live->in = zalloc((size_t)fn->block_count * words, sizeof(uint64_t));
+    live->out = zalloc((size_t)fn->block_count * words, sizeof(uint64_t));
+
+    for (int b = 0; b < fn->block_count; b++) {
+        const IRBlock *block = &fn->blocks[b];
+        for (int i = 0; i < block->count; i++) {
+            const IRInst *inst = &block->insts[i];
+            for (int s = 0; s < ir_src_count(inst->op); s++) {
+                int reg = inst->src[s].reg;
+                if (!inst->src[s].is_imm && !test_bit(def + b * words, reg)) {
+                    set_bit(use + b * words, reg);
+                }
+            }
+            if (inst->dst >= 0) {
+                set_bit(def + b * words, inst->dst);
+            }
+        }
+    }
+
+    while (changed) {
+        changed = false;
+        for (int i = cfg->rpo_count - 1; i >= 0; i--) {
+            int b = cfg->rpo[i];
+            uint64_t *out = live->out + b * words;
+            uint64_t *in = live->in + b * words;
+            int n = ir_successors(&fn->blocks[b], succ);
+
+            for (int s = 0; s < n; s++) {
+                for (int w = 0; w < words; w++) {
+                    out[w] |= live->in[succ[s] * words + w];
+                }
+            }
+            for (int w = 0; w < words; w++) {
+                uint64_t value = use[b * words + w] | (out[w] & ~def[b * words + w]);
+                if (value != in[w]) {
+                    in[w] = value;
+                    changed = true;
+                }
+            }
+        }
+    }
+    free(use);
+    free(def);
+    return live;
+}
+
+void liveness_free(Liveness *live) {
+    if (live) {
+        free(live->in);
+        free(live->out);
+        free(live);
+    }
+}
+
+bool live_in(const Liveness *live, int block, int reg) {
+    return reg < live->reg_count && test_bit(live->in + block * live->words, reg);
+}
+
+bool live_out(const Liveness *live, int block, int reg) {
+    return reg < live->reg_count && test_bit(live->out + block * live->words, reg);
+}
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+static const char *op_names[IR_OP_COUNT] = {
+    "mov", "add", "sub", "mul", "and", "or", "xor", "shl", "shr",
+    "lt", "le", "eq", "ne", "load", "store", "jmp", "br", "ret"
+};
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static char *xstrdup(const char *text) {
+    size_t length = strlen(text) + 1;
+    return memcpy(xrealloc(NULL, length), text, length);
+}
+
+IRFunction *ir_function_new(const char *name) {
+    IRFunction *fn = xrealloc(NULL, sizeof(IRFunction));
+    memset(fn, 0, sizeof(IRFunction));
+    fn->name = xstrdup(name);
+    return fn;
+}
+
+void ir_function_free(IRFunction *fn) {
+    if (!fn) {
+        return;
+    }
+    for (int i = 0; i < fn->reg_count; i++) {
+        free(fn->regs[i]);
+    }
+    for (int i = 0; i < fn->block_count; i++) {
+        free(fn->blocks[i].label);
+        free(fn->blocks[i].insts);
+    }
+    free(fn->regs);
+    free(fn->blocks);
+    free(fn->name);
+    free(fn);
+}
+
+static int add_reg(IRFunction *fn, const char *name) {
+    fn->regs = xrealloc(fn->regs, (fn->reg_count + 1) * sizeof(char *));
+    fn->regs[fn->reg_count] = xstrdup(name);
+    return fn->reg_count++;
+}
+
+int ir_reg(IRFunction *fn, const char *name) {
+    for (int i = 0; i < fn->reg_count; i++) {
+        if (strcmp(fn->regs[i], name) == 0) {
+            return i;
+        }
+    }
+    return add_reg(fn, name);
+}
+
+int ir_new_reg(IRFunction *fn, const char *hint) {
+    char name[64];
+
+    for (int n = 1;; n++) {
+        snprintf(name, sizeof(name), "%s.%d", hint, n);
+        bool taken = false;
+        for (int i = 0; i < fn->reg_count && !taken; i++) {
+            taken = strcmp(fn->regs[i], name) == 0;
+        }
+        if (!taken) {
+            return add_reg(fn, name);
+        }
+    }
+}
+
+int ir_block_new(IRFunction *fn, const char *label) {
+    char generated[96];
+
+    if (!label || ir_block_find(fn, label) >= 0) {
+        const char *base = label ? label : "L";
+        for (int n = label ? 1 : fn->block_count;; n++) {
+            snprintf(generated, sizeof(generated), "%s.%d", base, n);
+            if (ir_block_find(fn, generated) < 0) {
+                break;
+            }
+        }
+        label = generated;
+    }
+    if (fn->block_count == fn->block_capacity) {
+        fn->block_capacity = fn->block_capacity ? fn->block_capacity * 2 : 8;
+        fn->blocks = xrealloc(fn->blocks, fn->block_capacity * sizeof(IRBlock));
+    }
+
+    IRBlock *block = &fn->blocks[fn->block_count];
+    memset(block, 0, sizeof(IRBlock));
+    block->label = xstrdup(label);
+    return fn->block_count++;
+}
+
+int ir_block_find(const IRFunction *fn, const char *label) {
+    for (int i = 0; i < fn->block_count; i++) {
+        if (strcmp(fn->blocks[i].label, label) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ir_move_block(IRFunction *fn, int from, int to) {
+    IRBlock moved = fn->blocks[from];
+
+    if (from < to) {
+        memmove(&fn->blocks[from], &fn->blocks[from + 1], (to - from) * sizeof(IRBlock));
+    } else {
+        memmove(&fn->blocks[to + 1], &fn->blocks[to], (from - to) * sizeof(IRBlock));
+    }
+    fn->blocks[to] = moved;
+
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock *block = &fn->blocks[b];
+        for (int i = 0; i < block->count; i++) {
+            for (int t = 0; t < 2; t++) {
+                int *target = &block->insts[i].target[t];
+                if (*target < 0) {
+                    continue;
+                }
+                if (*target == from) {
+                    *target = to;
+                } else if (from < to && *target > from && *target <= to) {
+                    (*target)--;
+                } else if (to < from && *target >= to && *target < from) {
+                    (*target)++;
+                }
+            }
+        }
+    }
+}
+
+void ir_insert(IRFunction *fn, int block, int pos, IRInst inst) {
+    IRBlock *b = &fn->blocks[block];
+
+    if (b->count == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 8;
+        b->insts = xrealloc(b->insts, b->capacity * sizeof(IRInst));
+    }
+    memmove(&b->insts[pos + 1], &b->insts[pos], (b->count - pos) * sizeof(IRInst));
+    b->insts[pos] = inst;
+    b->count++;
+}
+
+void ir_append(IRFunction *fn, int block, IRInst inst) {
+    ir_insert(fn, block, fn->blocks[block].count, inst);
+}
+
+void ir_insert_before_end(IRFunction *fn, int block, IRInst inst) {
+    IRBlock *b = &fn->blocks[block];
+    int pos = b->count;
+
+    if (pos > 0 && ir_is_terminator(b->insts[pos - 1].op)) {
+        pos--;
+    }
+    ir_insert(fn, block, pos, inst);
+}
+
+void ir_remove(IRFunction *fn, int block, int pos) {
+    IRBlock *b = &fn->blocks[block];
+
+    memmove(&b->insts[pos], &b->insts[pos + 1], (b->count - pos - 1) * sizeof(IRInst));
+    b->count--;
+}
+
+IROperand ir_imm(int64_t value) {
+    IROperand operand = { true, value, -1 };
+    return operand;
+}
+
+IROperand ir_use(int reg) {
+    IROperand operand = { false, 0, reg };
+    return operand;
+}
+
+IRInst ir_inst(IROp op, int dst, IROperand a, IROperand b) {
+    IRInst inst;
+
+    memset(&inst, 0, sizeof(inst));
+    inst.op = op;
+    inst.dst = dst;
+    inst.src[0] = a;
+    inst.src[1] = b;
+    inst.src[2].reg = -1;
+    inst.target[0] = inst.target[1] = -1;
+    return inst;
+}
+
+IRInst ir_jmp(int target) {
+    IRInst inst = ir_inst(IR_JMP, -1, ir_imm(0), ir_imm(0));
+    inst.target[0] = target;
+    return inst;
+}
+
+const char *ir_op_name(IROp op) {
+    return op < IR_OP_COUNT ? op_names[op] : "?";
+}
+
+bool ir_is_terminator(IROp op) {
+    return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+bool ir_is_pure(IROp op) {
+    return op <= IR_NE;
+}
+
+int ir_src_count(IROp op) {
+    switch (op) {
+        case IR_MOV:
+        case IR_BR:
+        case IR_RET:
+            return 1;
+        case IR_STORE:
+            return 3;
+        case IR_JMP:
+            return 0;
+        default:
+            return 2;
+    }
+}
+
+const IRInst *ir_terminator(const IRBlock *block) {
+    if (block->count == 0 || !ir_is_terminator(block->insts[block->count - 1].op)) {
+        return NULL;
+    }
+    return &block->insts[block->count - 1];
+}
+
+int ir_successors(const IRBlock *block, int out[2]) {
+    const IRInst *last = ir_terminator(block);
+
+    if (!last || last->op == IR_RET) {
+        return 0;
+    }
+    out[0] = last->target[0];
+    if (last->op == IR_JMP || last->target[1] == last->target[0]) {
+        return 1;
+    }
+    out[1] = last->target[1];
+    return 2;
+}
+
+static void print_operand(const IRFunction *fn, IROperand operand, FILE *out) {
+    if (operand.is_imm) {
+        fprintf(out, "%lld", (long long)operand.imm);
+    } else {
+        fprintf(out, "%s", fn->regs[operand.reg]);
+    }
+}
+
+void ir_print(const IRFunction *fn, FILE *out) {
+    fprintf(out, "func %s(", fn->name);
+    for (int i = 0; i < fn->param_count; i++) {
+        fprintf(out, "%s%s", i ? ", " : "", fn->regs[i]);
+    }
+    fprintf(out, ")\n");
+
+    for (int b = 0; b < fn->block_count; b++) {
+        const IRBlock *block = &fn->blocks[b];
+        fprintf(out, "%s:\n", block->label);
+        for (int i = 0; i < block->count; i++) {
+            const IRInst *inst = &block->insts[i];
+            const char *separator = " ";
+
+            fprintf(out, "    %s", ir_op_name(inst->op));
+            if (inst->dst >= 0) {
+                fprintf(out, " %s", fn->regs[inst->dst]);
+                separator = ", ";
+            }
+            for (int s = 0; s < ir_src_count(inst->op); s++) {
+                fprintf(out, "%s", separator);
+                print_operand(fn, inst->src[s], out);
+                separator = ", ";
+            }
+            if (inst->op == IR_JMP || inst->op == IR_BR) {
+                fprintf(out, "%s%s", separator, fn->blocks[inst->target[0]].label);
+            }
+            if (inst->op == IR_BR) {
+                fprintf(out, ", %s", fn->blocks[inst->target[1]].label);
+            }
+            fprintf(out, "\n");
+        }
+    }
+    fprintf(out, "end\n");
+}
+
+bool ir_verify(const IRFunction *fn, char *error, size_t error_size) {
+    if (fn->block_count == 0) {
+        snprintf(error, error_size, "%s has no blocks", fn->name);
+        return false;
+    }
+    for (int b = 0; b < fn->block_count; b++) {
+        const IRBlock *block = &fn->blocks[b];
+        if (!ir_terminator(block)) {
+            snprintf(error, error_size, "%s: block %s has no terminator", fn->name, block->label);
+            return false;
+        }
+        for (int i = 0; i < block->count; i++) {
+            const IRInst *inst = &block->insts[i];
+            if (i < block->count - 1 && ir_is_terminator(inst->op)) {
+                snprintf(error, error_size, "%s: %s in the middle of block %s", fn->name,
+                         ir_op_name(inst->op), block->label);
+                return false;
+            }
+            if (inst->dst >= fn->reg_count || (inst->dst < 0) != (inst->op >= IR_STORE)) {
+                snprintf(error, error_size, "%s: bad destination in block %s", fn->name, block->label);
+                return false;
+            }
+            for (int s = 0; s < ir_src_count(inst->op); s++) {
+                const IROperand *operand = &inst->src[s];
+                if (!operand->is_imm && (operand->reg < 0 || operand->reg >= fn->reg_count)) {
+                    snprintf(error, error_size, "%s: bad operand in block %s", fn->name, block->label);
+                    return false;
+                }
+            }
+            int targets = inst->op == IR_BR ? 2 : inst->op == IR_JMP ? 1 : 0;
+            for (int t = 0; t < targets; t++) {
+                if (inst->target[t] < 0 || inst->target[t] >= fn->block_count) {
+                    snprintf(error, error_size, "%s: bad branch target in block %s", fn->name,
+                             block->label);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,9 @@
+// The IR driver on its own, built against the host C library
+//
+//   irc [-O0|-O1] [-funroll=N] [-S [-mavx2]] <file.mir>
+
+#include "irdriver.h"
+
+int main(int argc, char *argv[]) {
+    return ir_driver_main(argc, argv);
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "irdriver.h"
+#include "ir.h"
+#include "loopopt.h"
+#include "vectorize.h"
+#include "x86gen.h"
+
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    char *text = NULL;
+    long size;
+
+    if (!file) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 &&
+        fseek(file, 0, SEEK_SET) == 0 && (text = malloc(size + 1)) != NULL) {
+        text[fread(text, 1, size, file)] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+// Optimize each function in a MicroASM IR file and print the result, as
+// IR or, with `assembly`, as x86-64 NASM source
+static int optimize_ir(const char *path, const LoopOptions *options, bool assembly) {
+    char *text = read_file(path);
+    const char *cursor = text;
+    char error[256];
+    IRFunction *fn;
+
+    if (!text) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    while ((fn = ir_parse(&cursor, error, sizeof(error))) != NULL) {
+        LoopOptStats stats;
+
+        loop_optimize(fn, options, &stats);
+        if (!ir_verify(fn, error, sizeof(error))) {
+            fprintf(stderr, "%s: internal error: %s\n", path, error);
+            ir_function_free(fn);
+            free(text);
+            return 1;
+        }
+        printf("; %s: %d hoisted, %d reduced, %d unrolled\n", fn->name,
+               stats.hoisted, stats.reduced, stats.unrolled);
+        if (!assembly) {
+            ir_print(fn, stdout);
+        } else if (!x86_emit_function(fn, options->vector_width, stdout, error, sizeof(error))) {
+            fprintf(stderr, "%s: %s\n", path, error);
+            ir_function_free(fn);
+            free(text);
+            return 1;
+        }
+        ir_function_free(fn);
+    }
+    free(text);
+    if (error[0]) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        return 1;
+    }
+    return 0;
+}
+
+bool ir_driver_accepts(const char *path) {
+    size_t length = strlen(path);
+
+    return length > 4 && strcmp(path + length - 4, ".mir") == 0;
+}
+
+int ir_driver_main(int argc, char *argv[]) {
+    LoopOptions options;
+    const char *source_file = NULL;
+    int vector_width = VECTOR_SSE2;
+    bool vectorize = true, assembly = false;
+
+    loop_options_default(&options);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0) {
+            options.licm = false;
+            options.strength_reduce = false;
+            options.unroll_factor = 1;
+            vectorize = false;
+        } else if (strcmp(argv[i], "-O1") == 0) {
+            loop_options_default(&options);
+            vectorize = true;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            assembly = true;
+        } else if (strcmp(argv[i], "-mavx2") == 0) {
+            vector_width = VECTOR_AVX2;
+        } else if (strcmp(argv[i], "-fno-vectorize") == 0) {
+            vectorize = false;
+        } else if (strncmp(argv[i], "-funroll=", 9) == 0) {
+            options.unroll_factor = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "-fno-unroll") == 0) {
+            options.unroll_factor = 1;
+        } else if (strcmp(argv[i], "-fno-licm") == 0) {
+            options.licm = false;
+        } else if (strcmp(argv[i], "-fno-strength-reduce") == 0) {
+            options.strength_reduce = false;
+        } else {
+            source_file = argv[i];
+        }
+    }
+    if (!source_file || !ir_driver_accepts(source_file)) {
+        fprintf(stderr, "Usage: %s [-O0|-O1] [-funroll=N] [-S [-mavx2]] <file.mir>\n", argv[0]);
+        return 1;
+    }
+    // Vector loops exist only in the x86 backend's output
+    options.vector_width = vectorize && assembly ? vector_width : 0;
+    return optimize_ir(source_file, &options, assembly);
+}
@@ -0,0 +1,262 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+#define MAX_WORDS 8
+#define MAX_WORD_LENGTH 64
+#define MAX_FIXUPS 1024
+
+// A branch whose target label may not have been seen yet
+typedef struct {
+    int block;
+    int inst;
+    int slot;
+    char label[MAX_WORD_LENGTH];
+} Fixup;
+
+typedef struct {
+    const char *text;
+    int line;
+    char *error;
+    size_t error_size;
+    Fixup fixups[MAX_FIXUPS];
+    int fixup_count;
+} Reader;
+
+static bool fail(Reader *reader, const char *message, const char *word) {
+    snprintf(reader->error, reader->error_size, "line %d: %s%s%s", reader->line, message,
+             word ? " " : "", word ? word : "");
+    return false;
+}
+
+static bool is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '-';
+}
+
+// Split the next line into words, dropping commas, parentheses and
+// comments. A word ending in ':' is a label. Returns the word count, or
+// -1 at the end of the input.
+static int read_line(Reader *reader, char words[MAX_WORDS][MAX_WORD_LENGTH]) {
+    const char *p = reader->text;
+    int count = 0;
+
+    if (*p == '\0') {
+        return -1;
+    }
+    reader->line++;
+    while (*p && *p != '\n') {
+        if (*p == ';') {
+            while (*p && *p != '\n') {
+                p++;
+            }
+            break;
+        }
+        if (!is_word_char(*p)) {
+            if (*p == ':' && count > 0) {
+                strcat(words[count - 1], ":");
+            }
+            p++;
+            continue;
+        }
+
+        int length = 0;
+        while (is_word_char(*p)) {
+            if (length < MAX_WORD_LENGTH - 2 && count < MAX_WORDS) {
+                words[count][length++] = *p;
+            }
+            p++;
+        }
+        if (count < MAX_WORDS) {
+            words[count++][length] = '\0';
+        }
+    }
+    reader->text = *p ? p + 1 : p;
+    return count;
+}
+
+static bool parse_operand(Reader *reader, IRFunction *fn, const char *word, IROperand *out) {
+    if (isdigit((unsigned char)word[0]) || (word[0] == '-' && isdigit((unsigned char)word[1]))) {
+        char *end;
+        long long value = strtoll(word, &end, 0);
+        if (*end) {
+            return fail(reader, "bad number", word);
+        }
+        *out = ir_imm(value);
+        return true;
+    }
+    if (!isalpha((unsigned char)word[0]) && word[0] != '_') {
+        return fail(reader, "bad operand", word);
+    }
+    *out = ir_use(ir_reg(fn, word));
+    return true;
+}
+
+static bool add_fixup(Reader *reader, int block, int inst, int slot, const char *label) {
+    if (reader->fixup_count == MAX_FIXUPS) {
+        return fail(reader, "too many branches", NULL);
+    }
+    Fixup *fixup = &reader->fixups[reader->fixup_count++];
+    fixup->block = block;
+    fixup->inst = inst;
+    fixup->slot = slot;
+    strcpy(fixup->label, label);
+    return true;
+}
+
+static bool parse_inst(Reader *reader, IRFunction *fn, int block,
+                       char words[MAX_WORDS][MAX_WORD_LENGTH], int count) {
+    IROp op = IR_OP_COUNT;
+
+    for (int i = 0; i < IR_OP_COUNT; i++) {
+        if (strcmp(words[0], ir_op_name((IROp)i)) == 0) {
+            op = (IROp)i;
+        }
+    }
+    if (op == IR_OP_COUNT) {
+        return fail(reader, "unknown instruction", words[0]);
+    }
+
+    IRInst inst = ir_inst(op, -1, ir_imm(0), ir_imm(0));
+    int has_dst = op < IR_STORE;
+    int sources = ir_src_count(op);
+    int labels = op == IR_BR ? 2 : op == IR_JMP ? 1 : 0;
+    int expected = 1 + has_dst + sources + labels;
+
+    // A bare ret returns 0
+    if (op == IR_RET && count == 1) {
+        count = expected;
+        strcpy(words[1], "0");
+    }
+    if (count != expected) {
+        return fail(reader, "wrong operand count for", words[0]);
+    }
+
+    int word = 1;
+    if (has_dst) {
+        if (!isalpha((unsigned char)words[word][0]) && words[word][0] != '_') {
+            return fail(reader, "bad destination", words[word]);
+        }
+        inst.dst = ir_reg(fn, words[word++]);
+    }
+    for (int s = 0; s < sources; s++) {
+        if (!parse_operand(reader, fn, words[word++], &inst.src[s])) {
+            return false;
+        }
+    }
+    for (int t = 0; t < labels; t++) {
+        if (!add_fixup(reader, block, fn->blocks[block].count, t, words[word++])) {
+            return false;
+        }
+    }
+    ir_append(fn, block, inst);
+    return true;
+}
+
+static bool ends_block(const IRFunction *fn, int block) {
+    return ir_terminator(&fn->blocks[block]) != NULL;
+}
+
+static IRFunction *parse_function(Reader *reader, char words[MAX_WORDS][MAX_WORD_LENGTH], int count) {
+    IRFunction *fn = ir_function_new(words[1]);
+    int block = -1;
+
+    for (int i = 2; i < count; i++) {
+        ir_reg(fn, words[i]);
+    }
+    fn->param_count = fn->reg_count;
+
+    while ((count = read_line(reader, words)) >= 0) {
+        if (count == 0) {
+            continue;
+        }
+        if (strcmp(words[0], "end") == 0) {
+            if (block < 0) {
+                fail(reader, "empty function", fn->name);
+                break;
+            }
+            if (!ends_block(fn, block)) {
+                ir_append(fn, block, ir_inst(IR_RET, -1, ir_imm(0), ir_imm(0)));
+            }
+            for (int f = 0; f < reader->fixup_count; f++) {
+                Fixup *fixup = &reader->fixups[f];
+                int target = ir_block_find(fn, fixup->label);
+                if (target < 0) {
+                    fail(reader, "unknown label", fixup->label);
+                    ir_function_free(fn);
+                    return NULL;
+                }
+                fn->blocks[fixup->block].insts[fixup->inst].target[fixup->slot] = target;
+            }
+            if (!ir_verify(fn, reader->error, reader->error_size)) {
+                break;
+            }
+            return fn;
+        }
+
+        size_t length = strlen(words[0]);
+        if (words[0][length - 1] == ':') {
+            words[0][length - 1] = '\0';
+            if (ir_block_find(fn, words[0]) >= 0) {
+                fail(reader, "duplicate label", words[0]);
+                break;
+            }
+            int next = ir_block_new(fn, words[0]);
+            if (block >= 0 && !ends_block(fn, block)) {
+                ir_append(fn, block, ir_jmp(next));
+            }
+            block = next;
+            if (count == 1) {
+                continue;
+            }
+            // An instruction on the label's line
+            memmove(words[0], words[1], (count - 1) * sizeof(words[0]));
+            count--;
+        }
+
+        if (block < 0) {
+            block = ir_block_new(fn, "entry");
+        } else if (ends_block(fn, block)) {
+            // Unreachable code after a terminator gets its own block
+            block = ir_block_new(fn, NULL);
+        }
+        if (!parse_inst(reader, fn, block, words, count)) {
+            ir_function_free(fn);
+            return NULL;
+        }
+    }
+
+    if (reader->error[0] == '\0') {
+        fail(reader, "missing end for", fn->name);
+    }
+    ir_function_free(fn);
+    return NULL;
+}
+
+IRFunction *ir_parse(const char **text, char *error, size_t error_size) {
+    char words[MAX_WORDS][MAX_WORD_LENGTH];
+    static Reader reader;
+    int count;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.text = *text;
+    reader.error = error;
+    reader.error_size = error_size;
+    error[0] = '\0';
+
+    while ((count = read_line(&reader, words)) == 0) {
+    }
+    if (count < 0) {
+        *text = reader.text;
+        return NULL;
+    }
+    if (strcmp(words[0], "func") != 0 || count < 2) {
+        fail(&reader, "expected func, found", words[0]);
+        return NULL;
+    }
+
+    IRFunction *fn = parse_function(&reader, words, count);
+    *text = reader.text;
+    return fn;
+}
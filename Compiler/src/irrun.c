@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+#define MUL_COST 3
+
+static int64_t value_of(const int64_t *regs, IROperand operand) {
+    return operand.is_imm ? operand.imm : regs[operand.reg];
+}
+
+static int64_t *word_at(int64_t base, int64_t index) {
+    return (int64_t *)(intptr_t)(base + index * 8);
+}
+
+// Registers start at 0 except the parameters, and addresses are host
+// pointers, so the caller passes real arrays as arguments
+bool ir_run(const IRFunction *fn, const int64_t *args, int64_t *result,
+            IRRunStats *stats, uint64_t limit) {
+    int64_t *regs = calloc(fn->reg_count ? fn->reg_count : 1, sizeof(int64_t));
+    IRRunStats counts = { 0, 0, 0 };
+    int block = 0;
+    bool ok = false;
+
+    if (!regs) {
+        return false;
+    }
+    memcpy(regs, args, fn->param_count * sizeof(int64_t));
+
+    while (counts.insts < limit) {
+        const IRBlock *b = &fn->blocks[block];
+        int next = -1;
+
+        for (int i = 0; i < b->count && next < 0; i++) {
+            const IRInst *inst = &b->insts[i];
+            int64_t x = value_of(regs, inst->src[0]);
+            int64_t y = ir_src_count(inst->op) > 1 ? value_of(regs, inst->src[1]) : 0;
+
+            counts.insts++;
+            counts.cost += inst->op == IR_MUL ? MUL_COST : 1;
+            switch (inst->op) {
+                case IR_MOV: regs[inst->dst] = x; break;
+                case IR_ADD: regs[inst->dst] = (int64_t)((uint64_t)x + (uint64_t)y); break;
+                case IR_SUB: regs[inst->dst] = (int64_t)((uint64_t)x - (uint64_t)y); break;
+                case IR_MUL: regs[inst->dst] = (int64_t)((uint64_t)x * (uint64_t)y); break;
+                case IR_AND: regs[inst->dst] = x & y; break;
+                case IR_OR: regs[inst->dst] = x | y; break;
+                case IR_XOR: regs[inst->dst] = x ^ y; break;
+                case IR_SHL: regs[inst->dst] = (int64_t)((uint64_t)x << (y & 63)); break;
+                case IR_SHR: regs[inst->dst] = x >> (y & 63); break;
+                case IR_LT: regs[inst->dst] = x < y; break;
+                case IR_LE: regs[inst->dst] = x <= y; break;
+                case IR_EQ: regs[inst->dst] = x == y; break;
+                case IR_NE: regs[inst->dst] = x != y; break;
+                case IR_LOAD: regs[inst->dst] = *word_at(x, y); break;
+                case IR_STORE: *word_at(x, y) = value_of(regs, inst->src[2]); break;
+                case IR_JMP:
+                    next = inst->target[0];
+                    counts.branches++;
+                    break;
+                case IR_BR:
+                    next = x ? inst->target[0] : inst->target[1];
+                    counts.branches++;
+                    break;
+                case IR_RET:
+                    *result = x;
+                    ok = true;
+                    goto done;
+                default:
+                    goto done;
+            }
+        }
+        if (next < 0) {
+            goto done;              // Fell off a block without a terminator
+        }
+        block = next;
+    }
+
+done:
+    if (stats) {
+        *stats = counts;
+    }
+    free(regs);
+    return ok;
+}
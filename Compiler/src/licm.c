@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include "cfg.h"
+#include "loopopt.h"
+
+static bool has_store(const IRFunction *fn, const Loop *loop) {
+    for (int i = 0; i < loop->block_count; i++) {
+        const IRBlock *block = &fn->blocks[loop->blocks[i]];
+        for (int n = 0; n < block->count; n++) {
+            if (block->insts[n].op == IR_STORE) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The block runs on every iteration that leaves the loop
+static bool dominates_exits(const CFG *cfg, int block, const int *exiting, int exiting_count) {
+    for (int i = 0; i < exiting_count; i++) {
+        if (!cfg_dominates(cfg, block, exiting[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether the value a register holds after the loop may come from inside it
+static bool live_after(const IRFunction *fn, const Loop *loop, const Liveness *live,
+                       const int *exiting, int exiting_count, int reg) {
+    int succ[2];
+
+    for (int i = 0; i < exiting_count; i++) {
+        int n = ir_successors(&fn->blocks[exiting[i]], succ);
+        for (int s = 0; s < n; s++) {
+            if (!loop_contains(loop, succ[s]) && live_in(live, succ[s], reg)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The instruction computes the same value on every iteration, and doing
+// it once before the loop leaves every use of its result unchanged: no
+// use can see an older value (the register is not live into the header),
+// and one left live after the loop was written before any exit.
+static bool can_hoist(const IRFunction *fn, const CFG *cfg, const Loop *loop,
+                      const Liveness *live, const int *defs, bool stores,
+                      const int *exiting, int exiting_count, int block, const IRInst *inst) {
+    bool every_iteration = dominates_exits(cfg, block, exiting, exiting_count);
+
+    if (inst->dst < 0 || defs[inst->dst] != 1) {
+        return false;
+    }
+    if (!ir_is_pure(inst->op) && !(inst->op == IR_LOAD && !stores && every_iteration)) {
+        return false;
+    }
+    for (int s = 0; s < ir_src_count(inst->op); s++) {
+        if (!inst->src[s].is_imm && defs[inst->src[s].reg] > 0) {
+            return false;
+        }
+    }
+    if (live_in(live, loop->header, inst->dst)) {
+        return false;
+    }
+    return every_iteration ||
+           !live_after(fn, loop, live, exiting, exiting_count, inst->dst);
+}
+
+static int hoist_loop(IRFunction *fn, const CFG *cfg, const Loop *loop) {
+    Liveness *live = liveness_compute(fn, cfg);
+    int *defs = calloc(fn->reg_count ? fn->reg_count : 1, sizeof(int));
+    int *exiting = calloc(loop->block_count, sizeof(int));
+    int exiting_count, hoisted = 0;
+    bool stores, changed = true;
+
+    if (!defs || !exiting) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    loop_count_defs(fn, loop, defs);
+    exiting_count = loop_exiting_blocks(fn, loop, exiting);
+    stores = has_store(fn, loop);
+
+    // Hoisting one instruction can make the ones using its result
+    // invariant, so repeat until nothing moves
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < loop->block_count; i++) {
+            int b = loop->blocks[i];
+            for (int n = 0; n < fn->blocks[b].count; n++) {
+                IRInst inst = fn->blocks[b].insts[n];
+                if (!can_hoist(fn, cfg, loop, live, defs, stores, exiting, exiting_count,
+                               b, &inst)) {
+                    continue;
+                }
+                ir_remove(fn, b, n--);
+                ir_insert_before_end(fn, loop->preheader, inst);
+                defs[inst.dst] = 0;
+                hoisted++;
+                changed = true;
+            }
+        }
+    }
+    liveness_free(live);
+    free(defs);
+    free(exiting);
+    return hoisted;
+}
+
+// Innermost loops first, so code leaving an inner loop lands in its
+// preheader inside the outer loop and can keep moving out from there
+int loop_licm(IRFunction *fn) {
+    CFG *cfg = cfg_analyze(fn);
+    int hoisted = 0;
+
+    for (int i = 0; i < cfg->loop_count; i++) {
+        if (loop_has_preheader(&cfg->loops[i])) {
+            hoisted += hoist_loop(fn, cfg, &cfg->loops[i]);
+        }
+    }
+    cfg_free(cfg);
+    return hoisted;
+}
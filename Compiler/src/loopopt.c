@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "loopopt.h"
+
+void loop_options_default(LoopOptions *options) {
+    options->licm = true;
+    options->strength_reduce = true;
+    options->unroll_factor = LOOP_UNROLL_DEFAULT;
+    options->vector_width = 0;
+}
+
+static void retarget(IRBlock *block, int from, int to) {
+    for (int i = 0; i < block->count; i++) {
+        for (int t = 0; t < 2; t++) {
+            if (block->insts[i].target[t] == from) {
+                block->insts[i].target[t] = to;
+            }
+        }
+    }
+}
+
+// New block just before the header that every edge from outside the loop
+// goes through. A header at the entry gets its preheader as the new entry.
+static void insert_preheader(IRFunction *fn, const CFG *cfg, const Loop *loop) {
+    char label[96];
+    int header = loop->header;
+
+    snprintf(label, sizeof(label), "%s.pre", fn->blocks[header].label);
+    int pre = ir_block_new(fn, label);
+    for (int p = 0; p < cfg->pred_count[header]; p++) {
+        int pred = cfg->preds[header][p];
+        if (!loop_contains(loop, pred)) {
+            retarget(&fn->blocks[pred], header, pre);
+        }
+    }
+    ir_append(fn, pre, ir_jmp(header));
+    ir_move_block(fn, pre, header);
+}
+
+// Block numbers change as preheaders go in, so analyze again after each
+int loop_insert_preheaders(IRFunction *fn) {
+    int inserted = 0;
+
+    for (;;) {
+        CFG *cfg = cfg_analyze(fn);
+        const Loop *missing = NULL;
+
+        for (int i = 0; i < cfg->loop_count && !missing; i++) {
+            if (!loop_has_preheader(&cfg->loops[i])) {
+                missing = &cfg->loops[i];
+            }
+        }
+        if (!missing) {
+            cfg_free(cfg);
+            return inserted;
+        }
+        insert_preheader(fn, cfg, missing);
+        inserted++;
+        cfg_free(cfg);
+    }
+}
+
+static void mark_reachable(const IRFunction *fn, bool *reachable) {
+    int *stack = calloc(fn->block_count, sizeof(int));
+    int depth = 0, succ[2];
+
+    if (!stack) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    reachable[0] = true;
+    stack[depth++] = 0;
+    while (depth > 0) {
+        int b = stack[--depth];
+        int n = ir_successors(&fn->blocks[b], succ);
+        for (int s = 0; s < n; s++) {
+            if (!reachable[succ[s]]) {
+                reachable[succ[s]] = true;
+                stack[depth++] = succ[s];
+            }
+        }
+    }
+    free(stack);
+}
+
+// Compact the block array down to the reachable blocks
+static int remove_unreachable(IRFunction *fn) {
+    bool *reachable = calloc(fn->block_count, sizeof(bool));
+    int *remap = calloc(fn->block_count, sizeof(int));
+    int kept = 0, removed;
+
+    if (!reachable || !remap) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    mark_reachable(fn, reachable);
+    for (int b = 0; b < fn->block_count; b++) {
+        if (reachable[b]) {
+            remap[b] = kept;
+            fn->blocks[kept++] = fn->blocks[b];
+        } else {
+            free(fn->blocks[b].label);
+            free(fn->blocks[b].insts);
+        }
+    }
+    removed = fn->block_count - kept;
+    fn->block_count = kept;
+    for (int b = 0; b < kept; b++) {
+        IRBlock *block = &fn->blocks[b];
+        for (int i = 0; i < block->count; i++) {
+            for (int t = 0; t < 2; t++) {
+                if (block->insts[i].target[t] >= 0) {
+                    block->insts[i].target[t] = remap[block->insts[i].target[t]];
+                }
+            }
+        }
+    }
+    free(reachable);
+    free(remap);
+    return removed;
+}
+
+int ir_simplify_cfg(IRFunction *fn) {
+    CFG *cfg = cfg_analyze(fn);
+    int changes = 0;
+
+    // A merged block's edges move to the block it joined, so the counts of
+    // every other block stay right while merging
+    for (int b = 0; b < fn->block_count; b++) {
+        if (cfg->rpo_index[b] < 0) {
+            continue;
+        }
+        for (;;) {
+            IRBlock *block = &fn->blocks[b];
+            const IRInst *last = ir_terminator(block);
+            if (!last || last->op != IR_JMP) {
+                break;
+            }
+
+            int next = last->target[0];
+            if (next == b || next == 0 || cfg->pred_count[next] != 1) {
+                break;
+            }
+            block->count--;
+            for (int i = 0; i < fn->blocks[next].count; i++) {
+                ir_append(fn, b, fn->blocks[next].insts[i]);
+            }
+            fn->blocks[next].count = 0;
+            ir_append(fn, next, ir_jmp(next));      // Now unreachable
+            cfg->pred_count[next] = 0;
+            changes++;
+        }
+    }
+    cfg_free(cfg);
+    return changes + remove_unreachable(fn);
+}
+
+void loop_optimize(IRFunction *fn, const LoopOptions *options, LoopOptStats *stats) {
+    memset(stats, 0, sizeof(LoopOptStats));
+    if (!options->licm && !options->strength_reduce && options->unroll_factor <= 1) {
+        return;
+    }
+
+    stats->preheaders = loop_insert_preheaders(fn);
+    if (options->licm) {
+        stats->hoisted = loop_licm(fn);
+    }
+    if (options->strength_reduce) {
+        stats->reduced = loop_strength_reduce(fn);
+    }
+    if (options->unroll_factor > 1) {
+        stats->unrolled = loop_unroll(fn, options->unroll_factor, options->vector_width);
+    }
+    ir_simplify_cfg(fn);
+}
@@ -1,13 +1,18 @@
 #include <stdio.h>
 #include "compiler.h"
+#include "irdriver.h"
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <source_file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-O0|-O1] [-funroll=N] [-S [-mavx2]] <source_file>\n", argv[0]);
         return 1;
     }
 
-    const char *source_file = argv[1];
+    // IR files, with their optimization flags, go to the IR driver
+    const char *source_file = argv[argc - 1];
+    if (ir_driver_accepts(source_file)) {
+        return ir_driver_main(argc, argv);
+    }
 
     // Initialize the compiler
     Compiler compiler;
@@ -26,4 +31,4 @@ int main(int argc, char *argv[]) {
     // Cleanup and exit
     compiler_cleanup(&compiler);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "loopopt.h"
+
+#define MAX_REDUCED 64
+
+// A register that tracks iv * factor
+typedef struct {
+    int iv;
+    IROperand factor;
+    int reg;
+} Reduced;
+
+typedef struct {
+    IRFunction *fn;
+    const Loop *loop;
+    const Liveness *live;
+    int *defs;
+    Reduced reduced[MAX_REDUCED];
+    int reduced_count;
+} Reducer;
+
+static bool same_operand(IROperand a, IROperand b) {
+    return a.is_imm == b.is_imm && (a.is_imm ? a.imm == b.imm : a.reg == b.reg);
+}
+
+static bool reads(const IRInst *inst, int reg) {
+    for (int s = 0; s < ir_src_count(inst->op); s++) {
+        if (!inst->src[s].is_imm && inst->src[s].reg == reg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Split `mul j, a, b` or `shl j, a, k` into an induction variable and a
+// loop-invariant factor
+static bool match(Reducer *r, const IRInst *inst, int *iv, int64_t *step, IROperand *factor) {
+    int block, pos;
+
+    if (inst->op == IR_SHL) {
+        if (!inst->src[1].is_imm || inst->src[1].imm < 0 || inst->src[1].imm > 62) {
+            return false;
+        }
+        *iv = inst->src[0].reg;
+        *factor = ir_imm(1LL << inst->src[1].imm);
+        return !inst->src[0].is_imm && *iv != inst->dst &&
+               loop_induction(r->fn, r->loop, r->defs, *iv, step, &block, &pos);
+    }
+    if (inst->op != IR_MUL) {
+        return false;
+    }
+    for (int s = 0; s < 2; s++) {
+        IROperand a = inst->src[s], b = inst->src[1 - s];
+        if (a.is_imm || a.reg == inst->dst || (!b.is_imm && r->defs[b.reg] > 0)) {
+            continue;
+        }
+        if (loop_induction(r->fn, r->loop, r->defs, a.reg, step, &block, &pos)) {
+            *iv = a.reg;
+            *factor = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void grow_defs(Reducer *r, int old_count) {
+    r->defs = realloc(r->defs, r->fn->reg_count * sizeof(int));
+    if (!r->defs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int reg = old_count; reg < r->fn->reg_count; reg++) {
+        r->defs[reg] = 0;
+    }
+}
+
+// Register holding iv * factor, set up in the preheader and stepped next
+// to the induction variable's update. The instruction being replaced is
+// at (b, *n), which moves down if the update goes in before it.
+static int reduced_reg(Reducer *r, int iv, int64_t step, IROperand factor, int b, int *n) {
+    IRFunction *fn = r->fn;
+    int preheader = r->loop->preheader;
+    int old_count = fn->reg_count;
+    int block, pos;
+
+    for (int i = 0; i < r->reduced_count; i++) {
+        if (r->reduced[i].iv == iv && same_operand(r->reduced[i].factor, factor)) {
+            return r->reduced[i].reg;
+        }
+    }
+    if (r->reduced_count == MAX_REDUCED) {
+        return -1;
+    }
+
+    char hint[64];
+    snprintf(hint, sizeof(hint), "%s.sr", fn->regs[fn->blocks[b].insts[*n].dst]);
+    int reg = ir_new_reg(fn, hint);
+    IROperand increment;
+
+    ir_insert_before_end(fn, preheader, ir_inst(IR_MUL, reg, ir_use(iv), factor));
+    if (factor.is_imm) {
+        increment = ir_imm((int64_t)((uint64_t)step * (uint64_t)factor.imm));
+    } else if (step == 1) {
+        increment = factor;
+    } else {
+        int scaled = ir_new_reg(fn, hint);
+        ir_insert_before_end(fn, preheader, ir_inst(IR_MUL, scaled, factor, ir_imm(step)));
+        increment = ir_use(scaled);
+    }
+
+    grow_defs(r, old_count);
+    r->defs[reg] = 1;
+
+    loop_induction(fn, r->loop, r->defs, iv, &step, &block, &pos);
+    ir_insert(fn, block, pos + 1, ir_inst(IR_ADD, reg, ir_use(reg), increment));
+    if (block == b && pos < *n) {
+        (*n)++;
+    }
+
+    r->reduced[r->reduced_count].iv = iv;
+    r->reduced[r->reduced_count].factor = factor;
+    r->reduced[r->reduced_count].reg = reg;
+    r->reduced_count++;
+    return reg;
+}
+
+// Point later reads of `from` in the block at `to` while both still hold
+// the same value, then drop the copy if nothing reads it any more.
+// Returns whether the copy went.
+static bool propagate(Reducer *r, int b, int pos) {
+    IRBlock *block = &r->fn->blocks[b];
+    int from = block->insts[pos].dst;
+    int to = block->insts[pos].src[0].reg;
+    bool still_read = live_out(r->live, b, from);
+
+    for (int i = pos + 1; i < block->count; i++) {
+        IRInst *inst = &block->insts[i];
+        for (int s = 0; s < ir_src_count(inst->op); s++) {
+            if (!inst->src[s].is_imm && inst->src[s].reg == from) {
+                inst->src[s].reg = to;
+            }
+        }
+        if (inst->dst == from) {
+            still_read = false;
+            break;
+        }
+        if (inst->dst == to) {
+            for (int j = i + 1; j < block->count && !still_read; j++) {
+                still_read = reads(&block->insts[j], from);
+                if (block->insts[j].dst == from) {
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    if (still_read) {
+        return false;
+    }
+    ir_remove(r->fn, b, pos);
+    r->defs[from]--;
+    return true;
+}
+
+static int reduce_loop(IRFunction *fn, const CFG *cfg, const Loop *loop) {
+    Reducer r;
+    int reduced = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.fn = fn;
+    r.loop = loop;
+    r.live = liveness_compute(fn, cfg);
+    r.defs = calloc(fn->reg_count ? fn->reg_count : 1, sizeof(int));
+    if (!r.defs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    loop_count_defs(fn, loop, r.defs);
+
+    for (int i = 0; i < loop->block_count; i++) {
+        int b = loop->blocks[i];
+        for (int n = 0; n < fn->blocks[b].count; n++) {
+            IRInst *inst = &fn->blocks[b].insts[n];
+            IROperand factor;
+            int64_t step;
+            int iv;
+
+            if (!match(&r, inst, &iv, &step, &factor)) {
+                continue;
+            }
+            int dst = inst->dst;
+            int reg = reduced_reg(&r, iv, step, factor, b, &n);
+            if (reg < 0) {
+                continue;
+            }
+            fn->blocks[b].insts[n] = ir_inst(IR_MOV, dst, ir_use(reg), ir_imm(0));
+            if (propagate(&r, b, n)) {
+                n--;
+            }
+            reduced++;
+        }
+    }
+    liveness_free((Liveness *)r.live);
+    free(r.defs);
+    return reduced;
+}
+
+int loop_strength_reduce(IRFunction *fn) {
+    CFG *cfg = cfg_analyze(fn);
+    int reduced = 0;
+
+    for (int i = 0; i < cfg->loop_count; i++) {
+        if (loop_has_preheader(&cfg->loops[i])) {
+            reduced += reduce_loop(fn, cfg, &cfg->loops[i]);
+        }
+    }
+    cfg_free(cfg);
+    return reduced;
+}
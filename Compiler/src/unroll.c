@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "loopopt.h"
+#include "vectorize.h"
+
+// An innermost loop of the shape
+//
+//     head:
+//         ...
+//         lt c, i, n          ; or le
+//         ...
+//         br c, body, exit
+//
+// where i is a basic induction variable counting up, updated once on
+// every iteration, n does not change in the loop, and head is the only
+// way out.
+typedef struct {
+    int header;
+    int compare;            // Index of the compare in the header
+    int cond;
+    IROp op;
+    int iv;
+    int64_t step;
+    IROperand limit;
+    bool updated_first;     // The compare sees i after this iteration's update
+    int body;               // The header's in-loop successor
+    int size;               // Instructions in the loop
+    bool cond_used;         // The compare's result is read outside the branch
+} CountedLoop;
+
+static bool find_counted(const IRFunction *fn, const CFG *cfg, const Loop *loop,
+                         const int *defs, CountedLoop *out) {
+    const IRBlock *header = &fn->blocks[loop->header];
+    const IRInst *branch = ir_terminator(header);
+    int block, pos;
+
+    if (!loop->innermost || !loop_has_preheader(loop) || loop->latch_count != 1) {
+        return false;
+    }
+    for (int i = 1; i < loop->block_count; i++) {
+        int succ[2];
+        int n = ir_successors(&fn->blocks[loop->blocks[i]], succ);
+        for (int s = 0; s < n; s++) {
+            if (!loop_contains(loop, succ[s])) {
+                return false;
+            }
+        }
+    }
+    if (!branch || branch->op != IR_BR || branch->src[0].is_imm ||
+        !loop_contains(loop, branch->target[0]) || loop_contains(loop, branch->target[1])) {
+        return false;
+    }
+
+    memset(out, 0, sizeof(CountedLoop));
+    out->header = loop->header;
+    out->cond = branch->src[0].reg;
+    out->body = branch->target[0];
+    out->compare = -1;
+    for (int n = 0; n < header->count; n++) {
+        if (header->insts[n].dst == out->cond) {
+            out->compare = n;
+        }
+    }
+    if (out->compare < 0 || defs[out->cond] != 1) {
+        return false;
+    }
+
+    const IRInst *compare = &header->insts[out->compare];
+    out->op = compare->op;
+    out->iv = compare->src[0].reg;
+    out->limit = compare->src[1];
+    if ((out->op != IR_LT && out->op != IR_LE) || compare->src[0].is_imm) {
+        return false;
+    }
+    if (!out->limit.is_imm && defs[out->limit.reg] > 0) {
+        return false;
+    }
+    if (!loop_induction(fn, loop, defs, out->iv, &out->step, &block, &pos) || out->step <= 0) {
+        return false;
+    }
+    // The update runs exactly once per iteration
+    if (!cfg_dominates(cfg, block, loop->latches[0])) {
+        return false;
+    }
+    out->updated_first = block == loop->header && pos < out->compare;
+
+    for (int i = 0; i < loop->block_count; i++) {
+        const IRBlock *b = &fn->blocks[loop->blocks[i]];
+        out->size += b->count;
+        for (int n = 0; n < b->count; n++) {
+            const IRInst *inst = &b->insts[n];
+            if (inst == branch) {
+                continue;
+            }
+            for (int s = 0; s < ir_src_count(inst->op); s++) {
+                if (!inst->src[s].is_imm && inst->src[s].reg == out->cond) {
+                    out->cond_used = true;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Where a branch in copy m of the loop goes. Returning to the header
+// starts the next copy, or the guard after the last one.
+static int copy_target(const CountedLoop *counted, const int *map, int block_count,
+                       const int *copies, int guard, int factor, int m, int target) {
+    if (target == counted->header) {
+        return m + 1 < factor ? copies[m + 1] : guard;
+    }
+    return map[m * block_count + target];
+}
+
+// Add a guard and `factor` copies of the loop in front of its header:
+//
+//     head.unroll:
+//         add lim, i, (factor - 1) * step     ; factor * step if the
+//                                             ; compare follows the update
+//         lt g, lim, n
+//         br g, head.1, head
+//     head.1:                 ; Header without the branch, then the body
+//         ...
+//     head.2:
+//         ...
+//         jmp head.unroll
+//
+// When the guard passes, every copy's compare would have been true, so
+// the copies leave their branches out. The original loop runs whatever
+// is left over.
+static int unroll_loop(IRFunction *fn, const Loop *loop, const CountedLoop *counted,
+                       int factor) {
+    int block_count = fn->block_count;
+    int header = counted->header;
+    int *map = calloc((size_t)factor * block_count, sizeof(int));
+    int *copies = calloc(factor, sizeof(int));
+    char label[96];
+
+    if (!map || !copies) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(label, sizeof(label), "%s.unroll", fn->blocks[header].label);
+    int guard = ir_block_new(fn, label);
+    for (int m = 0; m < factor; m++) {
+        copies[m] = ir_block_new(fn, fn->blocks[header].label);
+        for (int i = 1; i < loop->block_count; i++) {
+            int b = loop->blocks[i];
+            map[m * block_count + b] = ir_block_new(fn, fn->blocks[b].label);
+        }
+    }
+
+    int lim = ir_new_reg(fn, fn->regs[counted->iv]);
+    int cond = ir_new_reg(fn, fn->regs[counted->cond]);
+    int last_seen = counted->updated_first ? factor : factor - 1;
+    int64_t span = (int64_t)((uint64_t)last_seen * (uint64_t)counted->step);
+    IRInst branch = ir_inst(IR_BR, -1, ir_use(cond), ir_imm(0));
+    branch.target[0] = copies[0];
+    branch.target[1] = header;
+    ir_append(fn, guard, ir_inst(IR_ADD, lim, ir_use(counted->iv), ir_imm(span)));
+    ir_append(fn, guard, ir_inst(counted->op, cond, ir_use(lim), counted->limit));
+    ir_append(fn, guard, branch);
+
+    for (int m = 0; m < factor; m++) {
+        int last = fn->blocks[header].count - 1;
+        for (int n = 0; n < last; n++) {
+            if (n != counted->compare || counted->cond_used) {
+                ir_append(fn, copies[m], fn->blocks[header].insts[n]);
+            }
+        }
+        ir_append(fn, copies[m], ir_jmp(copy_target(counted, map, block_count, copies, guard,
+                                                    factor, m, counted->body)));
+
+        for (int i = 1; i < loop->block_count; i++) {
+            int b = loop->blocks[i];
+            int copy = map[m * block_count + b];
+            for (int n = 0; n < fn->blocks[b].count; n++) {
+                IRInst inst = fn->blocks[b].insts[n];
+                for (int t = 0; t < 2; t++) {
+                    if (inst.target[t] >= 0) {
+                        inst.target[t] = copy_target(counted, map, block_count, copies, guard,
+                                                     factor, m, inst.target[t]);
+                    }
+                }
+                ir_append(fn, copy, inst);
+            }
+        }
+    }
+
+    // The preheader now enters through the guard
+    IRBlock *preheader = &fn->blocks[loop->preheader];
+    for (int t = 0; t < 2; t++) {
+        if (preheader->insts[preheader->count - 1].target[t] == header) {
+            preheader->insts[preheader->count - 1].target[t] = guard;
+        }
+    }
+
+    // Lay the new blocks out in order just before the header
+    for (int i = 0; block_count + i < fn->block_count; i++) {
+        ir_move_block(fn, block_count + i, header + i);
+    }
+    free(map);
+    free(copies);
+    return 1;
+}
+
+static bool seen(char **labels, int count, const char *label) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(labels[i], label) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static char **add_label(char **labels, int *count, const char *label) {
+    labels = realloc(labels, (*count + 1) * sizeof(char *));
+    if (!labels || !(labels[*count] = malloc(strlen(label) + 1))) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(labels[(*count)++], label);
+    return labels;
+}
+
+// Each unrolled loop changes the block numbering, so analyze again after
+// each one. Loops are remembered by header label so neither the leftover
+// loop nor the unrolled one is unrolled again.
+int loop_unroll(IRFunction *fn, int factor, int vector_width) {
+    char **done = NULL;
+    int done_count = 0, unrolled = 0;
+    bool progress = true;
+
+    if (factor > LOOP_UNROLL_MAX) {
+        factor = LOOP_UNROLL_MAX;
+    }
+    while (factor > 1 && progress) {
+        CFG *cfg = cfg_analyze(fn);
+        Liveness *live = vector_width > 1 ? liveness_compute(fn, cfg) : NULL;
+        int *defs = calloc(fn->reg_count ? fn->reg_count : 1, sizeof(int));
+
+        if (!defs) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        progress = false;
+        for (int i = 0; i < cfg->loop_count && !progress; i++) {
+            const Loop *loop = &cfg->loops[i];
+            const char *label = fn->blocks[loop->header].label;
+            CountedLoop counted;
+
+            if (seen(done, done_count, label)) {
+                continue;
+            }
+            done = add_label(done, &done_count, label);
+            loop_count_defs(fn, loop, defs);
+            if (!find_counted(fn, cfg, loop, defs, &counted) ||
+                (live && vector_plan_loop(fn, live, loop, vector_width, NULL))) {
+                continue;
+            }
+
+            int copies = factor;
+            if (counted.size * copies > LOOP_UNROLL_BUDGET) {
+                copies = LOOP_UNROLL_BUDGET / counted.size;
+            }
+            if (copies < 2) {
+                continue;
+            }
+            // The guard takes the header's place
+            unrolled += unroll_loop(fn, loop, &counted, copies);
+            done = add_label(done, &done_count, fn->blocks[loop->header].label);
+            progress = true;
+        }
+        free(defs);
+        liveness_free(live);
+        cfg_free(cfg);
+    }
+
+    for (int i = 0; i < done_count; i++) {
+        free(done[i]);
+    }
+    free(done);
+    return unrolled;
+}
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vectorize.h"
+
+typedef struct {
+    const IRFunction *fn;
+    const int *defs;
+    VectorLoop *plan;
+} Planner;
+
+static bool reads(const IRInst *inst, int reg) {
+    for (int s = 0; s < ir_src_count(inst->op); s++) {
+        if (!inst->src[s].is_imm && inst->src[s].reg == reg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool add_base(VectorLoop *plan, int reg, bool stored) {
+    for (int i = 0; i < plan->base_count; i++) {
+        if (plan->bases[i] == reg) {
+            plan->stored[i] = plan->stored[i] || stored;
+            return true;
+        }
+    }
+    if (plan->base_count == VECTOR_MAX_BASES) {
+        return false;
+    }
+    plan->bases[plan->base_count] = reg;
+    plan->stored[plan->base_count++] = stored;
+    return true;
+}
+
+// An operand of a lane-wise operation: a lane value, or something the
+// backend can broadcast
+static bool lane_operand(Planner *p, IROperand operand) {
+    VectorLoop *plan = p->plan;
+
+    if (operand.is_imm) {
+        for (int i = 0; i < plan->constant_count; i++) {
+            if (plan->constants[i] == operand.imm) {
+                return true;
+            }
+        }
+        if (plan->constant_count == VECTOR_REGS) {
+            return false;
+        }
+        plan->constants[plan->constant_count++] = operand.imm;
+        return true;
+    }
+    if (operand.reg == plan->iv) {
+        return false;                   // Would need i + lane in each lane
+    }
+    if (p->defs[operand.reg] == 0) {
+        plan->kinds[operand.reg] = LANE_UNIFORM;
+        return true;
+    }
+    return plan->kinds[operand.reg] == LANE_VALUE;
+}
+
+static bool is_iv(const VectorLoop *plan, IROperand operand) {
+    return !operand.is_imm && operand.reg == plan->iv;
+}
+
+static bool invariant(const Planner *p, IROperand operand) {
+    return operand.is_imm || p->defs[operand.reg] == 0;
+}
+
+// `add s, s, x` where nothing else in the loop reads or writes s
+static bool is_sum(const Planner *p, const Loop *loop, const IRInst *inst) {
+    const IRFunction *fn = p->fn;
+    int sum = inst->dst;
+    int count = 0;
+
+    if (inst->op != IR_ADD || p->defs[sum] != 1 || sum == p->plan->iv) {
+        return false;
+    }
+    for (int s = 0; s < 2; s++) {
+        if (!inst->src[s].is_imm && inst->src[s].reg == sum) {
+            count++;
+        }
+    }
+    if (count != 1) {
+        return false;
+    }
+    for (int i = 0; i < loop->block_count; i++) {
+        const IRBlock *block = &fn->blocks[loop->blocks[i]];
+        for (int n = 0; n < block->count; n++) {
+            if (&block->insts[n] != inst && reads(&block->insts[n], sum)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool plan_inst(Planner *p, const Loop *loop, const IRInst *inst) {
+    VectorLoop *plan = p->plan;
+
+    switch (inst->op) {
+        case IR_LOAD:
+            if (!invariant(p, inst->src[0]) || inst->src[0].is_imm || !is_iv(plan, inst->src[1]) ||
+                !add_base(plan, inst->src[0].reg, false)) {
+                return false;
+            }
+            break;
+        case IR_STORE:
+            return !inst->src[0].is_imm && invariant(p, inst->src[0]) &&
+                   is_iv(plan, inst->src[1]) && lane_operand(p, inst->src[2]) &&
+                   add_base(plan, inst->src[0].reg, true);
+        case IR_ADD:
+            if (is_sum(p, loop, inst)) {
+                IROperand other = inst->src[0].reg == inst->dst ? inst->src[1] : inst->src[0];
+                plan->kinds[inst->dst] = LANE_SUM;
+                return lane_operand(p, other);
+            }
+            // Fall through
+        case IR_SUB:
+        case IR_AND:
+        case IR_OR:
+        case IR_XOR:
+            if (!lane_operand(p, inst->src[0]) || !lane_operand(p, inst->src[1])) {
+                return false;
+            }
+            break;
+        case IR_MOV:
+            if (!lane_operand(p, inst->src[0])) {
+                return false;
+            }
+            break;
+        case IR_SHL:
+            if (!lane_operand(p, inst->src[0]) || !inst->src[1].is_imm ||
+                inst->src[1].imm < 0 || inst->src[1].imm > 63) {
+                return false;
+            }
+            break;
+        default:
+            // No 64-bit lane multiply, arithmetic shift or compare
+            // before AVX-512
+            return false;
+    }
+    if (inst->dst == plan->iv || plan->kinds[inst->dst] == LANE_SUM ||
+        plan->kinds[inst->dst] == LANE_UNIFORM) {
+        return false;
+    }
+    plan->kinds[inst->dst] = LANE_VALUE;
+    return true;
+}
+
+static bool plan_header(const IRFunction *fn, const Loop *loop, const int *defs, VectorLoop *plan) {
+    const IRBlock *header = &fn->blocks[loop->header];
+    const IRBlock *body;
+    int block, pos;
+    int64_t step;
+
+    if (!loop->innermost || !loop_has_preheader(loop) || loop->block_count != 2 ||
+        header->count != 2) {
+        return false;
+    }
+
+    const IRInst *compare = &header->insts[0];
+    const IRInst *branch = &header->insts[1];
+    if (branch->op != IR_BR || branch->src[0].is_imm || branch->src[0].reg != compare->dst ||
+        (compare->op != IR_LT && compare->op != IR_LE) || compare->src[0].is_imm ||
+        branch->target[0] != loop->blocks[1] || loop_contains(loop, branch->target[1])) {
+        return false;
+    }
+    plan->header = loop->header;
+    plan->body = loop->blocks[1];
+    plan->preheader = loop->preheader;
+    plan->exit = branch->target[1];
+    plan->iv = compare->src[0].reg;
+    plan->compare = compare->op;
+    plan->limit = compare->src[1];
+    if (!plan->limit.is_imm && defs[plan->limit.reg] > 0) {
+        return false;
+    }
+
+    body = &fn->blocks[plan->body];
+    const IRInst *last = ir_terminator(body);
+    if (!last || last->op != IR_JMP || last->target[0] != loop->header) {
+        return false;
+    }
+    return loop_induction(fn, loop, defs, plan->iv, &step, &block, &pos) &&
+           step == 1 && block == plan->body;
+}
+
+bool vector_plan_loop(const IRFunction *fn, const Liveness *live, const Loop *loop, int width,
+                      VectorLoop *plan) {
+    VectorLoop local;
+    Planner p;
+    int *defs = calloc(fn->reg_count ? fn->reg_count : 1, sizeof(int));
+    bool ok = false;
+    int lanes = 0, update;
+
+    if (!defs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!plan) {
+        plan = &local;
+    }
+    memset(plan, 0, sizeof(VectorLoop));
+    memset(&p, 0, sizeof(p));
+    plan->width = width;
+    plan->kinds = calloc(fn->reg_count ? fn->reg_count : 1, sizeof(LaneKind));
+    if (!plan->kinds) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    p.fn = fn;
+    p.defs = defs;
+    p.plan = plan;
+    loop_count_defs(fn, loop, defs);
+    if (width < 2 || !plan_header(fn, loop, defs, plan)) {
+        goto done;
+    }
+
+    // Every read of i has to see this iteration's value
+    const IRBlock *body = &fn->blocks[plan->body];
+    update = vector_iv_update(fn, plan);
+    for (int n = update + 1; n < body->count; n++) {
+        if (reads(&body->insts[n], plan->iv)) {
+            goto done;
+        }
+    }
+    for (int n = 0; n < body->count - 1; n++) {
+        if (n != update && !plan_inst(&p, loop, &body->insts[n])) {
+            goto done;
+        }
+    }
+
+    for (int reg = 0; reg < fn->reg_count; reg++) {
+        if (plan->kinds[reg] == LANE_VALUE &&
+            (live_in(live, plan->header, reg) || live_in(live, plan->exit, reg))) {
+            goto done;
+        }
+        if (plan->kinds[reg] != LANE_SCALAR) {
+            lanes++;
+        }
+    }
+    ok = lanes + plan->constant_count <= VECTOR_REGS && plan->base_count > 0;
+
+done:
+    free(defs);
+    if (!ok || plan == &local) {
+        vector_plan_free(plan);
+    }
+    return ok;
+}
+
+void vector_plan_free(VectorLoop *plan) {
+    free(plan->kinds);
+    plan->kinds = NULL;
+}
+
+int vector_iv_update(const IRFunction *fn, const VectorLoop *plan) {
+    const IRBlock *body = &fn->blocks[plan->body];
+
+    for (int n = 0; n < body->count; n++) {
+        if (body->insts[n].dst == plan->iv) {
+            return n;
+        }
+    }
+    return -1;
+}
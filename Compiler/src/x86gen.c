@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "vectorize.h"
+#include "x86gen.h"
+
+#define SCRATCH 15                      // Vector register for intermediates
+
+static const char *param_regs[X86_MAX_PARAMS] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+
+typedef struct {
+    const IRFunction *fn;
+    FILE *out;
+    int next_block;                     // Emitted after the current one
+} Emitter;
+
+// The register and immediate a loop's vector instructions use
+typedef struct {
+    const VectorLoop *plan;
+    bool avx;
+    const char *vreg;                   // "xmm" or "ymm"
+    int *lane_reg;                      // Per IR register, or -1
+    int constant_reg[VECTOR_REGS];
+} VectorEmitter;
+
+static int slot(int reg) {
+    return 8 * (reg + 1);
+}
+
+static bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static void load(Emitter *e, const char *gpr, IROperand operand) {
+    if (operand.is_imm) {
+        fprintf(e->out, "    mov %s, %lld\n", gpr, (long long)operand.imm);
+    } else {
+        fprintf(e->out, "    mov %s, qword [rbp-%d]\n", gpr, slot(operand.reg));
+    }
+}
+
+// Second operand of a two-operand instruction; rcx is free to hold it
+static const char *source(Emitter *e, IROperand operand, char *text, size_t size) {
+    if (operand.is_imm && fits_imm32(operand.imm)) {
+        snprintf(text, size, "%lld", (long long)operand.imm);
+    } else if (operand.is_imm) {
+        load(e, "rcx", operand);
+        snprintf(text, size, "rcx");
+    } else {
+        snprintf(text, size, "qword [rbp-%d]", slot(operand.reg));
+    }
+    return text;
+}
+
+static void store(Emitter *e, int reg) {
+    fprintf(e->out, "    mov qword [rbp-%d], rax\n", slot(reg));
+}
+
+static void jump(Emitter *e, const char *op, int target) {
+    fprintf(e->out, "    %s %s.%s\n", op, e->fn->name, e->fn->blocks[target].label);
+}
+
+static void emit_inst(Emitter *e, const IRInst *inst) {
+    static const char *arith[] = {
+        [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "imul",
+        [IR_AND] = "and", [IR_OR] = "or", [IR_XOR] = "xor"
+    };
+    static const char *set[] = {
+        [IR_LT] = "setl", [IR_LE] = "setle", [IR_EQ] = "sete", [IR_NE] = "setne"
+    };
+    char text[64];
+
+    switch (inst->op) {
+        case IR_MOV:
+            load(e, "rax", inst->src[0]);
+            store(e, inst->dst);
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_AND:
+        case IR_OR:
+        case IR_XOR:
+            load(e, "rax", inst->src[0]);
+            fprintf(e->out, "    %s rax, %s\n", arith[inst->op],
+                    source(e, inst->src[1], text, sizeof(text)));
+            store(e, inst->dst);
+            break;
+        case IR_SHL:
+        case IR_SHR:
+            load(e, "rax", inst->src[0]);
+            if (inst->src[1].is_imm) {
+                fprintf(e->out, "    %s rax, %d\n", inst->op == IR_SHL ? "shl" : "sar",
+                        (int)(inst->src[1].imm & 63));
+            } else {
+                load(e, "rcx", inst->src[1]);
+                fprintf(e->out, "    %s rax, cl\n", inst->op == IR_SHL ? "shl" : "sar");
+            }
+            store(e, inst->dst);
+            break;
+        case IR_LT:
+        case IR_LE:
+        case IR_EQ:
+        case IR_NE:
+            load(e, "rax", inst->src[0]);
+            fprintf(e->out, "    cmp rax, %s\n", source(e, inst->src[1], text, sizeof(text)));
+            fprintf(e->out, "    %s al\n", set[inst->op]);
+            fprintf(e->out, "    movzx eax, al\n");
+            store(e, inst->dst);
+            break;
+        case IR_LOAD:
+            load(e, "rax", inst->src[0]);
+            load(e, "rcx", inst->src[1]);
+            fprintf(e->out, "    mov rax, qword [rax+rcx*8]\n");
+            store(e, inst->dst);
+            break;
+        case IR_STORE:
+            load(e, "rax", inst->src[0]);
+            load(e, "rcx", inst->src[1]);
+            load(e, "rdx", inst->src[2]);
+            fprintf(e->out, "    mov qword [rax+rcx*8], rdx\n");
+            break;
+        case IR_JMP:
+            if (inst->target[0] != e->next_block) {
+                jump(e, "jmp", inst->target[0]);
+            }
+            break;
+        case IR_BR:
+            load(e, "rax", inst->src[0]);
+            fprintf(e->out, "    test rax, rax\n");
+            if (inst->target[0] == e->next_block) {
+                jump(e, "jz", inst->target[1]);
+            } else {
+                jump(e, "jnz", inst->target[0]);
+                if (inst->target[1] != e->next_block) {
+                    jump(e, "jmp", inst->target[1]);
+                }
+            }
+            break;
+        case IR_RET:
+            load(e, "rax", inst->src[0]);
+            fprintf(e->out, "    leave\n");
+            fprintf(e->out, "    ret\n");
+            break;
+        default:
+            break;
+    }
+}
+
+static int vector_operand(const VectorEmitter *v, IROperand operand) {
+    if (!operand.is_imm) {
+        return v->lane_reg[operand.reg];
+    }
+    for (int i = 0; i < v->plan->constant_count; i++) {
+        if (v->plan->constants[i] == operand.imm) {
+            return v->constant_reg[i];
+        }
+    }
+    return -1;
+}
+
+// d = p op q. SSE2 instructions overwrite their first operand, so they
+// work on the scratch register.
+static void vector_op(Emitter *e, const VectorEmitter *v, const char *op, int d, int p,
+                      const char *q) {
+    if (v->avx) {
+        fprintf(e->out, "    v%s ymm%d, ymm%d, %s\n", op, d, p, q);
+    } else {
+        fprintf(e->out, "    movdqa xmm%d, xmm%d\n", SCRATCH, p);
+        fprintf(e->out, "    %s xmm%d, %s\n", op, SCRATCH, q);
+        fprintf(e->out, "    movdqa xmm%d, xmm%d\n", d, SCRATCH);
+    }
+}
+
+static void emit_vector_inst(Emitter *e, const VectorEmitter *v, const IRInst *inst) {
+    static const char *lane_op[] = {
+        [IR_ADD] = "paddq", [IR_SUB] = "psubq", [IR_AND] = "pand",
+        [IR_OR] = "por", [IR_XOR] = "pxor"
+    };
+    const char *mov = v->avx ? "vmovdqu" : "movdqu";
+    const char *r = v->vreg;
+    char text[32];
+
+    switch (inst->op) {
+        case IR_LOAD:
+            fprintf(e->out, "    mov rax, qword [rbp-%d]\n", slot(inst->src[0].reg));
+            fprintf(e->out, "    %s %s%d, [rax+rcx*8]\n", mov, r, v->lane_reg[inst->dst]);
+            break;
+        case IR_STORE:
+            fprintf(e->out, "    mov rax, qword [rbp-%d]\n", slot(inst->src[0].reg));
+            fprintf(e->out, "    %s [rax+rcx*8], %s%d\n", mov, r,
+                    vector_operand(v, inst->src[2]));
+            break;
+        case IR_MOV:
+            fprintf(e->out, "    %s %s%d, %s%d\n", v->avx ? "vmovdqa" : "movdqa", r,
+                    v->lane_reg[inst->dst], r, vector_operand(v, inst->src[0]));
+            break;
+        case IR_SHL:
+            snprintf(text, sizeof(text), "%d", (int)inst->src[1].imm);
+            vector_op(e, v, "psllq", v->lane_reg[inst->dst], vector_operand(v, inst->src[0]),
+                      text);
+            break;
+        default:
+            if (v->plan->kinds[inst->dst] == LANE_SUM) {
+                int sum = v->lane_reg[inst->dst];
+                IROperand x = inst->src[0].reg == inst->dst ? inst->src[1] : inst->src[0];
+                if (v->avx) {
+                    fprintf(e->out, "    vpaddq ymm%d, ymm%d, ymm%d\n", sum, sum,
+                            vector_operand(v, x));
+                } else {
+                    fprintf(e->out, "    paddq xmm%d, xmm%d\n", sum, vector_operand(v, x));
+                }
+                break;
+            }
+            snprintf(text, sizeof(text), "%s%d", r, vector_operand(v, inst->src[1]));
+            vector_op(e, v, lane_op[inst->op], v->lane_reg[inst->dst],
+                      vector_operand(v, inst->src[0]), text);
+            break;
+    }
+}
+
+// Put the same 64-bit value in every lane of register k; the value is in
+// rax, or in memory at `from` if that is not NULL
+static void broadcast(Emitter *e, const VectorEmitter *v, int k, const char *from) {
+    if (v->avx) {
+        if (from) {
+            fprintf(e->out, "    vpbroadcastq ymm%d, %s\n", k, from);
+        } else {
+            fprintf(e->out, "    vmovq xmm%d, rax\n", k);
+            fprintf(e->out, "    vpbroadcastq ymm%d, xmm%d\n", k, k);
+        }
+    } else {
+        fprintf(e->out, "    movq xmm%d, %s\n", k, from ? from : "rax");
+        fprintf(e->out, "    punpcklqdq xmm%d, xmm%d\n", k, k);
+    }
+}
+
+// Add up the lanes of register k into the register's stack slot
+static void fold_sum(Emitter *e, const VectorEmitter *v, int k, int reg) {
+    if (v->avx) {
+        fprintf(e->out, "    vextracti128 xmm%d, ymm%d, 1\n", SCRATCH, k);
+        fprintf(e->out, "    vpaddq xmm%d, xmm%d, xmm%d\n", k, k, SCRATCH);
+        fprintf(e->out, "    vpshufd xmm%d, xmm%d, 0x4e\n", SCRATCH, k);
+        fprintf(e->out, "    vpaddq xmm%d, xmm%d, xmm%d\n", k, k, SCRATCH);
+        fprintf(e->out, "    vmovq rax, xmm%d\n", k);
+    } else {
+        fprintf(e->out, "    pshufd xmm%d, xmm%d, 0x4e\n", SCRATCH, k);
+        fprintf(e->out, "    paddq xmm%d, xmm%d\n", k, SCRATCH);
+        fprintf(e->out, "    movq rax, xmm%d\n", k);
+    }
+    fprintf(e->out, "    add qword [rbp-%d], rax\n", slot(reg));
+}
+
+// Run the loop `width` iterations at a time until fewer are left, with i
+// in rcx and the bound in rdx, then fall into the scalar loop
+static void emit_vector_loop(Emitter *e, const VectorLoop *plan) {
+    const IRFunction *fn = e->fn;
+    const IRBlock *body = &fn->blocks[plan->body];
+    const char *name = fn->name;
+    const char *header = fn->blocks[plan->header].label;
+    int width = plan->width;
+    int update = vector_iv_update(fn, plan);
+    VectorEmitter v;
+    int next = 0;
+    char from[32];
+
+    memset(&v, 0, sizeof(v));
+    v.plan = plan;
+    v.avx = width == VECTOR_AVX2;
+    v.vreg = v.avx ? "ymm" : "xmm";
+    v.lane_reg = malloc(fn->reg_count * sizeof(int));
+    if (!v.lane_reg) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int reg = 0; reg < fn->reg_count; reg++) {
+        v.lane_reg[reg] = plan->kinds[reg] == LANE_SCALAR ? -1 : next++;
+    }
+    for (int i = 0; i < plan->constant_count; i++) {
+        v.constant_reg[i] = next++;
+    }
+
+    fprintf(e->out, "    ; %s: %d iterations at a time with %s\n", header, width,
+            v.avx ? "AVX2" : "SSE2");
+
+    // Arrays closer than a vector apart would see each other's stores
+    // in a different order
+    for (int a = 0; a < plan->base_count; a++) {
+        for (int b = a + 1; b < plan->base_count; b++) {
+            if (!plan->stored[a] && !plan->stored[b]) {
+                continue;
+            }
+            fprintf(e->out, "    mov rax, qword [rbp-%d]\n", slot(plan->bases[a]));
+            fprintf(e->out, "    sub rax, qword [rbp-%d]\n", slot(plan->bases[b]));
+            fprintf(e->out, "    mov r8, rax\n");
+            fprintf(e->out, "    neg r8\n");
+            fprintf(e->out, "    cmovs r8, rax\n");
+            fprintf(e->out, "    dec r8\n");
+            fprintf(e->out, "    cmp r8, %d\n", width * 8 - 1);
+            fprintf(e->out, "    jb %s.%s.scalar\n", name, header);
+        }
+    }
+
+    for (int reg = 0; reg < fn->reg_count; reg++) {
+        if (plan->kinds[reg] == LANE_UNIFORM) {
+            snprintf(from, sizeof(from), "qword [rbp-%d]", slot(reg));
+            broadcast(e, &v, v.lane_reg[reg], from);
+        } else if (plan->kinds[reg] == LANE_SUM) {
+            int k = v.lane_reg[reg];
+            if (v.avx) {
+                fprintf(e->out, "    vpxor ymm%d, ymm%d, ymm%d\n", k, k, k);
+            } else {
+                fprintf(e->out, "    pxor xmm%d, xmm%d\n", k, k);
+            }
+        }
+    }
+    for (int i = 0; i < plan->constant_count; i++) {
+        fprintf(e->out, "    mov rax, %lld\n", (long long)plan->constants[i]);
+        broadcast(e, &v, v.constant_reg[i], NULL);
+    }
+    fprintf(e->out, "    mov rcx, qword [rbp-%d]\n", slot(plan->iv));
+    load(e, "rdx", plan->limit);
+
+    fprintf(e->out, "%s.%s.vector:\n", name, header);
+    fprintf(e->out, "    lea rax, [rcx+%d]\n", width - 1);
+    fprintf(e->out, "    cmp rax, rdx\n");
+    fprintf(e->out, "    %s %s.%s.vector_end\n", plan->compare == IR_LT ? "jge" : "jg",
+            name, header);
+    for (int n = 0; n < body->count - 1; n++) {
+        if (n != update) {
+            emit_vector_inst(e, &v, &body->insts[n]);
+        }
+    }
+    fprintf(e->out, "    add rcx, %d\n", width);
+    fprintf(e->out, "    jmp %s.%s.vector\n", name, header);
+
+    fprintf(e->out, "%s.%s.vector_end:\n", name, header);
+    fprintf(e->out, "    mov qword [rbp-%d], rcx\n", slot(plan->iv));
+    for (int reg = 0; reg < fn->reg_count; reg++) {
+        if (plan->kinds[reg] == LANE_SUM) {
+            fold_sum(e, &v, v.lane_reg[reg], reg);
+        }
+    }
+    if (v.avx) {
+        fprintf(e->out, "    vzeroupper\n");
+    }
+    fprintf(e->out, "%s.%s.scalar:\n", name, header);
+    free(v.lane_reg);
+}
+
+// Plans for the loops the backend vectorizes, by preheader
+static VectorLoop *plan_loops(const IRFunction *fn, int width) {
+    VectorLoop *plans = calloc(fn->block_count, sizeof(VectorLoop));
+    CFG *cfg = cfg_analyze(fn);
+    Liveness *live = liveness_compute(fn, cfg);
+
+    if (!plans) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < cfg->loop_count && width > 1; i++) {
+        VectorLoop plan;
+        if (vector_plan_loop(fn, live, &cfg->loops[i], width, &plan)) {
+            plans[plan.preheader] = plan;
+        }
+    }
+    liveness_free(live);
+    cfg_free(cfg);
+    return plans;
+}
+
+bool x86_emit_function(const IRFunction *fn, int vector_width, FILE *out,
+                       char *error, size_t error_size) {
+    Emitter e = { fn, out, -1 };
+    int frame = (slot(fn->reg_count - 1) + 15) & ~15;
+
+    if (fn->param_count > X86_MAX_PARAMS) {
+        snprintf(error, error_size, "%s: more than %d parameters", fn->name, X86_MAX_PARAMS);
+        return false;
+    }
+    if (!ir_verify(fn, error, error_size)) {
+        return false;
+    }
+
+    VectorLoop *plans = plan_loops(fn, vector_width);
+
+    fprintf(out, "section .text\n");
+    fprintf(out, "global %s\n", fn->name);
+    fprintf(out, "%s:\n", fn->name);
+    fprintf(out, "    push rbp\n");
+    fprintf(out, "    mov rbp, rsp\n");
+    fprintf(out, "    sub rsp, %d\n", frame);
+    for (int reg = 0; reg < fn->reg_count; reg++) {
+        if (reg < fn->param_count) {
+            fprintf(out, "    mov qword [rbp-%d], %s\n", slot(reg), param_regs[reg]);
+        } else {
+            fprintf(out, "    mov qword [rbp-%d], 0\n", slot(reg));
+        }
+    }
+
+    for (int b = 0; b < fn->block_count; b++) {
+        const IRBlock *block = &fn->blocks[b];
+
+        e.next_block = b + 1 < fn->block_count ? b + 1 : -1;
+        fprintf(out, "%s.%s:\n", fn->name, block->label);
+        for (int i = 0; i < block->count; i++) {
+            if (i == block->count - 1 && plans[b].kinds) {
+                emit_vector_loop(&e, &plans[b]);
+            }
+            emit_inst(&e, &block->insts[i]);
+        }
+    }
+    fprintf(out, "\n");
+
+    for (int b = 0; b < fn->block_count; b++) {
+        vector_plan_free(&plans[b]);
+    }
+    free(plans);
+    return true;
+}
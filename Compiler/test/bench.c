@@ -0,0 +1,259 @@
+// Loop optimizer benchmark: each kernel runs on the IR interpreter with
+// the loop passes switched on one after another.
+//
+//   bench [-n elements] [kernel...]
+//
+// For every configuration it reports the dynamic instruction count,
+// branches taken and the cost (a multiply weighs three), checks the
+// result against the unoptimized run, and gives the speedup in cost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "loopopt.h"
+
+#define STEP_LIMIT 100000000ULL
+#define MAX_ARGS 4
+
+typedef struct {
+    const char *name;
+    // Fill args from two arrays of n words and the element count
+    void (*setup)(int64_t *args, int64_t *a, int64_t *b, int64_t n);
+    const char *text;
+} Kernel;
+
+typedef struct {
+    const char *name;
+    LoopOptions options;
+} Config;
+
+static void setup_pair(int64_t *args, int64_t *a, int64_t *b, int64_t n) {
+    args[0] = (int64_t)(intptr_t)a;
+    args[1] = (int64_t)(intptr_t)b;
+    args[2] = n;
+    args[3] = 3;
+}
+
+static void setup_stride(int64_t *args, int64_t *a, int64_t *b, int64_t n) {
+    (void)b;
+    args[0] = (int64_t)(intptr_t)a;
+    args[1] = n / 4;
+    args[2] = 4;
+}
+
+static void setup_matrix(int64_t *args, int64_t *a, int64_t *b, int64_t n) {
+    (void)b;
+    args[0] = (int64_t)(intptr_t)a;
+    args[1] = n / 25;
+    args[2] = 25;
+}
+
+static const Kernel kernels[] = {
+    { "sum", setup_pair,
+      "func sum(a, b, n)\n"
+      "    mov s, 0\n"
+      "    mov i, 0\n"
+      "head:\n"
+      "    lt c, i, n\n"
+      "    br c, body, done\n"
+      "body:\n"
+      "    load x, a, i\n"
+      "    add s, s, x\n"
+      "    add i, i, 1\n"
+      "    jmp head\n"
+      "done:\n"
+      "    ret s\n"
+      "end\n" },
+    { "dot", setup_pair,
+      "func dot(a, b, n)\n"
+      "    mov s, 0\n"
+      "    mov i, 0\n"
+      "head:\n"
+      "    lt c, i, n\n"
+      "    br c, body, done\n"
+      "body:\n"
+      "    load x, a, i\n"
+      "    load y, b, i\n"
+      "    mul p, x, y\n"
+      "    add s, s, p\n"
+      "    add i, i, 1\n"
+      "    jmp head\n"
+      "done:\n"
+      "    ret s\n"
+      "end\n" },
+    // b[i] = a[i] * (k * 3 + 1): the factor is loop-invariant
+    { "scale", setup_pair,
+      "func scale(a, b, n, k)\n"
+      "    mov i, 0\n"
+      "head:\n"
+      "    lt c, i, n\n"
+      "    br c, body, done\n"
+      "body:\n"
+      "    mul t, k, 3\n"
+      "    add f, t, 1\n"
+      "    load x, a, i\n"
+      "    mul y, x, f\n"
+      "    store b, i, y\n"
+      "    add i, i, 1\n"
+      "    jmp head\n"
+      "done:\n"
+      "    ret 0\n"
+      "end\n" },
+    // Every k-th word: the index i * k is reduced to an addition
+    { "stride", setup_stride,
+      "func stride(a, n, k)\n"
+      "    mov s, 0\n"
+      "    mov i, 0\n"
+      "head:\n"
+      "    lt c, i, n\n"
+      "    br c, body, done\n"
+      "body:\n"
+      "    mul j, i, k\n"
+      "    load x, a, j\n"
+      "    add s, s, x\n"
+      "    add i, i, 1\n"
+      "    jmp head\n"
+      "done:\n"
+      "    ret s\n"
+      "end\n" },
+    // Sum of a rows x cols matrix: r * cols is invariant in the inner
+    // loop and an induction variable of the outer one
+    { "matrix", setup_matrix,
+      "func matrix(a, rows, cols)\n"
+      "    mov s, 0\n"
+      "    mov r, 0\n"
+      "rows:\n"
+      "    lt c, r, rows\n"
+      "    br c, row, done\n"
+      "row:\n"
+      "    mov j, 0\n"
+      "cols:\n"
+      "    lt d, j, cols\n"
+      "    br d, col, next\n"
+      "col:\n"
+      "    mul base, r, cols\n"
+      "    add index, base, j\n"
+      "    load x, a, index\n"
+      "    add s, s, x\n"
+      "    add j, j, 1\n"
+      "    jmp cols\n"
+      "next:\n"
+      "    add r, r, 1\n"
+      "    jmp rows\n"
+      "done:\n"
+      "    ret s\n"
+      "end\n" },
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+// The interpreter runs scalar code, so vector_width is left 0
+static const Config configs[] = {
+    { "-O0",       { .licm = false, .strength_reduce = false, .unroll_factor = 1 } },
+    { "licm",      { .licm = true, .strength_reduce = false, .unroll_factor = 1 } },
+    { "licm+sr",   { .licm = true, .strength_reduce = true, .unroll_factor = 1 } },
+    { "-O1",       { .licm = true, .strength_reduce = true, .unroll_factor = LOOP_UNROLL_DEFAULT } },
+    { "unroll=8",  { .licm = true, .strength_reduce = true, .unroll_factor = 8 } },
+};
+
+#define CONFIG_COUNT (sizeof(configs) / sizeof(configs[0]))
+
+static bool wanted(int argc, char **argv, int first, const char *name) {
+    if (first >= argc) {
+        return true;
+    }
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false if the optimized run disagrees with the unoptimized one
+static bool run_kernel(const Kernel *kernel, int64_t n) {
+    int64_t *a = malloc(n * sizeof(int64_t));
+    int64_t *b = malloc(n * sizeof(int64_t));
+    int64_t *expected_b = malloc(n * sizeof(int64_t));
+    int64_t args[MAX_ARGS], expected = 0;
+    uint64_t base_cost = 0;
+    bool ok = true;
+
+    if (!a || !b || !expected_b) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t c = 0; c < CONFIG_COUNT; c++) {
+        const char *cursor = kernel->text;
+        char error[256];
+        IRFunction *fn = ir_parse(&cursor, error, sizeof(error));
+        LoopOptStats stats;
+        IRRunStats run;
+        int64_t result;
+
+        if (!fn) {
+            fprintf(stderr, "%s: %s\n", kernel->name, error);
+            exit(EXIT_FAILURE);
+        }
+        loop_optimize(fn, &configs[c].options, &stats);
+        if (!ir_verify(fn, error, sizeof(error))) {
+            fprintf(stderr, "%s %s: %s\n", kernel->name, configs[c].name, error);
+            ok = false;
+            ir_function_free(fn);
+            continue;
+        }
+
+        for (int64_t i = 0; i < n; i++) {
+            a[i] = (i * 7919) % 1000 - 500;
+            b[i] = (i * 104729) % 100;
+        }
+        kernel->setup(args, a, b, n);
+        if (!ir_run(fn, args, &result, &run, STEP_LIMIT)) {
+            fprintf(stderr, "%s %s: did not return\n", kernel->name, configs[c].name);
+            ok = false;
+            ir_function_free(fn);
+            continue;
+        }
+
+        bool match = true;
+        if (c == 0) {
+            expected = result;
+            base_cost = run.cost;
+            memcpy(expected_b, b, n * sizeof(int64_t));
+        } else {
+            match = result == expected && memcmp(expected_b, b, n * sizeof(int64_t)) == 0;
+        }
+        ok = ok && match;
+
+        printf("%-8s %-9s %10llu insts %9llu branches %10llu cost  %5.2fx  %s\n",
+               kernel->name, configs[c].name, (unsigned long long)run.insts,
+               (unsigned long long)run.branches, (unsigned long long)run.cost,
+               run.cost ? (double)base_cost / run.cost : 0.0, match ? "ok" : "MISMATCH");
+        ir_function_free(fn);
+    }
+    free(a);
+    free(b);
+    free(expected_b);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int64_t n = 1000;
+    int first = 1;
+    bool ok = true;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        n = atoll(argv[2]);
+        first = 3;
+    }
+    if (n < 100) {
+        n = 100;
+    }
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        if (wanted(argc, argv, first, kernels[k].name)) {
+            ok = run_kernel(&kernels[k], n) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
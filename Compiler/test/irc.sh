@@ -0,0 +1,97 @@
+#!/bin/sh
+# Runs the IR driver over .mir files with each of its flags:
+# - IR output parses and verifies again.
+# - -O1 runs every loop pass somewhere; -O0 and the -fno- flags turn
+#   them off.
+# - -S emits SSE2 or AVX2 vector loops only when asked to, and some
+#   loop gets them.
+# - With nasm on the PATH, every -S output assembles.
+#
+#   test/irc.sh <irc> <file.mir>...
+
+IRC=$1
+shift
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+status=0
+passes=""           # Passes -O1 ran somewhere
+vector=0            # Files with SSE2 loops
+
+fail() {
+    echo "irc.sh: $MIR: $*"
+    status=1
+}
+
+for MIR in "$@"; do
+    functions=$(grep -c '^func ' "$MIR")
+
+    # Stats lines are "; <function>: N hoisted, N reduced, N unrolled"
+    for flags in "-O0" "-O1" "-O1 -funroll=8" "-O1 -fno-licm" "-O1 -fno-strength-reduce" "-O1 -fno-unroll"; do
+        if ! $IRC $flags "$MIR" > "$WORK/out.mir"; then
+            fail "$flags: failed"
+            continue
+        fi
+        if [ "$(grep -c '^func ' "$WORK/out.mir")" -ne "$functions" ]; then
+            fail "$flags: expected $functions functions"
+        fi
+        if ! $IRC -O0 "$WORK/out.mir" > /dev/null; then
+            fail "$flags: output does not parse again"
+        fi
+        case $flags in
+        -O0)                   off='hoisted reduced unrolled';;
+        *-fno-licm)            off='hoisted';;
+        *-fno-strength-reduce) off='reduced';;
+        *-fno-unroll)          off='unrolled';;
+        *)                     off='';;
+        esac
+        for pass in $off; do
+            if grep -q "^;.* [1-9][0-9]* $pass" "$WORK/out.mir"; then
+                fail "$flags: $pass something"
+            fi
+        done
+        if [ "$flags" = "-O1" ]; then
+            for pass in hoisted reduced unrolled; do
+                grep -q "^;.* [1-9][0-9]* $pass" "$WORK/out.mir" && passes="$passes $pass"
+            done
+        fi
+    done
+
+    for flags in "-O0 -S" "-O1 -S" "-O1 -S -mavx2" "-O1 -S -fno-vectorize"; do
+        if ! $IRC $flags "$MIR" > "$WORK/out.asm"; then
+            fail "$flags: failed"
+            continue
+        fi
+        xmm=$(grep -c 'xmm[0-9]' "$WORK/out.asm")
+        ymm=$(grep -c 'ymm[0-9]' "$WORK/out.asm")
+        case $flags in
+        "-O1 -S")
+            [ "$ymm" -eq 0 ] || fail "$flags: AVX2 code without -mavx2"
+            sse2=$xmm
+            [ "$xmm" -gt 0 ] && vector=$((vector + 1));;
+        *-mavx2)
+            [ "$sse2" -eq 0 ] || [ "$ymm" -gt 0 ] || fail "$flags: SSE2 loops but no AVX2 ones";;
+        *)
+            [ "$xmm" -eq 0 ] && [ "$ymm" -eq 0 ] || fail "$flags: vector code without vectorization";;
+        esac
+        if command -v nasm > /dev/null 2>&1 && ! nasm -f elf64 "$WORK/out.asm" -o "$WORK/out.o"; then
+            fail "$flags: output does not assemble"
+        fi
+    done
+done
+
+MIR="$*"
+for pass in hoisted reduced unrolled; do
+    case " $passes " in
+    *" $pass "*) ;;
+    *) fail "-O1: nothing $pass";;
+    esac
+done
+[ $vector -gt 0 ] || fail "-O1 -S: no vector loops"
+
+MIR=missing.c
+if $IRC -O1 "$WORK/missing.c" > /dev/null 2>&1; then
+    fail "accepted as IR"
+fi
+
+[ $status -eq 0 ] && echo "irc: ok"
+exit $status
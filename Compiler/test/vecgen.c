@@ -0,0 +1,86 @@
+// Emit every function in a MicroASM file once per vectorizer benchmark
+// configuration, as <name>_o0, <name>_scalar, <name>_sse2 and
+// <name>_avx2, for test/vecbench.c to call.
+//
+//   vecgen kernels.mir > kernels.asm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "loopopt.h"
+#include "vectorize.h"
+#include "x86gen.h"
+
+typedef struct {
+    const char *suffix;
+    bool optimize;
+    int vector_width;
+} Config;
+
+static const Config configs[] = {
+    { "o0", false, 0 },
+    { "scalar", true, 0 },
+    { "sse2", true, VECTOR_SSE2 },
+    { "avx2", true, VECTOR_AVX2 },
+};
+
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    char *text = NULL;
+    long size;
+
+    if (!file) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 &&
+        fseek(file, 0, SEEK_SET) == 0 && (text = malloc(size + 1)) != NULL) {
+        text[fread(text, 1, size, file)] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+int main(int argc, char **argv) {
+    char error[256];
+    char *text;
+
+    if (argc != 2 || !(text = read_file(argv[1]))) {
+        fprintf(stderr, "Usage: %s <file.mir>\n", argv[0]);
+        return 1;
+    }
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        const char *cursor = text;
+        IRFunction *fn;
+
+        while ((fn = ir_parse(&cursor, error, sizeof(error))) != NULL) {
+            LoopOptions options;
+            LoopOptStats stats;
+            size_t length = strlen(fn->name) + strlen(configs[c].suffix) + 2;
+            char *name = malloc(length);
+
+            snprintf(name, length, "%s_%s", fn->name, configs[c].suffix);
+            free(fn->name);
+            fn->name = name;
+
+            loop_options_default(&options);
+            options.vector_width = configs[c].vector_width;
+            if (!configs[c].optimize) {
+                options.licm = options.strength_reduce = false;
+                options.unroll_factor = 1;
+            }
+            loop_optimize(fn, &options, &stats);
+            if (!x86_emit_function(fn, configs[c].vector_width, stdout, error, sizeof(error))) {
+                fprintf(stderr, "%s\n", error);
+                return 1;
+            }
+            ir_function_free(fn);
+        }
+        if (error[0]) {
+            fprintf(stderr, "%s: %s\n", argv[1], error);
+            return 1;
+        }
+    }
+    free(text);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef COLLECTIONS_H
+#define COLLECTIONS_H
+
+#include "stddef.h"
+#include "stdint.h"
+
+/*
+ * Container types shared by the kernel and the MicroASM VM.
+ * These back the MNI DataStructures.* calls (see v2instructions.md).
+ */
+
+/* Growable array of fixed-size elements stored contiguously */
+typedef struct {
+    uint8_t* data;
+    size_t size;        /* Number of elements in use */
+    size_t capacity;    /* Number of elements allocated */
+    size_t elem_size;   /* Size of one element in bytes */
+} vector_t;
+
+int vector_init(vector_t* v, size_t elem_size, size_t initial_capacity);
+void vector_destroy(vector_t* v);
+int vector_reserve(vector_t* v, size_t capacity);
+void* vector_push(vector_t* v, const void* elem);
+void* vector_get(const vector_t* v, size_t index);
+int vector_remove(vector_t* v, size_t index);
+void vector_clear(vector_t* v);
+
+/*
+ * Open-addressing hash map from null-terminated string keys to
+ * fixed-size values. Control bytes are probed a group at a time and
+ * key bytes live in a single arena, so inserts never allocate per entry.
+ */
+#define HASHMAP_GROUP_WIDTH 8
+
+typedef struct {
+    uint8_t* ctrl;      /* capacity + HASHMAP_GROUP_WIDTH control bytes */
+    uint8_t* slots;     /* capacity slots of slot_size bytes */
+    size_t capacity;    /* Always a power of two */
+    size_t size;        /* Number of live entries */
+    size_t growth_left; /* Inserts left before the table must grow */
+    size_t value_size;
+    size_t slot_size;
+    vector_t keys;      /* Arena holding the key bytes */
+} hashmap_t;
+
+int hashmap_init(hashmap_t* map, size_t value_size, size_t initial_capacity);
+void hashmap_destroy(hashmap_t* map);
+void* hashmap_put(hashmap_t* map, const char* key, const void* value);
+void* hashmap_get(const hashmap_t* map, const char* key);
+int hashmap_contains(const hashmap_t* map, const char* key);
+int hashmap_remove(hashmap_t* map, const char* key);
+void hashmap_clear(hashmap_t* map);
+int hashmap_next(const hashmap_t* map, size_t* cursor, const char** key,
+                 size_t* key_len, void** value);
+
+// wyhash-style hash used for string keys
+uint64_t wyhash(const void* key, size_t len, uint64_t seed);
+
+#endif /* COLLECTIONS_H */
@@ -0,0 +1,468 @@
+#include "libc.h"
+
+// Request queue
+
+void fsio_init(fsio_t* io, const fsio_backend_t* backend, void* ctx) {
+    memset(io, 0, sizeof(*io));
+    io->backend = backend;
+    io->ctx = ctx;
+}
+
+static void fsio_finish(fsio_t* io, fsio_request_t* req) {
+    req->done = 1;
+    io->in_flight--;
+
+    if (req->result > 0) {
+        if (req->op == FSIO_READ) {
+            io->stats.bytes_read += req->result;
+        } else {
+            io->stats.bytes_written += req->result;
+        }
+    }
+
+    if (!req->internal) {
+        io->completed[io->completed_count++] = req;
+    }
+}
+
+static size_t reap_some(fsio_t* io, int wait) {
+    fsio_request_t* done[FSIO_QUEUE_DEPTH];
+    size_t n = io->backend->reap(io->ctx, done, FSIO_QUEUE_DEPTH, wait && io->in_flight);
+
+    for (size_t i = 0; i < n; i++) {
+        fsio_finish(io, done[i]);
+    }
+    return n;
+}
+
+// Hand every queued request to the backend in one call
+int fsio_submit(fsio_t* io) {
+    if (!io->queued) {
+        return 0;
+    }
+
+    io->stats.submits++;
+    io->stats.requests += io->queued;
+    io->in_flight += io->queued;
+
+    size_t count = io->queued;
+    io->queued = 0;
+    return io->backend->submit(io->ctx, io->queue, count);
+}
+
+// Queue a request without starting it. Caller-owned requests stay on the
+// completion list until fsio_complete or fsio_wait picks them up, so at
+// most FSIO_QUEUE_DEPTH of them may be outstanding.
+int fsio_queue(fsio_t* io, fsio_request_t* req) {
+    req->done = 0;
+    req->result = 0;
+
+    if (!req->internal &&
+        io->completed_count + io->queued + io->in_flight >= FSIO_QUEUE_DEPTH) {
+        return -1;
+    }
+
+    while (io->queued + io->in_flight >= FSIO_QUEUE_DEPTH) {
+        if (io->queued) {
+            fsio_submit(io);
+        } else if (!reap_some(io, 1)) {
+            return -1;
+        }
+    }
+
+    io->queue[io->queued++] = req;
+    return 0;
+}
+
+static void drop_completed(fsio_t* io, fsio_request_t* req) {
+    for (size_t i = 0; i < io->completed_count; i++) {
+        if (io->completed[i] == req) {
+            io->completed[i] = io->completed[--io->completed_count];
+            return;
+        }
+    }
+}
+
+// Block until `req` has finished
+int fsio_wait(fsio_t* io, fsio_request_t* req) {
+    if (!req->done) {
+        fsio_submit(io);
+        while (!req->done) {
+            if (!reap_some(io, 1) && !io->in_flight) {
+                return -1;
+            }
+        }
+    }
+
+    if (!req->internal) {
+        drop_completed(io, req);
+    }
+    return req->result < 0 ? -1 : 0;
+}
+
+// Collect finished caller-owned requests
+size_t fsio_complete(fsio_t* io, fsio_request_t** done, size_t max, int wait) {
+    fsio_submit(io);
+    reap_some(io, 0);
+
+    while (wait && !io->completed_count && io->in_flight) {
+        reap_some(io, 1);
+    }
+
+    size_t n = io->completed_count < max ? io->completed_count : max;
+    for (size_t i = 0; i < n; i++) {
+        done[i] = io->completed[i];
+    }
+    for (size_t i = n; i < io->completed_count; i++) {
+        io->completed[i - n] = io->completed[i];
+    }
+    io->completed_count -= n;
+    return n;
+}
+
+// Buffered files
+
+static void start_buffer(fsio_file_t* file, fsio_buffer_t* b, int op,
+                         uint64_t offset, uint32_t len) {
+    b->offset = offset;
+    b->busy = 1;
+    b->req.op = op;
+    b->req.handle = file->handle;
+    b->req.offset = offset;
+    b->req.buf = b->buf;
+    b->req.len = len;
+    b->req.internal = 1;
+    b->req.tag = 0;
+
+    if (op == FSIO_READ) {
+        b->len = len;
+    }
+    fsio_queue(file->io, &b->req);
+}
+
+// Wait for a buffer's request; read buffers keep only the bytes read
+static void settle_buffer(fsio_file_t* file, fsio_buffer_t* b) {
+    if (!b->busy) {
+        return;
+    }
+
+    fsio_wait(file->io, &b->req);
+    b->busy = 0;
+
+    if (b->req.result < 0 || (b->req.op == FSIO_WRITE && (uint32_t)b->req.result != b->req.len)) {
+        file->error = 1;
+    }
+
+    if (b->req.op == FSIO_READ) {
+        b->len = b->req.result > 0 ? (uint32_t)b->req.result : 0;
+    } else {
+        b->len = 0;
+    }
+}
+
+static int alloc_buffers(fsio_buffer_t* pair) {
+    for (int i = 0; i < 2; i++) {
+        if (!pair[i].buf) {
+            pair[i].buf = (uint8_t*)malloc(FSIO_WINDOW_MAX);
+            if (!pair[i].buf) {
+                return -1;
+            }
+            pair[i].len = 0;
+            pair[i].busy = 0;
+        }
+    }
+    return 0;
+}
+
+int fsio_open(fsio_t* io, fsio_file_t* file, const char* path, const char* mode) {
+    memset(file, 0, sizeof(*file));
+    file->io = io;
+    file->window = FSIO_WINDOW_MIN;
+
+    if (io->backend->open(io->ctx, path, mode, &file->handle) != 0) {
+        return -1;
+    }
+
+    if (mode[0] == 'a') {
+        int64_t size = io->backend->size(io->ctx, file->handle);
+        file->pos = size > 0 ? (uint64_t)size : 0;
+    }
+    return 0;
+}
+
+static int covers(const fsio_buffer_t* b, uint64_t pos) {
+    uint32_t len = b->busy ? b->req.len : b->len;
+    return b->buf && pos >= b->offset && pos < b->offset + len;
+}
+
+static fsio_buffer_t* ra_lookup(fsio_file_t* file, uint64_t pos) {
+    for (int i = 0; i < 2; i++) {
+        if (covers(&file->ra[i], pos)) {
+            return &file->ra[i];
+        }
+    }
+    return NULL;
+}
+
+// Start reading the window at `offset` into the buffer not in use
+static void prefetch(fsio_file_t* file, const fsio_buffer_t* current, uint64_t offset) {
+    if (ra_lookup(file, offset)) {
+        return;
+    }
+
+    fsio_buffer_t* b = (current == &file->ra[0]) ? &file->ra[1] : &file->ra[0];
+    if (!b->busy) {
+        start_buffer(file, b, FSIO_READ, offset, file->window);
+    }
+}
+
+int64_t fsio_read(fsio_file_t* file, void* buf, size_t len) {
+    fsio_t* io = file->io;
+    uint8_t* out = (uint8_t*)buf;
+    size_t total = 0;
+
+    if (fsio_flush(file) != 0 || alloc_buffers(file->ra) != 0) {
+        return -1;
+    }
+
+    // Streaming readers get a growing window; random access resets it
+    int sequential = (file->pos == file->last_end);
+    if (!sequential) {
+        file->window = FSIO_WINDOW_MIN;
+    }
+
+    while (total < len) {
+        fsio_buffer_t* b = ra_lookup(file, file->pos);
+
+        if (b) {
+            if (b->busy) {
+                settle_buffer(file, b);
+                if (file->error) {
+                    break;
+                }
+                continue;
+            }
+
+            size_t avail = b->offset + b->len - file->pos;
+            size_t n = avail < len - total ? avail : len - total;
+            memcpy(out + total, b->buf + (file->pos - b->offset), n);
+            total += n;
+            file->pos += n;
+            io->stats.readahead_hits++;
+
+            // A full window means the file goes on: fetch the next one
+            if (sequential && b->len == b->req.len) {
+                prefetch(file, b, b->offset + b->len);
+            }
+            continue;
+        }
+
+        // Large reads bypass the buffers and land in the caller's memory
+        if (len - total >= file->window) {
+            fsio_request_t req;
+            req.op = FSIO_READ;
+            req.handle = file->handle;
+            req.offset = file->pos;
+            req.buf = out + total;
+            req.len = (uint32_t)((len - total) < FSIO_WINDOW_MAX ? (len - total) : FSIO_WINDOW_MAX);
+            req.internal = 1;
+            req.tag = 0;
+
+            if (fsio_queue(io, &req) != 0 || fsio_wait(io, &req) != 0) {
+                file->error = 1;
+                break;
+            }
+            if (req.result <= 0) {
+                break;
+            }
+            total += req.result;
+            file->pos += req.result;
+            continue;
+        }
+
+        // Miss: fill a free buffer, and the next window too if streaming
+        fsio_buffer_t* slot = file->ra[0].busy ? &file->ra[1] : &file->ra[0];
+        settle_buffer(file, slot);
+        start_buffer(file, slot, FSIO_READ, file->pos, file->window);
+        if (sequential) {
+            prefetch(file, slot, file->pos + file->window);
+        }
+
+        settle_buffer(file, slot);
+        if (file->error || slot->len == 0) {
+            break;
+        }
+    }
+
+    file->last_end = file->pos;
+    if (sequential && file->window < FSIO_WINDOW_MAX) {
+        file->window *= 2;
+    }
+
+    // Start any readahead queued above before returning to the script
+    fsio_submit(io);
+
+    if (file->error && total == 0) {
+        return -1;
+    }
+    return (int64_t)total;
+}
+
+static void drop_readahead(fsio_file_t* file) {
+    for (int i = 0; i < 2; i++) {
+        settle_buffer(file, &file->ra[i]);
+        file->ra[i].len = 0;
+    }
+    file->last_end = (uint64_t)-1;
+}
+
+// Writes collect in one buffer while the other is being written out
+int64_t fsio_write(fsio_file_t* file, const void* buf, size_t len) {
+    const uint8_t* in = (const uint8_t*)buf;
+    size_t total = 0;
+
+    if (alloc_buffers(file->wb) != 0) {
+        return -1;
+    }
+    drop_readahead(file);
+
+    while (total < len) {
+        fsio_buffer_t* b = &file->wb[file->wb_active];
+
+        if (b->busy) {
+            settle_buffer(file, b);
+        }
+
+        // Only contiguous data can share a buffer
+        if (b->len && b->offset + b->len != file->pos) {
+            start_buffer(file, b, FSIO_WRITE, b->offset, b->len);
+            file->wb_active ^= 1;
+            continue;
+        }
+
+        if (b->len == 0) {
+            b->offset = file->pos;
+        }
+
+        size_t room = FSIO_WINDOW_MAX - b->len;
+        size_t n = room < len - total ? room : len - total;
+        memcpy(b->buf + b->len, in + total, n);
+        b->len += n;
+        total += n;
+        file->pos += n;
+
+        if (b->len == FSIO_WINDOW_MAX) {
+            start_buffer(file, b, FSIO_WRITE, b->offset, b->len);
+            file->wb_active ^= 1;
+        }
+    }
+
+    fsio_submit(file->io);
+    return file->error ? -1 : (int64_t)total;
+}
+
+// Write out buffered data and wait for every outstanding write
+int fsio_flush(fsio_file_t* file) {
+    if (!file->wb[0].buf) {
+        return file->error ? -1 : 0;
+    }
+
+    fsio_buffer_t* active = &file->wb[file->wb_active];
+    if (!active->busy && active->len) {
+        start_buffer(file, active, FSIO_WRITE, active->offset, active->len);
+        file->wb_active ^= 1;
+    }
+
+    settle_buffer(file, &file->wb[0]);
+    settle_buffer(file, &file->wb[1]);
+    return file->error ? -1 : 0;
+}
+
+int fsio_seek(fsio_file_t* file, uint64_t pos) {
+    int status = fsio_flush(file);
+    file->pos = pos;
+    return status;
+}
+
+uint64_t fsio_tell(const fsio_file_t* file) {
+    return file->pos;
+}
+
+int64_t fsio_size(fsio_file_t* file) {
+    fsio_flush(file);
+    return file->io->backend->size(file->io->ctx, file->handle);
+}
+
+int fsio_close(fsio_file_t* file) {
+    int status = fsio_flush(file);
+
+    for (int i = 0; i < 2; i++) {
+        settle_buffer(file, &file->ra[i]);
+        free(file->ra[i].buf);
+        free(file->wb[i].buf);
+        file->ra[i].buf = NULL;
+        file->wb[i].buf = NULL;
+    }
+
+    if (file->io->backend->close(file->io->ctx, file->handle) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+// Blocking backend: each request runs to completion inside submit and
+// is handed back by the next reap
+
+static int blocking_open(void* ctx, const char* path, const char* mode, int64_t* handle) {
+    fsio_blocking_t* b = (fsio_blocking_t*)ctx;
+    return b->open(b->ctx, path, mode, handle);
+}
+
+static int blocking_close(void* ctx, int64_t handle) {
+    fsio_blocking_t* b = (fsio_blocking_t*)ctx;
+    return b->close(b->ctx, handle);
+}
+
+static int64_t blocking_size(void* ctx, int64_t handle) {
+    fsio_blocking_t* b = (fsio_blocking_t*)ctx;
+    return b->size(b->ctx, handle);
+}
+
+static int blocking_submit(void* ctx, fsio_request_t** reqs, size_t count) {
+    fsio_blocking_t* b = (fsio_blocking_t*)ctx;
+
+    for (size_t i = 0; i < count; i++) {
+        fsio_request_t* req = reqs[i];
+        if (req->op == FSIO_READ) {
+            req->result = b->pread(b->ctx, req->handle, req->buf, req->len, req->offset);
+        } else {
+            req->result = b->pwrite(b->ctx, req->handle, req->buf, req->len, req->offset);
+        }
+        b->done[b->done_count++] = req;
+    }
+    return 0;
+}
+
+static size_t blocking_reap(void* ctx, fsio_request_t** done, size_t max, int wait) {
+    fsio_blocking_t* b = (fsio_blocking_t*)ctx;
+    size_t n = b->done_count < max ? b->done_count : max;
+    (void)wait;
+
+    for (size_t i = 0; i < n; i++) {
+        done[i] = b->done[i];
+    }
+    for (size_t i = n; i < b->done_count; i++) {
+        b->done[i - n] = b->done[i];
+    }
+    b->done_count -= n;
+    return n;
+}
+
+const fsio_backend_t fsio_blocking_backend = {
+    "blocking",
+    blocking_open,
+    blocking_close,
+    blocking_size,
+    blocking_submit,
+    blocking_reap
+};
@@ -0,0 +1,134 @@
+#ifndef FSIO_H
+#define FSIO_H
+
+#include "stddef.h"
+#include "stdint.h"
+
+/*
+ * File I/O layer behind the MNI FileSystem.* calls.
+ *
+ * Reads and writes become requests that are queued and handed to a
+ * backend in batches. Sequential readers get readahead, and sequential
+ * writers get write-behind, each from a pair of buffers so one can be
+ * in flight while the other is used. Scripts that overlap compute with
+ * I/O can use the async calls directly and collect completions later.
+ *
+ * Backends: io_uring on a Linux host (fsio_uring.c, built with
+ * -DMLIBC_IO_URING), and fsio_blocking_backend for anything that only
+ * has blocking pread/pwrite, such as the kernel's block cache.
+ */
+
+#define FSIO_QUEUE_DEPTH 64
+/* Readahead window bounds; small-heap builds can lower the maximum */
+#ifndef FSIO_WINDOW_MIN
+#define FSIO_WINDOW_MIN  (16 * 1024)
+#endif
+#ifndef FSIO_WINDOW_MAX
+#define FSIO_WINDOW_MAX  (256 * 1024)
+#endif
+
+enum {
+    FSIO_READ,
+    FSIO_WRITE
+};
+
+typedef struct fsio_request {
+    int op;             /* FSIO_READ or FSIO_WRITE */
+    int64_t handle;
+    uint64_t offset;
+    void* buf;
+    uint32_t len;
+    int32_t result;     /* Bytes transferred, or a negative error */
+    int done;
+    int internal;       /* Issued by readahead/write-behind, not the caller */
+    uint64_t tag;       /* Caller cookie for async requests */
+} fsio_request_t;
+
+typedef struct {
+    const char* name;
+    int (*open)(void* ctx, const char* path, const char* mode, int64_t* handle);
+    int (*close)(void* ctx, int64_t handle);
+    int64_t (*size)(void* ctx, int64_t handle);
+    // Start `count` requests with as few device/kernel round trips as possible
+    int (*submit)(void* ctx, fsio_request_t** reqs, size_t count);
+    // Collect finished requests; blocks for at least one when `wait` is set
+    size_t (*reap)(void* ctx, fsio_request_t** done, size_t max, int wait);
+} fsio_backend_t;
+
+typedef struct {
+    uint64_t submits;       /* Backend submit calls (syscalls on a host) */
+    uint64_t requests;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t readahead_hits;
+} fsio_stats_t;
+
+typedef struct {
+    const fsio_backend_t* backend;
+    void* ctx;
+    fsio_request_t* queue[FSIO_QUEUE_DEPTH];    /* Prepared, not yet submitted */
+    size_t queued;
+    size_t in_flight;
+    fsio_request_t* completed[FSIO_QUEUE_DEPTH]; /* Finished async requests */
+    size_t completed_count;
+    fsio_stats_t stats;
+} fsio_t;
+
+// One readahead or write-behind buffer
+typedef struct {
+    uint8_t* buf;
+    uint64_t offset;
+    uint32_t len;       /* Valid bytes (reads) or filled bytes (writes) */
+    int busy;           /* Request in flight */
+    fsio_request_t req;
+} fsio_buffer_t;
+
+typedef struct {
+    fsio_t* io;
+    int64_t handle;
+    uint64_t pos;
+    uint64_t last_end;  /* End of the previous read, to detect streaming */
+    uint32_t window;    /* Readahead size, grows while access is sequential */
+    fsio_buffer_t ra[2];
+    fsio_buffer_t wb[2];
+    int wb_active;
+    int error;
+} fsio_file_t;
+
+void fsio_init(fsio_t* io, const fsio_backend_t* backend, void* ctx);
+
+int fsio_open(fsio_t* io, fsio_file_t* file, const char* path, const char* mode);
+int fsio_close(fsio_file_t* file);
+int64_t fsio_read(fsio_file_t* file, void* buf, size_t len);
+int64_t fsio_write(fsio_file_t* file, const void* buf, size_t len);
+int fsio_seek(fsio_file_t* file, uint64_t pos);
+uint64_t fsio_tell(const fsio_file_t* file);
+int64_t fsio_size(fsio_file_t* file);
+int fsio_flush(fsio_file_t* file);
+
+// Completion-based interface
+int fsio_queue(fsio_t* io, fsio_request_t* req);
+int fsio_submit(fsio_t* io);
+int fsio_wait(fsio_t* io, fsio_request_t* req);
+size_t fsio_complete(fsio_t* io, fsio_request_t** done, size_t max, int wait);
+
+// Adapter for backends that can only do blocking transfers
+typedef struct {
+    int (*open)(void* ctx, const char* path, const char* mode, int64_t* handle);
+    int (*close)(void* ctx, int64_t handle);
+    int64_t (*size)(void* ctx, int64_t handle);
+    int32_t (*pread)(void* ctx, int64_t handle, void* buf, uint32_t len, uint64_t offset);
+    int32_t (*pwrite)(void* ctx, int64_t handle, const void* buf, uint32_t len, uint64_t offset);
+    void* ctx;
+    fsio_request_t* done[FSIO_QUEUE_DEPTH];
+    size_t done_count;
+} fsio_blocking_t;
+
+extern const fsio_backend_t fsio_blocking_backend;
+
+#ifdef MLIBC_IO_URING
+int fsio_uring_init(fsio_t* io, unsigned entries);
+void fsio_uring_destroy(fsio_t* io);
+#endif
+
+#endif /* FSIO_H */
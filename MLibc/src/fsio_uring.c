@@ -0,0 +1,279 @@
+#include "libc.h"
+
+#if defined(MLIBC_IO_URING) && defined(__x86_64__)
+
+// io_uring backend for hosted builds on Linux. MLibc has no syscall
+// layer, so the few calls needed are issued directly and the kernel ABI
+// structures are declared here.
+
+#define SYS_MMAP             9
+#define SYS_MUNMAP           11
+#define SYS_CLOSE            3
+#define SYS_LSEEK            8
+#define SYS_OPENAT           257
+#define SYS_IO_URING_SETUP   425
+#define SYS_IO_URING_ENTER   426
+
+#define AT_FDCWD             (-100)
+#define O_RDONLY             0
+#define O_WRONLY             1
+#define O_RDWR               2
+#define O_CREAT              0x40
+#define O_TRUNC              0x200
+#define SEEK_END             2
+
+#define PROT_READ            1
+#define PROT_WRITE           2
+#define MAP_SHARED           1
+#define MAP_POPULATE         0x8000
+
+#define IORING_OFF_SQ_RING   0ULL
+#define IORING_OFF_CQ_RING   0x8000000ULL
+#define IORING_OFF_SQES      0x10000000ULL
+#define IORING_OP_READ       22
+#define IORING_OP_WRITE      23
+#define IORING_ENTER_GETEVENTS 1
+
+typedef struct {
+    uint32_t head, tail, ring_mask, ring_entries, flags, dropped, array, resv1;
+    uint64_t user_addr;
+} sq_offsets_t;
+
+typedef struct {
+    uint32_t head, tail, ring_mask, ring_entries, overflow, cqes, flags, resv1;
+    uint64_t user_addr;
+} cq_offsets_t;
+
+typedef struct {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    sq_offsets_t sq_off;
+    cq_offsets_t cq_off;
+} uring_params_t;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t rw_flags;
+    uint64_t user_data;
+    uint64_t pad[3];
+} uring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+} uring_cqe_t;
+
+typedef struct {
+    int fd;
+    uint8_t* sq_ring;
+    size_t sq_ring_size;
+    uint8_t* cq_ring;
+    size_t cq_ring_size;
+    uring_sqe_t* sqes;
+    size_t sqes_size;
+
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    uring_cqe_t* cqes;
+} uring_t;
+
+static long sys6(long n, long a, long b, long c, long d, long e, long f) {
+    long ret;
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+    __asm__ volatile("syscall"
+                     : "=a"(ret)
+                     : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+                     : "rcx", "r11", "memory");
+    return ret;
+}
+
+static void* map_ring(int fd, size_t size, uint64_t offset) {
+    long addr = sys6(SYS_MMAP, 0, (long)size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, (long)offset);
+    return (addr < 0 && addr > -4096) ? NULL : (void*)addr;
+}
+
+static int uring_open(void* ctx, const char* path, const char* mode, int64_t* handle) {
+    int flags = O_RDONLY;
+    (void)ctx;
+
+    if (mode[0] == 'w') {
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    } else if (mode[0] == 'a') {
+        flags = O_WRONLY | O_CREAT;
+    }
+    if (mode[0] && mode[1] == '+') {
+        flags = (flags & ~O_WRONLY) | O_RDWR;
+    }
+
+    long fd = sys6(SYS_OPENAT, AT_FDCWD, (long)path, flags, 0644, 0, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    *handle = fd;
+    return 0;
+}
+
+static int uring_close(void* ctx, int64_t handle) {
+    (void)ctx;
+    return sys6(SYS_CLOSE, (long)handle, 0, 0, 0, 0, 0) < 0 ? -1 : 0;
+}
+
+static int64_t uring_size(void* ctx, int64_t handle) {
+    (void)ctx;
+    long size = sys6(SYS_LSEEK, (long)handle, 0, SEEK_END, 0, 0, 0);
+    return size < 0 ? -1 : size;
+}
+
+// Fill one SQE per request and start them all with a single enter call
+static int uring_submit(void* ctx, fsio_request_t** reqs, size_t count) {
+    uring_t* ring = (uring_t*)ctx;
+    uint32_t tail = *ring->sq_tail;
+    uint32_t mask = *ring->sq_mask;
+
+    for (size_t i = 0; i < count; i++) {
+        fsio_request_t* req = reqs[i];
+        uint32_t index = tail & mask;
+        uring_sqe_t* sqe = &ring->sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = req->op == FSIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = (int32_t)req->handle;
+        sqe->off = req->offset;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = req->len;
+        sqe->user_data = (uint64_t)(uintptr_t)req;
+
+        ring->sq_array[index] = index;
+        tail++;
+    }
+
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    long ret = sys6(SYS_IO_URING_ENTER, ring->fd, (long)count, 0, 0, 0, 0);
+    return ret < 0 ? -1 : 0;
+}
+
+static size_t uring_reap(void* ctx, fsio_request_t** done, size_t max, int wait) {
+    uring_t* ring = (uring_t*)ctx;
+    uint32_t head = *ring->cq_head;
+    uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head == tail && wait) {
+        sys6(SYS_IO_URING_ENTER, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    size_t n = 0;
+    while (head != tail && n < max) {
+        uring_cqe_t* cqe = &ring->cqes[head & *ring->cq_mask];
+        fsio_request_t* req = (fsio_request_t*)(uintptr_t)cqe->user_data;
+        req->result = cqe->res;
+        done[n++] = req;
+        head++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+static const fsio_backend_t uring_backend = {
+    "io_uring",
+    uring_open,
+    uring_close,
+    uring_size,
+    uring_submit,
+    uring_reap
+};
+
+static void unmap_ring(uring_t* ring) {
+    if (ring->sq_ring) {
+        sys6(SYS_MUNMAP, (long)ring->sq_ring, (long)ring->sq_ring_size, 0, 0, 0, 0);
+    }
+    if (ring->cq_ring) {
+        sys6(SYS_MUNMAP, (long)ring->cq_ring, (long)ring->cq_ring_size, 0, 0, 0, 0);
+    }
+    if (ring->sqes) {
+        sys6(SYS_MUNMAP, (long)ring->sqes, (long)ring->sqes_size, 0, 0, 0, 0);
+    }
+    sys6(SYS_CLOSE, ring->fd, 0, 0, 0, 0, 0);
+}
+
+// The ring must hold every request fsio can have in flight
+int fsio_uring_init(fsio_t* io, unsigned entries) {
+    uring_params_t params;
+    uring_t* ring;
+
+    if (entries < FSIO_QUEUE_DEPTH) {
+        entries = FSIO_QUEUE_DEPTH;
+    }
+
+    memset(&params, 0, sizeof(params));
+    long fd = sys6(SYS_IO_URING_SETUP, entries, (long)&params, 0, 0, 0, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    ring = (uring_t*)malloc(sizeof(uring_t));
+    if (!ring) {
+        sys6(SYS_CLOSE, fd, 0, 0, 0, 0, 0);
+        return -1;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)fd;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(uring_cqe_t);
+    ring->sqes_size = params.sq_entries * sizeof(uring_sqe_t);
+
+    ring->sq_ring = (uint8_t*)map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    ring->cq_ring = (uint8_t*)map_ring(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    ring->sqes = (uring_sqe_t*)map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+        unmap_ring(ring);
+        free(ring);
+        return -1;
+    }
+
+    ring->sq_tail = (uint32_t*)(ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (uint32_t*)(ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (uint32_t*)(ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (uint32_t*)(ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (uring_cqe_t*)(ring->cq_ring + params.cq_off.cqes);
+
+    fsio_init(io, &uring_backend, ring);
+    return 0;
+}
+
+void fsio_uring_destroy(fsio_t* io) {
+    uring_t* ring = (uring_t*)io->ctx;
+
+    if (io->backend == &uring_backend && ring) {
+        unmap_ring(ring);
+        free(ring);
+        io->ctx = NULL;
+    }
+}
+
+#endif
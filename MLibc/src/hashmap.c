@@ -0,0 +1,431 @@
+#include "libc.h"
+
+/*
+ * Swiss-table style hash map.
+ *
+ * Every slot has a one-byte control value: EMPTY, DELETED, or the low
+ * 7 bits of the key's hash (h2) when the slot is full. Lookups load a
+ * group of 8 control bytes into one 64-bit word and test all of them
+ * at once with SWAR bit tricks, so the slot array is only touched for
+ * likely matches. The first HASHMAP_GROUP_WIDTH control bytes are
+ * mirrored past the end of the table so a group load never wraps.
+ */
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+
+#define GROUP_LSBS 0x0101010101010101ULL
+#define GROUP_MSBS 0x8080808080808080ULL
+
+#define HASHMAP_MIN_CAPACITY HASHMAP_GROUP_WIDTH
+#define NOT_FOUND ((size_t)-1)
+
+// Slot layout: key offset and length in the key arena, then the value
+typedef struct {
+    uint32_t key_off;
+    uint32_t key_len;
+} hashmap_slot_t;
+
+static const uint64_t wyhash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+// 64x64 -> 128 bit multiply, low half in *a and high half in *b
+static void wymum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wyr8(const uint8_t* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint64_t wyr4(const uint8_t* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24);
+}
+
+static uint64_t wyr3(const uint8_t* p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t wyhash(const void* key, size_t len, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)key;
+    const uint64_t* s = wyhash_secret;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ s[0], s[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = (wyr4(p) << 32) | wyr4(p + mid);
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ s[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ s[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ s[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ s[1], wyr8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+// Group helpers: each returns a mask with the high bit set in every
+// byte that matches. h2 matches may include rare false positives, so
+// find_slot re-checks the control byte before comparing keys.
+static uint64_t group_match(uint64_t group, uint8_t h2) {
+    uint64_t x = group ^ (GROUP_LSBS * h2);
+    return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+}
+
+static uint64_t group_match_empty(uint64_t group) {
+    return group & ~(group << 6) & GROUP_MSBS;
+}
+
+static uint64_t group_match_empty_or_deleted(uint64_t group) {
+    return group & ~(group << 7) & GROUP_MSBS;
+}
+
+static size_t group_lowest(uint64_t mask) {
+#if defined(__GNUC__) && !defined(__TINYC__)
+    // Split in halves so 32-bit builds don't need libgcc's __ctzdi2
+    uint32_t lo = (uint32_t)mask;
+    if (lo) {
+        return (size_t)(__builtin_ctz(lo) >> 3);
+    }
+    return 4 + (size_t)(__builtin_ctz((uint32_t)(mask >> 32)) >> 3);
+#else
+    size_t i = 0;
+    while (!(mask & 0x80)) {
+        mask >>= 8;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static size_t max_load(size_t capacity) {
+    return capacity - capacity / 8;
+}
+
+static hashmap_slot_t* slot_at(const hashmap_t* map, size_t index) {
+    return (hashmap_slot_t*)(map->slots + index * map->slot_size);
+}
+
+static void set_ctrl(hashmap_t* map, size_t index, uint8_t value) {
+    map->ctrl[index] = value;
+    if (index < HASHMAP_GROUP_WIDTH) {
+        map->ctrl[map->capacity + index] = value;
+    }
+}
+
+static int slot_key_equals(const hashmap_t* map, size_t index,
+                           const char* key, size_t len) {
+    const hashmap_slot_t* slot = slot_at(map, index);
+    if (slot->key_len != len) {
+        return 0;
+    }
+
+    const uint8_t* stored = map->keys.data + slot->key_off;
+    for (size_t i = 0; i < len; i++) {
+        if (stored[i] != (uint8_t)key[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static size_t find_slot(const hashmap_t* map, const char* key, size_t len,
+                        uint64_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t pos = (size_t)(hash >> 7) & mask;
+    size_t step = 0;
+    uint8_t h2 = (uint8_t)(hash & 0x7f);
+
+    // Terminates because the load factor always leaves an EMPTY slot
+    while (1) {
+        uint64_t group = wyr8(map->ctrl + pos);
+        uint64_t match = group_match(group, h2);
+
+        while (match) {
+            size_t index = (pos + group_lowest(match)) & mask;
+            if (map->ctrl[index] == h2 && slot_key_equals(map, index, key, len)) {
+                return index;
+            }
+            match &= match - 1;
+        }
+
+        if (group_match_empty(group)) {
+            return NOT_FOUND;
+        }
+
+        step += HASHMAP_GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+static size_t find_insert_slot(const hashmap_t* map, uint64_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t pos = (size_t)(hash >> 7) & mask;
+    size_t step = 0;
+
+    while (1) {
+        uint64_t match = group_match_empty_or_deleted(wyr8(map->ctrl + pos));
+        if (match) {
+            return (pos + group_lowest(match)) & mask;
+        }
+
+        step += HASHMAP_GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+// Copy key bytes into the arena, growing it geometrically
+static int arena_append(vector_t* arena, const char* key, size_t len,
+                        uint32_t* offset) {
+    if (arena->size + len > arena->capacity) {
+        size_t capacity = arena->capacity ? arena->capacity * 2 : 64;
+        while (capacity < arena->size + len) {
+            capacity *= 2;
+        }
+        if (vector_reserve(arena, capacity) != 0) {
+            return -1;
+        }
+    }
+
+    *offset = (uint32_t)arena->size;
+    memcpy(arena->data + arena->size, key, len);
+    arena->size += len;
+    return 0;
+}
+
+static int alloc_table(hashmap_t* map, size_t capacity, size_t key_bytes) {
+    map->ctrl = (uint8_t*)malloc(capacity + HASHMAP_GROUP_WIDTH);
+    map->slots = (uint8_t*)malloc(capacity * map->slot_size);
+    if (!map->ctrl || !map->slots) {
+        free(map->ctrl);
+        free(map->slots);
+        return -1;
+    }
+
+    memset(map->ctrl, CTRL_EMPTY, capacity + HASHMAP_GROUP_WIDTH);
+    map->capacity = capacity;
+    map->size = 0;
+    map->growth_left = max_load(capacity);
+
+    return vector_init(&map->keys, 1, key_bytes);
+}
+
+int hashmap_init(hashmap_t* map, size_t value_size, size_t initial_capacity) {
+    size_t capacity = HASHMAP_MIN_CAPACITY;
+    while (max_load(capacity) < initial_capacity) {
+        capacity *= 2;
+    }
+
+    map->value_size = value_size;
+    map->slot_size = sizeof(hashmap_slot_t) + ((value_size + 7) & ~(size_t)7);
+
+    return alloc_table(map, capacity, 0);
+}
+
+void hashmap_destroy(hashmap_t* map) {
+    free(map->ctrl);
+    free(map->slots);
+    vector_destroy(&map->keys);
+    map->ctrl = NULL;
+    map->slots = NULL;
+    map->capacity = 0;
+    map->size = 0;
+    map->growth_left = 0;
+}
+
+// Move every live entry into a fresh table. This also drops tombstones
+// and compacts the key arena, which only ever grows between rehashes.
+static int rehash(hashmap_t* map, size_t capacity) {
+    hashmap_t fresh;
+    fresh.value_size = map->value_size;
+    fresh.slot_size = map->slot_size;
+
+    size_t key_bytes = 0;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (!(map->ctrl[i] & 0x80)) {
+            key_bytes += slot_at(map, i)->key_len;
+        }
+    }
+
+    if (alloc_table(&fresh, capacity, key_bytes) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] & 0x80) {
+            continue;
+        }
+
+        const hashmap_slot_t* old = slot_at(map, i);
+        const char* key = (const char*)map->keys.data + old->key_off;
+        uint64_t hash = wyhash(key, old->key_len, 0);
+        size_t index = find_insert_slot(&fresh, hash);
+        hashmap_slot_t* slot = slot_at(&fresh, index);
+
+        // The arena was sized up front, so this cannot fail
+        arena_append(&fresh.keys, key, old->key_len, &slot->key_off);
+        slot->key_len = old->key_len;
+        memcpy(slot + 1, old + 1, map->value_size);
+
+        set_ctrl(&fresh, index, (uint8_t)(hash & 0x7f));
+        fresh.size++;
+        fresh.growth_left--;
+    }
+
+    hashmap_destroy(map);
+    *map = fresh;
+    return 0;
+}
+
+// Insert or overwrite `key`. Returns a pointer to the stored value.
+void* hashmap_put(hashmap_t* map, const char* key, const void* value) {
+    size_t len = strlen(key);
+    uint64_t hash = wyhash(key, len, 0);
+
+    size_t index = find_slot(map, key, len, hash);
+    if (index != NOT_FOUND) {
+        void* stored = slot_at(map, index) + 1;
+        if (value) {
+            memcpy(stored, value, map->value_size);
+        }
+        return stored;
+    }
+
+    if (map->growth_left == 0) {
+        // Mostly tombstones: clean up in place instead of doubling
+        size_t capacity = map->capacity;
+        if (map->size * 2 >= max_load(capacity)) {
+            capacity *= 2;
+        }
+        if (rehash(map, capacity) != 0) {
+            return NULL;
+        }
+    }
+
+    index = find_insert_slot(map, hash);
+    hashmap_slot_t* slot = slot_at(map, index);
+
+    if (arena_append(&map->keys, key, len, &slot->key_off) != 0) {
+        return NULL;
+    }
+    slot->key_len = (uint32_t)len;
+
+    // Reusing a tombstone does not consume growth
+    if (map->ctrl[index] == CTRL_EMPTY) {
+        map->growth_left--;
+    }
+    set_ctrl(map, index, (uint8_t)(hash & 0x7f));
+    map->size++;
+
+    if (value) {
+        memcpy(slot + 1, value, map->value_size);
+    }
+    return slot + 1;
+}
+
+void* hashmap_get(const hashmap_t* map, const char* key) {
+    size_t len = strlen(key);
+    size_t index = find_slot(map, key, len, wyhash(key, len, 0));
+
+    if (index == NOT_FOUND) {
+        return NULL;
+    }
+    return slot_at(map, index) + 1;
+}
+
+int hashmap_contains(const hashmap_t* map, const char* key) {
+    return hashmap_get(map, key) != NULL;
+}
+
+int hashmap_remove(hashmap_t* map, const char* key) {
+    size_t len = strlen(key);
+    size_t index = find_slot(map, key, len, wyhash(key, len, 0));
+
+    if (index == NOT_FOUND) {
+        return -1;
+    }
+
+    // The key bytes stay in the arena until the next rehash
+    set_ctrl(map, index, CTRL_DELETED);
+    map->size--;
+    return 0;
+}
+
+void hashmap_clear(hashmap_t* map) {
+    memset(map->ctrl, CTRL_EMPTY, map->capacity + HASHMAP_GROUP_WIDTH);
+    map->size = 0;
+    map->growth_left = max_load(map->capacity);
+    vector_clear(&map->keys);
+}
+
+// Iterate over live entries in table order. Start with *cursor = 0 and
+// call until it returns 0. Keys are not null-terminated.
+int hashmap_next(const hashmap_t* map, size_t* cursor, const char** key,
+                 size_t* key_len, void** value) {
+    while (*cursor < map->capacity) {
+        size_t index = (*cursor)++;
+        if (map->ctrl[index] & 0x80) {
+            continue;
+        }
+
+        hashmap_slot_t* slot = slot_at(map, index);
+        *key = (const char*)map->keys.data + slot->key_off;
+        *key_len = slot->key_len;
+        *value = slot + 1;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "libc.h"
+
+#ifdef MLIBC_HEAPPROF
+
+#define SITE_MASK     (HEAPPROF_SITES - 1)
+#define OVERFLOW_SITE HEAPPROF_SITES
+
+static heapprof_site_t sites[HEAPPROF_SITES + 1];
+static heapprof_bucket_t buckets[HEAPPROF_BUCKETS];
+static uint32_t site_count = 0;
+static uint64_t alloc_clock = 0;
+static uint64_t (*clock_fn)(void) = NULL;
+
+void heapprof_set_clock(uint64_t (*now)(void)) {
+    clock_fn = now;
+}
+
+uint64_t heapprof_now(void) {
+    return clock_fn ? clock_fn() : alloc_clock;
+}
+
+// Bit length, so 0 -> 0, 1 -> 1, 2-3 -> 2, 4-7 -> 3, ...
+static uint32_t size_bucket(size_t size) {
+    uint32_t bucket = 0;
+
+    while (size && bucket < HEAPPROF_BUCKETS - 1) {
+        size >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static uint16_t find_site(uintptr_t caller) {
+    uint32_t i = (((uint32_t)(caller >> 2) * 2654435761u) >> 25) & SITE_MASK;
+
+    for (uint32_t probes = 0; probes < HEAPPROF_SITES; probes++) {
+        if (sites[i].caller == caller) {
+            return (uint16_t)i;
+        }
+        if (sites[i].caller == 0) {
+            // Keep one slot empty so lookups always terminate
+            if (site_count == HEAPPROF_SITES - 1) {
+                break;
+            }
+            sites[i].caller = caller;
+            site_count++;
+            return (uint16_t)i;
+        }
+        i = (i + 1) & SITE_MASK;
+    }
+    return OVERFLOW_SITE;
+}
+
+uint16_t heapprof_alloc(uintptr_t caller, size_t size, uint64_t* born) {
+    uint16_t index = find_site(caller);
+    heapprof_site_t* site = &sites[index];
+    heapprof_bucket_t* bucket = &buckets[size_bucket(size)];
+
+    alloc_clock++;
+    *born = heapprof_now();
+
+    site->allocs++;
+    site->live_blocks++;
+    site->live_bytes += (uint32_t)size;
+    site->total_bytes += size;
+    site->live_born += *born;
+    if (site->live_bytes > site->peak_bytes) {
+        site->peak_bytes = site->live_bytes;
+    }
+    bucket->allocs++;
+    bucket->live++;
+    return index;
+}
+
+void heapprof_free(uint16_t index, size_t size, uint64_t born) {
+    heapprof_site_t* site = &sites[index];
+    uint64_t lifetime = heapprof_now() - born;
+
+    site->frees++;
+    site->live_blocks--;
+    site->live_bytes -= (uint32_t)size;
+    site->live_born -= born;
+    site->lifetime_total += lifetime;
+    if (lifetime > site->lifetime_max) {
+        site->lifetime_max = lifetime;
+    }
+    buckets[size_bucket(size)].live--;
+}
+
+uint32_t heapprof_sites(heapprof_site_t* out, uint32_t max) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i <= HEAPPROF_SITES && count < max; i++) {
+        if (sites[i].allocs) {
+            out[count++] = sites[i];
+        }
+    }
+    return count;
+}
+
+void heapprof_histogram(heapprof_bucket_t out[HEAPPROF_BUCKETS]) {
+    memcpy(out, buckets, sizeof(buckets));
+}
+
+// Forget history but keep what is live, so frees still balance
+void heapprof_reset(void) {
+    for (uint32_t i = 0; i <= HEAPPROF_SITES; i++) {
+        sites[i].allocs = sites[i].live_blocks;
+        sites[i].frees = 0;
+        sites[i].peak_bytes = sites[i].live_bytes;
+        sites[i].total_bytes = sites[i].live_bytes;
+        sites[i].lifetime_total = 0;
+        sites[i].lifetime_max = 0;
+    }
+    for (uint32_t i = 0; i < HEAPPROF_BUCKETS; i++) {
+        buckets[i].allocs = buckets[i].live;
+    }
+}
+
+#endif
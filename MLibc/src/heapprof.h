@@ -0,0 +1,84 @@
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include "stddef.h"
+#include "stdint.h"
+
+/*
+ * Heap statistics and the optional allocation-site profiler.
+ *
+ * malloc() serves power-of-two blocks, from 16 bytes up to the whole
+ * heap, each starting with a small header. Freed blocks go on a free list
+ * per size class and are reused before the heap grows. heap_get_stats()
+ * is always available and costs a few counter updates per call.
+ *
+ * With -DMLIBC_HEAPPROF, every allocation is also charged to its call
+ * site, the return address of malloc(). The counts live in a fixed
+ * open-addressed table of HEAPPROF_SITES entries; once it is full, new
+ * sites share one overflow entry. The header then also records the site
+ * and a birth time, so free() can credit the block's lifetime back to
+ * the site. Request sizes go into a power-of-two histogram. Without the
+ * define none of this is compiled, and the header stays 8 bytes.
+ *
+ * Times come from the clock set with heapprof_set_clock(); without one,
+ * time is counted in allocations. Sums are kept raw, so 32-bit callers
+ * can divide them with their own 64-bit helpers.
+ */
+
+#define HEAP_MIN_CLASS   4      /* 16-byte blocks */
+#ifndef HEAP_CLASSES
+#define HEAP_CLASSES     13     /* 16 bytes .. 64 KiB */
+#endif
+
+#define HEAPPROF_SITES   128    /* Power of two */
+#define HEAPPROF_BUCKETS 18     /* Request sizes 0, 1, 2-3, 4-7, .. 64K-128K */
+
+typedef struct {
+    uint32_t heap_size;
+    uint32_t heap_used;         /* Carved from the heap so far */
+    uint32_t live_blocks;
+    uint32_t live_bytes;        /* As requested */
+    uint32_t block_bytes;       /* Live blocks, with headers and rounding */
+    uint32_t free_bytes;        /* On the free lists */
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;
+    uint32_t class_live[HEAP_CLASSES];
+    uint32_t class_free[HEAP_CLASSES];
+} heap_stats_t;
+
+typedef struct {
+    uintptr_t caller;           /* 0 for the overflow entry */
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t live_blocks;
+    uint32_t live_bytes;
+    uint32_t peak_bytes;        /* Highest live_bytes */
+    uint64_t total_bytes;       /* Every allocation, freed or not */
+    uint64_t live_born;         /* Sum of birth times of live blocks */
+    uint64_t lifetime_total;    /* Sum of lifetimes of freed blocks */
+    uint64_t lifetime_max;
+} heapprof_site_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t live;
+} heapprof_bucket_t;
+
+void heap_get_stats(heap_stats_t* out);
+
+#ifdef MLIBC_HEAPPROF
+void heapprof_set_clock(uint64_t (*now)(void));
+uint64_t heapprof_now(void);
+
+// Copy the sites that have allocated anything; returns how many
+uint32_t heapprof_sites(heapprof_site_t* out, uint32_t max);
+void heapprof_histogram(heapprof_bucket_t out[HEAPPROF_BUCKETS]);
+void heapprof_reset(void);
+
+// Allocator hooks; the site index goes in the block header
+uint16_t heapprof_alloc(uintptr_t caller, size_t size, uint64_t* born);
+void heapprof_free(uint16_t site, size_t size, uint64_t born);
+#endif
+
+#endif /* HEAPPROF_H */
@@ -4,11 +4,18 @@
 /* Include our custom implementations of standard headers */
 #include "stddef.h"
 #include "stdint.h"
+#include "collections.h"
+#include "strops.h"
+#include "mbc.h"
+#include "vmprof.h"
+#include "fsio.h"
+#include "heapprof.h"
 
 /* For variadic functions */
 typedef __builtin_va_list va_list;
 #define va_start(ap, param) __builtin_va_start(ap, param)
 #define va_end(ap) __builtin_va_end(ap)
+#define va_copy(dest, src) __builtin_va_copy(dest, src)
 #define va_arg(ap, type) __builtin_va_arg(ap, type)
 
 // Memory functions
@@ -16,6 +23,9 @@ void* memcpy(void* dest, const void* src, size_t n);
 void* memset(void* s, int c, size_t n);
 void* malloc(size_t size);
 void free(void* ptr);
+#ifdef MLIBC_HOSTED
+void heap_reset(void);
+#endif
 
 // String functions
 size_t strlen(const char* str);
@@ -31,6 +41,9 @@ char* strstr(const char* haystack, const char* needle);
 int putchar(int c);
 int puts(const char* s);
 int printf(const char* format, ...);
+int vsnprintf(char* buf, size_t size, const char* format, va_list ap);
+int snprintf(char* buf, size_t size, const char* format, ...);
+int snprintf_array(char* buf, size_t size, const char* format, const uint64_t* array);
 char getchar(void);
 char* gets(char* str);
 
@@ -38,4 +51,12 @@ char* gets(char* str);
 int atoi(const char* str);
 char* itoa(int value, char* str, int base);
 
+// Konstruct user mode (usys.c, built with -DMLIBC_USER)
+#ifdef MLIBC_USER
+void exit(int code) __attribute__((noreturn));
+intptr_t write(int fd, const void* buf, size_t len);
+int getpid(void);
+uint64_t now_ns(void);
+#endif
+
 #endif /* LIBC_H */
@@ -0,0 +1,512 @@
+#include "libc.h"
+
+static uint32_t align_up(uint32_t value) {
+    return (value + MBC_ALIGN - 1) & ~(uint32_t)(MBC_ALIGN - 1);
+}
+
+// Loader
+
+static int section_ok(const mbc_header_t* header, size_t image_size, int index,
+                      size_t record_size) {
+    const mbc_section_t* s = &header->sections[index];
+
+    if ((uint64_t)s->offset + s->size > image_size) {
+        return 0;
+    }
+    if (record_size > 1 && (s->offset % MBC_ALIGN || s->size % record_size)) {
+        return 0;
+    }
+    return 1;
+}
+
+// The label tables are what lookups index with values from the file:
+// every label must point into the code, hashes must be sorted for
+// mbc_find_label, and label_order must hold valid indices sorted by
+// code offset for mbc_label_index_at
+static int labels_ok(const mbc_image_t* img) {
+    for (uint32_t i = 0; i < img->label_count; i++) {
+        uint32_t index = img->label_order[i];
+
+        if (img->labels[i].code_offset > img->code_size ||
+            (i > 0 && img->labels[i].hash < img->labels[i - 1].hash)) {
+            return 0;
+        }
+        if (index >= img->label_count ||
+            (i > 0 && img->labels[index].code_offset <
+                      img->labels[img->label_order[i - 1]].code_offset)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Validate an image and point `img` into it. Besides the header and the
+// section bounds, only the label tables are checked, so opening costs
+// time in the number of labels but not in the size of the code.
+int mbc_open(mbc_image_t* img, const void* base, size_t size) {
+    const mbc_header_t* header = (const mbc_header_t*)base;
+
+    if (size < sizeof(mbc_header_t) || (uintptr_t)base % MBC_ALIGN) {
+        return -1;
+    }
+    if (header->magic != MBC_MAGIC || header->version != MBC_VERSION ||
+        header->header_size != sizeof(mbc_header_t)) {
+        return -1;
+    }
+
+    if (!section_ok(header, size, MBC_SECTION_CODE, MBC_ALIGN) ||
+        !section_ok(header, size, MBC_SECTION_DATA, 1) ||
+        !section_ok(header, size, MBC_SECTION_DB, sizeof(mbc_data_t)) ||
+        !section_ok(header, size, MBC_SECTION_LABELS, sizeof(mbc_label_t)) ||
+        !section_ok(header, size, MBC_SECTION_LABEL_ORDER, sizeof(uint32_t)) ||
+        !section_ok(header, size, MBC_SECTION_RELOCS, sizeof(mbc_reloc_t)) ||
+        !section_ok(header, size, MBC_SECTION_IMPORTS, sizeof(mbc_import_t)) ||
+        !section_ok(header, size, MBC_SECTION_STRINGS, 1)) {
+        return -1;
+    }
+
+    const uint8_t* p = (const uint8_t*)base;
+    const mbc_section_t* s = header->sections;
+
+    img->base = p;
+    img->size = size;
+    img->header = header;
+    img->code = p + s[MBC_SECTION_CODE].offset;
+    img->code_size = s[MBC_SECTION_CODE].size;
+    img->data = p + s[MBC_SECTION_DATA].offset;
+    img->db = (const mbc_data_t*)(p + s[MBC_SECTION_DB].offset);
+    img->db_count = s[MBC_SECTION_DB].size / sizeof(mbc_data_t);
+    img->labels = (const mbc_label_t*)(p + s[MBC_SECTION_LABELS].offset);
+    img->label_order = (const uint32_t*)(p + s[MBC_SECTION_LABEL_ORDER].offset);
+    img->label_count = s[MBC_SECTION_LABELS].size / sizeof(mbc_label_t);
+    img->relocs = (const mbc_reloc_t*)(p + s[MBC_SECTION_RELOCS].offset);
+    img->reloc_count = s[MBC_SECTION_RELOCS].size / sizeof(mbc_reloc_t);
+    img->imports = (const mbc_import_t*)(p + s[MBC_SECTION_IMPORTS].offset);
+    img->import_count = s[MBC_SECTION_IMPORTS].size / sizeof(mbc_import_t);
+    img->strings = (const char*)(p + s[MBC_SECTION_STRINGS].offset);
+    img->strings_size = s[MBC_SECTION_STRINGS].size;
+
+    if (s[MBC_SECTION_LABEL_ORDER].size != img->label_count * sizeof(uint32_t)) {
+        return -1;
+    }
+    if (img->strings_size && img->strings[img->strings_size - 1] != '\0') {
+        return -1;
+    }
+    if (header->entry > img->code_size || !labels_ok(img)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Instruction at `code_offset`, or NULL if it would run past the code
+const mbc_insn_t* mbc_insn_at(const mbc_image_t* img, uint32_t code_offset) {
+    if ((uint64_t)code_offset + sizeof(mbc_insn_t) > img->code_size) {
+        return NULL;
+    }
+
+    const mbc_insn_t* insn = (const mbc_insn_t*)(img->code + code_offset);
+    uint64_t end = (uint64_t)code_offset + sizeof(mbc_insn_t) + insn->argc * sizeof(int64_t);
+    if (insn->argc > MBC_MAX_ARGS || end > img->code_size) {
+        return NULL;
+    }
+    return insn;
+}
+
+static const char* image_string(const mbc_image_t* img, uint32_t offset) {
+    return offset < img->strings_size ? img->strings + offset : "";
+}
+
+// Code offset of a label, or MBC_NO_OFFSET
+uint32_t mbc_find_label(const mbc_image_t* img, const char* name) {
+    uint64_t hash = wyhash(name, strlen(name), 0);
+    uint32_t lo = 0, hi = img->label_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (img->labels[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < img->label_count && img->labels[lo].hash == hash; lo++) {
+        if (strcmp(image_string(img, img->labels[lo].name), name) == 0) {
+            return img->labels[lo].code_offset;
+        }
+    }
+    return MBC_NO_OFFSET;
+}
+
+// Index into img->labels of the closest label at or before
+// `code_offset`, or MBC_NO_OFFSET
+uint32_t mbc_label_index_at(const mbc_image_t* img, uint32_t code_offset) {
+    uint32_t lo = 0, hi = img->label_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (img->labels[img->label_order[mid]].code_offset <= code_offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return MBC_NO_OFFSET;
+    }
+    return img->label_order[lo - 1];
+}
+
+const char* mbc_label_name(const mbc_image_t* img, uint32_t index) {
+    if (index >= img->label_count) {
+        return NULL;
+    }
+    return image_string(img, img->labels[index].name);
+}
+
+// Name of the closest label at or before `code_offset`, or NULL
+const char* mbc_label_at(const mbc_image_t* img, uint32_t code_offset) {
+    return mbc_label_name(img, mbc_label_index_at(img, code_offset));
+}
+
+const char* mbc_import_name(const mbc_image_t* img, uint32_t index) {
+    if (index >= img->import_count) {
+        return NULL;
+    }
+    return image_string(img, img->imports[index].name);
+}
+
+// Writer
+
+static int append_bytes(vector_t* v, const void* bytes, size_t len) {
+    if (v->size + len > v->capacity) {
+        size_t capacity = v->capacity ? v->capacity * 2 : 256;
+        while (capacity < v->size + len) {
+            capacity *= 2;
+        }
+        if (vector_reserve(v, capacity) != 0) {
+            return -1;
+        }
+    }
+
+    memcpy(v->data + v->size, bytes, len);
+    v->size += len;
+    return 0;
+}
+
+static int append_string(mbc_writer_t* w, const char* s, uint32_t* offset) {
+    *offset = (uint32_t)w->strings.size;
+    return append_bytes(&w->strings, s, strlen(s) + 1);
+}
+
+int mbc_writer_init(mbc_writer_t* w) {
+    w->entry = 0;
+    w->entry_label = MBC_NO_OFFSET;
+    w->error = NULL;
+
+    if (vector_init(&w->code, 1, 0) != 0 ||
+        vector_init(&w->data, 1, 0) != 0 ||
+        vector_init(&w->db, sizeof(mbc_data_t), 0) != 0 ||
+        vector_init(&w->labels, sizeof(mbc_label_t), 0) != 0 ||
+        vector_init(&w->relocs, sizeof(mbc_reloc_t), 0) != 0 ||
+        vector_init(&w->imports, sizeof(mbc_import_t), 0) != 0 ||
+        vector_init(&w->strings, 1, 0) != 0 ||
+        hashmap_init(&w->label_index, sizeof(uint32_t), 0) != 0 ||
+        hashmap_init(&w->import_index, sizeof(uint32_t), 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void mbc_writer_destroy(mbc_writer_t* w) {
+    vector_destroy(&w->code);
+    vector_destroy(&w->data);
+    vector_destroy(&w->db);
+    vector_destroy(&w->labels);
+    vector_destroy(&w->relocs);
+    vector_destroy(&w->imports);
+    vector_destroy(&w->strings);
+    hashmap_destroy(&w->label_index);
+    hashmap_destroy(&w->import_index);
+}
+
+// Labels may be referenced before they are defined
+static int label_index(mbc_writer_t* w, const char* name, uint32_t* index) {
+    uint32_t* found = (uint32_t*)hashmap_get(&w->label_index, name);
+    if (found) {
+        *index = *found;
+        return 0;
+    }
+
+    mbc_label_t label;
+    label.hash = wyhash(name, strlen(name), 0);
+    label.code_offset = MBC_NO_OFFSET;
+    *index = (uint32_t)w->labels.size;
+
+    if (append_string(w, name, &label.name) != 0 ||
+        !vector_push(&w->labels, &label) ||
+        !hashmap_put(&w->label_index, name, index)) {
+        w->error = "out of memory";
+        return -1;
+    }
+    return 0;
+}
+
+static int import_index(mbc_writer_t* w, const char* name, uint32_t* index) {
+    uint32_t* found = (uint32_t*)hashmap_get(&w->import_index, name);
+    if (found) {
+        *index = *found;
+        return 0;
+    }
+
+    mbc_import_t import;
+    import.reserved = 0;
+    *index = (uint32_t)w->imports.size;
+
+    if (append_string(w, name, &import.name) != 0 ||
+        !vector_push(&w->imports, &import) ||
+        !hashmap_put(&w->import_index, name, index)) {
+        w->error = "out of memory";
+        return -1;
+    }
+    return 0;
+}
+
+int mbc_emit(mbc_writer_t* w, int opcode, int argc, const mbc_operand_t* args) {
+    if (opcode < 0 || opcode >= MBC_OP_COUNT || argc < 0 || argc > MBC_MAX_ARGS) {
+        w->error = "bad instruction";
+        return -1;
+    }
+
+    mbc_insn_t insn;
+    insn.opcode = (uint16_t)opcode;
+    insn.argc = (uint8_t)argc;
+    insn.kinds = 0;
+    insn.reserved = 0;
+    for (int i = 0; i < argc; i++) {
+        insn.kinds |= (uint8_t)((args[i].kind & 3) << (i * 2));
+    }
+
+    if (append_bytes(&w->code, &insn, sizeof(insn)) != 0) {
+        w->error = "out of memory";
+        return -1;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        int64_t value = args[i].value;
+
+        if (args[i].kind == MBC_ARG_LABEL || args[i].kind == MBC_ARG_IMPORT) {
+            mbc_reloc_t reloc;
+            reloc.code_offset = (uint32_t)w->code.size;
+            reloc.kind = (uint16_t)args[i].kind;
+            reloc.reserved = 0;
+            reloc.reserved2 = 0;
+
+            int status = args[i].kind == MBC_ARG_LABEL
+                ? label_index(w, args[i].name, &reloc.target)
+                : import_index(w, args[i].name, &reloc.target);
+            if (status != 0) {
+                return -1;
+            }
+
+            // Label operands are patched in mbc_write once all are known
+            value = reloc.target;
+            if (!vector_push(&w->relocs, &reloc)) {
+                w->error = "out of memory";
+                return -1;
+            }
+        }
+
+        if (append_bytes(&w->code, &value, sizeof(value)) != 0) {
+            w->error = "out of memory";
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int mbc_define_label(mbc_writer_t* w, const char* name) {
+    uint32_t index;
+    if (label_index(w, name, &index) != 0) {
+        return -1;
+    }
+
+    mbc_label_t* label = (mbc_label_t*)vector_get(&w->labels, index);
+    if (label->code_offset != MBC_NO_OFFSET) {
+        w->error = "duplicate label";
+        return -1;
+    }
+
+    label->code_offset = (uint32_t)w->code.size;
+    return 0;
+}
+
+// Start execution at `name`, which may be defined later
+int mbc_set_entry(mbc_writer_t* w, const char* name) {
+    return label_index(w, name, &w->entry_label);
+}
+
+int mbc_define_data(mbc_writer_t* w, uint64_t address, const void* bytes, uint32_t length) {
+    mbc_data_t record;
+    record.address = address;
+    record.offset = (uint32_t)w->data.size;
+    record.length = length;
+
+    if (append_bytes(&w->data, bytes, length) != 0 || !vector_push(&w->db, &record)) {
+        w->error = "out of memory";
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t section_sizes(const mbc_writer_t* w, uint32_t sizes[MBC_SECTION_COUNT]) {
+    sizes[MBC_SECTION_CODE] = (uint32_t)w->code.size;
+    sizes[MBC_SECTION_DATA] = (uint32_t)w->data.size;
+    sizes[MBC_SECTION_DB] = (uint32_t)(w->db.size * sizeof(mbc_data_t));
+    sizes[MBC_SECTION_LABELS] = (uint32_t)(w->labels.size * sizeof(mbc_label_t));
+    sizes[MBC_SECTION_LABEL_ORDER] = (uint32_t)(w->labels.size * sizeof(uint32_t));
+    sizes[MBC_SECTION_RELOCS] = (uint32_t)(w->relocs.size * sizeof(mbc_reloc_t));
+    sizes[MBC_SECTION_IMPORTS] = (uint32_t)(w->imports.size * sizeof(mbc_import_t));
+    sizes[MBC_SECTION_STRINGS] = (uint32_t)w->strings.size;
+
+    uint32_t total = align_up(sizeof(mbc_header_t));
+    for (int i = 0; i < MBC_SECTION_COUNT; i++) {
+        total += align_up(sizes[i]);
+    }
+    return total;
+}
+
+size_t mbc_image_size(const mbc_writer_t* w) {
+    uint32_t sizes[MBC_SECTION_COUNT];
+    return section_sizes(w, sizes);
+}
+
+static uint64_t label_key(const mbc_label_t* labels, uint32_t index, int by_offset) {
+    return by_offset ? labels[index].code_offset : labels[index].hash;
+}
+
+// Heapsort label indices by hash or by code offset
+static void sort_labels(uint32_t* order, uint32_t n, const mbc_label_t* labels, int by_offset) {
+    for (uint32_t end = n; end > 1; end--) {
+        // First pass builds the heap; later passes restore it from the root
+        uint32_t start = (end == n) ? n / 2 : 1;
+        while (start-- > 0) {
+            uint32_t root = start;
+            while (2 * root + 1 < end) {
+                uint32_t child = 2 * root + 1;
+                if (child + 1 < end &&
+                    label_key(labels, order[child], by_offset) <
+                    label_key(labels, order[child + 1], by_offset)) {
+                    child++;
+                }
+                if (label_key(labels, order[root], by_offset) >=
+                    label_key(labels, order[child], by_offset)) {
+                    break;
+                }
+                uint32_t tmp = order[root];
+                order[root] = order[child];
+                order[child] = tmp;
+                root = child;
+            }
+        }
+
+        uint32_t tmp = order[0];
+        order[0] = order[end - 1];
+        order[end - 1] = tmp;
+    }
+}
+
+// Serialize the image into `out`, which must hold mbc_image_size() bytes
+int mbc_write(mbc_writer_t* w, void* out, size_t size) {
+    uint32_t sizes[MBC_SECTION_COUNT];
+    uint32_t total = section_sizes(w, sizes);
+    uint32_t count = (uint32_t)w->labels.size;
+    const mbc_label_t* labels = (const mbc_label_t*)w->labels.data;
+
+    if (size < total || (uintptr_t)out % MBC_ALIGN) {
+        w->error = "output buffer too small";
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (labels[i].code_offset == MBC_NO_OFFSET) {
+            w->error = "undefined label";
+            return -1;
+        }
+    }
+
+    uint32_t* order = (uint32_t*)malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t* rank = (uint32_t*)malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!order || !rank) {
+        free(order);
+        free(rank);
+        w->error = "out of memory";
+        return -1;
+    }
+
+    uint8_t* p = (uint8_t*)out;
+    mbc_header_t* header = (mbc_header_t*)p;
+    memset(p, 0, total);
+
+    header->magic = MBC_MAGIC;
+    header->version = MBC_VERSION;
+    header->header_size = sizeof(mbc_header_t);
+    header->flags = 0;
+    header->entry = w->entry_label != MBC_NO_OFFSET ? labels[w->entry_label].code_offset : w->entry;
+
+    uint32_t offset = align_up(sizeof(mbc_header_t));
+    for (int i = 0; i < MBC_SECTION_COUNT; i++) {
+        header->sections[i].offset = offset;
+        header->sections[i].size = sizes[i];
+        offset += align_up(sizes[i]);
+    }
+
+    mbc_section_t* s = header->sections;
+
+    // Label table sorted by hash; rank maps writer index -> image index
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    sort_labels(order, count, labels, 0);
+
+    mbc_label_t* out_labels = (mbc_label_t*)(p + s[MBC_SECTION_LABELS].offset);
+    for (uint32_t i = 0; i < count; i++) {
+        out_labels[i] = labels[order[i]];
+        rank[order[i]] = i;
+    }
+
+    // Reverse index sorted by code offset, for mapping a PC to a label
+    uint32_t* out_order = (uint32_t*)(p + s[MBC_SECTION_LABEL_ORDER].offset);
+    for (uint32_t i = 0; i < count; i++) {
+        out_order[i] = i;
+    }
+    sort_labels(out_order, count, out_labels, 1);
+
+    // Code, with every label operand resolved to its code offset
+    uint8_t* code = p + s[MBC_SECTION_CODE].offset;
+    memcpy(code, w->code.data, w->code.size);
+
+    mbc_reloc_t* out_relocs = (mbc_reloc_t*)(p + s[MBC_SECTION_RELOCS].offset);
+    for (size_t i = 0; i < w->relocs.size; i++) {
+        mbc_reloc_t reloc = *(const mbc_reloc_t*)vector_get(&w->relocs, i);
+
+        if (reloc.kind == MBC_ARG_LABEL) {
+            int64_t target = labels[reloc.target].code_offset;
+            memcpy(code + reloc.code_offset, &target, sizeof(target));
+            reloc.target = rank[reloc.target];
+        }
+        out_relocs[i] = reloc;
+    }
+
+    memcpy(p + s[MBC_SECTION_DATA].offset, w->data.data, w->data.size);
+    memcpy(p + s[MBC_SECTION_DB].offset, w->db.data, sizes[MBC_SECTION_DB]);
+    memcpy(p + s[MBC_SECTION_IMPORTS].offset, w->imports.data, sizes[MBC_SECTION_IMPORTS]);
+    memcpy(p + s[MBC_SECTION_STRINGS].offset, w->strings.data, w->strings.size);
+
+    free(order);
+    free(rank);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#ifndef MBC_H
+#define MBC_H
+
+#include "stddef.h"
+#include "stdint.h"
+#include "collections.h"
+
+/*
+ * MicroASM bytecode image (.mbc).
+ *
+ * An assembled program: code, DB data, the resolved label table,
+ * relocations and MNI imports. Every reference inside the image is an
+ * offset from the image (or section) start, so the VM can mmap the
+ * file read-only and run it in place. The layout is described in
+ * v2instructions.md. Images are little-endian.
+ */
+
+#define MBC_MAGIC   0x4D53414DU   /* "MASM" */
+#define MBC_VERSION 1
+#define MBC_ALIGN   8
+#define MBC_NO_OFFSET 0xFFFFFFFFU
+
+enum {
+    MBC_SECTION_CODE,
+    MBC_SECTION_DATA,        /* Raw DB bytes */
+    MBC_SECTION_DB,          /* mbc_data_t records */
+    MBC_SECTION_LABELS,      /* mbc_label_t, sorted by hash */
+    MBC_SECTION_LABEL_ORDER, /* uint32_t label indices, sorted by code offset */
+    MBC_SECTION_RELOCS,      /* mbc_reloc_t */
+    MBC_SECTION_IMPORTS,     /* mbc_import_t */
+    MBC_SECTION_STRINGS,     /* Null-terminated names */
+    MBC_SECTION_COUNT
+};
+
+enum {
+    MBC_OP_MOV, MBC_OP_ADD, MBC_OP_SUB, MBC_OP_MUL, MBC_OP_DIV, MBC_OP_INC,
+    MBC_OP_JMP, MBC_OP_CMP, MBC_OP_JE, MBC_OP_JL, MBC_OP_CALL, MBC_OP_RET,
+    MBC_OP_PUSH, MBC_OP_POP, MBC_OP_OUT, MBC_OP_COUT, MBC_OP_HLT, MBC_OP_EXIT,
+    MBC_OP_ARGC, MBC_OP_GETARG,
+    MBC_OP_AND, MBC_OP_OR, MBC_OP_XOR, MBC_OP_NOT, MBC_OP_SHL, MBC_OP_SHR,
+    MBC_OP_MOVADDR, MBC_OP_MOVTO,
+    MBC_OP_JNE, MBC_OP_JG, MBC_OP_JLE, MBC_OP_JGE,
+    MBC_OP_ENTER, MBC_OP_LEAVE,
+    MBC_OP_COPY, MBC_OP_FILL, MBC_OP_CMP_MEM,
+    MBC_OP_MNI,
+    MBC_OP_COUNT
+};
+
+// Operand kinds, two bits each in mbc_insn_t.kinds
+enum {
+    MBC_ARG_REG,    /* Register number */
+    MBC_ARG_IMM,    /* 64-bit immediate or $address */
+    MBC_ARG_LABEL,  /* Code offset of a #label, resolved at assembly */
+    MBC_ARG_IMPORT  /* Index into the MNI import table */
+};
+
+#define MBC_MAX_ARGS 4
+#define MBC_ARG_KIND(insn, i) (((insn)->kinds >> ((i) * 2)) & 3)
+
+typedef struct {
+    uint32_t offset;    /* From the start of the image */
+    uint32_t size;
+} mbc_section_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t flags;
+    uint32_t entry;     /* Code offset of the first instruction */
+    mbc_section_t sections[MBC_SECTION_COUNT];
+} mbc_header_t;
+
+// Each instruction is this header followed by argc 64-bit operands
+typedef struct {
+    uint16_t opcode;
+    uint8_t argc;
+    uint8_t kinds;
+    uint32_t reserved;
+} mbc_insn_t;
+
+// DB $address "bytes"
+typedef struct {
+    uint64_t address;
+    uint32_t offset;    /* Into the data section */
+    uint32_t length;
+} mbc_data_t;
+
+typedef struct {
+    uint64_t hash;      /* wyhash of the name */
+    uint32_t name;      /* Offset into the string table */
+    uint32_t code_offset;
+} mbc_label_t;
+
+// Location of an operand that refers to a label or an import
+typedef struct {
+    uint32_t code_offset;  /* Offset of the 64-bit operand */
+    uint16_t kind;         /* MBC_ARG_LABEL or MBC_ARG_IMPORT */
+    uint16_t reserved;
+    uint32_t target;       /* Label or import index */
+    uint32_t reserved2;
+} mbc_reloc_t;
+
+typedef struct {
+    uint32_t name;      /* Offset into the string table, e.g. "Math.sin" */
+    uint32_t reserved;
+} mbc_import_t;
+
+// A validated image. Pointers refer directly into the mapped file.
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    const mbc_header_t* header;
+    const uint8_t* code;
+    uint32_t code_size;
+    const uint8_t* data;
+    const mbc_data_t* db;
+    uint32_t db_count;
+    const mbc_label_t* labels;
+    const uint32_t* label_order;
+    uint32_t label_count;
+    const mbc_reloc_t* relocs;
+    uint32_t reloc_count;
+    const mbc_import_t* imports;
+    uint32_t import_count;
+    const char* strings;
+    uint32_t strings_size;
+} mbc_image_t;
+
+int mbc_open(mbc_image_t* img, const void* base, size_t size);
+const mbc_insn_t* mbc_insn_at(const mbc_image_t* img, uint32_t code_offset);
+uint32_t mbc_find_label(const mbc_image_t* img, const char* name);
+uint32_t mbc_label_index_at(const mbc_image_t* img, uint32_t code_offset);
+const char* mbc_label_name(const mbc_image_t* img, uint32_t index);
+const char* mbc_label_at(const mbc_image_t* img, uint32_t code_offset);
+const char* mbc_import_name(const mbc_image_t* img, uint32_t index);
+
+// Operand as handed to the writer by the assembler
+typedef struct {
+    int kind;           /* MBC_ARG_* */
+    int64_t value;      /* Register number or immediate */
+    const char* name;   /* Label or import name */
+} mbc_operand_t;
+
+// Builds an image while the assembler walks the source once
+typedef struct {
+    vector_t code;
+    vector_t data;
+    vector_t db;
+    vector_t labels;
+    vector_t relocs;
+    vector_t imports;
+    vector_t strings;
+    hashmap_t label_index;   /* name -> uint32_t label index */
+    hashmap_t import_index;  /* name -> uint32_t import index */
+    uint32_t entry;          /* Code offset, unless entry_label is set */
+    uint32_t entry_label;    /* Label index, or MBC_NO_OFFSET */
+    const char* error;
+} mbc_writer_t;
+
+int mbc_writer_init(mbc_writer_t* w);
+void mbc_writer_destroy(mbc_writer_t* w);
+int mbc_emit(mbc_writer_t* w, int opcode, int argc, const mbc_operand_t* args);
+int mbc_define_label(mbc_writer_t* w, const char* name);
+int mbc_set_entry(mbc_writer_t* w, const char* name);
+int mbc_define_data(mbc_writer_t* w, uint64_t address, const void* bytes, uint32_t length);
+size_t mbc_image_size(const mbc_writer_t* w);
+int mbc_write(mbc_writer_t* w, void* out, size_t size);
+
+#endif /* MBC_H */
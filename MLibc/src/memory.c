@@ -1,10 +1,35 @@
 #include "libc.h"
 
-// A very simple memory allocator
+// Power-of-two block allocator over a static heap; see heapprof.h. A
+// hosted build may set a bigger heap, with HEAP_CLASSES to match.
+#ifndef HEAP_SIZE
 #define HEAP_SIZE 65536  // 64 KB heap
-static uint8_t heap[HEAP_SIZE];
+#endif
+static uint8_t heap[HEAP_SIZE] __attribute__((aligned(16)));
 static size_t heap_end = 0;
 
+typedef struct {
+    uint32_t size;          // As requested
+    uint16_t size_class;    // Block is 1 << size_class bytes
+    uint16_t site;          // heapprof site, when profiling
+#ifdef MLIBC_HEAPPROF
+    uint64_t born;
+#endif
+} block_header_t;
+
+// A free block's payload holds the next block in its class
+typedef struct free_block {
+    struct free_block* next;
+} free_block_t;
+
+static free_block_t* free_lists[HEAP_CLASSES];
+static heap_stats_t stats = { .heap_size = HEAP_SIZE };
+
+// Provided by the environment, like print_char: the kernel takes a
+// spinlock, a single-threaded program does nothing
+extern void heap_lock(void);
+extern void heap_unlock(void);
+
 void* memcpy(void* dest, const void* src, size_t n) {
     uint8_t* d = (uint8_t*)dest;
     const uint8_t* s = (const uint8_t*)src;
@@ -26,26 +51,106 @@ void* memset(void* s, int c, size_t n) {
     return s;
 }
 
-// Very simple malloc - just moves a pointer forward
-// (no free list, no coalescing, etc.)
+static int size_class(size_t size) {
+    if (size > HEAP_SIZE) {
+        return -1;
+    }
+
+    // Room for the free-list link once the block is freed
+    size_t need = (size < sizeof(free_block_t) ? sizeof(free_block_t) : size) +
+                  sizeof(block_header_t);
+    int c = HEAP_MIN_CLASS;
+
+    while (((size_t)1 << c) < need) {
+        if (++c >= HEAP_MIN_CLASS + HEAP_CLASSES) {
+            return -1;
+        }
+    }
+    return c;
+}
+
 void* malloc(size_t size) {
-    if (heap_end + size > HEAP_SIZE) {
+    int c = size_class(size);
+    if (c < 0) {
+        stats.failed++;
+        return NULL;
+    }
+
+    block_header_t* block;
+    uint32_t block_size = (uint32_t)1 << c;
+    free_block_t** list = &free_lists[c - HEAP_MIN_CLASS];
+    heap_lock();
+    if (*list) {
+        block = (block_header_t*)((uint8_t*)*list - sizeof(block_header_t));
+        *list = (*list)->next;
+        stats.free_bytes -= block_size;
+        stats.class_free[c - HEAP_MIN_CLASS]--;
+    } else if (heap_end + block_size <= HEAP_SIZE) {
+        block = (block_header_t*)&heap[heap_end];
+        heap_end += block_size;
+        stats.heap_used = (uint32_t)heap_end;
+    } else {
         // Out of memory
+        stats.failed++;
+        heap_unlock();
         return NULL;
     }
-    
-    void* ptr = &heap[heap_end];
-    heap_end += size;
-    
-    // Align to 4 bytes
-    heap_end = (heap_end + 3) & ~3;
-    
-    return ptr;
+
+    block->size = (uint32_t)size;
+    block->size_class = (uint16_t)c;
+    block->site = 0;
+#ifdef MLIBC_HEAPPROF
+    block->site = heapprof_alloc((uintptr_t)__builtin_return_address(0), size, &block->born);
+#endif
+
+    stats.allocs++;
+    stats.live_blocks++;
+    stats.live_bytes += (uint32_t)size;
+    stats.block_bytes += block_size;
+    stats.class_live[c - HEAP_MIN_CLASS]++;
+    heap_unlock();
+    return block + 1;
 }
 
-// Our free doesn't actually do anything :)
-// In a real implementation, we'd manage a free list
 void free(void* ptr) {
-    // Not implemented
-    (void)ptr;
+    if (!ptr) {
+        return;
+    }
+
+    block_header_t* block = (block_header_t*)ptr - 1;
+    int c = block->size_class;
+    uint32_t block_size = (uint32_t)1 << c;
+    heap_lock();
+#ifdef MLIBC_HEAPPROF
+    heapprof_free(block->site, block->size, block->born);
+#endif
+
+    stats.frees++;
+    stats.live_blocks--;
+    stats.live_bytes -= block->size;
+    stats.block_bytes -= block_size;
+    stats.class_live[c - HEAP_MIN_CLASS]--;
+    stats.free_bytes += block_size;
+    stats.class_free[c - HEAP_MIN_CLASS]++;
+
+    free_block_t* node = (free_block_t*)ptr;
+    node->next = free_lists[c - HEAP_MIN_CLASS];
+    free_lists[c - HEAP_MIN_CLASS] = node;
+    heap_unlock();
+}
+
+void heap_get_stats(heap_stats_t* out) {
+    heap_lock();
+    *out = stats;
+    heap_unlock();
+}
+
+#ifdef MLIBC_HOSTED
+// Drop every allocation at once, so benchmarks can reuse the heap
+void heap_reset(void) {
+    heap_end = 0;
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(&stats, 0, sizeof(stats));
+    stats.heap_size = HEAP_SIZE;
 }
+#endif
@@ -0,0 +1,47 @@
+#ifndef ML_PREFIX_H
+#define ML_PREFIX_H
+
+/*
+ * Hosted build: force-included (-include src/ml_prefix.h) into every
+ * MLibc file so the C library names become ml_memcpy, ml_printf and so
+ * on. The result links into an ordinary Linux program next to glibc,
+ * which is how the test and benchmark programs in test/ compare the two.
+ *
+ * Only names that clash with the host C library, or that the kernel
+ * normally provides (print_char, the keyboard and heap lock hooks), are
+ * renamed.
+ */
+
+#define memcpy            ml_memcpy
+#define memset            ml_memset
+#define malloc            ml_malloc
+#define free              ml_free
+#define heap_reset        ml_heap_reset
+
+#define strlen            ml_strlen
+#define strcpy            ml_strcpy
+#define strncpy           ml_strncpy
+#define strcmp            ml_strcmp
+#define strncmp           ml_strncmp
+#define strcat            ml_strcat
+#define strchr            ml_strchr
+#define strstr            ml_strstr
+
+#define putchar           ml_putchar
+#define puts              ml_puts
+#define printf            ml_printf
+#define vsnprintf         ml_vsnprintf
+#define snprintf          ml_snprintf
+#define snprintf_array    ml_snprintf_array
+#define getchar           ml_getchar
+#define gets              ml_gets
+#define atoi              ml_atoi
+#define itoa              ml_itoa
+
+#define print_char        ml_print_char
+#define read_scan_code    ml_read_scan_code
+#define scancode_to_ascii ml_scancode_to_ascii
+#define heap_lock         ml_heap_lock
+#define heap_unlock       ml_heap_unlock
+
+#endif /* ML_PREFIX_H */
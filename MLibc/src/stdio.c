@@ -18,75 +18,185 @@ int puts(const char* s) {
     return 0;
 }
 
-// Very basic printf implementation
-int printf(const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    
-    int printed = 0;
-    
+// Output sink for the formatting core: the console or a bounded buffer
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+} format_out_t;
+
+// Argument source: either a va_list or an array of 64-bit values
+typedef struct {
+    va_list* ap;
+    const uint64_t* array;
+} format_args_t;
+
+static void format_putc(format_out_t* out, char c) {
+    if (!out->buf) {
+        putchar(c);
+    } else if (out->len + 1 < out->size) {
+        out->buf[out->len] = c;
+    }
+    out->len++;
+}
+
+static void format_puts(format_out_t* out, const char* s) {
+    while (*s) {
+        format_putc(out, *s++);
+    }
+}
+
+static int64_t next_int(format_args_t* args) {
+    if (args->array) {
+        return (int64_t)*args->array++;
+    }
+    return va_arg(*args->ap, int);
+}
+
+static uint64_t next_uint(format_args_t* args) {
+    if (args->array) {
+        return *args->array++;
+    }
+    return va_arg(*args->ap, unsigned int);
+}
+
+static const char* next_str(format_args_t* args) {
+    if (args->array) {
+        return (const char*)(uintptr_t)*args->array++;
+    }
+    return va_arg(*args->ap, const char*);
+}
+
+// Divide in 16-bit steps so 32-bit builds don't need libgcc's __udivdi3
+static uint32_t divmod_small(uint64_t* value, uint32_t base) {
+    uint64_t quotient = 0;
+    uint32_t rem = 0;
+
+    for (int shift = 48; shift >= 0; shift -= 16) {
+        uint32_t cur = (rem << 16) | (uint32_t)((*value >> shift) & 0xFFFF);
+        quotient |= (uint64_t)(cur / base) << shift;
+        rem = cur % base;
+    }
+
+    *value = quotient;
+    return rem;
+}
+
+static void format_number(format_out_t* out, uint64_t value, uint32_t base, int negative) {
+    char buf[24];
+    int i = 0;
+
+    do {
+        uint32_t digit = divmod_small(&value, base);
+        buf[i++] = (digit < 10) ? '0' + digit : 'a' + digit - 10;
+    } while (value);
+
+    if (negative) {
+        format_putc(out, '-');
+    }
+    while (i > 0) {
+        format_putc(out, buf[--i]);
+    }
+}
+
+// Shared by printf, vsnprintf and StringOperations.format
+static int format_core(format_out_t* out, const char* format, format_args_t* args) {
     while (*format) {
         if (*format == '%') {
             format++;
             switch (*format) {
                 case 'd': {
-                    int val = va_arg(args, int);
-                    char buf[32];
-                    itoa(val, buf, 10);
-                    char* s = buf;
-                    while (*s) {
-                        putchar(*s++);
-                        printed++;
+                    int64_t val = next_int(args);
+                    if (val < 0) {
+                        // Negate unsigned: -val overflows for INT64_MIN
+                        format_number(out, 0 - (uint64_t)val, 10, 1);
+                    } else {
+                        format_number(out, (uint64_t)val, 10, 0);
                     }
                     break;
                 }
-                case 'x': {
-                    int val = va_arg(args, int);
-                    char buf[32];
-                    itoa(val, buf, 16);
-                    char* s = buf;
-                    while (*s) {
-                        putchar(*s++);
-                        printed++;
-                    }
+                case 'u':
+                    format_number(out, next_uint(args), 10, 0);
                     break;
-                }
-                case 's': {
-                    char* s = va_arg(args, char*);
-                    while (*s) {
-                        putchar(*s++);
-                        printed++;
-                    }
+                case 'x':
+                    format_number(out, next_uint(args), 16, 0);
                     break;
-                }
-                case 'c': {
-                    char c = (char)va_arg(args, int);
-                    putchar(c);
-                    printed++;
+                case 's':
+                    format_puts(out, next_str(args));
                     break;
-                }
-                case '%': {
-                    putchar('%');
-                    printed++;
+                case 'c':
+                    format_putc(out, (char)next_int(args));
                     break;
-                }
+                case '%':
+                    format_putc(out, '%');
+                    break;
+                case '\0':
+                    // Lone '%' at the end of the format string
+                    format_putc(out, '%');
+                    return (int)out->len;
                 default:
-                    putchar('%');
-                    putchar(*format);
-                    printed += 2;
+                    format_putc(out, '%');
+                    format_putc(out, *format);
                     break;
             }
         } else {
-            putchar(*format);
-            printed++;
+            format_putc(out, *format);
         }
         format++;
     }
-    
-    va_end(args);
+
+    // Always null-terminate buffer output, truncating if needed
+    if (out->buf && out->size) {
+        out->buf[out->len < out->size ? out->len : out->size - 1] = '\0';
+    }
+
+    return (int)out->len;
+}
+
+// Very basic printf implementation
+int printf(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+
+    format_out_t out = { NULL, 0, 0 };
+    format_args_t args = { &ap, NULL };
+    int printed = format_core(&out, format, &args);
+
+    va_end(ap);
     return printed;
 }
 
+// Returns the length the full output would have had, like C99 vsnprintf
+int vsnprintf(char* buf, size_t size, const char* format, va_list ap) {
+    va_list copy;
+    va_copy(copy, ap);
+
+    // A NULL buffer means "measure only"; format_out_t reads it as the console
+    char none;
+    format_out_t out = { buf ? buf : &none, buf ? size : 0, 0 };
+    format_args_t args = { &copy, NULL };
+    int len = format_core(&out, format, &args);
+
+    va_end(copy);
+    return len;
+}
+
+int snprintf(char* buf, size_t size, const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(buf, size, format, ap);
+    va_end(ap);
+    return len;
+}
+
+// Format with arguments taken from an array of 64-bit values, as the
+// MicroASM VM passes them (integers by value, strings by address)
+int snprintf_array(char* buf, size_t size, const char* format, const uint64_t* array) {
+    format_out_t out = { buf, size, 0 };
+    format_args_t args = { NULL, array };
+    return format_core(&out, format, &args);
+}
+
 char getchar(void) {
     char scancode;
     char c = 0;
@@ -34,11 +34,14 @@ int strcmp(const char* s1, const char* s2) {
 }
 
 int strncmp(const char* s1, const char* s2, size_t n) {
-    while (n-- && *s1 && (*s1 == *s2)) {
+    if (n == 0) {
+        return 0;
+    }
+    while (--n && *s1 && (*s1 == *s2)) {
         s1++;
         s2++;
     }
-    return n < 0 ? 0 : (unsigned char)*s1 - (unsigned char)*s2;
+    return (unsigned char)*s1 - (unsigned char)*s2;
 }
 
 char* strcat(char* dest, const char* src) {
@@ -51,10 +54,12 @@ char* strcat(char* dest, const char* src) {
 }
 
 char* strchr(const char* s, int c) {
-    while (*s && *s != c) {
+    char ch = (char)c;
+
+    while (*s && *s != ch) {
         s++;
     }
-    return (*s == c) ? (char*)s : NULL;
+    return (*s == ch) ? (char*)s : NULL;
 }
 
 char* strstr(const char* haystack, const char* needle) {
@@ -0,0 +1,579 @@
+#include "libc.h"
+
+/*
+ * The scalar routines work a machine word at a time using SWAR tricks.
+ * With MLIBC_SIMD the same operations get SSE2 and AVX2 versions built
+ * from GCC vector extensions, so no intrinsic headers are needed.
+ */
+
+#define WORD_SIZE sizeof(size_t)
+#define ONES  ((size_t)-1 / 0xFF)
+#define HIGHS (ONES * 0x80)
+
+#define PARSE_INT_DIGITS   19
+#define PARSE_FLOAT_DIGITS 18
+
+typedef size_t __attribute__((may_alias, aligned(1))) uword_t;
+typedef uint64_t __attribute__((may_alias, aligned(1))) u64_unaligned_t;
+
+typedef struct {
+    const char* name;
+    size_t (*length)(const char* s);
+    void (*convert_case)(char* dest, const char* src, size_t len, uint8_t first);
+    void (*copy)(char* dest, const char* src, size_t len);
+    const char* (*find)(const char* haystack, size_t hlen,
+                        const char* needle, size_t nlen);
+} strops_impl_t;
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int bytes_equal(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Scalar implementation
+
+static size_t length_scalar(const char* s) {
+    const char* p = s;
+
+    // Aligned word reads never cross into the next page
+    while ((uintptr_t)p % WORD_SIZE) {
+        if (!*p) {
+            return p - s;
+        }
+        p++;
+    }
+
+    const uword_t* w = (const uword_t*)p;
+    while (!((*w - ONES) & ~*w & HIGHS)) {
+        w++;
+    }
+
+    p = (const char*)w;
+    while (*p) {
+        p++;
+    }
+    return p - s;
+}
+
+// Flip the case of every byte in [first, first + 26). A byte is in range
+// when adding (0x80 - first) sets its top bit but adding
+// (0x80 - first - 26) does not; ~w keeps non-ASCII bytes out.
+static void convert_case_scalar(char* dest, const char* src, size_t len, uint8_t first) {
+    size_t add_lo = ONES * (0x80 - first);
+    size_t add_hi = ONES * (0x80 - first - 26);
+    size_t i = 0;
+
+    for (; i + WORD_SIZE <= len; i += WORD_SIZE) {
+        size_t w = *(const uword_t*)(src + i);
+        size_t h = w & ~HIGHS;
+        size_t in_range = ((h + add_lo) ^ (h + add_hi)) & ~w & HIGHS;
+        *(uword_t*)(dest + i) = w ^ (in_range >> 2);
+    }
+
+    for (; i < len; i++) {
+        uint8_t c = (uint8_t)src[i];
+        dest[i] = (uint8_t)(c - first) < 26 ? (char)(c ^ 0x20) : (char)c;
+    }
+}
+
+// Forward copy; safe for overlapping buffers when dest <= src
+static void copy_scalar(char* dest, const char* src, size_t len) {
+    size_t i = 0;
+
+    for (; i + WORD_SIZE <= len; i += WORD_SIZE) {
+        *(uword_t*)(dest + i) = *(const uword_t*)(src + i);
+    }
+    for (; i < len; i++) {
+        dest[i] = src[i];
+    }
+}
+
+static const char* find_scalar(const char* haystack, size_t hlen,
+                               const char* needle, size_t nlen) {
+    if (nlen == 0) {
+        return haystack;
+    }
+    if (nlen > hlen) {
+        return NULL;
+    }
+
+    char first = needle[0];
+    char last = needle[nlen - 1];
+    for (size_t i = 0; i + nlen <= hlen; i++) {
+        if (haystack[i] == first && haystack[i + nlen - 1] == last &&
+            bytes_equal(haystack + i + 1, needle + 1, nlen > 2 ? nlen - 2 : 0)) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+static const strops_impl_t impl_scalar = {
+    "scalar", length_scalar, convert_case_scalar, copy_scalar, find_scalar
+};
+
+#if defined(MLIBC_SIMD) && defined(__GNUC__) && !defined(__TINYC__) && \
+    (defined(__i386__) || defined(__x86_64__))
+#define STROPS_X86_SIMD 1
+
+typedef uint8_t v16u8 __attribute__((vector_size(16), may_alias, aligned(1)));
+typedef uint8_t v16u8_aligned __attribute__((vector_size(16)));
+typedef char v16qi __attribute__((vector_size(16)));
+typedef uint8_t v32u8 __attribute__((vector_size(32), may_alias, aligned(1)));
+typedef uint8_t v32u8_aligned __attribute__((vector_size(32)));
+typedef char v32qi __attribute__((vector_size(32)));
+
+// SSE2 implementation
+
+__attribute__((target("sse2")))
+static size_t length_sse2(const char* s) {
+    uintptr_t off = (uintptr_t)s & 15;
+    const v16u8_aligned* p = (const v16u8_aligned*)(s - off);
+    uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb128((v16qi)(*p == 0)) >> off;
+
+    if (mask) {
+        return __builtin_ctz(mask);
+    }
+
+    while (1) {
+        p++;
+        mask = (uint32_t)__builtin_ia32_pmovmskb128((v16qi)(*p == 0));
+        if (mask) {
+            return (const char*)p - s + __builtin_ctz(mask);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void convert_case_sse2(char* dest, const char* src, size_t len, uint8_t first) {
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        v16u8 v = *(const v16u8*)(src + i);
+        v16u8 in_range = (v16u8)((v16u8)(v - first) < 26);
+        *(v16u8*)(dest + i) = v ^ (in_range & 0x20);
+    }
+    convert_case_scalar(dest + i, src + i, len - i, first);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(char* dest, const char* src, size_t len) {
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        *(v16u8*)(dest + i) = *(const v16u8*)(src + i);
+    }
+    copy_scalar(dest + i, src + i, len - i);
+}
+
+// Compare the needle's first and last bytes against a whole block of
+// candidate positions at once, then verify only the survivors
+__attribute__((target("sse2")))
+static const char* find_sse2(const char* haystack, size_t hlen,
+                             const char* needle, size_t nlen) {
+    if (nlen == 0) {
+        return haystack;
+    }
+    if (nlen > hlen) {
+        return NULL;
+    }
+
+    v16u8 first = (v16u8){0} + (uint8_t)needle[0];
+    v16u8 last = (v16u8){0} + (uint8_t)needle[nlen - 1];
+    size_t inner = nlen > 2 ? nlen - 2 : 0;
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 16 <= hlen; i += 16) {
+        v16u8 block_first = *(const v16u8*)(haystack + i);
+        v16u8 block_last = *(const v16u8*)(haystack + i + nlen - 1);
+        uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb128(
+            (v16qi)((block_first == first) & (block_last == last)));
+
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (bytes_equal(haystack + pos + 1, needle + 1, inner)) {
+                return haystack + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_scalar(haystack + i, hlen - i, needle, nlen);
+}
+
+static const strops_impl_t impl_sse2 = {
+    "sse2", length_sse2, convert_case_sse2, copy_sse2, find_sse2
+};
+
+// AVX2 implementation
+
+__attribute__((target("avx2")))
+static size_t length_avx2(const char* s) {
+    uintptr_t off = (uintptr_t)s & 31;
+    const v32u8_aligned* p = (const v32u8_aligned*)(s - off);
+    uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb256((v32qi)(*p == 0)) >> off;
+
+    if (mask) {
+        return __builtin_ctz(mask);
+    }
+
+    while (1) {
+        p++;
+        mask = (uint32_t)__builtin_ia32_pmovmskb256((v32qi)(*p == 0));
+        if (mask) {
+            return (const char*)p - s + __builtin_ctz(mask);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void convert_case_avx2(char* dest, const char* src, size_t len, uint8_t first) {
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        v32u8 v = *(const v32u8*)(src + i);
+        v32u8 in_range = (v32u8)((v32u8)(v - first) < 26);
+        *(v32u8*)(dest + i) = v ^ (in_range & 0x20);
+    }
+    convert_case_sse2(dest + i, src + i, len - i, first);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(char* dest, const char* src, size_t len) {
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        *(v32u8*)(dest + i) = *(const v32u8*)(src + i);
+    }
+    copy_sse2(dest + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char* find_avx2(const char* haystack, size_t hlen,
+                             const char* needle, size_t nlen) {
+    if (nlen == 0) {
+        return haystack;
+    }
+    if (nlen > hlen) {
+        return NULL;
+    }
+
+    v32u8 first = (v32u8){0} + (uint8_t)needle[0];
+    v32u8 last = (v32u8){0} + (uint8_t)needle[nlen - 1];
+    size_t inner = nlen > 2 ? nlen - 2 : 0;
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 32 <= hlen; i += 32) {
+        v32u8 block_first = *(const v32u8*)(haystack + i);
+        v32u8 block_last = *(const v32u8*)(haystack + i + nlen - 1);
+        uint32_t mask = (uint32_t)__builtin_ia32_pmovmskb256(
+            (v32qi)((block_first == first) & (block_last == last)));
+
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (bytes_equal(haystack + pos + 1, needle + 1, inner)) {
+                return haystack + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_sse2(haystack + i, hlen - i, needle, nlen);
+}
+
+static const strops_impl_t impl_avx2 = {
+    "avx2", length_avx2, convert_case_avx2, copy_avx2, find_avx2
+};
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+    __asm__ volatile("cpuid"
+                     : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static const strops_impl_t* select_impl(void) {
+    uint32_t regs[4];
+
+    cpuid(0, 0, regs);
+    uint32_t max_leaf = regs[0];
+
+    cpuid(1, 0, regs);
+    int has_sse2 = (regs[3] >> 26) & 1;
+    int has_osxsave = (regs[2] >> 27) & 1;
+    int has_avx = (regs[2] >> 28) & 1;
+
+    // AVX2 also needs the OS to save YMM state (XCR0 bits 1 and 2)
+    if (has_osxsave && has_avx && max_leaf >= 7) {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+
+        cpuid(7, 0, regs);
+        if ((xcr0_lo & 6) == 6 && ((regs[1] >> 5) & 1)) {
+            return &impl_avx2;
+        }
+    }
+
+    if (has_sse2) {
+        return &impl_sse2;
+    }
+    return &impl_scalar;
+}
+#endif
+
+static const strops_impl_t* active_impl = NULL;
+
+static const strops_impl_t* strops_impl(void) {
+    if (!active_impl) {
+#ifdef STROPS_X86_SIMD
+        active_impl = select_impl();
+#else
+        active_impl = &impl_scalar;
+#endif
+    }
+    return active_impl;
+}
+
+const char* strops_impl_name(void) {
+    return strops_impl()->name;
+}
+
+#ifdef MLIBC_HOSTED
+// Implementations from slowest to fastest; the CPU runs every one up to
+// the one select_impl picks
+static const strops_impl_t* const all_impls[] = {
+    &impl_scalar,
+#ifdef STROPS_X86_SIMD
+    &impl_sse2,
+    &impl_avx2,
+#endif
+};
+
+int strops_use(const char* name) {
+#ifdef STROPS_X86_SIMD
+    const strops_impl_t* best = select_impl();
+#else
+    const strops_impl_t* best = &impl_scalar;
+#endif
+
+    for (size_t i = 0; i < sizeof(all_impls) / sizeof(all_impls[0]); i++) {
+        if (strcmp(all_impls[i]->name, name) == 0) {
+            active_impl = all_impls[i];
+            return 0;
+        }
+        if (all_impls[i] == best) {
+            break;
+        }
+    }
+    return -1;
+}
+#endif
+
+// StringOperations.toUpper / toLower / trim. dest may equal src.
+
+size_t str_to_upper(char* dest, const char* src) {
+    const strops_impl_t* ops = strops_impl();
+    size_t len = ops->length(src);
+
+    ops->convert_case(dest, src, len, 'a');
+    dest[len] = '\0';
+    return len;
+}
+
+size_t str_to_lower(char* dest, const char* src) {
+    const strops_impl_t* ops = strops_impl();
+    size_t len = ops->length(src);
+
+    ops->convert_case(dest, src, len, 'A');
+    dest[len] = '\0';
+    return len;
+}
+
+size_t str_trim(char* dest, const char* src) {
+    const strops_impl_t* ops = strops_impl();
+    size_t end = ops->length(src);
+    size_t start = 0;
+
+    while (start < end && is_space(src[start])) {
+        start++;
+    }
+    while (end > start && is_space(src[end - 1])) {
+        end--;
+    }
+
+    ops->copy(dest, src + start, end - start);
+    dest[end - start] = '\0';
+    return end - start;
+}
+
+// StringOperations.contains / startsWith / endsWith
+
+const char* str_find(const char* haystack, const char* needle) {
+    const strops_impl_t* ops = strops_impl();
+    return ops->find(haystack, ops->length(haystack), needle, ops->length(needle));
+}
+
+int str_contains(const char* haystack, const char* needle) {
+    return str_find(haystack, needle) != NULL;
+}
+
+int str_starts_with(const char* s, const char* prefix) {
+    while (*prefix) {
+        if (*s++ != *prefix++) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int str_ends_with(const char* s, const char* suffix) {
+    const strops_impl_t* ops = strops_impl();
+    size_t len = ops->length(s);
+    size_t suffix_len = ops->length(suffix);
+
+    if (suffix_len > len) {
+        return 0;
+    }
+    return bytes_equal(s + len - suffix_len, suffix, suffix_len);
+}
+
+// StringOperations.parseInt / parseFloat
+
+// Convert eight ASCII digits in one go (first digit in the lowest byte)
+static uint32_t parse_eight_digits(const char* p) {
+    uint64_t val = *(const u64_unaligned_t*)p;
+
+    val = ((val & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    val = ((val & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (uint32_t)(((val & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+// Parse up to max_digits leading digits of a digit run and skip the rest.
+// *digits receives the full length of the run.
+static uint64_t parse_digits(const char** sp, size_t max_digits, size_t* digits) {
+    const char* s = *sp;
+    const char* p = s;
+
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+
+    size_t run = p - s;
+    size_t n = run < max_digits ? run : max_digits;
+    uint64_t value = 0;
+
+    while (n >= 8) {
+        value = value * 100000000 + parse_eight_digits(s);
+        s += 8;
+        n -= 8;
+    }
+    while (n--) {
+        value = value * 10 + (*s++ - '0');
+    }
+
+    *sp = p;
+    *digits = run;
+    return value;
+}
+
+int64_t str_parse_int(const char* s) {
+    int negative = 0;
+    size_t digits;
+
+    while (is_space(*s)) {
+        s++;
+    }
+    if (*s == '-' || *s == '+') {
+        negative = (*s == '-');
+        s++;
+    }
+
+    // Leading zeros would otherwise count against PARSE_INT_DIGITS
+    while (*s == '0') {
+        s++;
+    }
+
+    // Out of range saturates, as strtoll does. Nineteen digits always
+    // fit in a uint64_t, so only longer runs can wrap.
+    uint64_t value = parse_digits(&s, PARSE_INT_DIGITS, &digits);
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    if (digits > PARSE_INT_DIGITS || value > limit) {
+        return negative ? INT64_MIN : INT64_MAX;
+    }
+    if (negative) {
+        return value ? -(int64_t)(value - 1) - 1 : 0;
+    }
+    return (int64_t)value;
+}
+
+static double pow10_double(int exp) {
+    static const double table[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    double result = 1.0;
+
+    while (exp > 22) {
+        result *= 1e22;
+        exp -= 22;
+    }
+    return result * table[exp];
+}
+
+// Keeps the first 18 significant digits of each part, which is enough
+// for the 64-bit values MicroASM registers hold
+double str_parse_float(const char* s) {
+    int negative = 0;
+    size_t digits;
+
+    while (is_space(*s)) {
+        s++;
+    }
+    if (*s == '-' || *s == '+') {
+        negative = (*s == '-');
+        s++;
+    }
+
+    uint64_t int_part = parse_digits(&s, PARSE_FLOAT_DIGITS, &digits);
+    double value = (double)(int64_t)int_part;
+    if (digits > PARSE_FLOAT_DIGITS) {
+        value *= pow10_double((int)(digits - PARSE_FLOAT_DIGITS));
+    }
+
+    if (*s == '.') {
+        s++;
+        uint64_t frac = parse_digits(&s, PARSE_FLOAT_DIGITS, &digits);
+        size_t used = digits < PARSE_FLOAT_DIGITS ? digits : PARSE_FLOAT_DIGITS;
+        value += (double)(int64_t)frac / pow10_double((int)used);
+    }
+
+    if (*s == 'e' || *s == 'E') {
+        int exp_negative = 0;
+        s++;
+        if (*s == '-' || *s == '+') {
+            exp_negative = (*s == '-');
+            s++;
+        }
+
+        int exp = (int)parse_digits(&s, 4, &digits);
+        if (exp_negative) {
+            value /= pow10_double(exp);
+        } else {
+            value *= pow10_double(exp);
+        }
+    }
+
+    return negative ? -value : value;
+}
+
+// StringOperations.format: args holds one 64-bit value per conversion
+int str_format(char* dest, size_t size, const char* format, const uint64_t* args) {
+    return snprintf_array(dest, size, format, args);
+}
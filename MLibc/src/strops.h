@@ -0,0 +1,40 @@
+#ifndef STROPS_H
+#define STROPS_H
+
+#include "stddef.h"
+#include "stdint.h"
+
+/*
+ * String routines behind the MNI StringOperations.* calls
+ * (see v2instructions.md). All inputs are null-terminated.
+ *
+ * The default build processes a machine word at a time. Building with
+ * -DMLIBC_SIMD under gcc or clang adds SSE2 and AVX2 versions that are
+ * picked at runtime from CPUID. Leave it off for the kernel, which
+ * does not enable SSE.
+ */
+
+size_t str_to_upper(char* dest, const char* src);
+size_t str_to_lower(char* dest, const char* src);
+size_t str_trim(char* dest, const char* src);
+
+const char* str_find(const char* haystack, const char* needle);
+int str_contains(const char* haystack, const char* needle);
+int str_starts_with(const char* s, const char* prefix);
+int str_ends_with(const char* s, const char* suffix);
+
+int64_t str_parse_int(const char* s);
+double str_parse_float(const char* s);
+
+int str_format(char* dest, size_t size, const char* format, const uint64_t* args);
+
+// Name of the implementation picked at runtime ("scalar", "sse2", "avx2")
+const char* strops_impl_name(void);
+
+#ifdef MLIBC_HOSTED
+// Switch to the named implementation, for the tests and benchmarks.
+// Returns -1 if it was not built or the CPU cannot run it.
+int strops_use(const char* name);
+#endif
+
+#endif /* STROPS_H */
@@ -0,0 +1,80 @@
+#ifndef SYSABI_H
+#define SYSABI_H
+
+#include "stdint.h"
+
+/*
+ * Konstruct system-call ABI, shared by the kernel and MLibc's user-mode
+ * backend (usys.c).
+ *
+ * x86_64: SYSCALL with the number in rax and arguments in rdi, rsi, rdx
+ * and r10. The result comes back in rax. rcx and r11 are clobbered, and
+ * the kernel also clears rdi, rsi, rdx and r8-r10.
+ *
+ * i386: SYSENTER with the number in eax and arguments in ebx, esi and
+ * edi. The caller puts its stack pointer in ecx and the return address
+ * in edx, where SYSEXIT takes them back from. The result comes back in
+ * eax; every other register is preserved.
+ *
+ * A negative result is an error.
+ *
+ * Processes start with the System V stack layout: argc, then the argv
+ * pointers and a NULL, then an empty environment, then an auxiliary
+ * vector. AT_SYSINFO_EHDR in that vector is the address of a read-only
+ * vdso_data_t page that the kernel keeps current. getpid and the clock
+ * read it directly, without entering the kernel.
+ */
+
+#define SYS_EXIT      0     /* (code) - does not return */
+#define SYS_WRITE     1     /* (fd, buf, len) -> bytes written; 1 is stdout, 2 the console */
+#define SYS_GETPID    2
+#define SYS_NOW_NS    3     /* (uint64_t* out) - the slow path of vdso_now_ns() */
+#define SYS_NULL      4     /* Does nothing; for measuring entry and exit */
+#define SYS_COUNT     5
+
+#define SYS_EFAULT    (-14)
+#define SYS_EPIPE     (-32) /* fd 1 is a pipe whose reader has exited */
+#define SYS_EBADF     (-9)
+#define SYS_ENOSYS    (-38)
+
+#define AT_NULL         0
+#define AT_PAGESZ       6
+#define AT_SYSINFO_EHDR 33
+
+#define VDSO_MAGIC 0x4F534456       /* "VDSO" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t pid;
+    uint32_t tsc_mult;          /* ns = tsc * tsc_mult >> tsc_shift */
+    uint32_t tsc_shift;         /* At most 32 */
+    uint32_t seq;               /* Odd while the kernel rewrites the clock */
+} vdso_data_t;
+
+// Sequence-count reads of the clock fields (the kernel's lock.h has the
+// writer side): copy them between the two calls, and again while the
+// second returns nonzero
+static inline uint32_t vdso_read_begin(const vdso_data_t* vdso) {
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&vdso->seq, __ATOMIC_ACQUIRE)) & 1) {
+        __asm__ volatile("pause");
+    }
+    return seq;
+}
+
+static inline int vdso_read_retry(const vdso_data_t* vdso, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&vdso->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// Nanoseconds since reset. The product is split at bit 32 so it needs
+// no 128-bit or library arithmetic on either kernel.
+static inline uint64_t vdso_tsc_to_ns(const vdso_data_t* vdso, uint64_t tsc) {
+    uint64_t high = (tsc >> 32) * vdso->tsc_mult;
+    uint64_t low = (tsc & 0xFFFFFFFF) * vdso->tsc_mult;
+
+    return (high << (32 - vdso->tsc_shift)) + (low >> vdso->tsc_shift);
+}
+
+#endif /* SYSABI_H */
@@ -0,0 +1,159 @@
+#include "libc.h"
+#include "sysabi.h"
+
+// User-mode backend for Konstruct processes: the system-call stubs, the
+// startup code, and the console and keyboard hooks the rest of MLibc
+// calls. Compiled to nothing unless MLIBC_USER is defined.
+
+#ifdef MLIBC_USER
+
+#define OUTPUT_BUFFER_SIZE 256
+
+static const vdso_data_t* vdso = NULL;
+static char output[OUTPUT_BUFFER_SIZE];
+static size_t output_len = 0;
+
+int main(int argc, char** argv);
+
+#ifdef __x86_64__
+static inline intptr_t sys_call(uintptr_t num, uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    register uintptr_t r10 __asm__("r10") = a3;
+    intptr_t result;
+
+    __asm__ volatile("syscall"
+                     : "=a"(result), "+D"(a0), "+S"(a1), "+d"(a2), "+r"(r10)
+                     : "a"(num)
+                     : "rcx", "r8", "r9", "r11", "memory");
+    return result;
+}
+
+// The kernel starts us with rsp at argc
+__asm__(".text\n"
+        ".globl _start\n"
+        "_start:\n"
+        "    movq %rsp, %rdi\n"
+        "    xorl %ebp, %ebp\n"
+        "    call mlibc_start\n"
+        "    hlt\n");
+#else
+// SYSEXIT returns to the label with the stack pointer we left in ecx
+static inline intptr_t sys_call(uintptr_t num, uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    intptr_t result;
+
+    (void)a3;
+    __asm__ volatile("movl %%esp, %%ecx\n"
+                     "movl $1f, %%edx\n"
+                     "sysenter\n"
+                     "1:\n"
+                     : "=a"(result)
+                     : "a"(num), "b"(a0), "S"(a1), "D"(a2)
+                     : "ecx", "edx", "memory");
+    return result;
+}
+
+__asm__(".text\n"
+        ".globl _start\n"
+        "_start:\n"
+        "    movl %esp, %eax\n"
+        "    xorl %ebp, %ebp\n"
+        "    andl $-16, %esp\n"
+        "    subl $12, %esp\n"
+        "    pushl %eax\n"
+        "    call mlibc_start\n"
+        "    hlt\n");
+#endif
+
+void mlibc_start(uintptr_t* sp) __attribute__((noreturn, used));
+
+void mlibc_start(uintptr_t* sp) {
+    int argc = (int)sp[0];
+    char** argv = (char**)(sp + 1);
+    uintptr_t* auxv = sp + argc + 2;
+
+    while (*auxv) {             // Skip the environment
+        auxv++;
+    }
+    for (auxv++; auxv[0] != AT_NULL; auxv += 2) {
+        if (auxv[0] == AT_SYSINFO_EHDR) {
+            vdso = (const vdso_data_t*)auxv[1];
+        }
+    }
+    if (vdso && vdso->magic != VDSO_MAGIC) {
+        vdso = NULL;
+    }
+
+    exit(main(argc, argv));
+}
+
+static void flush_output(void) {
+    if (output_len) {
+        sys_call(SYS_WRITE, 1, (uintptr_t)output, output_len, 0);
+        output_len = 0;
+    }
+}
+
+void exit(int code) {
+    flush_output();
+    sys_call(SYS_EXIT, (uintptr_t)code, 0, 0, 0);
+    while (1) {
+    }
+}
+
+intptr_t write(int fd, const void* buf, size_t len) {
+    if (fd == 1) {
+        flush_output();
+    }
+    return sys_call(SYS_WRITE, (uintptr_t)fd, (uintptr_t)buf, len, 0);
+}
+
+int getpid(void) {
+    if (vdso) {
+        return (int)vdso->pid;
+    }
+    return (int)sys_call(SYS_GETPID, 0, 0, 0, 0);
+}
+
+uint64_t now_ns(void) {
+    uint64_t ns = 0;
+
+    if (vdso && vdso->tsc_mult) {
+        uint32_t seq, low, high;
+        // Retry if the kernel rewrote the clock meanwhile
+        do {
+            seq = vdso_read_begin(vdso);
+            __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+            ns = vdso_tsc_to_ns(vdso, ((uint64_t)high << 32) | low);
+        } while (vdso_read_retry(vdso, seq));
+        return ns;
+    }
+    sys_call(SYS_NOW_NS, (uintptr_t)&ns, 0, 0, 0);
+    return ns;
+}
+
+// stdio's output hook. Lines go out in one system call each.
+void print_char(char c) {
+    output[output_len++] = c;
+    if (c == '\n' || output_len == OUTPUT_BUFFER_SIZE) {
+        flush_output();
+    }
+}
+
+// Processes have no keyboard. getchar() reads newlines, so gets()
+// returns empty lines instead of waiting forever.
+char read_scan_code(void) {
+    return 0x1C;                // Enter
+}
+
+char scancode_to_ascii(char scancode) {
+    (void)scancode;
+    return '\n';
+}
+
+// A process has one thread, so the heap needs no lock
+void heap_lock(void) {
+}
+
+void heap_unlock(void) {
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include "libc.h"
+
+#define VECTOR_MIN_CAPACITY 8
+
+int vector_init(vector_t* v, size_t elem_size, size_t initial_capacity) {
+    v->data = NULL;
+    v->size = 0;
+    v->capacity = 0;
+    v->elem_size = elem_size;
+
+    if (initial_capacity) {
+        return vector_reserve(v, initial_capacity);
+    }
+    return 0;
+}
+
+void vector_destroy(vector_t* v) {
+    free(v->data);
+    v->data = NULL;
+    v->size = 0;
+    v->capacity = 0;
+}
+
+// Make room for at least `capacity` elements, moving the data once
+int vector_reserve(vector_t* v, size_t capacity) {
+    if (capacity <= v->capacity) {
+        return 0;
+    }
+
+    uint8_t* data = (uint8_t*)malloc(capacity * v->elem_size);
+    if (!data) {
+        return -1;
+    }
+
+    if (v->data) {
+        memcpy(data, v->data, v->size * v->elem_size);
+        free(v->data);
+    }
+
+    v->data = data;
+    v->capacity = capacity;
+    return 0;
+}
+
+// Append a copy of `elem` and return a pointer to the stored element.
+// Capacity doubles when full, so appends are amortized O(1).
+void* vector_push(vector_t* v, const void* elem) {
+    if (v->size == v->capacity) {
+        size_t capacity = v->capacity ? v->capacity * 2 : VECTOR_MIN_CAPACITY;
+        if (vector_reserve(v, capacity) != 0) {
+            return NULL;
+        }
+    }
+
+    void* slot = v->data + v->size * v->elem_size;
+    if (elem) {
+        memcpy(slot, elem, v->elem_size);
+    }
+    v->size++;
+
+    return slot;
+}
+
+void* vector_get(const vector_t* v, size_t index) {
+    if (index >= v->size) {
+        return NULL;
+    }
+    return v->data + index * v->elem_size;
+}
+
+// Remove the element at `index`, keeping the remaining elements in order
+int vector_remove(vector_t* v, size_t index) {
+    if (index >= v->size) {
+        return -1;
+    }
+
+    uint8_t* dest = v->data + index * v->elem_size;
+    const uint8_t* src = dest + v->elem_size;
+    size_t tail = (v->size - index - 1) * v->elem_size;
+
+    // Regions overlap, but copying forwards is safe when dest < src
+    for (size_t i = 0; i < tail; i++) {
+        dest[i] = src[i];
+    }
+
+    v->size--;
+    return 0;
+}
+
+void vector_clear(vector_t* v) {
+    v->size = 0;
+}
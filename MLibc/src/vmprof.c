@@ -0,0 +1,229 @@
+#include "libc.h"
+
+// Compiler barrier; x86 already keeps stores in program order
+#define barrier() __asm__ volatile("" ::: "memory")
+
+#define UNKNOWN_FRAME "[unknown]"
+
+int vmprof_init(vmprof_t* prof, const mbc_image_t* image) {
+    size_t labels = image->label_count + 1;
+    size_t imports = image->import_count ? image->import_count : 1;
+
+    prof->image = image;
+    prof->pending = 0;
+    prof->flags = 0;
+    prof->samples = 0;
+    prof->trace_head = 0;
+    prof->trace_tail = 0;
+    prof->trace_lost = 0;
+
+    prof->label_hits = (uint64_t*)malloc(labels * sizeof(uint64_t));
+    prof->mni_calls = (uint64_t*)malloc(imports * sizeof(uint64_t));
+    if (!prof->label_hits || !prof->mni_calls ||
+        hashmap_init(&prof->stacks, sizeof(uint64_t), 64) != 0) {
+        free(prof->label_hits);
+        free(prof->mni_calls);
+        return -1;
+    }
+
+    memset(prof->label_hits, 0, labels * sizeof(uint64_t));
+    memset(prof->mni_calls, 0, imports * sizeof(uint64_t));
+    return 0;
+}
+
+void vmprof_destroy(vmprof_t* prof) {
+    free(prof->label_hits);
+    free(prof->mni_calls);
+    hashmap_destroy(&prof->stacks);
+    prof->label_hits = NULL;
+    prof->mni_calls = NULL;
+}
+
+void vmprof_enable(vmprof_t* prof, uint32_t flags) {
+    prof->flags |= flags;
+    if (flags & VMPROF_TRACE) {
+        prof->pending |= VMPROF_TRACE;
+    }
+}
+
+// Clearing a sample bit can race with a tick; that only drops the tick
+void vmprof_disable(vmprof_t* prof, uint32_t flags) {
+    prof->flags &= ~flags;
+    prof->pending &= ~flags;
+}
+
+// Called from the host's timer signal (or the kernel's timer IRQ).
+// Only sets a bit, so it is async-signal safe.
+void vmprof_tick(vmprof_t* prof) {
+    if (prof->flags & VMPROF_PROFILE) {
+        prof->pending |= VMPROF_PROFILE;
+    }
+}
+
+// Slow path of VMPROF_STEP, taken only while a sample is due or tracing is on
+void vmprof_step(vmprof_t* prof, uint32_t pc, uint16_t opcode, const uint32_t* frames, uint32_t depth) {
+    uint32_t pending = prof->pending;
+
+    if (pending & VMPROF_PROFILE) {
+        vmprof_sample(prof, pc, frames, depth);
+    }
+    if (pending & VMPROF_TRACE) {
+        vmprof_trace(prof, pc, opcode, depth);
+    }
+}
+
+static const char* frame_name(const vmprof_t* prof, uint32_t code_offset) {
+    const char* name = mbc_label_at(prof->image, code_offset);
+    return name ? name : UNKNOWN_FRAME;
+}
+
+static void append_frame(char* key, size_t* len, const char* name) {
+    if (*len && *len + 1 < VMPROF_STACK_KEY) {
+        key[(*len)++] = ';';
+    }
+    while (*name && *len + 1 < VMPROF_STACK_KEY) {
+        key[(*len)++] = *name++;
+    }
+    key[*len] = '\0';
+}
+
+// Charge one sample to the label containing `pc` and to the VM's call
+// stack, outermost frame first, in flamegraph folded form
+void vmprof_sample(vmprof_t* prof, uint32_t pc, const uint32_t* frames, uint32_t depth) {
+    const mbc_image_t* image = prof->image;
+    uint32_t label = mbc_label_index_at(image, pc);
+    char key[VMPROF_STACK_KEY];
+    size_t len = 0;
+
+    prof->pending &= ~VMPROF_PROFILE;
+    prof->samples++;
+    prof->label_hits[label < image->label_count ? label : image->label_count]++;
+
+    const char* caller = NULL;
+    key[0] = '\0';
+
+    if (depth > VMPROF_MAX_DEPTH) {
+        depth = VMPROF_MAX_DEPTH;
+    }
+    for (uint32_t i = 0; i < depth; i++) {
+        caller = frame_name(prof, frames[i]);
+        append_frame(key, &len, caller);
+    }
+
+    // Inner labels (loops etc.) nest under their function's frame
+    const char* leaf = label < image->label_count ? mbc_label_name(image, label) : UNKNOWN_FRAME;
+    if (!caller || strcmp(caller, leaf) != 0) {
+        append_frame(key, &len, leaf);
+    }
+
+    uint64_t* count = (uint64_t*)hashmap_get(&prof->stacks, key);
+    if (count) {
+        (*count)++;
+    } else {
+        uint64_t one = 1;
+        hashmap_put(&prof->stacks, key, &one);
+    }
+}
+
+void vmprof_mni(vmprof_t* prof, uint32_t import) {
+    if ((prof->flags & VMPROF_PROFILE) && import < prof->image->import_count) {
+        prof->mni_calls[import]++;
+    }
+}
+
+// Single-producer ring: the VM never waits, and once the ring is full
+// the oldest entries are overwritten
+void vmprof_trace(vmprof_t* prof, uint32_t pc, uint16_t opcode, uint32_t depth) {
+    uint32_t head = prof->trace_head;
+    vmprof_trace_t* entry = &prof->trace[head & (VMPROF_TRACE_SIZE - 1)];
+
+    entry->pc = pc;
+    entry->opcode = opcode;
+    entry->depth = (uint16_t)depth;
+
+    barrier();
+    prof->trace_head = head + 1;
+}
+
+// Copy out up to `max` entries the reader has not seen yet. Safe to call
+// from another thread while the VM keeps tracing; entries overwritten
+// during the copy are dropped and counted in trace_lost.
+size_t vmprof_trace_read(vmprof_t* prof, vmprof_trace_t* out, size_t max) {
+    uint32_t head = prof->trace_head;
+    barrier();
+
+    uint32_t tail = prof->trace_tail;
+    if (head - tail > VMPROF_TRACE_SIZE) {
+        prof->trace_lost += head - tail - VMPROF_TRACE_SIZE;
+        tail = head - VMPROF_TRACE_SIZE;
+    }
+
+    size_t count = head - tail;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        out[i] = prof->trace[(tail + i) & (VMPROF_TRACE_SIZE - 1)];
+    }
+
+    barrier();
+    uint32_t oldest = prof->trace_head - VMPROF_TRACE_SIZE;
+    size_t skip = 0;
+    if ((int32_t)(oldest - tail) > 0) {
+        skip = oldest - tail < count ? oldest - tail : count;
+        for (size_t i = skip; i < count; i++) {
+            out[i - skip] = out[i];
+        }
+        prof->trace_lost += skip;
+    }
+
+    prof->trace_tail = tail + count;
+    return count - skip;
+}
+
+// One "frame;frame;leaf count" line per distinct stack, as consumed by
+// flamegraph.pl and similar tools
+void vmprof_write_folded(const vmprof_t* prof, vmprof_emit_t emit, void* ctx) {
+    char line[VMPROF_STACK_KEY + 32];
+    size_t cursor = 0;
+    const char* key;
+    size_t key_len;
+    void* value;
+
+    while (hashmap_next(&prof->stacks, &cursor, &key, &key_len, &value)) {
+        memcpy(line, key, key_len);
+        snprintf_array(line + key_len, sizeof(line) - key_len, " %u", (const uint64_t*)value);
+        emit(ctx, line);
+    }
+}
+
+void vmprof_write_summary(const vmprof_t* prof, vmprof_emit_t emit, void* ctx) {
+    const mbc_image_t* image = prof->image;
+    char line[128];
+    uint64_t args[2];
+
+    args[0] = prof->samples;
+    snprintf_array(line, sizeof(line), "samples %u", args);
+    emit(ctx, line);
+
+    for (uint32_t i = 0; i <= image->label_count; i++) {
+        if (!prof->label_hits[i]) {
+            continue;
+        }
+        const char* name = i < image->label_count ? mbc_label_name(image, i) : UNKNOWN_FRAME;
+        args[0] = (uint64_t)(uintptr_t)name;
+        args[1] = prof->label_hits[i];
+        snprintf_array(line, sizeof(line), "label %s %u", args);
+        emit(ctx, line);
+    }
+
+    for (uint32_t i = 0; i < image->import_count; i++) {
+        if (!prof->mni_calls[i]) {
+            continue;
+        }
+        args[0] = (uint64_t)(uintptr_t)mbc_import_name(image, i);
+        args[1] = prof->mni_calls[i];
+        snprintf_array(line, sizeof(line), "mni %s %u", args);
+        emit(ctx, line);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef VMPROF_H
+#define VMPROF_H
+
+#include "stddef.h"
+#include "stdint.h"
+#include "collections.h"
+#include "mbc.h"
+
+/*
+ * Sampling profiler and instruction trace for the MicroASM VM, backing
+ * the MNI Debug.trace* and Debug.profile* calls.
+ *
+ * The timer handler only calls vmprof_tick(), which sets a bit in
+ * `pending`. The dispatch loop takes the sample at the next instruction
+ * through VMPROF_STEP, so the handler never touches the tables. Tracing
+ * keeps its own bit set in the same word, so with both off a step is one
+ * load and a not-taken branch. While tracing is off the VM only needs to
+ * step on CALL and taken jumps, since straight-line code always reaches
+ * one; tracing needs a step before every instruction.
+ *
+ * The VM owns the call stack. VMPROF_STEP gets `frames`, the code offset
+ * of each active CALL's target with the outermost first, and `depth`,
+ * the number of them, so CALL and RET cost the dispatch loop nothing
+ * extra. Only the outermost VMPROF_MAX_DEPTH frames are charged.
+ */
+
+#define VMPROF_TRACE_SIZE 4096   /* Trace ring entries, a power of two */
+#define VMPROF_MAX_DEPTH  64     /* Call stack frames charged per sample */
+#define VMPROF_STACK_KEY  512    /* Longest folded stack, in bytes */
+
+#define VMPROF_PROFILE 1
+#define VMPROF_TRACE   2
+
+typedef struct {
+    uint32_t pc;
+    uint16_t opcode;
+    uint16_t depth;
+} vmprof_trace_t;
+
+typedef struct {
+    const mbc_image_t* image;
+    volatile uint32_t pending;      /* VMPROF_PROFILE: sample due; VMPROF_TRACE: tracing */
+    volatile uint32_t flags;        /* VMPROF_PROFILE | VMPROF_TRACE */
+
+    uint64_t samples;
+    uint64_t* label_hits;           /* label_count + 1 entries; last is "unknown" */
+    uint64_t* mni_calls;            /* import_count entries */
+    hashmap_t stacks;               /* Folded stack -> uint64_t sample count */
+
+    volatile uint32_t trace_head;   /* Next slot the VM writes */
+    uint32_t trace_tail;            /* Next slot the reader consumes */
+    uint64_t trace_lost;
+    vmprof_trace_t trace[VMPROF_TRACE_SIZE];
+} vmprof_t;
+
+// Take a due sample and record a trace entry; the check is inlined into
+// the dispatch loop and everything else stays out of line
+#define VMPROF_STEP(prof, pc, opcode, frames, depth) \
+    do { \
+        if (__builtin_expect((prof)->pending != 0, 0)) \
+            vmprof_step((prof), (pc), (opcode), (frames), (depth)); \
+    } while (0)
+
+int vmprof_init(vmprof_t* prof, const mbc_image_t* image);
+void vmprof_destroy(vmprof_t* prof);
+void vmprof_enable(vmprof_t* prof, uint32_t flags);
+void vmprof_disable(vmprof_t* prof, uint32_t flags);
+
+void vmprof_tick(vmprof_t* prof);
+void vmprof_step(vmprof_t* prof, uint32_t pc, uint16_t opcode, const uint32_t* frames, uint32_t depth);
+void vmprof_sample(vmprof_t* prof, uint32_t pc, const uint32_t* frames, uint32_t depth);
+void vmprof_mni(vmprof_t* prof, uint32_t import);
+
+void vmprof_trace(vmprof_t* prof, uint32_t pc, uint16_t opcode, uint32_t depth);
+size_t vmprof_trace_read(vmprof_t* prof, vmprof_trace_t* out, size_t max);
+
+// Report writers; `emit` receives one null-terminated line at a time
+typedef void (*vmprof_emit_t)(void* ctx, const char* line);
+
+void vmprof_write_folded(const vmprof_t* prof, vmprof_emit_t emit, void* ctx);
+void vmprof_write_summary(const vmprof_t* prof, vmprof_emit_t emit, void* ctx);
+
+#endif /* VMPROF_H */
@@ -0,0 +1,665 @@
+// Microbenchmarks: MLibc against glibc, in nanoseconds per call.
+//
+//   bench [-t ms] [benchmark...]
+//
+// Each benchmark runs long enough to fill -t milliseconds (default 50),
+// takes the best of several runs, and reports both libraries and their
+// ratio. Calls go through function pointers so the compiler cannot
+// replace glibc's with inline code.
+
+#define _GNU_SOURCE                 // hsearch_r
+
+#include "ml.h"
+
+#include <ctype.h>
+#include <search.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define RUNS        5
+#define MALLOC_BATCH 1024           // 32-byte blocks; fits MLibc's heap
+#define STROPS_MAX  (64u << 20)
+
+typedef struct {
+    const char* name;
+    void* (*memcpy)(void*, const void*, size_t);
+    void* (*memset)(void*, int, size_t);
+    size_t (*strlen)(const char*);
+    int (*strcmp)(const char*, const char*);
+    char* (*strstr)(const char*, const char*);
+    int (*snprintf)(char*, size_t, const char*, ...);
+    void* (*malloc)(size_t);
+    void (*free)(void*);
+    void (*heap_reset)(void);
+} impl_t;
+
+typedef struct {
+    const char* name;
+    size_t size;
+    // Run `iters` operations and return how many calls that was
+    long (*fn)(const impl_t* impl, size_t size, long iters);
+} bench_t;
+
+static const impl_t ml_impl = {
+    "MLibc", ml_memcpy, ml_memset, ml_strlen, ml_strcmp, ml_strstr, ml_snprintf,
+    ml_malloc, ml_free, ml_heap_reset
+};
+static const impl_t glibc_impl = {
+    "glibc", memcpy, memset, strlen, strcmp, strstr, snprintf, malloc, free, NULL
+};
+
+static char src[1 << 16];
+static char dst[1 << 16];
+static char other[1 << 16];
+static volatile size_t sink;
+static uint64_t untimed_ns;         // Set-up inside a run, left out of its time
+
+static long bench_memcpy(const impl_t* impl, size_t size, long iters) {
+    for (long i = 0; i < iters; i++) {
+        impl->memcpy(dst, src, size);
+    }
+    return iters;
+}
+
+static long bench_memset(const impl_t* impl, size_t size, long iters) {
+    for (long i = 0; i < iters; i++) {
+        impl->memset(dst, (int)i, size);
+    }
+    return iters;
+}
+
+static long bench_strlen(const impl_t* impl, size_t size, long iters) {
+    src[size] = '\0';
+    for (long i = 0; i < iters; i++) {
+        sink += impl->strlen(src);
+    }
+    src[size] = 'x';
+    return iters;
+}
+
+// Equal strings, so the whole length is compared
+static long bench_strcmp(const impl_t* impl, size_t size, long iters) {
+    src[size] = '\0';
+    other[size] = '\0';
+    for (long i = 0; i < iters; i++) {
+        sink += (size_t)impl->strcmp(src, other);
+    }
+    src[size] = 'x';
+    other[size] = 'x';
+    return iters;
+}
+
+// An 8-byte needle at the end of a `size`-byte haystack
+static long bench_strstr(const impl_t* impl, size_t size, long iters) {
+    char needle[9];
+
+    memcpy(needle, src + size - 8, 8);
+    needle[8] = '\0';
+    src[size] = '\0';
+    for (long i = 0; i < iters; i++) {
+        sink += (size_t)impl->strstr(src, needle);
+    }
+    src[size] = 'x';
+    return iters;
+}
+
+static long bench_snprintf(const impl_t* impl, size_t size, long iters) {
+    (void)size;
+    for (long i = 0; i < iters; i++) {
+        sink += (size_t)impl->snprintf(dst, 128, "block %d of %s: %x bytes, %u%%",
+                                       (int)i, "ahci0", (unsigned)i * 4096u, 100u);
+    }
+    return iters;
+}
+
+// Allocate a batch and free it again; counts one op per malloc/free pair
+static long bench_malloc(const impl_t* impl, size_t size, long iters) {
+    static void* blocks[MALLOC_BATCH];
+    long batches = (iters + MALLOC_BATCH - 1) / MALLOC_BATCH;
+
+    for (long b = 0; b < batches; b++) {
+        for (int i = 0; i < MALLOC_BATCH; i++) {
+            blocks[i] = impl->malloc(size);
+        }
+        for (int i = 0; i < MALLOC_BATCH; i++) {
+            impl->free(blocks[i]);
+        }
+        if (impl->heap_reset) {
+            impl->heap_reset();
+        }
+    }
+    return batches * MALLOC_BATCH;
+}
+
+// Push `size` 8-byte elements, then start over. glibc has no vector,
+// so its column is the usual realloc-doubling array.
+static long bench_vector(const impl_t* impl, size_t size, long iters) {
+    long batches = (iters + (long)size - 1) / (long)size;
+
+    for (long b = 0; b < batches; b++) {
+        if (impl == &ml_impl) {
+            vector_t v;
+            ml_heap_reset();
+            vector_init(&v, sizeof(uint64_t), 0);
+            for (size_t i = 0; i < size; i++) {
+                uint64_t value = i;
+                vector_push(&v, &value);
+            }
+            sink += v.size;
+        } else {
+            uint64_t* data = NULL;
+            size_t capacity = 0;
+            for (size_t i = 0; i < size; i++) {
+                if (i == capacity) {
+                    capacity = capacity ? capacity * 2 : 8;
+                    data = realloc(data, capacity * sizeof(uint64_t));
+                }
+                data[i] = i;
+            }
+            sink += data[size - 1];
+            free(data);
+        }
+    }
+    return batches * (long)size;
+}
+
+static char (*map_keys)[16];
+static size_t map_keys_made;
+
+// Keys are made as the benchmarks first need them
+static void make_keys(size_t count) {
+    if (count <= map_keys_made) {
+        return;
+    }
+    map_keys = realloc(map_keys, count * sizeof(map_keys[0]));
+    for (size_t i = map_keys_made; i < count; i++) {
+        snprintf(map_keys[i], sizeof(map_keys[i]), "key%zu", i);
+    }
+    map_keys_made = count;
+}
+
+// Fill a map with `size` keys, off the clock. glibc's column is
+// hsearch_r, which cannot grow and so is sized up front; MLibc's map is
+// sized up front too, so both start from the same place.
+static void ml_map_fill(hashmap_t* map, size_t size) {
+    uint64_t start = now_ns();
+    ml_heap_reset();
+    hashmap_init(map, sizeof(uint64_t), size);
+    for (size_t i = 0; i < size; i++) {
+        uint64_t value = i;
+        hashmap_put(map, map_keys[i], &value);
+    }
+    untimed_ns += now_ns() - start;
+}
+
+static void glibc_table_fill(struct hsearch_data* table, size_t size) {
+    uint64_t start = now_ns();
+    ENTRY entry, *found;
+    memset(table, 0, sizeof(*table));
+    hcreate_r(size + size / 4, table);
+    for (size_t i = 0; i < size; i++) {
+        entry.key = map_keys[i];
+        entry.data = (void*)i;
+        hsearch_r(entry, ENTER, &found, table);
+    }
+    untimed_ns += now_ns() - start;
+}
+
+// Put `size` keys into an empty map, counting one op per put. MLibc's
+// map starts small and grows as it goes.
+static long bench_hashmap_put(const impl_t* impl, size_t size, long iters) {
+    long batches = (iters + (long)size - 1) / (long)size;
+
+    make_keys(size);
+    for (long b = 0; b < batches; b++) {
+        if (impl == &ml_impl) {
+            hashmap_t map;
+            ml_heap_reset();
+            hashmap_init(&map, sizeof(uint64_t), 0);
+            for (size_t i = 0; i < size; i++) {
+                uint64_t value = i;
+                hashmap_put(&map, map_keys[i], &value);
+            }
+            sink += map.size;
+        } else {
+            struct hsearch_data table;
+            ENTRY entry, *found;
+            memset(&table, 0, sizeof(table));
+            hcreate_r(size + size / 4, &table);
+            for (size_t i = 0; i < size; i++) {
+                entry.key = map_keys[i];
+                entry.data = (void*)i;
+                hsearch_r(entry, ENTER, &found, &table);
+            }
+            sink += (size_t)found;
+            hdestroy_r(&table);
+        }
+    }
+    return batches * (long)size;
+}
+
+// Look up every key of a map of `size` entries, in batches of `size`;
+// every lookup hits
+static long bench_hashmap_get(const impl_t* impl, size_t size, long iters) {
+    long batches = (iters + (long)size - 1) / (long)size;
+
+    make_keys(size);
+    if (impl == &ml_impl) {
+        hashmap_t map;
+        ml_map_fill(&map, size);
+        for (long b = 0; b < batches; b++) {
+            for (size_t i = 0; i < size; i++) {
+                sink += *(uint64_t*)hashmap_get(&map, map_keys[i]);
+            }
+        }
+    } else {
+        struct hsearch_data table;
+        ENTRY entry, *found;
+        glibc_table_fill(&table, size);
+        for (long b = 0; b < batches; b++) {
+            for (size_t i = 0; i < size; i++) {
+                entry.key = map_keys[i];
+                hsearch_r(entry, FIND, &found, &table);
+                sink += (size_t)found->data;
+            }
+        }
+        hdestroy_r(&table);
+    }
+    return batches * (long)size;
+}
+
+// Remove every key from a full map of `size` entries, refilling it off
+// the clock between batches. hsearch_r cannot remove, so glibc has no
+// column.
+static long bench_hashmap_del(const impl_t* impl, size_t size, long iters) {
+    long batches = (iters + (long)size - 1) / (long)size;
+
+    if (impl != &ml_impl) {
+        return 0;
+    }
+    make_keys(size);
+    for (long b = 0; b < batches; b++) {
+        hashmap_t map;
+        ml_map_fill(&map, size);
+        for (size_t i = 0; i < size; i++) {
+            sink += (size_t)hashmap_remove(&map, map_keys[i]);
+        }
+        sink += map.size;
+    }
+    return batches * (long)size;
+}
+
+static long bench_parse_int(const impl_t* impl, size_t size, long iters) {
+    static const char* const numbers[] = { "0", "42", "-1234567", "9007199254740993" };
+    (void)size;
+
+    for (long i = 0; i < iters; i++) {
+        const char* s = numbers[i & 3];
+        sink += impl == &ml_impl ? (size_t)str_parse_int(s) : (size_t)strtoll(s, NULL, 10);
+    }
+    return iters;
+}
+
+// StringOperations throughput, over buffers of up to STROPS_MAX bytes
+static char* big_src;
+static char* big_dst;
+
+// glibc has no whole-string case conversion; its column is a toupper loop
+static long bench_str_upper(const impl_t* impl, size_t size, long iters) {
+    big_src[size] = '\0';
+    for (long i = 0; i < iters; i++) {
+        if (impl == &ml_impl) {
+            sink += str_to_upper(big_dst, big_src);
+        } else {
+            for (size_t j = 0; j <= size; j++) {
+                big_dst[j] = (char)toupper((unsigned char)big_src[j]);
+            }
+        }
+    }
+    big_src[size] = 'x';
+    return iters;
+}
+
+// Nothing to trim, so the whole string is measured and copied
+static long bench_str_trim(const impl_t* impl, size_t size, long iters) {
+    big_src[size] = '\0';
+    for (long i = 0; i < iters; i++) {
+        if (impl == &ml_impl) {
+            sink += str_trim(big_dst, big_src);
+        } else {
+            size_t len = strlen(big_src);
+            memcpy(big_dst, big_src, len + 1);
+            sink += len;
+        }
+    }
+    big_src[size] = 'x';
+    return iters;
+}
+
+// A needle that never occurs, so the whole haystack is scanned
+static long bench_str_find(const impl_t* impl, size_t size, long iters) {
+    big_src[size] = '\0';
+    for (long i = 0; i < iters; i++) {
+        sink += (size_t)(impl == &ml_impl ? str_find(big_src, "0123456789")
+                                          : strstr(big_src, "0123456789"));
+    }
+    big_src[size] = 'x';
+    return iters;
+}
+
+static const bench_t strops_benches[] = {
+    { "str_upper",    0,     bench_str_upper },
+    { "str_trim",     0,     bench_str_trim },
+    { "str_find",     0,     bench_str_find },
+};
+
+static const size_t strops_sizes[] = { 1 << 10, 1 << 16, 1 << 20, STROPS_MAX };
+static const char* const strops_impls[] = { "scalar", "sse2", "avx2" };
+
+// A MicroASM dispatch loop over an assembled image, to price vmprof's
+// hooks: the program calls a short function from a counted loop
+#define REG(n)   { MBC_ARG_REG, n, NULL }
+#define IMM(v)   { MBC_ARG_IMM, v, NULL }
+#define LABEL(s) { MBC_ARG_LABEL, 0, s }
+#define VM_LOOP_INSNS 10            // Instructions per pass of the loop
+#define VM_ROUNDS     20            // Interleaved runs of each vmprof mode
+
+static uint64_t vm_buf[512];
+static mbc_image_t vm_image;
+static vmprof_t vm_prof;
+
+static void vm_build(void) {
+    mbc_writer_t w;
+
+    ml_heap_reset();
+    mbc_writer_init(&w);
+    mbc_set_entry(&w, "main");
+    mbc_define_label(&w, "work");
+    mbc_emit(&w, MBC_OP_ADD, 2, (mbc_operand_t[]){ REG(2), REG(0) });
+    mbc_emit(&w, MBC_OP_XOR, 2, (mbc_operand_t[]){ REG(3), REG(2) });
+    mbc_emit(&w, MBC_OP_SHL, 2, (mbc_operand_t[]){ REG(3), IMM(1) });
+    mbc_emit(&w, MBC_OP_SUB, 2, (mbc_operand_t[]){ REG(2), REG(3) });
+    mbc_emit(&w, MBC_OP_RET, 0, NULL);
+    mbc_define_label(&w, "main");
+    mbc_emit(&w, MBC_OP_MOV, 2, (mbc_operand_t[]){ REG(0), IMM(0) });
+    mbc_define_label(&w, "loop");
+    mbc_emit(&w, MBC_OP_CALL, 1, (mbc_operand_t[]){ LABEL("work") });
+    mbc_emit(&w, MBC_OP_INC, 1, (mbc_operand_t[]){ REG(0) });
+    mbc_emit(&w, MBC_OP_CMP, 2, (mbc_operand_t[]){ REG(0), REG(1) });
+    mbc_emit(&w, MBC_OP_JL, 1, (mbc_operand_t[]){ LABEL("loop") });
+    mbc_emit(&w, MBC_OP_HLT, 0, NULL);
+    mbc_write(&w, vm_buf, mbc_image_size(&w));
+    mbc_open(&vm_image, vm_buf, mbc_image_size(&w));
+    mbc_writer_destroy(&w);
+    vmprof_init(&vm_prof, &vm_image);
+}
+
+// Dispatch modes: no hooks, VMPROF_STEP on CALL and taken jumps (as
+// long as tracing is off), or VMPROF_STEP before every instruction
+#define VM_BARE   0
+#define VM_BRANCH 1
+#define VM_EVERY  2
+
+// Runs `passes` passes of the loop and returns the instructions run.
+// Inlined once per mode, so the bare loop has no trace of the hooks.
+static inline __attribute__((always_inline)) long vm_run(long passes, const int hooks) {
+    const uint8_t* code = vm_image.code;
+    uint32_t pc = vm_image.header->entry;
+    uint32_t stack[16], frames[16];
+    int64_t r[16] = { 0 };
+    long executed = 0;
+    int sp = 0, cmp = 0;
+
+    r[1] = passes;
+    while (1) {
+        const mbc_insn_t* insn = (const mbc_insn_t*)(code + pc);
+        const int64_t* a = (const int64_t*)(insn + 1);
+        int64_t src = insn->argc > 1 && MBC_ARG_KIND(insn, 1) == MBC_ARG_REG ? r[a[1]] : a[1];
+        uint32_t at = pc;
+
+        if (hooks == VM_EVERY) {
+            VMPROF_STEP(&vm_prof, at, insn->opcode, frames, sp);
+        }
+        executed++;
+        pc += sizeof(mbc_insn_t) + insn->argc * sizeof(int64_t);
+        switch (insn->opcode) {
+            case MBC_OP_MOV: r[a[0]] = src; break;
+            case MBC_OP_ADD: r[a[0]] += src; break;
+            case MBC_OP_SUB: r[a[0]] -= src; break;
+            case MBC_OP_XOR: r[a[0]] ^= src; break;
+            case MBC_OP_SHL: r[a[0]] <<= src; break;
+            case MBC_OP_INC: r[a[0]]++; break;
+            case MBC_OP_CMP: cmp = (r[a[0]] > src) - (r[a[0]] < src); break;
+            case MBC_OP_JL:
+                if (cmp < 0) {
+                    pc = (uint32_t)a[0];
+                    if (hooks == VM_BRANCH) {
+                        VMPROF_STEP(&vm_prof, at, MBC_OP_JL, frames, sp);
+                    }
+                }
+                break;
+            case MBC_OP_CALL:
+                if (hooks) {
+                    frames[sp] = (uint32_t)a[0];
+                }
+                stack[sp++] = pc;
+                pc = (uint32_t)a[0];
+                if (hooks == VM_BRANCH) {
+                    VMPROF_STEP(&vm_prof, at, MBC_OP_CALL, frames, sp);
+                }
+                break;
+            case MBC_OP_RET:
+                pc = stack[--sp];
+                break;
+            default:
+                sink += (size_t)r[2];
+                return executed;
+        }
+    }
+}
+
+static long bench_vm_bare(const impl_t* impl, size_t size, long iters) {
+    (void)impl;
+    (void)size;
+    return vm_run(iters / VM_LOOP_INSNS + 1, VM_BARE);
+}
+
+// A VM runs the per-instruction loop only while tracing is on
+static long bench_vm_hooked(const impl_t* impl, size_t size, long iters) {
+    (void)impl;
+    (void)size;
+    if (vm_prof.flags & VMPROF_TRACE) {
+        return vm_run(iters / VM_LOOP_INSNS + 1, VM_EVERY);
+    }
+    return vm_run(iters / VM_LOOP_INSNS + 1, VM_BRANCH);
+}
+
+static void on_sigprof(int sig) {
+    (void)sig;
+    vmprof_tick(&vm_prof);
+}
+
+static const bench_t benches[] = {
+    { "memcpy",       16,       bench_memcpy },
+    { "memcpy",       256,      bench_memcpy },
+    { "memcpy",       4096,     bench_memcpy },
+    { "memcpy",       65536,    bench_memcpy },
+    { "memset",       16,       bench_memset },
+    { "memset",       256,      bench_memset },
+    { "memset",       4096,     bench_memset },
+    { "memset",       65536,    bench_memset },
+    { "strlen",       16,       bench_strlen },
+    { "strlen",       256,      bench_strlen },
+    { "strlen",       4096,     bench_strlen },
+    { "strcmp",       16,       bench_strcmp },
+    { "strcmp",       256,      bench_strcmp },
+    { "strcmp",       4096,     bench_strcmp },
+    { "strstr",       256,      bench_strstr },
+    { "strstr",       4096,     bench_strstr },
+    { "snprintf",     0,        bench_snprintf },
+    { "malloc",       32,       bench_malloc },
+    { "vector",       1024,     bench_vector },
+    { "hashmap-put",  1000,     bench_hashmap_put },
+    { "hashmap-put",  100000,   bench_hashmap_put },
+    { "hashmap-put",  10000000, bench_hashmap_put },
+    { "hashmap-get",  1000,     bench_hashmap_get },
+    { "hashmap-get",  100000,   bench_hashmap_get },
+    { "hashmap-get",  10000000, bench_hashmap_get },
+    { "hashmap-del",  1000,     bench_hashmap_del },
+    { "hashmap-del",  100000,   bench_hashmap_del },
+    { "hashmap-del",  10000000, bench_hashmap_del },
+    { "str_parse_int", 0,       bench_parse_int },
+};
+
+#define BENCH_COUNT (int)(sizeof(benches) / sizeof(benches[0]))
+
+// Best time per op over RUNS runs, each of roughly `budget_ns`
+static double measure(const bench_t* bench, const impl_t* impl, uint64_t budget_ns) {
+    long iters = 1;
+    double best = 0;
+
+    // Grow the count until one run fills a tenth of the budget
+    while (1) {
+        uint64_t start = now_ns();
+        untimed_ns = 0;
+        if (bench->fn(impl, bench->size, iters) == 0) {
+            return 0;               // Nothing to compare against
+        }
+        if (now_ns() - start - untimed_ns >= budget_ns / 10 || iters >= (1L << 40)) {
+            break;
+        }
+        iters *= 2;
+    }
+    iters *= 10;
+
+    for (int run = 0; run < RUNS; run++) {
+        uint64_t start = now_ns();
+        untimed_ns = 0;
+        long ops = bench->fn(impl, bench->size, iters);
+        double per_op = (double)(now_ns() - start - untimed_ns) / (double)ops;
+        if (run == 0 || per_op < best) {
+            best = per_op;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    uint64_t budget_ns = 50 * 1000000ULL;
+    int first_name = argc;
+    uint64_t rng = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            budget_ns = strtoull(argv[++i], NULL, 0) * 1000000ULL;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-t ms] [benchmark...]\n", argv[0]);
+            return 2;
+        } else {
+            first_name = i;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (char)('a' + rng_below(&rng, 26));
+    }
+    memcpy(other, src, sizeof(src));
+
+    printf("%-12s %8s %12s %12s %8s\n", "benchmark", "size", "MLibc ns/op", "glibc ns/op", "ratio");
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        int selected = first_name == argc;
+        for (int i = first_name; i < argc; i++) {
+            selected |= strcmp(argv[i], benches[b].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+
+        double ml = measure(&benches[b], &ml_impl, budget_ns);
+        double glibc = measure(&benches[b], &glibc_impl, budget_ns);
+        printf("%-12s %8zu %12.2f", benches[b].name, benches[b].size, ml);
+        if (glibc == 0) {
+            printf(" %12s %8s\n", "-", "-");
+        } else {
+            printf(" %12.2f %7.2fx\n", glibc, ml / glibc);
+        }
+    }
+
+    // Each strops implementation the CPU can run, in MB/s
+    for (size_t b = 0; b < sizeof(strops_benches) / sizeof(strops_benches[0]); b++) {
+        int selected = first_name == argc;
+        for (int i = first_name; i < argc; i++) {
+            selected |= strcmp(argv[i], strops_benches[b].name) == 0;
+        }
+        if (selected && !big_src) {
+            big_src = malloc(STROPS_MAX + 1);
+            big_dst = malloc(STROPS_MAX + 1);
+            for (size_t i = 0; i <= STROPS_MAX; i++) {
+                big_src[i] = (char)('a' + rng_below(&rng, 26));
+            }
+            printf("\n%-12s %9s %9s %9s %9s %9s  (MB/s)\n", "strops", "size", "scalar", "sse2",
+                   "avx2", "glibc");
+        }
+        for (size_t n = 0; selected && n < sizeof(strops_sizes) / sizeof(strops_sizes[0]); n++) {
+            bench_t bench = strops_benches[b];
+            bench.size = strops_sizes[n];
+            printf("%-12s %9zu", bench.name, bench.size);
+            for (int i = 0; i < 3; i++) {
+                if (strops_use(strops_impls[i]) != 0) {
+                    printf(" %9s", "-");
+                    continue;
+                }
+                printf(" %9.0f", (double)bench.size * 1000.0 / measure(&bench, &ml_impl, budget_ns));
+            }
+            printf(" %9.0f\n", (double)bench.size * 1000.0 / measure(&bench, &glibc_impl, budget_ns));
+        }
+    }
+    free(big_src);
+    free(big_dst);
+
+    // vmprof's cost per VM instruction: hooks compiled in but off,
+    // sampling from a 1 kHz SIGPROF timer, and tracing every instruction
+    int selected = first_name == argc;
+    for (int i = first_name; i < argc; i++) {
+        selected |= strcmp(argv[i], "vmprof") == 0;
+    }
+    if (selected) {
+        static const char* const modes[] = { "bare", "hooks off", "profiling", "tracing" };
+        struct itimerval timer = { { 0, 1000 }, { 0, 1000 } };
+        struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+        bench_t bare = { "vmprof", 0, bench_vm_bare };
+        bench_t hooked = { "vmprof", 0, bench_vm_hooked };
+        double best[4] = { 0 };
+
+        // Modes take turns so drift on a busy machine hits them alike
+        vm_build();
+        signal(SIGPROF, on_sigprof);
+        for (int round = 0; round < VM_ROUNDS; round++) {
+            for (int m = 0; m < 4; m++) {
+                vmprof_disable(&vm_prof, VMPROF_PROFILE | VMPROF_TRACE);
+                vmprof_enable(&vm_prof, m == 2 ? VMPROF_PROFILE : m == 3 ? VMPROF_TRACE : 0);
+                if (m == 2) {
+                    setitimer(ITIMER_PROF, &timer, NULL);
+                }
+                double ns = measure(m == 0 ? &bare : &hooked, &ml_impl, budget_ns);
+                setitimer(ITIMER_PROF, &stop, NULL);
+                if (round == 0 || ns < best[m]) {
+                    best[m] = ns;
+                }
+            }
+        }
+
+        printf("\n%-12s %9s %9s\n", "vmprof", "ns/insn", "overhead");
+        printf("%-12s %9.3f\n", modes[0], best[0]);
+        for (int m = 1; m < 4; m++) {
+            printf("%-12s %9.3f %+8.1f%%\n", modes[m], best[m], (best[m] / best[0] - 1) * 100);
+        }
+        printf("%-12s %9llu\n", "samples", (unsigned long long)vm_prof.samples);
+        vmprof_destroy(&vm_prof);
+    }
+    return 0;
+}
@@ -0,0 +1,1208 @@
+// Property tests: every MLibc function against glibc on random inputs.
+//
+//   check [-n cases] [-s seed] [-c case] [property...]
+//
+// Each case draws its inputs from its own seed, derived from -s and the
+// case number. A failure prints both, and -s with -c replays that case.
+
+#include "ml.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WHY_SIZE   256
+#define BUF_SIZE   4096
+#define GUARD      64               // Canary bytes on each side of a buffer
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            snprintf(why, WHY_SIZE, __VA_ARGS__);       \
+            return -1;                                  \
+        }                                               \
+    } while (0)
+
+typedef int (*property_fn)(uint64_t* rng, char* why);
+
+typedef struct {
+    const char* name;
+    property_fn fn;
+} property_t;
+
+static unsigned char buf_a[BUF_SIZE + 2 * GUARD];
+static unsigned char buf_b[BUF_SIZE + 2 * GUARD];
+static unsigned char buf_c[BUF_SIZE + 2 * GUARD];
+
+// Mostly short lengths, where the edge cases are, with some long ones
+static size_t random_length(uint64_t* rng, size_t max) {
+    switch (rng_below(rng, 4)) {
+        case 0:  return rng_below(rng, 17 < max ? 17 : max + 1);
+        case 1:  return rng_below(rng, 257 < max ? 257 : max + 1);
+        default: return rng_below(rng, (uint32_t)max + 1);
+    }
+}
+
+static void random_bytes(uint64_t* rng, unsigned char* p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (unsigned char)rng_next(rng);
+    }
+}
+
+// A NUL-terminated string of `len` bytes drawn from `alphabet`, or from
+// all non-zero bytes if alphabet is NULL
+static void random_string(uint64_t* rng, char* s, size_t len, const char* alphabet) {
+    size_t count = alphabet ? strlen(alphabet) : 0;
+
+    for (size_t i = 0; i < len; i++) {
+        s[i] = alphabet ? alphabet[rng_below(rng, (uint32_t)count)]
+                        : (char)(1 + rng_below(rng, 255));
+    }
+    s[len] = '\0';
+}
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+static int prop_memcpy(uint64_t* rng, char* why) {
+    size_t n = random_length(rng, BUF_SIZE - 16);
+    size_t src_off = rng_below(rng, 16);
+    size_t dst_off = rng_below(rng, 16);
+    unsigned char* src = buf_a + GUARD + src_off;
+    unsigned char* dst = buf_b + GUARD + dst_off;
+
+    random_bytes(rng, buf_a, sizeof(buf_a));
+    memset(buf_b, 0xA5, sizeof(buf_b));
+    memcpy(buf_c, buf_b, sizeof(buf_b));
+    memcpy(buf_c + GUARD + dst_off, src, n);
+
+    void* ret = ml_memcpy(dst, src, n);
+    CHECK(ret == dst, "n=%zu: returned %p, not dest %p", n, ret, (void*)dst);
+    for (size_t i = 0; i < sizeof(buf_b); i++) {
+        CHECK(buf_b[i] == buf_c[i], "n=%zu src+%zu dst+%zu: byte %zd differs",
+              n, src_off, dst_off, (ptrdiff_t)i - (ptrdiff_t)(GUARD + dst_off));
+    }
+    return 0;
+}
+
+static int prop_memset(uint64_t* rng, char* why) {
+    size_t n = random_length(rng, BUF_SIZE - 16);
+    size_t off = rng_below(rng, 16);
+    int c = (int)rng_next(rng);     // Only the low byte counts
+
+    random_bytes(rng, buf_a, sizeof(buf_a));
+    memcpy(buf_b, buf_a, sizeof(buf_a));
+    memset(buf_b + GUARD + off, c, n);
+
+    void* ret = ml_memset(buf_a + GUARD + off, c, n);
+    CHECK(ret == buf_a + GUARD + off, "n=%zu: wrong return value", n);
+    for (size_t i = 0; i < sizeof(buf_a); i++) {
+        CHECK(buf_a[i] == buf_b[i], "n=%zu off=%zu c=0x%x: byte %zd differs",
+              n, off, c, (ptrdiff_t)i - (ptrdiff_t)(GUARD + off));
+    }
+    return 0;
+}
+
+static int prop_strlen(uint64_t* rng, char* why) {
+    size_t len = random_length(rng, BUF_SIZE - 32);
+    char* s = (char*)buf_a + GUARD + rng_below(rng, 16);
+
+    random_bytes(rng, buf_a, sizeof(buf_a));
+    random_string(rng, s, len, NULL);
+
+    size_t got = ml_strlen(s);
+    CHECK(got == len, "len=%zu: got %zu", len, got);
+    return 0;
+}
+
+// Two strings that share a random prefix, then differ, end or both
+static void string_pair(uint64_t* rng, char* a, char* b, size_t max) {
+    size_t common = random_length(rng, max);
+    const char* alphabet = rng_below(rng, 2) ? "ab" : NULL;
+
+    random_string(rng, a, common, alphabet);
+    memcpy(b, a, common + 1);
+    switch (rng_below(rng, 4)) {
+        case 0:                     // Equal
+            break;
+        case 1:                     // b is longer
+            random_string(rng, b + common, rng_below(rng, 8) + 1, alphabet);
+            break;
+        default:                    // Differ at `common`, with tails
+            random_string(rng, a + common, rng_below(rng, 8) + 1, alphabet);
+            random_string(rng, b + common, rng_below(rng, 8) + 1, alphabet);
+            break;
+    }
+}
+
+static int prop_strcmp(uint64_t* rng, char* why) {
+    char* a = (char*)buf_a + GUARD + rng_below(rng, 16);
+    char* b = (char*)buf_b + GUARD + rng_below(rng, 16);
+
+    string_pair(rng, a, b, 512);
+    int want = sign(strcmp(a, b));
+    int got = sign(ml_strcmp(a, b));
+    CHECK(got == want, "strcmp(%zu bytes, %zu bytes): sign %d, glibc %d",
+          strlen(a), strlen(b), got, want);
+    got = sign(ml_strcmp(b, a));
+    CHECK(got == -want, "strcmp(b, a) not antisymmetric");
+    return 0;
+}
+
+static int prop_strncmp(uint64_t* rng, char* why) {
+    char* a = (char*)buf_a + GUARD;
+    char* b = (char*)buf_b + GUARD;
+
+    string_pair(rng, a, b, 512);
+    size_t n = rng_below(rng, (uint32_t)strlen(a) + 10);
+    int want = sign(strncmp(a, b, n));
+    int got = sign(ml_strncmp(a, b, n));
+    CHECK(got == want, "strncmp(%zu bytes, %zu bytes, %zu): sign %d, glibc %d",
+          strlen(a), strlen(b), n, got, want);
+    return 0;
+}
+
+static int prop_strchr(uint64_t* rng, char* why) {
+    char* s = (char*)buf_a + GUARD;
+    size_t len = random_length(rng, 512);
+    int c;
+
+    random_string(rng, s, len, rng_below(rng, 2) ? "abcd\xe9" : NULL);
+    switch (rng_below(rng, 3)) {
+        case 0:  c = 0; break;
+        case 1:  c = len ? (unsigned char)s[rng_below(rng, (uint32_t)len)] : 'x'; break;
+        default: c = (int)rng_below(rng, 256); break;
+    }
+
+    char* want = strchr(s, c);
+    char* got = ml_strchr(s, c);
+    CHECK(got == want, "strchr(%zu bytes, 0x%x): offset %td, glibc %td", len, c,
+          got ? got - s : (ptrdiff_t)-1, want ? want - s : (ptrdiff_t)-1);
+    return 0;
+}
+
+static int prop_strstr(uint64_t* rng, char* why) {
+    char* hay = (char*)buf_a + GUARD;
+    char* needle = (char*)buf_b + GUARD;
+    size_t hay_len = random_length(rng, 256);
+    size_t needle_len = rng_below(rng, 7);
+
+    random_string(rng, hay, hay_len, "aab");
+    if (hay_len >= needle_len && rng_below(rng, 2)) {
+        memcpy(needle, hay + rng_below(rng, (uint32_t)(hay_len - needle_len + 1)), needle_len);
+        needle[needle_len] = '\0';
+    } else {
+        random_string(rng, needle, needle_len, "ab");
+    }
+
+    char* want = strstr(hay, needle);
+    char* got = ml_strstr(hay, needle);
+    CHECK(got == want, "strstr(\"%s\", \"%s\"): offset %td, glibc %td", hay, needle,
+          got ? got - hay : (ptrdiff_t)-1, want ? want - hay : (ptrdiff_t)-1);
+    return 0;
+}
+
+static int prop_strcpy(uint64_t* rng, char* why) {
+    char* src = (char*)buf_a + GUARD + rng_below(rng, 16);
+    size_t len = random_length(rng, 1024);
+    size_t prefix = rng_below(rng, 64);
+    size_t n = rng_below(rng, (uint32_t)len + 16);
+
+    random_string(rng, src, len, NULL);
+    memset(buf_b, 0x5A, sizeof(buf_b));
+    memset(buf_c, 0x5A, sizeof(buf_c));
+    random_string(rng, (char*)buf_b + GUARD, prefix, "xyz");
+    memcpy(buf_c, buf_b, sizeof(buf_b));
+
+    switch (rng_below(rng, 3)) {
+        case 0:
+            CHECK(ml_strcpy((char*)buf_b + GUARD, src) == (char*)buf_b + GUARD,
+                  "strcpy: wrong return value");
+            strcpy((char*)buf_c + GUARD, src);
+            break;
+        case 1:
+            CHECK(ml_strncpy((char*)buf_b + GUARD, src, n) == (char*)buf_b + GUARD,
+                  "strncpy: wrong return value");
+            strncpy((char*)buf_c + GUARD, src, n);
+            break;
+        default:
+            CHECK(ml_strcat((char*)buf_b + GUARD, src) == (char*)buf_b + GUARD,
+                  "strcat: wrong return value");
+            strcat((char*)buf_c + GUARD, src);
+            break;
+    }
+    CHECK(memcmp(buf_b, buf_c, sizeof(buf_b)) == 0,
+          "copy of %zu bytes (n=%zu, dest holds %zu) differs from glibc", len, n, prefix);
+    return 0;
+}
+
+// The conversions MLibc supports: %d %u %x %s %c %%. The argument list
+// is fixed (int, int, char*, int, char*, int); each slot gets a random
+// conversion of the right kind, with literal text and %% in between.
+static void random_format(uint64_t* rng, char* fmt, int ints[4], char strs[2][64]) {
+    static const char* const int_convs[] = { "%d", "%u", "%x", "%c" };
+    static const int int_edges[] = { 0, 1, -1, INT_MAX, INT_MIN, 10, -10, 0x7F };
+    char* out = fmt;
+    int next_int = 0;
+    int next_str = 0;
+
+    for (int slot = 0; slot < 6; slot++) {
+        size_t text = rng_below(rng, 6);
+        random_string(rng, out, text, "abc XYZ-=:");
+        out += text;
+        if (rng_below(rng, 4) == 0) {
+            out += sprintf(out, "%%%%");
+        }
+
+        if (slot == 2 || slot == 4) {
+            random_string(rng, strs[next_str++], random_length(rng, 40),
+                          "abcdefghijklmnopqrstuvwxyz0123456789 %");
+            out += sprintf(out, "%%s");
+            continue;
+        }
+        const char* conv = int_convs[rng_below(rng, 4)];
+        int value;
+        if (conv[1] == 'c') {
+            value = 1 + (int)rng_below(rng, 255);
+        } else if (rng_below(rng, 3) == 0) {
+            value = int_edges[rng_below(rng, sizeof(int_edges) / sizeof(int_edges[0]))];
+        } else {
+            value = (int)rng_next(rng) >> rng_below(rng, 32);
+        }
+        ints[next_int++] = value;
+        out += sprintf(out, "%s", conv);
+    }
+    *out = '\0';
+}
+
+static int prop_snprintf(uint64_t* rng, char* why) {
+    char fmt[256];
+    int ints[4];
+    char strs[2][64];
+    char got[512];
+    char want[512];
+
+    random_format(rng, fmt, ints, strs);
+    int full = snprintf(want, sizeof(want), fmt, ints[0], ints[1], strs[0], ints[2], strs[1], ints[3]);
+    size_t size = rng_below(rng, 4) ? (size_t)full + 1 : rng_below(rng, (uint32_t)full + 2);
+
+    memset(got, 0x5A, sizeof(got));
+    memset(want, 0x5A, sizeof(want));
+    int got_len = ml_snprintf(got, size, fmt, ints[0], ints[1], strs[0], ints[2], strs[1], ints[3]);
+    snprintf(want, size, fmt, ints[0], ints[1], strs[0], ints[2], strs[1], ints[3]);
+    CHECK(got_len == full, "snprintf(\"%s\"): returned %d, glibc %d", fmt, got_len, full);
+    CHECK(memcmp(got, want, sizeof(got)) == 0, "snprintf(\"%s\", size %zu): output differs",
+          fmt, size);
+
+    capture_reset();
+    got_len = ml_snprintf(NULL, 0, fmt, ints[0], ints[1], strs[0], ints[2], strs[1], ints[3]);
+    CHECK(got_len == full, "snprintf(NULL, 0, \"%s\"): returned %d, glibc %d", fmt, got_len, full);
+    CHECK(capture_len == 0, "snprintf(NULL, 0, \"%s\") wrote to the console", fmt);
+
+    capture_reset();
+    got_len = ml_printf(fmt, ints[0], ints[1], strs[0], ints[2], strs[1], ints[3]);
+    snprintf(want, sizeof(want), fmt, ints[0], ints[1], strs[0], ints[2], strs[1], ints[3]);
+    CHECK(got_len == full && capture_len == (size_t)full &&
+          memcmp(capture_buf, want, (size_t)full) == 0,
+          "printf(\"%s\"): wrote %zu bytes, returned %d, glibc %d", fmt, capture_len, got_len, full);
+    return 0;
+}
+
+static int prop_atoi(uint64_t* rng, char* why) {
+    char s[64];
+    char* out = s;
+
+    for (uint32_t i = rng_below(rng, 3); i > 0; i--) {
+        *out++ = rng_below(rng, 2) ? ' ' : '\t';
+    }
+    switch (rng_below(rng, 3)) {
+        case 0: *out++ = '-'; break;
+        case 1: *out++ = '+'; break;
+    }
+    size_t digits = rng_below(rng, 10);   // Stays inside int
+    random_string(rng, out, digits, "0123456789");
+    out += digits;
+    random_string(rng, out, rng_below(rng, 4), "x9 -");
+
+    CHECK(ml_atoi(s) == atoi(s), "atoi(\"%s\"): %d, glibc %d", s, ml_atoi(s), atoi(s));
+    return 0;
+}
+
+// Blocks are powers of two with an 8-byte header, so a request never
+// takes more than twice its size plus the header, and at least 16 bytes
+static size_t worst_block(size_t size) {
+    return 2 * ((size < 8 ? 8 : size) + 8);
+}
+
+// Fill every block with its index, then check none was overwritten
+static int fill_and_check(unsigned char** blocks, const size_t* sizes, int count, char* why) {
+    for (int i = 0; i < count; i++) {
+        memset(blocks[i], i & 0xFF, sizes[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            CHECK(blocks[i][j] == (i & 0xFF), "block %d of %zu bytes overlaps another", i, sizes[i]);
+        }
+    }
+    return 0;
+}
+
+static int prop_malloc(uint64_t* rng, char* why) {
+    unsigned char* blocks[512];
+    size_t sizes[512];
+    size_t worst = 0;
+    int count = 0;
+
+    ml_heap_reset();
+    while (count < 512) {
+        size_t size = random_length(rng, 2048);
+        unsigned char* p = ml_malloc(size);
+        if (!p) {
+            CHECK(worst + worst_block(size) > ML_HEAP_SIZE,
+                  "malloc(%zu) failed with at most %zu bytes in use", size, worst);
+            break;
+        }
+        CHECK(((uintptr_t)p & 7) == 0, "malloc(%zu) = %p is not 8-byte aligned", size, (void*)p);
+        blocks[count] = p;
+        sizes[count] = size;
+        worst += worst_block(size);
+        count++;
+    }
+    if (fill_and_check(blocks, sizes, count, why) != 0) {
+        return -1;
+    }
+
+    // Free a random half and allocate the same sizes again. Each freed
+    // block is reused for its size class, so none of them can fail.
+    int freed[512];
+    for (int i = 0; i < count; i++) {
+        freed[i] = rng_below(rng, 2);
+        if (freed[i]) {
+            ml_free(blocks[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (freed[i]) {
+            blocks[i] = ml_malloc(sizes[i]);
+            CHECK(blocks[i], "malloc(%zu) failed after the same size was freed", sizes[i]);
+        }
+    }
+    if (fill_and_check(blocks, sizes, count, why) != 0) {
+        return -1;
+    }
+    ml_heap_reset();
+    return 0;
+}
+
+static const char* const strops_impls[] = { "scalar", "sse2", "avx2" };
+
+// Switch strops to a random one of the versions this CPU can run
+static const char* pick_strops(uint64_t* rng) {
+    while (1) {
+        const char* name = strops_impls[rng_below(rng, 3)];
+        if (strops_use(name) == 0) {
+            return name;
+        }
+    }
+}
+
+static int prop_str_case(uint64_t* rng, char* why) {
+    const char* impl = pick_strops(rng);
+    char* src = (char*)buf_a + GUARD + rng_below(rng, 32);
+    size_t len = random_length(rng, 2048);
+    int upper = (int)rng_below(rng, 2);
+    int in_place = (int)rng_below(rng, 4) == 0;
+    char* dest = in_place ? src : (char*)buf_b + GUARD + rng_below(rng, 32);
+
+    random_bytes(rng, buf_a, sizeof(buf_a));
+    random_string(rng, src, len, rng_below(rng, 2) ? "azAZ@[`{ 09\x80\xc1\xe1\xfa" : NULL);
+    memset(buf_b, 0x5A, sizeof(buf_b));
+    memcpy(buf_c, in_place ? buf_a : buf_b, sizeof(buf_c));
+    char* want = (char*)buf_c + (dest - (char*)(in_place ? buf_a : buf_b));
+    for (size_t i = 0; i <= len; i++) {
+        unsigned char c = (unsigned char)src[i];
+        want[i] = (char)(c >= (upper ? 'a' : 'A') && c <= (upper ? 'z' : 'Z') ? c ^ 0x20 : c);
+    }
+
+    size_t got = upper ? str_to_upper(dest, src) : str_to_lower(dest, src);
+    CHECK(got == len, "%s: str_to_%s of %zu bytes returned %zu", impl, upper ? "upper" : "lower",
+          len, got);
+    CHECK(memcmp(in_place ? buf_a : buf_b, buf_c, sizeof(buf_c)) == 0,
+          "%s: str_to_%s of %zu bytes%s differs", impl, upper ? "upper" : "lower", len,
+          in_place ? " in place" : "");
+    return 0;
+}
+
+static int prop_str_trim(uint64_t* rng, char* why) {
+    const char* impl = pick_strops(rng);
+    char* src = (char*)buf_a + GUARD + rng_below(rng, 32);
+    size_t len = random_length(rng, 1024);
+    int in_place = (int)rng_below(rng, 4) == 0;
+    char* dest = in_place ? src : (char*)buf_b + GUARD + rng_below(rng, 32);
+    char want[BUF_SIZE];
+
+    random_string(rng, src, len, rng_below(rng, 2) ? " \t\n\r\v\fab" : " \tx");
+    size_t start = 0, end = len;
+    while (start < end && strchr(" \t\n\r\v\f", src[start])) {
+        start++;
+    }
+    while (end > start && strchr(" \t\n\r\v\f", src[end - 1])) {
+        end--;
+    }
+    memcpy(want, src + start, end - start);
+    want[end - start] = '\0';
+
+    size_t got = str_trim(dest, src);
+    CHECK(got == end - start && strcmp(dest, want) == 0,
+          "%s: str_trim of %zu bytes%s: %zu bytes, expected %zu", impl, len,
+          in_place ? " in place" : "", got, end - start);
+    return 0;
+}
+
+static int prop_str_find(uint64_t* rng, char* why) {
+    const char* impl = pick_strops(rng);
+    char* hay = (char*)buf_a + GUARD + rng_below(rng, 32);
+    char* needle = (char*)buf_b + GUARD + rng_below(rng, 32);
+    size_t hay_len = random_length(rng, 1024);
+    size_t needle_len = rng_below(rng, 40);
+
+    random_string(rng, hay, hay_len, "aab");
+    if (hay_len >= needle_len && rng_below(rng, 2)) {
+        memcpy(needle, hay + rng_below(rng, (uint32_t)(hay_len - needle_len + 1)), needle_len);
+        needle[needle_len] = '\0';
+    } else {
+        random_string(rng, needle, needle_len, "ab");
+    }
+
+    const char* want = strstr(hay, needle);
+    const char* got = str_find(hay, needle);
+    CHECK(got == want, "%s: str_find(%zu bytes, \"%s\"): offset %td, glibc %td", impl,
+          hay_len, needle, got ? got - hay : (ptrdiff_t)-1, want ? want - hay : (ptrdiff_t)-1);
+    CHECK(str_contains(hay, needle) == (want != NULL), "%s: str_contains wrong", impl);
+    CHECK(str_starts_with(hay, needle) == (strncmp(hay, needle, needle_len) == 0),
+          "%s: str_starts_with(%zu bytes, \"%s\") wrong", impl, hay_len, needle);
+    CHECK(str_ends_with(hay, needle) == (hay_len >= needle_len &&
+                                         strcmp(hay + hay_len - needle_len, needle) == 0),
+          "%s: str_ends_with(%zu bytes, \"%s\") wrong", impl, hay_len, needle);
+    return 0;
+}
+
+// Against strtoll, which saturates out-of-range values the same way
+static int prop_str_parse_int(uint64_t* rng, char* why) {
+    static const char* const edges[] = {
+        "9223372036854775807", "9223372036854775808", "9223372036854775809",
+        "9999999999999999999", "18446744073709551616", "99999999999999999999",
+    };
+    char s[96];
+    char* out = s;
+
+    random_string(rng, out, rng_below(rng, 3), " \t\n");
+    out += strlen(out);
+    switch (rng_below(rng, 3)) {
+        case 0: *out++ = '-'; break;
+        case 1: *out++ = '+'; break;
+    }
+    random_string(rng, out, rng_below(rng, 4) ? 0 : rng_below(rng, 6), "0");
+    out += strlen(out);
+    if (rng_below(rng, 4) == 0) {
+        out += sprintf(out, "%s", edges[rng_below(rng, 6)]);
+    } else {
+        size_t digits = rng_below(rng, 23);
+        random_string(rng, out, digits, "0123456789");
+        out += digits;
+    }
+    random_string(rng, out, rng_below(rng, 4), "x9 -.");
+
+    long long want = strtoll(s, NULL, 10);
+    int64_t got = str_parse_int(s);
+    CHECK(got == want, "str_parse_int(\"%s\"): %lld, strtoll %lld", s, (long long)got, want);
+    return 0;
+}
+
+// Values MicroASM works with: up to 15 digits on each side of the point
+// and small exponents, within a few units in the last place of strtod
+static int prop_str_parse_float(uint64_t* rng, char* why) {
+    char s[96];
+    char* out = s;
+
+    if (rng_below(rng, 2)) {
+        *out++ = rng_below(rng, 2) ? '-' : '+';
+    }
+    size_t digits = 1 + rng_below(rng, 15);
+    random_string(rng, out, digits, "0123456789");
+    out += digits;
+    if (rng_below(rng, 2)) {
+        *out++ = '.';
+        digits = rng_below(rng, 16);
+        random_string(rng, out, digits, "0123456789");
+        out += digits;
+    }
+    if (rng_below(rng, 3) == 0) {
+        out += sprintf(out, "e%d", (int)rng_below(rng, 61) - 30);
+    }
+    *out = '\0';
+
+    double want = strtod(s, NULL);
+    double got = str_parse_float(s);
+    double err = want == 0 ? got - want : (got - want) / want;
+    CHECK(err < 1e-13 && err > -1e-13, "str_parse_float(\"%s\"): %.17g, strtod %.17g",
+          s, got, want);
+    return 0;
+}
+
+// StringOperations.format takes one 64-bit value per conversion, so its
+// %d, %u and %x match glibc's %lld, %llu and %llx
+static int prop_str_format(uint64_t* rng, char* why) {
+    static const char* const convs[][2] = { { "%d", "%lld" }, { "%u", "%llu" }, { "%x", "%llx" } };
+    static const uint64_t edges[] = {
+        0, 1, (uint64_t)-1, (uint64_t)INT64_MIN, (uint64_t)INT64_MAX, 0x80000000ULL, 0xFFFFFFFFULL
+    };
+    char fmt[256], glibc_fmt[256];
+    char* out = fmt;
+    char* glibc_out = glibc_fmt;
+    uint64_t args[4];
+    char got[512], want[512];
+
+    for (int i = 0; i < 4; i++) {
+        size_t text = rng_below(rng, 5);
+        random_string(rng, out, text, "ab :-");
+        memcpy(glibc_out, out, text);
+        out += text;
+        glibc_out += text;
+
+        int conv = (int)rng_below(rng, 3);
+        out += sprintf(out, "%s", convs[conv][0]);
+        glibc_out += sprintf(glibc_out, "%s", convs[conv][1]);
+        args[i] = rng_below(rng, 3) == 0 ? edges[rng_below(rng, 7)] : rng_next(rng) >> rng_below(rng, 64);
+    }
+    *out = '\0';
+    *glibc_out = '\0';
+
+    int full = snprintf(want, sizeof(want), glibc_fmt, (long long)args[0], (long long)args[1],
+                        (long long)args[2], (long long)args[3]);
+    int len = str_format(got, sizeof(got), fmt, args);
+    CHECK(len == full && strcmp(got, want) == 0, "str_format(\"%s\"): \"%s\", glibc \"%s\"",
+          fmt, got, want);
+    return 0;
+}
+
+#define VECTOR_MAX 600
+#define MAP_KEYS   200
+
+// Element `id` of a vector with `size`-byte elements
+static void vector_elem(unsigned char* out, size_t size, uint32_t id) {
+    for (size_t i = 0; i < size; i++) {
+        out[i] = (unsigned char)(id * 31 + i);
+    }
+}
+
+// Random pushes, removals and clears against a plain array of ids
+static int prop_vector(uint64_t* rng, char* why) {
+    static uint32_t model[VECTOR_MAX];
+    size_t elem_size = 1 + rng_below(rng, 24);
+    size_t count = 0;
+    uint32_t next_id = 0;
+    unsigned char want[24];
+    vector_t v;
+
+    ml_heap_reset();
+    CHECK(vector_init(&v, elem_size, rng_below(rng, 3) ? 0 : rng_below(rng, 64)) == 0,
+          "vector_init failed");
+    for (uint32_t op = rng_below(rng, 2000); op > 0; op--) {
+        uint32_t choice = rng_below(rng, 100);
+        if (choice < 60 && count < VECTOR_MAX) {
+            vector_elem(want, elem_size, next_id);
+            void* slot = vector_push(&v, want);
+            CHECK(slot && memcmp(slot, want, elem_size) == 0,
+                  "push of element %zu (%zu bytes) failed", count, elem_size);
+            model[count++] = next_id++;
+        } else if (choice < 95) {
+            size_t index = rng_below(rng, (uint32_t)count + 2);
+            int ret = vector_remove(&v, index);
+            CHECK(ret == (index < count ? 0 : -1), "remove(%zu) of %zu returned %d",
+                  index, count, ret);
+            if (index < count) {
+                memmove(model + index, model + index + 1, (count - index - 1) * sizeof(model[0]));
+                count--;
+            }
+        } else if (choice < 98) {
+            size_t capacity = count + rng_below(rng, 256);
+            CHECK(vector_reserve(&v, capacity) == 0 && v.capacity >= capacity,
+                  "reserve(%zu) failed", capacity);
+        } else {
+            vector_clear(&v);
+            count = 0;
+        }
+    }
+
+    CHECK(v.size == count && v.capacity >= count, "size %zu capacity %zu, expected %zu",
+          v.size, v.capacity, count);
+    CHECK(vector_get(&v, count) == NULL, "get(%zu) past the end is not NULL", count);
+    for (size_t i = 0; i < count; i++) {
+        vector_elem(want, elem_size, model[i]);
+        CHECK(memcmp(vector_get(&v, i), want, elem_size) == 0,
+              "element %zu of %zu (%zu bytes) differs", i, count, elem_size);
+    }
+    vector_destroy(&v);
+    ml_heap_reset();
+    return 0;
+}
+
+// Random puts, removals and clears over a pool of keys, against a table
+// of which keys are present. Removing and putting keys back exercises
+// tombstone reuse and in-place rehashing; a growing pool, doubling.
+static int prop_hashmap(uint64_t* rng, char* why) {
+    static char keys[MAP_KEYS][32];
+    static uint64_t values[MAP_KEYS];
+    static unsigned char present[MAP_KEYS];
+    static unsigned char seen[MAP_KEYS];
+    uint32_t pool = 1 + rng_below(rng, MAP_KEYS);
+    size_t count = 0;
+    hashmap_t map;
+
+    // A distinct number, then a tail from a tiny alphabet so that many
+    // keys share prefixes and lengths
+    for (uint32_t k = 0; k < pool; k++) {
+        int len = sprintf(keys[k], "%u.", k);
+        random_string(rng, keys[k] + len, rng_below(rng, 20), "ab");
+    }
+    memset(present, 0, sizeof(present));
+
+    ml_heap_reset();
+    CHECK(hashmap_init(&map, sizeof(uint64_t), rng_below(rng, 2) ? 0 : rng_below(rng, 100)) == 0,
+          "hashmap_init failed");
+    for (uint32_t op = rng_below(rng, 1500); op > 0; op--) {
+        uint32_t choice = rng_below(rng, 100);
+        uint32_t k = rng_below(rng, pool);
+        if (choice < 55) {
+            uint64_t value = rng_next(rng);
+            uint64_t* stored = hashmap_put(&map, keys[k], &value);
+            CHECK(stored && *stored == value, "put(\"%s\") with %zu entries failed",
+                  keys[k], count);
+            count += !present[k];
+            present[k] = 1;
+            values[k] = value;
+        } else if (choice < 85) {
+            int ret = hashmap_remove(&map, keys[k]);
+            CHECK(ret == (present[k] ? 0 : -1), "remove(\"%s\") returned %d", keys[k], ret);
+            count -= present[k];
+            present[k] = 0;
+        } else if (choice < 99) {
+            uint64_t* stored = hashmap_get(&map, keys[k]);
+            CHECK(present[k] ? stored && *stored == values[k] : !stored,
+                  "get(\"%s\") wrong mid-run", keys[k]);
+        } else {
+            hashmap_clear(&map);
+            memset(present, 0, sizeof(present));
+            count = 0;
+        }
+    }
+
+    CHECK(map.size == count, "size %zu, expected %zu", map.size, count);
+    CHECK((map.capacity & (map.capacity - 1)) == 0 && map.size < map.capacity,
+          "capacity %zu holding %zu", map.capacity, map.size);
+    for (uint32_t k = 0; k < pool; k++) {
+        uint64_t* stored = hashmap_get(&map, keys[k]);
+        CHECK(present[k] ? stored && *stored == values[k] : !stored,
+              "get(\"%s\"): %s, expected %s", keys[k], stored ? "found" : "missing",
+              present[k] ? "found" : "missing");
+        CHECK(hashmap_contains(&map, keys[k]) == present[k], "contains(\"%s\") wrong", keys[k]);
+    }
+
+    // Iteration visits each live entry exactly once
+    size_t cursor = 0, visited = 0, key_len;
+    const char* key;
+    void* value;
+    memset(seen, 0, sizeof(seen));
+    while (hashmap_next(&map, &cursor, &key, &key_len, &value)) {
+        uint32_t k = (uint32_t)strtoul(key, NULL, 10);
+        CHECK(k < pool && present[k] && !seen[k] && key_len == strlen(keys[k]) &&
+              memcmp(key, keys[k], key_len) == 0 && *(uint64_t*)value == values[k],
+              "iteration returned \"%.*s\", not a live entry", (int)key_len, key);
+        seen[k] = 1;
+        visited++;
+    }
+    CHECK(visited == count, "iteration visited %zu of %zu entries", visited, count);
+    hashmap_destroy(&map);
+    ml_heap_reset();
+    return 0;
+}
+
+#define MBC_INSNS  80
+#define MBC_LABELS 24
+
+typedef struct {
+    int opcode;
+    int argc;
+    mbc_operand_t args[MBC_MAX_ARGS];
+    uint32_t offset;
+} mbc_model_t;
+
+static const char* const mbc_imports[] = {
+    "Math.sin", "Math.cos", "StringOperations.trim", "Debug.profileStart"
+};
+
+static uint64_t mbc_buf[4096];      // 8-byte aligned, as mbc_write needs
+
+// Closest label at or before `pc` in the model, or MBC_NO_OFFSET
+static uint32_t model_label_offset(const uint32_t* offsets, int count, uint32_t pc) {
+    uint32_t best = MBC_NO_OFFSET;
+
+    for (int i = 0; i < count; i++) {
+        if (offsets[i] <= pc && (best == MBC_NO_OFFSET || offsets[i] > best)) {
+            best = offsets[i];
+        }
+    }
+    return best;
+}
+
+// Assemble a random program with the writer, load it back and check
+// every label, operand and DB record, then check that images with bad
+// label tables or bounds are rejected
+static int prop_mbc(uint64_t* rng, char* why) {
+    static mbc_model_t insns[MBC_INSNS];
+    static char names[MBC_LABELS][8];
+    static uint32_t offsets[MBC_LABELS];
+    static uint64_t bad[4096];
+    int label_count = 1 + (int)rng_below(rng, MBC_LABELS);
+    int insn_count = (int)rng_below(rng, MBC_INSNS);
+    int entry = rng_below(rng, 2) ? (int)rng_below(rng, (uint32_t)label_count) : -1;
+    uint32_t code_size = 0;
+    uint8_t data[64];
+    mbc_writer_t w;
+    mbc_image_t img;
+
+    ml_heap_reset();
+    CHECK(mbc_writer_init(&w) == 0, "mbc_writer_init failed");
+    for (int i = 0; i < label_count; i++) {
+        sprintf(names[i], "L%d", i);
+        offsets[i] = MBC_NO_OFFSET;
+    }
+    if (entry >= 0) {
+        CHECK(mbc_set_entry(&w, names[entry]) == 0, "mbc_set_entry failed");
+    }
+
+    for (int i = 0; i < insn_count; i++) {
+        mbc_model_t* insn = &insns[i];
+        int label = (int)rng_below(rng, (uint32_t)label_count);
+
+        if (rng_below(rng, 4) == 0 && offsets[label] == MBC_NO_OFFSET) {
+            CHECK(mbc_define_label(&w, names[label]) == 0, "define %s failed", names[label]);
+            offsets[label] = code_size;
+        }
+        insn->opcode = (int)rng_below(rng, MBC_OP_COUNT);
+        insn->argc = (int)rng_below(rng, MBC_MAX_ARGS + 1);
+        insn->offset = code_size;
+        for (int a = 0; a < insn->argc; a++) {
+            mbc_operand_t* arg = &insn->args[a];
+            arg->kind = (int)rng_below(rng, 4);
+            arg->value = arg->kind == MBC_ARG_REG ? (int64_t)rng_below(rng, 16) : (int64_t)rng_next(rng);
+            arg->name = mbc_imports[rng_below(rng, 4)];
+            if (arg->kind == MBC_ARG_LABEL) {
+                // The writer goes by name; the model keeps the index
+                arg->value = rng_below(rng, (uint32_t)label_count);
+                arg->name = names[arg->value];
+            }
+        }
+        CHECK(mbc_emit(&w, insn->opcode, insn->argc, insn->args) == 0, "emit %d: %s", i, w.error);
+        code_size += (uint32_t)(sizeof(mbc_insn_t) + insn->argc * sizeof(int64_t));
+
+        if (rng_below(rng, 8) == 0) {
+            random_bytes(rng, data, sizeof(data));
+            CHECK(mbc_define_data(&w, (uint64_t)i * 64, data, (uint32_t)(i % 64)) == 0,
+                  "define_data failed");
+        }
+    }
+
+    // Any label still undefined goes at the end of the code
+    for (int i = 0; i < label_count; i++) {
+        if (offsets[i] == MBC_NO_OFFSET) {
+            CHECK(mbc_define_label(&w, names[i]) == 0, "define %s failed", names[i]);
+            offsets[i] = code_size;
+        }
+    }
+    CHECK(mbc_define_label(&w, names[0]) != 0, "duplicate label %s accepted", names[0]);
+
+    size_t size = mbc_image_size(&w);
+    CHECK(size <= sizeof(mbc_buf), "image of %zu bytes", size);
+    CHECK(mbc_write(&w, mbc_buf, size) == 0, "mbc_write: %s", w.error);
+    CHECK(mbc_open(&img, mbc_buf, size) == 0, "mbc_open rejected a written image");
+
+    CHECK(img.code_size == code_size && img.label_count == (uint32_t)label_count,
+          "code %u bytes, %u labels; expected %u and %d", img.code_size, img.label_count,
+          code_size, label_count);
+    CHECK(img.header->entry == (entry >= 0 ? offsets[entry] : 0), "entry %u", img.header->entry);
+    for (int i = 0; i < label_count; i++) {
+        CHECK(mbc_find_label(&img, names[i]) == offsets[i], "find_label(%s): %u, expected %u",
+              names[i], mbc_find_label(&img, names[i]), offsets[i]);
+    }
+    CHECK(mbc_find_label(&img, "missing") == MBC_NO_OFFSET, "found a missing label");
+
+    for (int i = 0; i < insn_count; i++) {
+        const mbc_model_t* insn = &insns[i];
+        const mbc_insn_t* got = mbc_insn_at(&img, insn->offset);
+        CHECK(got && got->opcode == insn->opcode && got->argc == insn->argc,
+              "instruction %d at %u differs", i, insn->offset);
+
+        const int64_t* values = (const int64_t*)(got + 1);
+        for (int a = 0; a < insn->argc; a++) {
+            const mbc_operand_t* arg = &insn->args[a];
+            int ok = (int)MBC_ARG_KIND(got, a) == arg->kind;
+            if (arg->kind == MBC_ARG_LABEL) {
+                ok = ok && values[a] == (int64_t)offsets[arg->value];
+            } else if (arg->kind == MBC_ARG_IMPORT) {
+                const char* name = mbc_import_name(&img, (uint32_t)values[a]);
+                ok = ok && name && strcmp(name, arg->name) == 0;
+            } else {
+                ok = ok && values[a] == arg->value;
+            }
+            CHECK(ok, "instruction %d operand %d (kind %d) differs", i, a, arg->kind);
+        }
+
+        uint32_t want = model_label_offset(offsets, label_count, insn->offset);
+        const char* label = mbc_label_at(&img, insn->offset);
+        CHECK(label ? mbc_find_label(&img, label) == want : want == MBC_NO_OFFSET,
+              "label_at(%u): %s, expected one at %u", insn->offset, label ? label : "none", want);
+    }
+    CHECK(mbc_insn_at(&img, code_size) == NULL, "instruction past the end of the code");
+
+    // Corrupt one thing the loader must catch
+    memcpy(bad, mbc_buf, size);
+    mbc_header_t* header = (mbc_header_t*)bad;
+    mbc_label_t* labels = (mbc_label_t*)((uint8_t*)bad + header->sections[MBC_SECTION_LABELS].offset);
+    uint32_t* order = (uint32_t*)((uint8_t*)bad + header->sections[MBC_SECTION_LABEL_ORDER].offset);
+    uint32_t k = rng_below(rng, (uint32_t)label_count);
+    size_t bad_size = size;
+    switch (rng_below(rng, 4)) {
+        case 0:
+            order[k] = (uint32_t)label_count + rng_below(rng, 1000);
+            break;
+        case 1:
+            labels[k].code_offset = code_size + 1 + rng_below(rng, 1000);
+            break;
+        case 2:
+            bad_size = header->sections[MBC_SECTION_STRINGS].offset +
+                       header->sections[MBC_SECTION_STRINGS].size - 1;
+            break;
+        default:
+            header->entry = code_size + 1;
+            break;
+    }
+    CHECK(mbc_open(&img, bad, bad_size) != 0, "mbc_open accepted a corrupt image");
+
+    mbc_writer_destroy(&w);
+    ml_heap_reset();
+    return 0;
+}
+
+#define PROF_LABELS 12
+#define PROF_OPS    400
+#define PROF_DEPTH  (VMPROF_MAX_DEPTH + 6)
+
+typedef struct {
+    char lines[256][VMPROF_STACK_KEY + 32];
+    int count;
+} prof_lines_t;
+
+static void collect_line(void* ctx, const char* line) {
+    prof_lines_t* out = ctx;
+
+    if (out->count < 256) {
+        snprintf(out->lines[out->count++], sizeof(out->lines[0]), "%s", line);
+    }
+}
+
+static int has_line(const prof_lines_t* out, const char* line) {
+    for (int i = 0; i < out->count; i++) {
+        if (strcmp(out->lines[i], line) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Drive the profiler with random ticks, polls, calls, returns and MNI
+// calls, keeping the call stack and every expected count in a model,
+// then compare its folded stacks and summary line by line
+static int prop_vmprof(uint64_t* rng, char* why) {
+    static char names[PROF_LABELS][8];
+    static uint32_t offsets[PROF_LABELS];
+    static char keys[PROF_OPS][VMPROF_STACK_KEY];
+    static uint64_t key_counts[PROF_OPS];
+    static prof_lines_t out;
+    static vmprof_t prof;
+    uint32_t stack[PROF_DEPTH], frames[PROF_DEPTH];
+    uint64_t label_hits[PROF_LABELS + 1] = { 0 };
+    uint64_t mni[4] = { 0 };
+    uint32_t depth = 0, code_size = 0;
+    int key_count = 0, on = 0, pending = 0;
+    uint64_t samples = 0;
+    mbc_writer_t w;
+    mbc_image_t img;
+    mbc_operand_t args[2];
+    char line[VMPROF_STACK_KEY + 32];
+
+    // One instruction per label, with a gap before the first so some
+    // samples land before every label
+    ml_heap_reset();
+    CHECK(mbc_writer_init(&w) == 0, "mbc_writer_init failed");
+    args[0].kind = MBC_ARG_IMPORT;
+    args[1].kind = MBC_ARG_REG;
+    args[1].value = 0;
+    for (int i = 0; i < PROF_LABELS; i++) {
+        sprintf(names[i], "f%d", i);
+        args[0].name = mbc_imports[i % 4];
+        mbc_emit(&w, MBC_OP_MNI, 2, args);
+        offsets[i] = code_size += 24;
+        mbc_define_label(&w, names[i]);
+    }
+    mbc_emit(&w, MBC_OP_RET, 0, args);
+    code_size += 8;
+    size_t size = mbc_image_size(&w);
+    CHECK(mbc_write(&w, mbc_buf, size) == 0 && mbc_open(&img, mbc_buf, size) == 0,
+          "could not build the image");
+    mbc_writer_destroy(&w);
+
+    // The profiler gets the whole heap to itself
+    ml_heap_reset();
+    CHECK(vmprof_init(&prof, &img) == 0, "vmprof_init failed");
+    for (int op = 0; op < PROF_OPS; op++) {
+        switch (rng_below(rng, 8)) {
+            case 0:
+                if (rng_below(rng, 2)) {
+                    vmprof_enable(&prof, VMPROF_PROFILE);
+                    on = 1;
+                } else {
+                    vmprof_disable(&prof, VMPROF_PROFILE);
+                    on = pending = 0;
+                }
+                break;
+            case 1:
+                vmprof_tick(&prof);
+                pending |= on;
+                break;
+            case 2:
+            case 3: {
+                uint32_t pc = rng_below(rng, code_size);
+                VMPROF_STEP(&prof, pc, MBC_OP_MNI, frames, depth);
+                if (!pending) {
+                    break;
+                }
+                pending = 0;
+                samples++;
+
+                // Frames outermost first, then the label holding pc
+                // unless it is the innermost frame's own
+                int leaf = -1;
+                for (int i = 0; i < PROF_LABELS; i++) {
+                    if (offsets[i] <= pc) {
+                        leaf = i;
+                    }
+                }
+                label_hits[leaf >= 0 ? leaf : PROF_LABELS]++;
+                int len = 0;
+                const char* caller = NULL;
+                keys[key_count][0] = '\0';
+                for (uint32_t i = 0; i < depth && i < VMPROF_MAX_DEPTH; i++) {
+                    caller = names[stack[i]];
+                    len += sprintf(keys[key_count] + len, "%s%s", len ? ";" : "", caller);
+                }
+                const char* leaf_name = leaf >= 0 ? names[leaf] : "[unknown]";
+                if (!caller || strcmp(caller, leaf_name) != 0) {
+                    sprintf(keys[key_count] + len, "%s%s", len ? ";" : "", leaf_name);
+                }
+
+                int k = 0;
+                while (k < key_count && strcmp(keys[k], keys[key_count]) != 0) {
+                    k++;
+                }
+                key_counts[k] = k == key_count ? 1 : key_counts[k] + 1;
+                key_count += k == key_count;
+                break;
+            }
+            case 4:
+            case 5:
+                if (depth < PROF_DEPTH) {
+                    uint32_t target = rng_below(rng, PROF_LABELS);
+                    frames[depth] = offsets[target];
+                    stack[depth++] = target;
+                }
+                break;
+            case 6:
+                depth -= depth > 0;
+                break;
+            default: {
+                uint32_t import = rng_below(rng, 5);     // 4 is out of range
+                vmprof_mni(&prof, import);
+                if (on && import < 4) {
+                    mni[import]++;
+                }
+                break;
+            }
+        }
+    }
+
+    out.count = 0;
+    vmprof_write_folded(&prof, collect_line, &out);
+    CHECK(out.count == key_count, "%d folded stacks, expected %d", out.count, key_count);
+    for (int k = 0; k < key_count; k++) {
+        snprintf(line, sizeof(line), "%s %llu", keys[k], (unsigned long long)key_counts[k]);
+        CHECK(has_line(&out, line), "folded line \"%s\" missing", line);
+    }
+
+    out.count = 0;
+    vmprof_write_summary(&prof, collect_line, &out);
+    snprintf(line, sizeof(line), "samples %llu", (unsigned long long)samples);
+    CHECK(out.count > 0 && strcmp(out.lines[0], line) == 0, "summary starts \"%s\", expected \"%s\"",
+          out.count ? out.lines[0] : "", line);
+    int expected = 1;
+    for (int i = 0; i <= PROF_LABELS; i++) {
+        if (label_hits[i]) {
+            snprintf(line, sizeof(line), "label %s %llu", i < PROF_LABELS ? names[i] : "[unknown]",
+                     (unsigned long long)label_hits[i]);
+            CHECK(has_line(&out, line), "summary line \"%s\" missing", line);
+            expected++;
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        if (mni[i]) {
+            snprintf(line, sizeof(line), "mni %s %llu", mbc_imports[i], (unsigned long long)mni[i]);
+            CHECK(has_line(&out, line), "summary line \"%s\" missing", line);
+            expected++;
+        }
+    }
+    CHECK(out.count == expected, "%d summary lines, expected %d", out.count, expected);
+
+    vmprof_destroy(&prof);
+    ml_heap_reset();
+    return 0;
+}
+
+// Write entries numbered in order and read them back in random batches:
+// each read continues where the last stopped, or after the entries the
+// writer overwrote, and everything is either read or counted as lost
+static int prop_vmprof_trace(uint64_t* rng, char* why) {
+    static vmprof_t prof;
+    static vmprof_trace_t got[VMPROF_TRACE_SIZE];
+    uint32_t written = 0, next = 0, total = rng_below(rng, 4 * VMPROF_TRACE_SIZE);
+
+    memset(&prof, 0, sizeof(prof));
+    vmprof_enable(&prof, VMPROF_TRACE);
+    while (written < total || next < written) {
+        uint32_t burst = rng_below(rng, 3) ? rng_below(rng, 64) : rng_below(rng, 2 * VMPROF_TRACE_SIZE);
+        for (; burst > 0 && written < total; burst--, written++) {
+            VMPROF_STEP(&prof, written, (uint16_t)written, NULL, written & 7);
+        }
+
+        size_t max = 1 + rng_below(rng, VMPROF_TRACE_SIZE);
+        uint64_t lost_before = prof.trace_lost;
+        size_t n = vmprof_trace_read(&prof, got, max);
+        CHECK(n <= max, "read %zu of at most %zu", n, max);
+        next += (uint32_t)(prof.trace_lost - lost_before);
+        for (size_t i = 0; i < n; i++, next++) {
+            CHECK(got[i].pc == next && got[i].opcode == (uint16_t)next && got[i].depth == (next & 7),
+                  "entry %zu of a read is %u, expected %u", i, got[i].pc, next);
+        }
+        CHECK(written - next <= VMPROF_TRACE_SIZE, "%u entries unread, more than the ring holds",
+              written - next);
+    }
+    CHECK(next == written, "read up to %u of %u", next, written);
+    return 0;
+}
+
+static const property_t properties[] = {
+    { "memcpy",   prop_memcpy },
+    { "memset",   prop_memset },
+    { "strlen",   prop_strlen },
+    { "strcmp",   prop_strcmp },
+    { "strncmp",  prop_strncmp },
+    { "strchr",   prop_strchr },
+    { "strstr",   prop_strstr },
+    { "strcpy",   prop_strcpy },
+    { "snprintf", prop_snprintf },
+    { "atoi",     prop_atoi },
+    { "malloc",   prop_malloc },
+    { "vector",   prop_vector },
+    { "hashmap",  prop_hashmap },
+    { "str_case",        prop_str_case },
+    { "str_trim",        prop_str_trim },
+    { "str_find",        prop_str_find },
+    { "str_parse_int",   prop_str_parse_int },
+    { "str_parse_float", prop_str_parse_float },
+    { "str_format",      prop_str_format },
+    { "mbc",             prop_mbc },
+    { "vmprof",          prop_vmprof },
+    { "vmprof_trace",    prop_vmprof_trace },
+};
+
+#define PROPERTY_COUNT (int)(sizeof(properties) / sizeof(properties[0]))
+
+// splitmix64, so neighbouring case numbers get unrelated seeds
+static uint64_t case_seed(uint64_t seed, uint64_t index) {
+    uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int run(const property_t* prop, uint64_t seed, long cases, long only) {
+    char why[WHY_SIZE];
+    long first = only >= 0 ? only : 0;
+    long last = only >= 0 ? only + 1 : cases;
+
+    for (long i = first; i < last; i++) {
+        uint64_t rng = case_seed(seed, (uint64_t)i);
+        if (prop->fn(&rng, why) != 0) {
+            printf("%-16s FAIL case %ld (-s %llu -c %ld): %s\n", prop->name, i,
+                   (unsigned long long)seed, i, why);
+            return -1;
+        }
+    }
+    printf("%-16s ok, %ld cases\n", prop->name, last - first);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    uint64_t seed = now_ns();
+    long cases = 10000;
+    long only = -1;
+    int first_name = argc;
+    int failed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            cases = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            only = atol(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-n cases] [-s seed] [-c case] [property...]\n", argv[0]);
+            return 2;
+        } else {
+            first_name = i;
+            break;
+        }
+    }
+
+    printf("seed %llu, strops", (unsigned long long)seed);
+    for (int i = 0; i < 3; i++) {
+        if (strops_use(strops_impls[i]) == 0) {
+            printf(" %s", strops_impls[i]);
+        }
+    }
+    printf("\n");
+    for (int p = 0; p < PROPERTY_COUNT; p++) {
+        int selected = first_name == argc;
+        for (int i = first_name; i < argc; i++) {
+            selected |= strcmp(argv[i], properties[p].name) == 0;
+        }
+        if (selected && run(&properties[p], seed, cases, only) != 0) {
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#include "ml.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+char capture_buf[4096];
+size_t capture_len = 0;
+
+// stdio.c's console hooks, normally provided by the kernel
+void ml_print_char(char c) {
+    if (capture_len < sizeof(capture_buf)) {
+        capture_buf[capture_len] = c;
+    }
+    capture_len++;
+}
+
+char ml_read_scan_code(void) {
+    abort();                        // No keyboard in a hosted build
+}
+
+char ml_scancode_to_ascii(char scancode) {
+    (void)scancode;
+    abort();
+}
+
+// memory.c's lock hooks; the tests are single-threaded
+void ml_heap_lock(void) {
+}
+
+void ml_heap_unlock(void) {
+}
+
+void capture_reset(void) {
+    capture_len = 0;
+}
+
+uint64_t rng_next(uint64_t* state) {
+    uint64_t x = *state ? *state : 0x9E3779B97F4A7C15ULL;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+uint32_t rng_below(uint64_t* state, uint32_t bound) {
+    return (uint32_t)(((rng_next(state) >> 32) * bound) >> 32);
+}
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
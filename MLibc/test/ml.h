@@ -0,0 +1,60 @@
+#ifndef ML_H
+#define ML_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The hosted MLibc (libMLibc-hosted.a, built with src/ml_prefix.h) as
+ * seen from a glibc program, plus the pieces the test and benchmark
+ * programs share.
+ */
+
+void* ml_memcpy(void* dest, const void* src, size_t n);
+void* ml_memset(void* s, int c, size_t n);
+void* ml_malloc(size_t size);
+void ml_free(void* ptr);
+void ml_heap_reset(void);
+
+size_t ml_strlen(const char* str);
+char* ml_strcpy(char* dest, const char* src);
+char* ml_strncpy(char* dest, const char* src, size_t n);
+int ml_strcmp(const char* s1, const char* s2);
+int ml_strncmp(const char* s1, const char* s2, size_t n);
+char* ml_strcat(char* dest, const char* src);
+char* ml_strchr(const char* s, int c);
+char* ml_strstr(const char* haystack, const char* needle);
+
+int ml_printf(const char* format, ...);
+int ml_vsnprintf(char* buf, size_t size, const char* format, va_list ap);
+int ml_snprintf(char* buf, size_t size, const char* format, ...);
+int ml_atoi(const char* str);
+
+#define ML_HEAP_SIZE 65536          /* HEAP_SIZE in memory.c */
+
+/*
+ * MLibc's own headers for everything without a libc name. glibc's
+ * stddef.h and stdint.h use the same include guards as MLibc's, so
+ * these get glibc's types, which have the same sizes.
+ */
+#include "../src/collections.h"
+#include "../src/strops.h"
+#include "../src/mbc.h"
+#include "../src/vmprof.h"
+
+// Hosted-only, see src/strops.h
+int strops_use(const char* name);
+
+// Everything ml_printf writes since the last capture_reset()
+extern char capture_buf[4096];
+extern size_t capture_len;
+void capture_reset(void);
+
+// xorshift64*; a state of 0 is replaced by a fixed constant
+uint64_t rng_next(uint64_t* state);
+uint32_t rng_below(uint64_t* state, uint32_t bound);
+
+uint64_t now_ns(void);
+
+#endif /* ML_H */
@@ -0,0 +1,425 @@
+#include "blk.h"
+#include "io.h"
+#include "pci.h"
+#include "interrupts.h"
+#include "klog.h"
+
+/*
+ * AHCI driver for SATA disks. Each port gets a command list, a received-
+ * FIS area and one command table per slot, so every slot can carry a
+ * merged command of up to AHCI_PRDS scattered requests. Drives with NCQ
+ * get FPDMA queued commands and may finish them out of order; the rest
+ * get plain DMA commands, which the HBA runs in slot order.
+ */
+
+#define AHCI_MAX_PORTS  4
+#define AHCI_SLOTS      32
+#define AHCI_PRDS       8
+#define AHCI_MAX_SECTORS 2048       // 1 MiB per command
+#define AHCI_TIMEOUT    10000000
+
+// HBA registers
+#define HBA_CAP   0x00
+#define HBA_GHC   0x04
+#define HBA_IS    0x08
+#define HBA_PI    0x0C
+
+#define HBA_CAP_NCQ     (1u << 30)
+#define HBA_GHC_IE      (1u << 1)
+#define HBA_GHC_AE      (1u << 31)
+
+// Port registers, at 0x100 + port * 0x80
+#define PORT_CLB   0x00
+#define PORT_CLBU  0x04
+#define PORT_FB    0x08
+#define PORT_FBU   0x0C
+#define PORT_IS    0x10
+#define PORT_IE    0x14
+#define PORT_CMD   0x18
+#define PORT_TFD   0x20
+#define PORT_SIG   0x24
+#define PORT_SSTS  0x28
+#define PORT_SERR  0x30
+#define PORT_SACT  0x34
+#define PORT_CI    0x38
+
+#define PORT_CMD_ST   (1u << 0)
+#define PORT_CMD_FRE  (1u << 4)
+#define PORT_CMD_FR   (1u << 14)
+#define PORT_CMD_CR   (1u << 15)
+
+#define PORT_IS_DHRS  (1u << 0)     // D2H register FIS: non-queued command done
+#define PORT_IS_SDBS  (1u << 3)     // Set device bits FIS: queued command done
+#define PORT_IS_ERROR 0x7DC00050u   // TFES, HBFS, HBDS, IFS, OFS, ...
+
+#define PORT_SIG_ATA  0x00000101
+
+#define TFD_BSY 0x80
+#define TFD_DRQ 0x08
+
+#define FIS_TYPE_H2D  0x27
+
+#define ATA_CMD_READ_DMA_EXT   0x25
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_READ_FPDMA     0x60
+#define ATA_CMD_WRITE_FPDMA    0x61
+#define ATA_CMD_IDENTIFY       0xEC
+
+typedef struct {
+    uint32_t flags;             // FIS length, write, PRD count
+    volatile uint32_t prdbc;    // Bytes transferred
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} ahci_header_t;
+
+typedef struct {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;               // Byte count - 1, bit 31 interrupt on completion
+} ahci_prd_t;
+
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRDS];
+} ahci_table_t;
+
+// The command list wants 1 KiB alignment, the FIS area 256 bytes and
+// the command tables 128, which this layout keeps for every port
+typedef struct {
+    ahci_header_t headers[AHCI_SLOTS];
+    uint8_t fis[256];
+    ahci_table_t tables[AHCI_SLOTS];
+} __attribute__((aligned(1024))) ahci_memory_t;
+
+typedef struct {
+    volatile uint8_t* regs;     // Port registers
+    int number;
+    int ncq;
+    uint32_t issued;            // Slots handed to the HBA
+    volatile uint32_t status;   // PxIS bits latched by the interrupt handler
+    blk_device_t dev;
+} ahci_port_t;
+
+typedef struct {
+    volatile uint8_t* abar;
+    int irq;
+    int port_count;
+    ahci_port_t ports[AHCI_MAX_PORTS];
+} ahci_hba_t;
+
+static ahci_memory_t port_memory[AHCI_MAX_PORTS];
+static uint16_t identify_buf[256] __attribute__((aligned(16)));
+static ahci_hba_t hba;
+
+static inline uint32_t reg_read(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint32_t*)(base + offset);
+}
+
+static inline void reg_write(volatile uint8_t* base, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(base + offset) = value;
+}
+
+static int wait_clear(volatile uint8_t* base, uint32_t offset, uint32_t mask) {
+    for (int i = 0; i < AHCI_TIMEOUT; i++) {
+        if (!(reg_read(base, offset) & mask)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int port_stop(ahci_port_t* port) {
+    uint32_t cmd = reg_read(port->regs, PORT_CMD);
+
+    reg_write(port->regs, PORT_CMD, cmd & ~PORT_CMD_ST);
+    if (wait_clear(port->regs, PORT_CMD, PORT_CMD_CR) < 0) {
+        return -1;
+    }
+    reg_write(port->regs, PORT_CMD, reg_read(port->regs, PORT_CMD) & ~PORT_CMD_FRE);
+    return wait_clear(port->regs, PORT_CMD, PORT_CMD_FR);
+}
+
+static int port_start(ahci_port_t* port) {
+    if (wait_clear(port->regs, PORT_TFD, TFD_BSY | TFD_DRQ) < 0) {
+        return -1;
+    }
+    reg_write(port->regs, PORT_SERR, 0xFFFFFFFF);
+    reg_write(port->regs, PORT_IS, 0xFFFFFFFF);
+    reg_write(port->regs, PORT_CMD, reg_read(port->regs, PORT_CMD) | PORT_CMD_FRE | PORT_CMD_ST);
+    return 0;
+}
+
+static ahci_memory_t* port_mem(ahci_port_t* port) {
+    return &port_memory[port - hba.ports];
+}
+
+static void set_fis(uint8_t* fis, uint8_t command, uint64_t lba, uint16_t count, uint16_t features) {
+    memset(fis, 0, 20);
+    fis[0] = FIS_TYPE_H2D;
+    fis[1] = 0x80;              // Command, not control
+    fis[2] = command;
+    fis[3] = features & 0xFF;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[7] = 0x40;              // LBA mode
+    fis[8] = (lba >> 24) & 0xFF;
+    fis[9] = (lba >> 32) & 0xFF;
+    fis[10] = (lba >> 40) & 0xFF;
+    fis[11] = features >> 8;
+    fis[12] = count & 0xFF;
+    fis[13] = count >> 8;
+}
+
+static void set_prd(ahci_prd_t* prd, const void* buf, uint32_t bytes) {
+    uint64_t phys = dma_phys(buf);
+
+    prd->dba = (uint32_t)phys;
+    prd->dbau = (uint32_t)(phys >> 32);
+    prd->reserved = 0;
+    prd->dbc = bytes - 1;
+}
+
+static void set_header(ahci_port_t* port, int slot, int write, int prds) {
+    ahci_header_t* header = &port_mem(port)->headers[slot];
+    uint64_t table = dma_phys(&port_mem(port)->tables[slot]);
+
+    header->flags = 5 | (write ? (1u << 6) : 0) | ((uint32_t)prds << 16);
+    header->prdbc = 0;
+    header->ctba = (uint32_t)table;
+    header->ctbau = (uint32_t)(table >> 32);
+}
+
+// Tell the HBA about a filled slot; queued commands also go in PxSACT
+static void issue(ahci_port_t* port, int slot) {
+    io_barrier();
+    port->issued |= 1u << slot;
+    if (port->ncq) {
+        reg_write(port->regs, PORT_SACT, 1u << slot);
+    }
+    reg_write(port->regs, PORT_CI, 1u << slot);
+}
+
+static int ahci_start(blk_device_t* dev, int slot, blk_command_t* cmd) {
+    ahci_port_t* port = (ahci_port_t*)dev->driver;
+    ahci_table_t* table = &port_mem(port)->tables[slot];
+    int write = cmd->op == BLK_WRITE;
+    int prd = 0;
+
+    for (blk_request_t* req = cmd->reqs; req; req = req->next) {
+        set_prd(&table->prdt[prd++], req->buf, req->count * BLK_SECTOR_SIZE);
+    }
+    table->prdt[prd - 1].dbc |= 1u << 31;
+
+    if (port->ncq) {
+        // FPDMA commands carry the count in the features field and the tag in count
+        set_fis(table->cfis, write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA,
+                cmd->lba, (uint16_t)(slot << 3), (uint16_t)cmd->count);
+    } else {
+        set_fis(table->cfis, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT,
+                cmd->lba, (uint16_t)cmd->count, 0);
+    }
+    set_header(port, slot, write, prd);
+    issue(port, slot);
+    return 0;
+}
+
+// After a task-file error the port stops; fail what is left and restart it
+static void port_recover(ahci_port_t* port) {
+    uint32_t failed = port->issued;
+
+    klog(KLOG_WARN, "%s: task-file error, restarting port", port->dev.name);
+    port->issued = 0;
+    port_stop(port);
+    port_start(port);
+    for (int slot = 0; slot < AHCI_SLOTS; slot++) {
+        if (failed & (1u << slot)) {
+            blk_complete(&port->dev, slot, -1);
+        }
+    }
+}
+
+static void ahci_poll(blk_device_t* dev) {
+    ahci_port_t* port = (ahci_port_t*)dev->driver;
+    uint32_t status;
+
+    // Without an interrupt line nobody latches PxIS, so read it here
+    if (dev->irq_driven) {
+        irq_disable();
+        status = port->status;
+        port->status = 0;
+        irq_enable();
+    } else {
+        status = reg_read(port->regs, PORT_IS);
+        reg_write(port->regs, PORT_IS, status);
+    }
+
+    uint32_t active = reg_read(port->regs, PORT_CI) | reg_read(port->regs, PORT_SACT);
+    uint32_t finished = port->issued & ~active;
+    port->issued &= active;
+    for (int slot = 0; finished; slot++) {
+        if (finished & (1u << slot)) {
+            finished &= ~(1u << slot);
+            blk_complete(dev, slot, 0);
+        }
+    }
+
+    if (status & PORT_IS_ERROR) {
+        port_recover(port);
+    }
+}
+
+static const blk_ops_t ahci_ops = {
+    ahci_start,
+    ahci_poll
+};
+
+IRQ_HANDLER static void ahci_irq(int irq, void* ctx) {
+    ahci_hba_t* h = (ahci_hba_t*)ctx;
+    uint32_t pending = reg_read(h->abar, HBA_IS);
+
+    (void)irq;
+    for (int i = 0; i < h->port_count; i++) {
+        ahci_port_t* port = &h->ports[i];
+
+        if (pending & (1u << port->number)) {
+            uint32_t status = reg_read(port->regs, PORT_IS);
+            reg_write(port->regs, PORT_IS, status);
+            port->status |= status;
+            port->dev.irq_pending = 1;
+        }
+    }
+    reg_write(h->abar, HBA_IS, pending);
+}
+
+// Run one command in slot 0 and spin until it is done; used before the
+// port is registered
+static int exec_sync(ahci_port_t* port, uint8_t command, void* buf, uint32_t bytes) {
+    ahci_table_t* table = &port_mem(port)->tables[0];
+
+    set_prd(&table->prdt[0], buf, bytes);
+    set_fis(table->cfis, command, 0, 0, 0);
+    set_header(port, 0, 0, 1);
+
+    io_barrier();
+    reg_write(port->regs, PORT_CI, 1);
+    for (int i = 0; i < AHCI_TIMEOUT; i++) {
+        if (reg_read(port->regs, PORT_IS) & PORT_IS_ERROR) {
+            break;
+        }
+        if (!(reg_read(port->regs, PORT_CI) & 1)) {
+            reg_write(port->regs, PORT_IS, 0xFFFFFFFF);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int port_init(ahci_port_t* port, uint32_t cap) {
+    ahci_memory_t* mem = port_mem(port);
+    uint32_t ssts = reg_read(port->regs, PORT_SSTS);
+
+    // A device present with the link up, and a disk rather than ATAPI
+    if ((ssts & 0x0F) != 3 || ((ssts >> 8) & 0x0F) != 1 ||
+        reg_read(port->regs, PORT_SIG) != PORT_SIG_ATA) {
+        return -1;
+    }
+    if (port_stop(port) < 0) {
+        return -1;
+    }
+
+    memset(mem, 0, sizeof(*mem));
+    uint64_t clb = dma_phys(mem->headers);
+    uint64_t fb = dma_phys(mem->fis);
+    reg_write(port->regs, PORT_CLB, (uint32_t)clb);
+    reg_write(port->regs, PORT_CLBU, (uint32_t)(clb >> 32));
+    reg_write(port->regs, PORT_FB, (uint32_t)fb);
+    reg_write(port->regs, PORT_FBU, (uint32_t)(fb >> 32));
+    // Leave a port we give up on stopped, so it never DMAs into memory
+    // the caller may reuse
+    if (port_start(port) < 0 ||
+        exec_sync(port, ATA_CMD_IDENTIFY, identify_buf, sizeof(identify_buf)) < 0) {
+        port_stop(port);
+        return -1;
+    }
+
+    blk_device_t* dev = &port->dev;
+    dev->sectors = (uint64_t)identify_buf[100] | ((uint64_t)identify_buf[101] << 16) |
+                   ((uint64_t)identify_buf[102] << 32) | ((uint64_t)identify_buf[103] << 48);
+    if (dev->sectors == 0) {
+        dev->sectors = (uint32_t)identify_buf[60] | ((uint32_t)identify_buf[61] << 16);
+    }
+
+    // Slots are bounded by the HBA, and for NCQ by the drive's queue depth
+    int slots = ((cap >> 8) & 0x1F) + 1;
+    port->ncq = (cap & HBA_CAP_NCQ) && ((identify_buf[76] >> 8) & 1);
+    if (port->ncq && (identify_buf[75] & 0x1F) + 1 < slots) {
+        slots = (identify_buf[75] & 0x1F) + 1;
+    }
+
+    dev->max_sectors = AHCI_MAX_SECTORS;
+    dev->max_segments = AHCI_PRDS;
+    dev->slots = slots;
+    dev->ops = &ahci_ops;
+    dev->driver = port;
+    return 0;
+}
+
+void ahci_init(void) {
+    pci_device_t pci;
+
+    if (pci_find_class(0x01, 0x06, 0x01, 0, &pci) < 0) {
+        return;
+    }
+    pci_enable_dma(&pci);
+
+    memset(&hba, 0, sizeof(hba));
+    hba.abar = (volatile uint8_t*)mmio_ptr(pci_bar(&pci, 5) & ~0xFu);
+    reg_write(hba.abar, HBA_GHC, reg_read(hba.abar, HBA_GHC) | HBA_GHC_AE);
+
+    uint32_t cap = reg_read(hba.abar, HBA_CAP);
+    uint32_t implemented = reg_read(hba.abar, HBA_PI);
+
+    for (int n = 0; n < 32 && hba.port_count < AHCI_MAX_PORTS; n++) {
+        ahci_port_t* port = &hba.ports[hba.port_count];
+
+        if (!(implemented & (1u << n))) {
+            continue;
+        }
+        port->regs = hba.abar + 0x100 + n * 0x80;
+        port->number = n;
+        if (port_init(port, cap) == 0) {
+            hba.port_count++;
+        }
+    }
+    if (hba.port_count == 0) {
+        return;
+    }
+
+    // Legacy INTx through the PIC; 0 and 0xFF mean firmware routed nothing
+    hba.irq = (pci.irq_line > 0 && pci.irq_line < IRQ_LINES) ? pci.irq_line : -1;
+    if (hba.irq >= 0 && irq_register(hba.irq, ahci_irq, &hba) < 0) {
+        hba.irq = -1;
+    }
+
+    for (int i = 0; i < hba.port_count; i++) {
+        ahci_port_t* port = &hba.ports[i];
+        blk_device_t* dev = &port->dev;
+
+        strcpy(dev->name, "ahci0");
+        dev->name[4] = '0' + i;
+        dev->irq_driven = hba.irq >= 0;
+        if (dev->irq_driven) {
+            reg_write(port->regs, PORT_IE, PORT_IS_DHRS | PORT_IS_SDBS | PORT_IS_ERROR);
+        }
+        blk_register(dev);
+    }
+    if (hba.irq >= 0) {
+        reg_write(hba.abar, HBA_IS, 0xFFFFFFFF);
+        reg_write(hba.abar, HBA_GHC, reg_read(hba.abar, HBA_GHC) | HBA_GHC_IE);
+    }
+}
@@ -0,0 +1,239 @@
+#include "blk.h"
+#include "io.h"
+
+/*
+ * ATA PIO driver for the two legacy IDE channels. PIO moves every word
+ * through the CPU, so an interrupt would save nothing: the drive runs
+ * with nIEN set, one command at a time, and the whole transfer happens
+ * in start().
+ */
+
+#define ATA_DATA        0
+#define ATA_ERROR       1
+#define ATA_COUNT       2
+#define ATA_LBA_LOW     3
+#define ATA_LBA_MID     4
+#define ATA_LBA_HIGH    5
+#define ATA_DRIVE       6
+#define ATA_STATUS      7
+#define ATA_COMMAND     7
+
+#define ATA_STATUS_ERR  0x01
+#define ATA_STATUS_DRQ  0x08
+#define ATA_STATUS_DF   0x20
+#define ATA_STATUS_BSY  0x80
+
+#define ATA_CONTROL_NIEN 0x02
+
+#define ATA_CMD_READ          0x20
+#define ATA_CMD_READ_EXT      0x24
+#define ATA_CMD_WRITE         0x30
+#define ATA_CMD_WRITE_EXT     0x34
+#define ATA_CMD_FLUSH         0xE7
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_IDENTIFY      0xEC
+
+#define ATA_MAX_SECTORS 256
+#define ATA_TIMEOUT     10000000
+
+typedef struct {
+    uint16_t io_base;
+    uint16_t control;
+    int slave;
+    int lba48;
+    int result;         // Status of the command start() ran, for poll()
+    int finished;
+    blk_device_t dev;
+} ata_drive_t;
+
+static ata_drive_t drives[4];
+static int drive_count = 0;
+
+// Reading the alternate status four times gives the drive its 400 ns
+static void ata_delay(ata_drive_t* drive) {
+    for (int i = 0; i < 4; i++) {
+        inb(drive->control);
+    }
+}
+
+static int ata_wait(ata_drive_t* drive, int want_drq) {
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        uint8_t status = inb(drive->io_base + ATA_STATUS);
+
+        if (status & ATA_STATUS_BSY) {
+            continue;
+        }
+        if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+            return -1;
+        }
+        if (!want_drq || (status & ATA_STATUS_DRQ)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void ata_select(ata_drive_t* drive, uint8_t head) {
+    outb(drive->io_base + ATA_DRIVE, 0xE0 | (drive->slave << 4) | head);
+    ata_delay(drive);
+}
+
+static void ata_setup_lba(ata_drive_t* drive, uint64_t lba, uint32_t count) {
+    uint16_t port = drive->io_base;
+
+    if (drive->lba48) {
+        ata_select(drive, 0);
+        outb(port + ATA_COUNT, (count >> 8) & 0xFF);
+        outb(port + ATA_LBA_LOW, (lba >> 24) & 0xFF);
+        outb(port + ATA_LBA_MID, (lba >> 32) & 0xFF);
+        outb(port + ATA_LBA_HIGH, (lba >> 40) & 0xFF);
+    } else {
+        ata_select(drive, (lba >> 24) & 0x0F);
+    }
+    outb(port + ATA_COUNT, count & 0xFF);     // 0 means 256
+    outb(port + ATA_LBA_LOW, lba & 0xFF);
+    outb(port + ATA_LBA_MID, (lba >> 8) & 0xFF);
+    outb(port + ATA_LBA_HIGH, (lba >> 16) & 0xFF);
+}
+
+// Move the command's sectors through each merged request's buffer in turn
+static int ata_transfer(ata_drive_t* drive, blk_command_t* cmd) {
+    uint16_t port = drive->io_base + ATA_DATA;
+
+    for (blk_request_t* req = cmd->reqs; req; req = req->next) {
+        uint8_t* buf = (uint8_t*)req->buf;
+
+        for (uint32_t i = 0; i < req->count; i++) {
+            if (ata_wait(drive, 1) < 0) {
+                return -1;
+            }
+            if (cmd->op == BLK_READ) {
+                insw(port, buf, BLK_SECTOR_SIZE / 2);
+            } else {
+                outsw(port, buf, BLK_SECTOR_SIZE / 2);
+            }
+            buf += BLK_SECTOR_SIZE;
+        }
+    }
+    return 0;
+}
+
+static int ata_start(blk_device_t* dev, int slot, blk_command_t* cmd) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver;
+    uint8_t command;
+
+    (void)slot;
+    if (ata_wait(drive, 0) < 0) {
+        return -1;
+    }
+
+    ata_setup_lba(drive, cmd->lba, cmd->count);
+    if (cmd->op == BLK_READ) {
+        command = drive->lba48 ? ATA_CMD_READ_EXT : ATA_CMD_READ;
+    } else {
+        command = drive->lba48 ? ATA_CMD_WRITE_EXT : ATA_CMD_WRITE;
+    }
+    outb(drive->io_base + ATA_COMMAND, command);
+
+    // The last sector is still being written when DRQ drops; the drive
+    // takes FLUSH only once it is ready again
+    drive->result = ata_transfer(drive, cmd);
+    if (drive->result == 0 && cmd->op == BLK_WRITE) {
+        drive->result = ata_wait(drive, 0);
+        if (drive->result == 0) {
+            outb(drive->io_base + ATA_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+            drive->result = ata_wait(drive, 0);
+        }
+    }
+    drive->finished = 1;
+    return 0;
+}
+
+static void ata_poll(blk_device_t* dev) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver;
+
+    if (drive->finished) {
+        drive->finished = 0;
+        blk_complete(dev, 0, drive->result);
+    }
+}
+
+static const blk_ops_t ata_ops = {
+    ata_start,
+    ata_poll
+};
+
+static int ata_identify(ata_drive_t* drive, uint16_t* id) {
+    uint16_t port = drive->io_base;
+
+    ata_select(drive, 0);
+    outb(port + ATA_COUNT, 0);
+    outb(port + ATA_LBA_LOW, 0);
+    outb(port + ATA_LBA_MID, 0);
+    outb(port + ATA_LBA_HIGH, 0);
+    outb(port + ATA_COMMAND, ATA_CMD_IDENTIFY);
+
+    // No drive, or a floating bus with nothing attached
+    uint8_t status = inb(port + ATA_STATUS);
+    if (status == 0 || status == 0xFF) {
+        return -1;
+    }
+    for (int i = 0; i < ATA_TIMEOUT && (inb(port + ATA_STATUS) & ATA_STATUS_BSY); i++);
+
+    // ATAPI and SATA devices abort IDENTIFY and leave a signature instead
+    if (inb(port + ATA_LBA_MID) || inb(port + ATA_LBA_HIGH)) {
+        return -1;
+    }
+    if (ata_wait(drive, 1) < 0) {
+        return -1;
+    }
+    insw(port + ATA_DATA, id, 256);
+    return 0;
+}
+
+static void ata_probe(uint16_t io_base, uint16_t control, int slave) {
+    ata_drive_t* drive = &drives[drive_count];
+    uint16_t id[256];
+
+    memset(drive, 0, sizeof(*drive));
+    drive->io_base = io_base;
+    drive->control = control;
+    drive->slave = slave;
+
+    outb(control, ATA_CONTROL_NIEN);
+    if (ata_identify(drive, id) < 0) {
+        return;
+    }
+
+    blk_device_t* dev = &drive->dev;
+    drive->lba48 = (id[83] >> 10) & 1;
+    if (drive->lba48) {
+        dev->sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                       ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+    } else {
+        dev->sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+    }
+    if (dev->sectors == 0) {
+        return;
+    }
+
+    strcpy(dev->name, "ata0");
+    dev->name[3] = '0' + drive_count;
+    dev->max_sectors = ATA_MAX_SECTORS;
+    dev->max_segments = ATA_MAX_SECTORS;
+    dev->slots = 1;
+    dev->irq_driven = 0;
+    dev->ops = &ata_ops;
+    dev->driver = drive;
+
+    if (blk_register(dev) == 0) {
+        drive_count++;
+    }
+}
+
+void ata_init(void) {
+    ata_probe(0x1F0, 0x3F6, 0);
+    ata_probe(0x1F0, 0x3F6, 1);
+    ata_probe(0x170, 0x376, 0);
+    ata_probe(0x170, 0x376, 1);
+}
@@ -0,0 +1,586 @@
+#include "bcache.h"
+#include "tsc.h"
+
+#ifdef __x86_64__
+#include "paging.h"
+#endif
+
+#define BUF_VALID    0x01
+#define BUF_DIRTY    0x02
+#define BUF_BUSY     0x04       // Read or write-back in flight
+#define BUF_RA_MARK  0x08       // First block of a readahead window
+#define BUF_UNUSED   0x10       // Read ahead and not asked for yet
+#define BUF_FETCHED  0x20       // Read for a range; its first lookup was a miss
+
+#define BLOCK_SHIFT  12
+#define HASH_BITS    10
+#define HASH_SIZE    (1 << HASH_BITS)
+#define DIRTY_LIMIT  (BCACHE_MAX_FRAMES / 2)
+#define FETCH_LIMIT  (BCACHE_MAX_FRAMES / 4)
+
+typedef struct {
+    blk_device_t* dev;
+    uint64_t next;              // Block a sequential reader wants next
+    uint64_t ra_end;            // First block past the last window
+    uint32_t window;            // Blocks; 0 while access is random
+} readahead_t;
+
+bcache_stats_t bcache_stats;
+
+static bcache_buf_t bufs[BCACHE_MAX_FRAMES];
+static uint32_t buf_count = 0;      // Buffers that own a frame
+static bcache_buf_t* hash[HASH_SIZE];
+static readahead_t readahead[BLK_MAX_DEVICES];
+static uint32_t use_clock = 0;
+static bcache_buf_t* last_used = NULL;
+static uint32_t dirty_count = 0;
+
+#ifndef __x86_64__
+static uint8_t frame_pool[BCACHE_MAX_FRAMES][BCACHE_BLOCK_SIZE] __attribute__((aligned(4096)));
+#endif
+
+void bcache_init(void) {
+    memset(bufs, 0, sizeof(bufs));
+    memset(hash, 0, sizeof(hash));
+    memset(readahead, 0, sizeof(readahead));
+    buf_count = 0;
+    use_clock = 0;
+    last_used = NULL;
+    dirty_count = 0;
+    bcache_reset_stats();
+}
+
+void bcache_reset_stats(void) {
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+}
+
+uint32_t bcache_frames(void) {
+    return buf_count;
+}
+
+uint32_t bcache_dirty(void) {
+    return dirty_count;
+}
+
+static uint8_t* frame_get(void) {
+#ifdef __x86_64__
+    uint64_t phys = frame_alloc();
+    return phys ? (uint8_t*)phys_to_virt(phys) : NULL;
+#else
+    return frame_pool[buf_count];
+#endif
+}
+
+static uint64_t device_blocks(blk_device_t* dev) {
+    return (dev->sectors + BCACHE_BLOCK_SECTORS - 1) / BCACHE_BLOCK_SECTORS;
+}
+
+// Hash index
+
+static uint32_t hash_of(blk_device_t* dev, uint64_t block) {
+    uint32_t key = (uint32_t)block ^ (uint32_t)(block >> 32) ^ (uint32_t)((uintptr_t)dev >> 4);
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static bcache_buf_t* lookup(blk_device_t* dev, uint64_t block) {
+    bcache_buf_t* buf = hash[hash_of(dev, block)];
+
+    while (buf && (buf->dev != dev || buf->block != block)) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+static void hash_insert(bcache_buf_t* buf) {
+    uint32_t index = hash_of(buf->dev, buf->block);
+
+    buf->hash_next = hash[index];
+    hash[index] = buf;
+}
+
+static void hash_remove(bcache_buf_t* buf) {
+    bcache_buf_t** link = &hash[hash_of(buf->dev, buf->block)];
+
+    while (*link && *link != buf) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = buf->hash_next;
+    }
+    buf->dev = NULL;
+}
+
+// I/O
+
+static void io_done(blk_request_t* req) {
+    bcache_buf_t* buf = (bcache_buf_t*)req->ctx;
+
+    buf->flags &= ~BUF_BUSY;
+    if (req->status != 0) {
+        bcache_stats.errors++;
+    } else if (req->op == BLK_READ) {
+        buf->flags |= BUF_VALID;
+    } else {
+        buf->flags &= ~BUF_DIRTY;
+        dirty_count--;
+        bcache_stats.writebacks++;
+    }
+}
+
+static void start_io(bcache_buf_t* buf, int op) {
+    blk_request_t* req = &buf->req;
+
+    memset(req, 0, sizeof(*req));
+    req->op = op;
+    req->lba = buf->block * BCACHE_BLOCK_SECTORS;
+    req->count = (buf->len + BLK_SECTOR_SIZE - 1) / BLK_SECTOR_SIZE;
+    req->buf = buf->data;
+    req->done = io_done;
+    req->ctx = buf;
+
+    buf->flags |= BUF_BUSY;
+    if (blk_submit(buf->dev, req) < 0) {
+        req->status = -1;
+        io_done(req);
+    }
+}
+
+static void wait_buf(bcache_buf_t* buf) {
+    while (buf->flags & BUF_BUSY) {
+        blk_wait(buf->dev, &buf->req);
+    }
+}
+
+// LRU-2 victim: the oldest second-to-last use, where 0 (used once or
+// never) is oldest, and ties go to the oldest last use. A linear scan
+// costs little next to the disk read that follows a miss.
+static bcache_buf_t* find_victim(void) {
+    bcache_buf_t* victim = NULL;
+
+    for (uint32_t i = 0; i < buf_count; i++) {
+        bcache_buf_t* buf = &bufs[i];
+
+        if (buf->refs || (buf->flags & BUF_BUSY)) {
+            continue;
+        }
+        if (!victim || buf->last_use[1] < victim->last_use[1] ||
+            (buf->last_use[1] == victim->last_use[1] && buf->last_use[0] < victim->last_use[0])) {
+            victim = buf;
+        }
+    }
+    return victim;
+}
+
+// A buffer for `block`, from a fresh frame while there are any and by
+// eviction after that. It is hashed but holds no data yet.
+static bcache_buf_t* alloc_buf(blk_device_t* dev, uint64_t block) {
+    bcache_buf_t* buf = NULL;
+
+    if (buf_count < BCACHE_MAX_FRAMES) {
+        uint8_t* frame = frame_get();
+        if (frame) {
+            buf = &bufs[buf_count++];
+            buf->data = frame;
+        }
+    }
+
+    if (!buf) {
+        buf = find_victim();
+        if (!buf) {
+            return NULL;
+        }
+        if (buf->flags & BUF_DIRTY) {
+            start_io(buf, BLK_WRITE);
+            wait_buf(buf);
+            if (buf->flags & BUF_DIRTY) {
+                // The write failed; the data cannot be kept anywhere
+                buf->flags &= ~BUF_DIRTY;
+                dirty_count--;
+            }
+        }
+        if (buf->dev) {
+            hash_remove(buf);
+            bcache_stats.evictions++;
+        }
+    }
+
+    if (last_used == buf) {
+        last_used = NULL;
+    }
+
+    uint64_t remaining = dev->sectors - block * BCACHE_BLOCK_SECTORS;
+    buf->dev = dev;
+    buf->block = block;
+    buf->len = remaining < BCACHE_BLOCK_SECTORS ? (uint32_t)remaining * BLK_SECTOR_SIZE : BCACHE_BLOCK_SIZE;
+    buf->flags = 0;
+    buf->refs = 0;
+    buf->last_use[0] = 0;
+    buf->last_use[1] = 0;
+    hash_insert(buf);
+    return buf;
+}
+
+// Record a use; a repeat of the previous use is the same reference
+static void touch(bcache_buf_t* buf) {
+    if (buf == last_used) {
+        return;
+    }
+    last_used = buf;
+    use_clock++;
+
+    if (buf->flags & BUF_UNUSED) {
+        buf->flags &= ~BUF_UNUSED;
+        bcache_stats.readahead_used++;
+    } else {
+        buf->last_use[1] = buf->last_use[0];
+    }
+    buf->last_use[0] = use_clock;
+}
+
+// Readahead
+
+static readahead_t* readahead_state(blk_device_t* dev) {
+    readahead_t* free_slot = NULL;
+
+    for (int i = 0; i < BLK_MAX_DEVICES; i++) {
+        if (readahead[i].dev == dev) {
+            return &readahead[i];
+        }
+        if (!readahead[i].dev && !free_slot) {
+            free_slot = &readahead[i];
+        }
+    }
+    if (free_slot) {
+        free_slot->dev = dev;
+    }
+    return free_slot;
+}
+
+// Read [from, from + window) into the cache and mark the first block.
+// Read-ahead blocks rank as used once, so they are evicted before
+// anything a reader has used twice.
+static void readahead_window(readahead_t* ra, uint64_t from) {
+    uint64_t end = from + ra->window;
+    uint64_t blocks = device_blocks(ra->dev);
+
+    if (end > blocks) {
+        end = blocks;
+    }
+
+    for (uint64_t block = from; block < end; block++) {
+        bcache_buf_t* buf = lookup(ra->dev, block);
+
+        if (!buf) {
+            buf = alloc_buf(ra->dev, block);
+            if (!buf) {
+                break;
+            }
+            buf->flags |= BUF_UNUSED;
+            buf->last_use[0] = use_clock;
+            start_io(buf, BLK_READ);
+            bcache_stats.readahead++;
+        }
+        if (block == from) {
+            buf->flags |= BUF_RA_MARK;
+        }
+    }
+    if (end > ra->ra_end) {
+        ra->ra_end = end;
+    }
+}
+
+// A sequential miss opens a window after `block`; reaching a marked
+// block opens the next one, twice as large
+static void readahead_access(blk_device_t* dev, uint64_t block, int miss, int marked) {
+    readahead_t* ra = readahead_state(dev);
+
+    if (!ra) {
+        return;
+    }
+
+    int sequential = ra->next == block;
+    ra->next = block + 1;
+
+    if (marked) {
+        ra->window = ra->window ? ra->window * 2 : BCACHE_RA_MIN;
+        if (ra->window > BCACHE_RA_MAX) {
+            ra->window = BCACHE_RA_MAX;
+        }
+        readahead_window(ra, ra->ra_end > block ? ra->ra_end : block + 1);
+    } else if (miss && sequential) {
+        ra->window = ra->window ? ra->window * 2 : BCACHE_RA_MIN;
+        if (ra->window > BCACHE_RA_MAX) {
+            ra->window = BCACHE_RA_MAX;
+        }
+        readahead_window(ra, block + 1);
+    } else if (miss) {
+        ra->window = 0;
+    }
+}
+
+static void record_latency(uint64_t start) {
+    uint64_t us = tsc_to_us(tsc_read() - start);
+    int bucket = 0;
+
+    while (us && bucket < BCACHE_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    bcache_stats.latency[bucket]++;
+}
+
+// Pin `block`; `fill` is 0 when the caller will overwrite all of it
+static bcache_buf_t* get_block(blk_device_t* dev, uint64_t block, int fill) {
+    uint64_t start = tsc_read();
+
+    if (block >= device_blocks(dev)) {
+        return NULL;
+    }
+
+    // The demand read and its readahead go out together, so they merge
+    blk_plug(dev);
+    bcache_buf_t* buf = lookup(dev, block);
+    int miss = buf == NULL;
+
+    if (miss) {
+        bcache_stats.misses++;
+        buf = alloc_buf(dev, block);
+        if (!buf) {
+            blk_unplug(dev);
+            return NULL;
+        }
+        if (!fill) {
+            buf->flags |= BUF_VALID;
+        }
+    } else if (buf->flags & BUF_FETCHED) {
+        buf->flags &= ~BUF_FETCHED;
+    } else {
+        bcache_stats.hits++;
+    }
+
+    // Pinned before readahead can look for victims
+    buf->refs++;
+    int marked = buf->flags & BUF_RA_MARK;
+    buf->flags &= ~BUF_RA_MARK;
+
+    // Also retries a block whose earlier read failed
+    if (fill && !(buf->flags & (BUF_VALID | BUF_BUSY))) {
+        start_io(buf, BLK_READ);
+    }
+    readahead_access(dev, block, miss, marked);
+    blk_unplug(dev);
+
+    touch(buf);
+    wait_buf(buf);
+
+    if (!(buf->flags & BUF_VALID)) {
+        buf->refs--;
+        hash_remove(buf);
+        return NULL;
+    }
+
+    record_latency(start);
+    return buf;
+}
+
+bcache_buf_t* bcache_get(blk_device_t* dev, uint64_t block) {
+    return get_block(dev, block, 1);
+}
+
+void bcache_put(bcache_buf_t* buf) {
+    if (buf->refs > 0) {
+        buf->refs--;
+    }
+}
+
+void bcache_mark_dirty(bcache_buf_t* buf) {
+    if (!(buf->flags & BUF_DIRTY)) {
+        buf->flags |= BUF_DIRTY;
+        dirty_count++;
+    }
+}
+
+// Start reads for every missing block of a multi-block range at once,
+// so a contiguous range becomes one merged transfer instead of a read
+// per block
+static void fetch_range(blk_device_t* dev, uint64_t first, uint64_t last) {
+    if (last - first >= FETCH_LIMIT) {
+        last = first + FETCH_LIMIT - 1;
+    }
+
+    blk_plug(dev);
+    for (uint64_t block = first; block <= last; block++) {
+        if (lookup(dev, block)) {
+            continue;
+        }
+
+        bcache_buf_t* buf = alloc_buf(dev, block);
+        if (!buf) {
+            break;
+        }
+        bcache_stats.misses++;
+        buf->flags |= BUF_FETCHED;
+        buf->last_use[0] = use_clock;
+        start_io(buf, BLK_READ);
+    }
+    blk_unplug(dev);
+}
+
+int64_t bcache_pread(blk_device_t* dev, void* buf, uint32_t len, uint64_t offset) {
+    uint64_t size = dev->sectors * BLK_SECTOR_SIZE;
+    uint32_t done = 0;
+
+    if (offset >= size) {
+        return 0;
+    }
+    if (len > size - offset) {
+        len = (uint32_t)(size - offset);
+    }
+
+    uint64_t last = (offset + len - 1) >> BLOCK_SHIFT;
+    uint64_t fetched = offset >> BLOCK_SHIFT;   // Blocks below this are started
+
+    while (done < len) {
+        uint64_t block = (offset + done) >> BLOCK_SHIFT;
+        if (block >= fetched && block < last) {
+            fetch_range(dev, block, last);
+            fetched = block + FETCH_LIMIT;
+        }
+
+        uint64_t pos = offset + done;
+        uint32_t within = pos & (BCACHE_BLOCK_SIZE - 1);
+        uint32_t chunk = BCACHE_BLOCK_SIZE - within;
+        bcache_buf_t* b = get_block(dev, block, 1);
+
+        if (!b) {
+            return done ? (int64_t)done : -1;
+        }
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        memcpy((uint8_t*)buf + done, b->data + within, chunk);
+        bcache_put(b);
+        done += chunk;
+    }
+    return done;
+}
+
+int64_t bcache_pwrite(blk_device_t* dev, const void* buf, uint32_t len, uint64_t offset) {
+    uint64_t size = dev->sectors * BLK_SECTOR_SIZE;
+    uint32_t done = 0;
+
+    if (offset >= size) {
+        return -1;
+    }
+    if (len > size - offset) {
+        len = (uint32_t)(size - offset);
+    }
+
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t within = pos & (BCACHE_BLOCK_SIZE - 1);
+        uint32_t chunk = BCACHE_BLOCK_SIZE - within;
+
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+
+        // Only a partial block has to be read before it is changed
+        int whole = within == 0 && (chunk == BCACHE_BLOCK_SIZE || pos + chunk == size);
+        bcache_buf_t* b = get_block(dev, pos >> BLOCK_SHIFT, !whole);
+        if (!b) {
+            return done ? (int64_t)done : -1;
+        }
+        memcpy(b->data + within, (const uint8_t*)buf + done, chunk);
+        bcache_mark_dirty(b);
+        bcache_put(b);
+        done += chunk;
+    }
+
+    if (dirty_count > DIRTY_LIMIT) {
+        bcache_sync(NULL);
+    }
+    return done;
+}
+
+// Start every dirty block of a device before waiting for any of them
+static int sync_device(blk_device_t* dev) {
+    uint32_t errors = bcache_stats.errors;
+
+    blk_plug(dev);
+    for (uint32_t i = 0; i < buf_count; i++) {
+        bcache_buf_t* buf = &bufs[i];
+        if (buf->dev == dev && (buf->flags & BUF_DIRTY) && !(buf->flags & BUF_BUSY)) {
+            start_io(buf, BLK_WRITE);
+        }
+    }
+    blk_unplug(dev);
+
+    for (uint32_t i = 0; i < buf_count; i++) {
+        if (bufs[i].dev == dev) {
+            wait_buf(&bufs[i]);
+        }
+    }
+    return bcache_stats.errors == errors ? 0 : -1;
+}
+
+int bcache_sync(blk_device_t* dev) {
+    int result = 0;
+
+    if (dev) {
+        return sync_device(dev);
+    }
+    for (int i = 0; i < blk_count(); i++) {
+        if (sync_device(blk_get(i)) < 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// fsio backend: handles are block device indexes
+
+static fsio_blocking_t fsio_devices;
+
+static int device_open(void* ctx, const char* path, const char* mode, int64_t* handle) {
+    (void)ctx;
+    (void)mode;
+
+    for (int i = 0; i < blk_count(); i++) {
+        if (strcmp(blk_get(i)->name, path) == 0) {
+            *handle = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int device_close(void* ctx, int64_t handle) {
+    (void)ctx;
+    return bcache_sync(blk_get((int)handle));
+}
+
+static int64_t device_size(void* ctx, int64_t handle) {
+    (void)ctx;
+    return (int64_t)(blk_get((int)handle)->sectors * BLK_SECTOR_SIZE);
+}
+
+static int32_t device_pread(void* ctx, int64_t handle, void* buf, uint32_t len, uint64_t offset) {
+    (void)ctx;
+    return (int32_t)bcache_pread(blk_get((int)handle), buf, len, offset);
+}
+
+static int32_t device_pwrite(void* ctx, int64_t handle, const void* buf, uint32_t len, uint64_t offset) {
+    (void)ctx;
+    return (int32_t)bcache_pwrite(blk_get((int)handle), buf, len, offset);
+}
+
+void bcache_fsio_init(fsio_t* io) {
+    memset(&fsio_devices, 0, sizeof(fsio_devices));
+    fsio_devices.open = device_open;
+    fsio_devices.close = device_close;
+    fsio_devices.size = device_size;
+    fsio_devices.pread = device_pread;
+    fsio_devices.pwrite = device_pwrite;
+    fsio_init(io, &fsio_blocking_backend, &fsio_devices);
+}
@@ -0,0 +1,93 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "libc/libc.h"
+#include "blk.h"
+
+/*
+ * Block cache.
+ *
+ * Disk contents are cached in 4 KiB blocks keyed by (device, block) and
+ * found through a hash table. Frames come from the page-frame allocator
+ * on the 64-bit kernel and from a static pool on the 32-bit one.
+ *
+ * Eviction is LRU-2: the victim is the block whose second-to-last use is
+ * oldest, and blocks used only once go before any block used twice, so a
+ * long sequential scan cannot push out the working set. Back-to-back
+ * uses of the same block count once.
+ *
+ * Writes only dirty the cache. Dirty blocks go to disk when they are
+ * evicted, when too many pile up, or on bcache_sync(), which submits
+ * them together so the block layer can merge neighbours.
+ *
+ * Readahead starts when a device is read sequentially. The window
+ * doubles from BCACHE_RA_MIN to BCACHE_RA_MAX blocks. The first block
+ * of each window is marked; reaching it starts the next window, so the
+ * disk stays one window ahead of the reader. A read spanning several
+ * blocks starts all of its missing blocks at once, so a contiguous
+ * extent goes to the disk as one merged transfer.
+ */
+
+#define BCACHE_BLOCK_SIZE    4096
+#define BCACHE_BLOCK_SECTORS (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+
+#ifdef __x86_64__
+#define BCACHE_MAX_FRAMES 2048
+#else
+#define BCACHE_MAX_FRAMES 256
+#endif
+
+#define BCACHE_RA_MIN 4
+#define BCACHE_RA_MAX 32
+
+#define BCACHE_LATENCY_BUCKETS 16   /* Powers of two of microseconds */
+
+typedef struct bcache_buf {
+    blk_device_t* dev;
+    uint64_t block;
+    uint8_t* data;
+    uint32_t len;               /* Shorter than a block at the end of a disk */
+    int flags;
+    int refs;
+    uint32_t last_use[2];       /* Logical times of the last two uses; 0 = never */
+    struct bcache_buf* hash_next;
+    blk_request_t req;
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;         /* Blocks read ahead */
+    uint32_t readahead_used;    /* ... that were later asked for */
+    uint32_t evictions;
+    uint32_t writebacks;
+    uint32_t errors;
+    uint32_t latency[BCACHE_LATENCY_BUCKETS];
+} bcache_stats_t;
+
+extern bcache_stats_t bcache_stats;
+
+void bcache_init(void);
+
+// Pin a block, reading it in if needed; NULL on I/O error or if every
+// frame is pinned. Release with bcache_put().
+bcache_buf_t* bcache_get(blk_device_t* dev, uint64_t block);
+void bcache_put(bcache_buf_t* buf);
+void bcache_mark_dirty(bcache_buf_t* buf);
+
+// Byte-granular access through the cache; return bytes moved, or -1
+int64_t bcache_pread(blk_device_t* dev, void* buf, uint32_t len, uint64_t offset);
+int64_t bcache_pwrite(blk_device_t* dev, const void* buf, uint32_t len, uint64_t offset);
+
+// Write back dirty blocks of `dev`, or of every device if NULL
+int bcache_sync(blk_device_t* dev);
+
+// Frames in use and dirty, for reporting
+uint32_t bcache_frames(void);
+uint32_t bcache_dirty(void);
+void bcache_reset_stats(void);
+
+// fsio backend over the cache; paths name block devices ("ahci0")
+void bcache_fsio_init(fsio_t* io);
+
+#endif /* BCACHE_H */
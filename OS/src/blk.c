@@ -0,0 +1,204 @@
+#include "blk.h"
+#include "interrupts.h"
+#include "klog.h"
+
+static blk_device_t* devices[BLK_MAX_DEVICES];
+static int device_count = 0;
+
+int blk_register(blk_device_t* dev) {
+    if (device_count >= BLK_MAX_DEVICES || dev->slots < 1 || dev->slots > BLK_MAX_SLOTS) {
+        return -1;
+    }
+
+    dev->queue = NULL;
+    dev->busy = 0;
+    dev->plugged = 0;
+    dev->irq_pending = 0;
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    devices[device_count++] = dev;
+    klog(KLOG_INFO, "%s: %u MiB, %d slots%s", dev->name, (uint32_t)(dev->sectors >> 11),
+         dev->slots, dev->irq_driven ? "" : ", polled");
+    return 0;
+}
+
+int blk_count(void) {
+    return device_count;
+}
+
+blk_device_t* blk_get(int index) {
+    return (index >= 0 && index < device_count) ? devices[index] : NULL;
+}
+
+blk_device_t* blk_find(const char* name) {
+    for (int i = 0; i < device_count; i++) {
+        if (strcmp(devices[i]->name, name) == 0) {
+            return devices[i];
+        }
+    }
+    return NULL;
+}
+
+static void finish_request(blk_device_t* dev, blk_request_t* req, int status) {
+    if (status == 0) {
+        if (req->op == BLK_READ) {
+            dev->stats.sectors_read += req->count;
+        } else {
+            dev->stats.sectors_written += req->count;
+        }
+    } else {
+        dev->stats.errors++;
+        klog(KLOG_ERR, "%s: %s of %u sectors at %u failed", dev->name,
+             req->op == BLK_READ ? "read" : "write", req->count, (uint32_t)req->lba);
+    }
+
+    req->status = status;
+    if (req->done) {
+        req->done(req);
+    }
+}
+
+static int free_slot(blk_device_t* dev) {
+    for (int slot = 0; slot < dev->slots; slot++) {
+        if (!(dev->busy & (1u << slot))) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Take the queue head and every queued request that extends it
+static void build_command(blk_device_t* dev, blk_command_t* cmd) {
+    blk_request_t* req = dev->queue;
+    blk_request_t** tail = &cmd->reqs;
+
+    cmd->op = req->op;
+    cmd->lba = req->lba;
+    cmd->count = 0;
+    cmd->segments = 0;
+
+    while (req && req->op == cmd->op && req->lba == cmd->lba + cmd->count &&
+           cmd->count + req->count <= dev->max_sectors &&
+           cmd->segments < dev->max_segments) {
+        dev->queue = req->next;
+        *tail = req;
+        tail = &req->next;
+
+        cmd->count += req->count;
+        if (cmd->segments++ > 0) {
+            dev->stats.merges++;
+        }
+        req = dev->queue;
+    }
+    *tail = NULL;
+}
+
+static void dispatch(blk_device_t* dev) {
+    int slot;
+
+    while (dev->queue && !dev->plugged && (slot = free_slot(dev)) >= 0) {
+        blk_command_t* cmd = &dev->commands[slot];
+
+        build_command(dev, cmd);
+        dev->busy |= 1u << slot;
+        dev->stats.commands++;
+
+        if (dev->ops->start(dev, slot, cmd) < 0) {
+            blk_complete(dev, slot, -1);
+        }
+    }
+}
+
+int blk_submit(blk_device_t* dev, blk_request_t* req) {
+    if (req->count == 0 || req->count > dev->max_sectors ||
+        req->lba >= dev->sectors || req->count > dev->sectors - req->lba) {
+        return -1;
+    }
+
+    req->status = BLK_PENDING;
+    dev->stats.requests++;
+
+    // Insert after requests with a lower or equal LBA, so equal LBAs keep
+    // submission order
+    blk_request_t** link = &dev->queue;
+    while (*link && (*link)->lba <= req->lba) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link = req;
+
+    dispatch(dev);
+    return 0;
+}
+
+void blk_plug(blk_device_t* dev) {
+    dev->plugged = 1;
+}
+
+void blk_unplug(blk_device_t* dev) {
+    dev->plugged = 0;
+    dispatch(dev);
+}
+
+void blk_complete(blk_device_t* dev, int slot, int status) {
+    blk_command_t* cmd = &dev->commands[slot];
+    blk_request_t* req = cmd->reqs;
+
+    dev->busy &= ~(1u << slot);
+    cmd->reqs = NULL;
+
+    while (req) {
+        blk_request_t* next = req->next;
+        finish_request(dev, req, status);
+        req = next;
+    }
+}
+
+void blk_poll(blk_device_t* dev) {
+    dev->irq_pending = 0;
+    dev->ops->poll(dev);
+    dispatch(dev);
+}
+
+int blk_wait(blk_device_t* dev, blk_request_t* req) {
+    if (dev->plugged) {
+        blk_unplug(dev);
+    }
+    blk_poll(dev);
+    while (req->status == BLK_PENDING) {
+        if (dev->irq_driven) {
+            // Check and sleep with interrupts off, so a completion landing
+            // in between still wakes the hlt
+            irq_disable();
+            if (!dev->irq_pending) {
+                cpu_wait_irq();
+            } else {
+                irq_enable();
+            }
+        }
+        blk_poll(dev);
+    }
+    return req->status;
+}
+
+static int sync_io(blk_device_t* dev, int op, uint64_t lba, uint32_t count, void* buf) {
+    blk_request_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.lba = lba;
+    req.count = count;
+    req.buf = buf;
+
+    if (blk_submit(dev, &req) < 0) {
+        return -1;
+    }
+    return blk_wait(dev, &req);
+}
+
+int blk_read(blk_device_t* dev, uint64_t lba, uint32_t count, void* buf) {
+    return sync_io(dev, BLK_READ, lba, count, buf);
+}
+
+int blk_write(blk_device_t* dev, uint64_t lba, uint32_t count, const void* buf) {
+    return sync_io(dev, BLK_WRITE, lba, count, (void*)buf);
+}
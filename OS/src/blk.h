@@ -0,0 +1,115 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include "libc/libc.h"
+
+/*
+ * Block-device layer.
+ *
+ * Callers submit requests, which wait on a per-device queue kept sorted
+ * by LBA. Whenever the device has a free command slot, the head of the
+ * queue is taken together with any following requests that continue it
+ * (same direction, adjacent sectors) and handed to the driver as one
+ * command, up to the driver's sector and segment limits. Drivers with
+ * several slots keep that many commands in flight.
+ *
+ * Completion is split in two: the driver's interrupt handler only
+ * latches status and sets irq_pending, and blk_poll() later finishes the
+ * commands and runs the request callbacks outside interrupt context.
+ * blk_wait() sleeps with hlt between interrupts, so time spent waiting
+ * is free for the device.
+ */
+
+#define BLK_SECTOR_SIZE 512
+#define BLK_MAX_SLOTS   32
+#define BLK_MAX_DEVICES 8
+
+#define BLK_READ  0
+#define BLK_WRITE 1
+
+#define BLK_PENDING 1       /* req->status until completion; then 0 or -1 */
+
+typedef struct blk_request {
+    int op;
+    uint64_t lba;
+    uint32_t count;                     /* Sectors */
+    void* buf;                          /* Physically contiguous, 2-byte aligned */
+    volatile int status;
+    void (*done)(struct blk_request* req);  /* Optional */
+    void* ctx;
+    struct blk_request* next;           /* Queue link, then command chain */
+} blk_request_t;
+
+// One device command: a run of merged requests covering adjacent sectors
+typedef struct {
+    int op;
+    uint64_t lba;
+    uint32_t count;
+    uint32_t segments;
+    blk_request_t* reqs;
+} blk_command_t;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t commands;
+    uint32_t merges;            /* Requests folded into another's command */
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint32_t errors;
+} blk_stats_t;
+
+struct blk_device;
+
+typedef struct {
+    // Start `cmd` in `slot`; return -1 to fail it straight away
+    int (*start)(struct blk_device* dev, int slot, blk_command_t* cmd);
+    // Report finished slots through blk_complete()
+    void (*poll)(struct blk_device* dev);
+} blk_ops_t;
+
+typedef struct blk_device {
+    char name[8];
+    uint64_t sectors;
+    uint32_t max_sectors;       /* Per command */
+    uint32_t max_segments;      /* Requests per command */
+    int slots;                  /* Commands in flight, at most BLK_MAX_SLOTS */
+    int irq_driven;             /* Completions raise an interrupt */
+    const blk_ops_t* ops;
+    void* driver;
+
+    volatile int irq_pending;
+    blk_request_t* queue;       /* Sorted by LBA */
+    blk_command_t commands[BLK_MAX_SLOTS];
+    uint32_t busy;              /* Bit per slot */
+    int plugged;
+    blk_stats_t stats;
+} blk_device_t;
+
+// Drivers register devices once their geometry and ops are set
+int blk_register(blk_device_t* dev);
+int blk_count(void);
+blk_device_t* blk_get(int index);
+blk_device_t* blk_find(const char* name);
+
+// Returns -1 if the request lies outside the device
+int blk_submit(blk_device_t* dev, blk_request_t* req);
+
+// While plugged, submissions only queue, so a batch can merge before dispatch
+void blk_plug(blk_device_t* dev);
+void blk_unplug(blk_device_t* dev);
+
+void blk_poll(blk_device_t* dev);
+int blk_wait(blk_device_t* dev, blk_request_t* req);
+
+// Called by drivers from their poll routine
+void blk_complete(blk_device_t* dev, int slot, int status);
+
+// Synchronous helpers
+int blk_read(blk_device_t* dev, uint64_t lba, uint32_t count, void* buf);
+int blk_write(blk_device_t* dev, uint64_t lba, uint32_t count, const void* buf);
+
+// Drivers probe and register whatever they find
+void ata_init(void);
+void ahci_init(void);
+
+#endif /* BLK_H */
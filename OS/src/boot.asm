@@ -2,19 +2,47 @@
 [bits 16]
 [org 0x7c00]
 
-; Set up stack
+; Size in sectors of the kernel image: the LZ4 stub (lz4stub.asm) and the
+; compressed kernel. Passed in by the Makefile as -DKERNEL_SECTORS=n
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 15
+%endif
+
+KERNEL_BUFFER equ 0x10000       ; Real-mode load buffer, below the PM stack
+MAX_KERNEL_SECTORS equ (0x80000 - KERNEL_BUFFER) / 512
+
+; Boot timeline, read by the kernel (boot_stamps_t in bootinfo.h)
+BOOT_STAMPS equ 0x600
+BOOT_STAMPS_MAGIC equ 0x504D5453
+
+; Store the TSC as the loader stage numbered %1
+%macro BOOT_STAMP 1
+    rdtsc
+    mov [BOOT_STAMPS + 8 + %1 * 8], eax
+    mov [BOOT_STAMPS + 12 + %1 * 8], edx
+%endmacro
+
+%if KERNEL_SECTORS > MAX_KERNEL_SECTORS
+%error "kernel does not fit in the boot loader's load buffer"
+%endif
+
+; Set up segments and stack
+xor ax, ax
+mov ds, ax
+mov es, ax
+mov ss, ax
 mov bp, 0x9000
 mov sp, bp
 
+mov dword [BOOT_STAMPS], BOOT_STAMPS_MAGIC
+BOOT_STAMP 0
+
 ; Store boot drive number that BIOS provides in DL
 mov [BOOT_DRIVE], dl
 
-; Print a message
-mov si, MSG_REAL_MODE
-call print_string
-
 ; Load the kernel
 call load_kernel
+BOOT_STAMP 1
 
 ; Print success message
 mov si, KERNEL_LOADED_MSG
@@ -36,52 +64,116 @@ done:
     ret
 
 ; Load kernel function
+; Reads KERNEL_SIZE sectors following the boot sector into KERNEL_BUFFER,
+; as many sectors per BIOS call as the drive allows
 load_kernel:
-    ; Code to load kernel from disk to memory
     mov si, LOAD_KERNEL_MSG
     call print_string
-    
-    mov bx, KERNEL_OFFSET  ; Destination address
-    mov dh, 15             ; Number of sectors to read
-    mov dl, [BOOT_DRIVE]   ; Drive to read from
-    call disk_load
-    ret
 
-; Add disk_load function
-disk_load:
-    push dx         ; Store DX on stack to check against total sectors read
-    
-    mov ah, 0x02    ; BIOS read sector function
-    mov al, dh      ; Read DH sectors
-    mov ch, 0x00    ; Select cylinder 0
-    mov dh, 0x00    ; Select head 0
-    mov cl, 0x02    ; Start reading from second sector (after boot sector)
-    
-    int 0x13        ; BIOS interrupt
-    
-    jc disk_error   ; Jump if error (carry flag set)
-    
-    pop dx          ; Restore DX from the stack
-    cmp dh, al      ; If AL (sectors read) != DH (sectors expected)
-    jne sectors_error  ; Display error
+    mov ax, [KERNEL_SIZE]
+    mov [SECTORS_LEFT], ax
+
+    ; Use INT 13h extensions (LBA packet reads) when the BIOS has them
+    mov ah, 0x41
+    mov bx, 0x55aa
+    mov dl, [BOOT_DRIVE]
+    int 0x13
+    jc .geometry
+    cmp bx, 0xaa55
+    jne .geometry
+    shr cx, 1               ; Bit 0: AH=42h supported
+    jnc .geometry
+    inc byte [USE_LBA]
+    jmp .next
+
+.geometry:
+    ; Otherwise read a track at a time with CHS, so get the geometry
+    mov ah, 0x08
+    mov dl, [BOOT_DRIVE]
+    xor di, di
+    int 0x13
+    jc disk_error
+    and cx, 0x3f            ; Sectors per track
+    mov [SECTORS_PER_TRACK], cx
+    movzx dx, dh            ; Last head number
+    inc dx
+    mov [HEADS], dx
+
+.next:
+    mov ax, [SECTORS_LEFT]
+    test ax, ax
+    jz .done
+
+    ; A transfer must not cross a 64 KiB boundary (ISA DMA)
+    mov bx, [DAP_SEGMENT]
+    and bx, 0x0fff
+    neg bx
+    add bx, 0x1000
+    shr bx, 5               ; Sectors left before the boundary
+    cmp ax, bx
+    jbe .fits
+    mov ax, bx
+.fits:
+    cmp byte [USE_LBA], 0
+    je .read_chs
+
+    cmp ax, 127             ; Largest count all EDD BIOSes accept
+    jbe .read_lba
+    mov ax, 127
+.read_lba:
+    mov [DAP_COUNT], ax
+    mov si, DAP
+    mov ah, 0x42
+    mov dl, [BOOT_DRIVE]
+    int 0x13
+    jc disk_error
+    mov ax, [DAP_COUNT]     ; Sectors actually transferred
+    jmp .advance
+
+.read_chs:
+    ; Sector = LBA % SPT + 1, head = track % heads, cylinder = track / heads
+    push ax
+    mov ax, [DAP_LBA]
+    xor dx, dx
+    div word [SECTORS_PER_TRACK]
+    mov cx, [SECTORS_PER_TRACK]
+    sub cx, dx              ; Sectors left on this track
+    pop bx
+    cmp bx, cx
+    jbe .track
+    mov bx, cx
+.track:
+    push bx
+    mov cl, dl
+    inc cl
+    xor dx, dx
+    div word [HEADS]
+    mov dh, dl              ; Head
+    mov ch, al              ; Cylinder bits 0-7
+    shl ah, 6
+    or cl, ah               ; Cylinder bits 8-9
+    pop ax
+    push ax
+    mov ah, 0x02            ; BIOS read sector function
+    mov dl, [BOOT_DRIVE]
+    mov es, [DAP_SEGMENT]
+    xor bx, bx
+    int 0x13
+    jc disk_error
+    pop ax
+
+.advance:
+    add [DAP_LBA], ax
+    sub [SECTORS_LEFT], ax
+    shl ax, 5               ; 32 paragraphs per sector
+    add [DAP_SEGMENT], ax
+    jmp .next
+.done:
     ret
-    
+
 disk_error:
     mov si, DISK_ERROR_MSG
     call print_string
-    
-    ; Print error code
-    mov ah, 0
-    mov al, ah      ; Error code in AH after int 0x13
-    add al, '0'     ; Convert to ASCII
-    mov ah, 0x0e
-    int 0x10
-    
-    jmp $           ; Hang
-
-sectors_error:
-    mov si, SECTORS_ERROR_MSG
-    call print_string
     jmp $           ; Hang
 
 ; GDT
@@ -126,6 +218,12 @@ DATA_SEG equ gdt_data - gdt_start
 
 ; Switch to protected mode function
 switch_to_pm:
+    ; Enable the A20 line (fast A20 gate) so the kernel can live above 1 MiB
+    in al, 0x92
+    or al, 2
+    and al, 0xfe            ; Bit 0 would reset the machine
+    out 0x92, al
+
     cli                     ; Disable interrupts
     lgdt [gdt_descriptor]   ; Load GDT
     
@@ -157,19 +255,31 @@ init_pm:
 
 ; 32-bit protected mode code
 BEGIN_PM:
-    ; Load the kernel into memory
-    mov ebx, KERNEL_OFFSET  ; Point to the loaded kernel
-    jmp ebx                 ; Jump to the kernel
+    ; The image starts with the LZ4 stub, which decompresses the kernel
+    ; to the address it is linked at and records the handoff stamp
+    jmp KERNEL_BUFFER
+
+; Disk address packet for INT 13h AH=42h; also tracks the CHS position
+DAP:
+    db 0x10, 0              ; Packet size, reserved
+DAP_COUNT dw 0              ; Sectors to transfer
+    dw 0                    ; Buffer offset
+DAP_SEGMENT dw KERNEL_BUFFER >> 4
+DAP_LBA dq 1                ; Kernel starts right after the boot sector
 
 ; Constants and variables
-MSG_REAL_MODE db "Started in 16-bit Real Mode", 13, 10, 0
-DISK_ERROR_MSG db "Disk read error! Error code: ", 0
-SECTORS_ERROR_MSG db "Incorrect number of sectors read!", 13, 10, 0
-LOAD_KERNEL_MSG db "Loading kernel into memory...", 13, 10, 0
-KERNEL_LOADED_MSG db "Kernel loaded successfully!", 13, 10, 0
+DISK_ERROR_MSG db "Disk read error!", 13, 10, 0
+LOAD_KERNEL_MSG db "Loading kernel...", 13, 10, 0
+KERNEL_LOADED_MSG db "Kernel loaded", 13, 10, 0
 BOOT_DRIVE db 0
-KERNEL_OFFSET equ 0x1000
+USE_LBA db 0
+
+; Scratch variables past the end of the boot sector
+SECTORS_LEFT equ 0x7e00
+SECTORS_PER_TRACK equ 0x7e02
+HEADS equ 0x7e04
 
 ; Boot sector padding
-times 510-($-$$) db 0
+times 508-($-$$) db 0
+KERNEL_SIZE dw KERNEL_SECTORS   ; Header read by load_kernel
 dw 0xaa55
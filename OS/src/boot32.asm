@@ -0,0 +1,93 @@
+; Protected-mode to long-mode switch for the BIOS boot path.
+; boot.asm jumps here (the start of kernel64.bin, at 0x100000) in 32-bit
+; protected mode with paging off.
+[bits 32]
+
+global start32
+extern _start64
+extern __bss_phys_start
+extern __bss_phys_end
+
+KERNEL_VMA equ 0xFFFFFFFF80000000
+
+; Boot page tables in free conventional memory below the boot sector
+BOOT_PML4 equ 0x1000
+BOOT_PDPT equ 0x2000
+BOOT_PD   equ 0x3000
+
+BOOT_STAMPS equ 0x600           ; boot_stamps_t from the boot sector (bootinfo.h)
+
+section .boot progbits alloc exec nowrite
+start32:
+    ; The flat image has no BSS; clear it here
+    mov edi, __bss_phys_start
+    mov ecx, __bss_phys_end
+    sub ecx, edi
+    add ecx, 3
+    shr ecx, 2
+    xor eax, eax
+    rep stosd
+
+    ; Map the first 1 GiB twice with 2 MiB pages: identity for this code,
+    ; and at KERNEL_VMA for the kernel. paging_init replaces these.
+    mov edi, BOOT_PML4
+    mov ecx, 3 * 1024
+    rep stosd
+
+    mov dword [BOOT_PML4], BOOT_PDPT | 3
+    mov dword [BOOT_PML4 + 511 * 8], BOOT_PDPT | 3
+    mov dword [BOOT_PDPT], BOOT_PD | 3
+    mov dword [BOOT_PDPT + 510 * 8], BOOT_PD | 3
+
+    mov edi, BOOT_PD
+    mov eax, 0x83               ; Present, writable, 2 MiB page
+    mov ecx, 512
+.fill_pd:
+    mov [edi], eax
+    add eax, 0x200000
+    add edi, 8
+    loop .fill_pd
+
+    ; Enable PAE, load CR3, set EFER.LME, then turn on paging
+    mov eax, cr4
+    or eax, 1 << 5
+    mov cr4, eax
+
+    mov eax, BOOT_PML4
+    mov cr3, eax
+
+    mov ecx, 0xC0000080
+    rdmsr
+    or eax, 1 << 8
+    wrmsr
+
+    mov eax, cr0
+    or eax, 1 << 31
+    mov cr0, eax
+
+    lgdt [gdt64_descriptor]
+    jmp CODE_SEG:long_mode
+
+[bits 64]
+long_mode:
+    rdtsc                       ; Boot timeline: BOOT_STAGE_LONG_MODE
+    mov [BOOT_STAMPS + 8 + 3 * 8], eax
+    mov [BOOT_STAMPS + 12 + 3 * 8], edx
+    xor edi, edi                ; No boot info from a BIOS boot
+    mov rax, _start64
+    jmp rax
+
+align 8
+gdt64_start:
+    dq 0x0                      ; Null descriptor
+gdt64_code:
+    dq 0x00AF9A000000FFFF       ; 64-bit code segment
+gdt64_data:
+    dq 0x00CF92000000FFFF       ; Data segment
+gdt64_end:
+
+gdt64_descriptor:
+    dw gdt64_end - gdt64_start - 1
+    dd gdt64_start
+
+CODE_SEG equ gdt64_code - gdt64_start
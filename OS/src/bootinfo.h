@@ -0,0 +1,67 @@
+#ifndef BOOTINFO_H
+#define BOOTINFO_H
+
+/*
+ * What the UEFI loader hands the 64-bit kernel, by pointer in RDI.
+ * entry64.asm saves the pointer in boot_info_addr; the BIOS path leaves
+ * it 0. The loader includes this next to the EFI headers, so it uses
+ * plain C types only.
+ */
+
+#define BOOT_INFO_MAGIC 0x4F464E49544F4F42ULL  /* "BOOTINFO" */
+
+/*
+ * Loader half of the boot timeline: TSC readings taken before the kernel
+ * runs. The UEFI loader fills the copy in boot_info_t. The BIOS boot
+ * sector (with lz4stub.asm, and boot32.asm on x86_64) writes one at
+ * BOOT_STAMPS_PHYS, in memory nothing else uses that early; the assembly
+ * hard-codes the offsets.
+ * A zero reading means the stage did not happen on this path.
+ */
+#define BOOT_STAMPS_PHYS  0x600
+#define BOOT_STAMPS_MAGIC 0x504D5453        /* "STMP" */
+
+#define BOOT_STAGE_LOADER      0    /* Boot sector or efi_main entered */
+#define BOOT_STAGE_KERNEL_READ 1    /* Kernel image read from disk */
+#define BOOT_STAGE_HANDOFF     2    /* Kernel decompressed in place, about to jump */
+#define BOOT_STAGE_LONG_MODE   3    /* boot32.asm reached 64-bit mode */
+#define BOOT_LOADER_STAGES     4
+
+typedef struct {
+    unsigned int magic;
+    unsigned int reserved;
+    unsigned long long tsc[BOOT_LOADER_STAGES];
+} boot_stamps_t;
+
+/*
+ * Free RAM from the UEFI memory map: its EfiConventionalMemory
+ * descriptors, with neighbours merged, in map order. Memory the loader
+ * still owns (kernel image, page tables, this structure) is LoaderData
+ * and never listed. Descriptors past BOOT_MEM_REGIONS are dropped.
+ */
+#define BOOT_MEM_REGIONS 64
+
+typedef struct {
+    unsigned long long base;        /* Physical, page-aligned */
+    unsigned long long size;        /* Bytes, whole pages */
+} boot_mem_region_t;
+
+// Pixel layouts of a 32-bit framebuffer, lowest byte first
+#define BOOT_FB_RGBX 0
+#define BOOT_FB_BGRX 1
+
+typedef struct {
+    unsigned long long magic;
+    unsigned long long fb_base;     /* Physical; 0 if there is no framebuffer */
+    unsigned long long fb_size;
+    unsigned int fb_width;          /* Pixels */
+    unsigned int fb_height;
+    unsigned int fb_pitch;          /* Bytes per scanline */
+    unsigned int fb_format;
+    boot_stamps_t stamps;
+    unsigned int mem_region_count;
+    unsigned int mem_reserved;
+    boot_mem_region_t mem_regions[BOOT_MEM_REGIONS];
+} boot_info_t;
+
+#endif /* BOOTINFO_H */
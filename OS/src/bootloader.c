@@ -1,13 +1,361 @@
 #include <efi.h>
 #include <efilib.h>
 
+#include "bootinfo.h"
+#include "lz4.h"
+
 // Kernel entry point prototype
-typedef void (*KernelMain)(EFI_SIMPLE_TEXT_INPUT_PROTOCOL *KeyboardProtocol);
+typedef void (*KernelMain)(boot_info_t *BootInfo);
+
+// The kernel is an ELF64 image compressed into an LZ4 frame (lz4.h)
+#define KERNEL_FILE L"kernel.elf.lz4"
+
+// Minimal ELF64 definitions for loading kernel.elf
+#define ELF_MAGIC   0x464C457F  // "\x7fELF"
+#define ELFCLASS64  2
+#define EM_X86_64   62
+#define PT_LOAD     1
+#define PF_W        2
+
+typedef struct {
+    UINT8  e_ident[16];
+    UINT16 e_type;
+    UINT16 e_machine;
+    UINT32 e_version;
+    UINT64 e_entry;
+    UINT64 e_phoff;
+    UINT64 e_shoff;
+    UINT32 e_flags;
+    UINT16 e_ehsize;
+    UINT16 e_phentsize;
+    UINT16 e_phnum;
+    UINT16 e_shentsize;
+    UINT16 e_shnum;
+    UINT16 e_shstrndx;
+} Elf64_Ehdr;
+
+typedef struct {
+    UINT32 p_type;
+    UINT32 p_flags;
+    UINT64 p_offset;
+    UINT64 p_vaddr;
+    UINT64 p_paddr;
+    UINT64 p_filesz;
+    UINT64 p_memsz;
+    UINT64 p_align;
+} Elf64_Phdr;
+
+// Paging
+#define PAGE_SIZE       0x1000ULL
+#define LARGE_PAGE_SIZE 0x200000ULL
+#define PAGE_PRESENT    0x001
+#define PAGE_WRITABLE   0x002
+#define PAGE_LARGE      0x080
+#define IDENTITY_GIB    4       // Low memory kept identity-mapped for the loader and firmware
+
+// Handed to the kernel. Static, so the firmware zeroes it with the image.
+static boot_info_t BootInfo;
+
+static inline UINT64 ReadTsc(void) {
+    UINT32 Low, High;
+    __asm__ volatile("rdtsc" : "=a"(Low), "=d"(High));
+    return ((UINT64)High << 32) | Low;
+}
+
+// Where the kernel ended up
+typedef struct {
+    UINT64 Entry;
+    UINT64 VirtBase;            // 2 MiB-aligned start of the lowest segment
+    UINT64 Size;                // Whole 2 MiB pages spanned by the segments
+    EFI_PHYSICAL_ADDRESS PhysBase;
+    Elf64_Phdr *Phdrs;
+    UINTN PhdrCount;
+} KernelImage;
+
+// Read exactly Size bytes at Offset
+static EFI_STATUS ReadAt(EFI_FILE *File, UINT64 Offset, UINTN Size, VOID *Buffer) {
+    EFI_STATUS Status = uefi_call_wrapper(File->SetPosition, 2, File, Offset);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    UINTN Read = Size;
+    Status = uefi_call_wrapper(File->Read, 3, File, &Read, Buffer);
+    if (!EFI_ERROR(Status) && Read != Size) {
+        Status = EFI_LOAD_ERROR;
+    }
+    return Status;
+}
+
+// Read the whole file into a pool buffer, in one Read
+static EFI_STATUS ReadFile(EFI_BOOT_SERVICES *BS, EFI_FILE *File, UINT8 **Data, UINTN *Size) {
+    EFI_FILE_INFO *Info = LibFileInfo(File);
+    if (!Info) {
+        return EFI_LOAD_ERROR;
+    }
+    *Size = Info->FileSize;
+    FreePool(Info);
+
+    EFI_STATUS Status = uefi_call_wrapper(BS->AllocatePool, 3, EfiLoaderData, *Size, (void **)Data);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    return ReadAt(File, 0, *Size, *Data);
+}
+
+// Decompress the kernel's LZ4 frame into a pool buffer sized by the
+// content size in the frame header
+static EFI_STATUS Decompress(EFI_BOOT_SERVICES *BS, UINT8 *Packed, UINTN PackedSize,
+                             UINT8 **Data, UINTN *Size) {
+    *Size = lz4_frame_content_size(Packed, PackedSize);
+    if (*Size == 0) {
+        Print(L"kernel.elf.lz4 is not an LZ4 frame with a content size\n\r");
+        return EFI_LOAD_ERROR;
+    }
+
+    EFI_STATUS Status = uefi_call_wrapper(BS->AllocatePool, 3, EfiLoaderData, *Size, (void **)Data);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    if (lz4_decompress_frame(Packed, PackedSize, *Data, *Size) != (long)*Size) {
+        Print(L"kernel.elf.lz4 is corrupt\n\r");
+        return EFI_LOAD_ERROR;
+    }
+    return EFI_SUCCESS;
+}
+
+// Copy Size bytes at Offset of the decompressed file, if it has them
+static EFI_STATUS CopyAt(UINT8 *File, UINTN FileSize, UINT64 Offset, UINTN Size, VOID *Buffer) {
+    if (Offset > FileSize || Size > FileSize - Offset) {
+        Print(L"kernel.elf is truncated\n\r");
+        return EFI_LOAD_ERROR;
+    }
+    CopyMem(Buffer, File + Offset, Size);
+    return EFI_SUCCESS;
+}
+
+// Load the PT_LOAD segments of an ELF64 kernel, decompressed in memory,
+// into one physically contiguous, 2 MiB-aligned block. Only file-backed
+// bytes are copied; BSS is zeroed in place.
+static EFI_STATUS LoadKernel(EFI_BOOT_SERVICES *BS, UINT8 *File, UINTN FileSize, KernelImage *Image) {
+    Elf64_Ehdr Header;
+    EFI_STATUS Status = CopyAt(File, FileSize, 0, sizeof(Header), &Header);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    if (*(UINT32 *)Header.e_ident != ELF_MAGIC || Header.e_ident[4] != ELFCLASS64 ||
+        Header.e_machine != EM_X86_64 || Header.e_phentsize != sizeof(Elf64_Phdr)) {
+        Print(L"kernel.elf is not an x86_64 ELF64 image\n\r");
+        return EFI_LOAD_ERROR;
+    }
+
+    UINTN PhdrBytes = Header.e_phnum * sizeof(Elf64_Phdr);
+    Status = uefi_call_wrapper(BS->AllocatePool, 3, EfiLoaderData, PhdrBytes, (void **)&Image->Phdrs);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    Image->PhdrCount = Header.e_phnum;
+
+    Status = CopyAt(File, FileSize, Header.e_phoff, PhdrBytes, Image->Phdrs);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    // Span of all loadable segments, widened to 2 MiB pages
+    UINT64 Low = ~0ULL;
+    UINT64 High = 0;
+    for (UINTN i = 0; i < Image->PhdrCount; i++) {
+        Elf64_Phdr *Phdr = &Image->Phdrs[i];
+        if (Phdr->p_type != PT_LOAD || Phdr->p_memsz == 0) {
+            continue;
+        }
+        if (Phdr->p_vaddr < Low) {
+            Low = Phdr->p_vaddr;
+        }
+        if (Phdr->p_vaddr + Phdr->p_memsz > High) {
+            High = Phdr->p_vaddr + Phdr->p_memsz;
+        }
+    }
+
+    if (High == 0) {
+        Print(L"kernel.elf has no loadable segments\n\r");
+        return EFI_LOAD_ERROR;
+    }
+
+    Image->Entry = Header.e_entry;
+    Image->VirtBase = Low & ~(LARGE_PAGE_SIZE - 1);
+    Image->Size = ((High + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1)) - Image->VirtBase;
+
+    // Over-allocate by one large page, then give back what alignment skips
+    UINTN Pages = (Image->Size + LARGE_PAGE_SIZE) / PAGE_SIZE;
+    EFI_PHYSICAL_ADDRESS Block = 0;
+    Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, Pages, &Block);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Image->PhysBase = (Block + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    UINTN HeadPages = (Image->PhysBase - Block) / PAGE_SIZE;
+    UINTN TailPages = Pages - HeadPages - Image->Size / PAGE_SIZE;
+    if (HeadPages) {
+        uefi_call_wrapper(BS->FreePages, 2, Block, HeadPages);
+    }
+    if (TailPages) {
+        uefi_call_wrapper(BS->FreePages, 2, Image->PhysBase + Image->Size, TailPages);
+    }
+
+    for (UINTN i = 0; i < Image->PhdrCount; i++) {
+        Elf64_Phdr *Phdr = &Image->Phdrs[i];
+        if (Phdr->p_type != PT_LOAD || Phdr->p_memsz == 0) {
+            continue;
+        }
+
+        UINT8 *Dest = (UINT8 *)(Image->PhysBase + (Phdr->p_vaddr - Image->VirtBase));
+        if (Phdr->p_filesz) {
+            Status = CopyAt(File, FileSize, Phdr->p_offset, Phdr->p_filesz, Dest);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+        }
+        if (Phdr->p_memsz > Phdr->p_filesz) {
+            ZeroMem(Dest + Phdr->p_filesz, Phdr->p_memsz - Phdr->p_filesz);
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Build the page tables the kernel starts with: the low IDENTITY_GIB GiB
+// identity-mapped (the loader keeps running there until it jumps), and
+// the kernel image mapped at its link address. Both use 2 MiB pages, so
+// the whole kernel text costs a handful of TLB entries. Large pages are
+// writable only if a writable segment overlaps them.
+static EFI_STATUS BuildPageTables(EFI_BOOT_SERVICES *BS, KernelImage *Image, UINT64 **Pml4Out) {
+    UINTN Pml4Index = (Image->VirtBase >> 39) & 0x1FF;
+    UINTN PdptIndex = (Image->VirtBase >> 30) & 0x1FF;
+
+    if (Pml4Index == 0 ||
+        PdptIndex != (((Image->VirtBase + Image->Size - 1) >> 30) & 0x1FF)) {
+        Print(L"Kernel must be linked above 512 GiB and fit in one 1 GiB region\n\r");
+        return EFI_UNSUPPORTED;
+    }
+
+    // PML4, identity PDPT and its page directories, kernel PDPT and PD
+    UINTN TablePages = 2 + IDENTITY_GIB + 2;
+    EFI_PHYSICAL_ADDRESS Tables = 0;
+    EFI_STATUS Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData,
+                                          TablePages, &Tables);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    ZeroMem((VOID *)Tables, TablePages * PAGE_SIZE);
+
+    UINT64 *Pml4 = (UINT64 *)Tables;
+    UINT64 *IdentityPdpt = Pml4 + 512;
+    UINT64 *IdentityPd = IdentityPdpt + 512;
+    UINT64 *KernelPdpt = IdentityPd + 512 * IDENTITY_GIB;
+    UINT64 *KernelPd = KernelPdpt + 512;
+
+    Pml4[0] = (UINT64)IdentityPdpt | PAGE_PRESENT | PAGE_WRITABLE;
+    for (UINTN Gib = 0; Gib < IDENTITY_GIB; Gib++) {
+        UINT64 *Pd = IdentityPd + 512 * Gib;
+        IdentityPdpt[Gib] = (UINT64)Pd | PAGE_PRESENT | PAGE_WRITABLE;
+        for (UINTN i = 0; i < 512; i++) {
+            Pd[i] = ((Gib << 30) + i * LARGE_PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE;
+        }
+    }
+
+    Pml4[Pml4Index] = (UINT64)KernelPdpt | PAGE_PRESENT | PAGE_WRITABLE;
+    KernelPdpt[PdptIndex] = (UINT64)KernelPd | PAGE_PRESENT | PAGE_WRITABLE;
+
+    UINTN FirstPd = (Image->VirtBase >> 21) & 0x1FF;
+    for (UINT64 Offset = 0; Offset < Image->Size; Offset += LARGE_PAGE_SIZE) {
+        UINT64 Virt = Image->VirtBase + Offset;
+        UINT64 Flags = PAGE_PRESENT | PAGE_LARGE;
+
+        for (UINTN i = 0; i < Image->PhdrCount; i++) {
+            Elf64_Phdr *Phdr = &Image->Phdrs[i];
+            if (Phdr->p_type == PT_LOAD && (Phdr->p_flags & PF_W) &&
+                Phdr->p_vaddr < Virt + LARGE_PAGE_SIZE && Phdr->p_vaddr + Phdr->p_memsz > Virt) {
+                Flags |= PAGE_WRITABLE;
+            }
+        }
+
+        KernelPd[FirstPd + Offset / LARGE_PAGE_SIZE] = (Image->PhysBase + Offset) | Flags;
+    }
+
+    *Pml4Out = Pml4;
+    return EFI_SUCCESS;
+}
+
+// Copy the EfiConventionalMemory descriptors, merging each with the
+// previous one when they touch
+static VOID CollectMemory(EFI_MEMORY_DESCRIPTOR *Map, UINTN MapSize, UINTN DescriptorSize,
+                          boot_info_t *Info) {
+    Info->mem_region_count = 0;
+    for (UINTN Offset = 0; Offset + DescriptorSize <= MapSize; Offset += DescriptorSize) {
+        EFI_MEMORY_DESCRIPTOR *Desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)Map + Offset);
+        if (Desc->Type != EfiConventionalMemory || Desc->NumberOfPages == 0) {
+            continue;
+        }
+
+        UINT64 Size = Desc->NumberOfPages * EFI_PAGE_SIZE;
+        UINT32 Count = Info->mem_region_count;
+        if (Count > 0 && Info->mem_regions[Count - 1].base + Info->mem_regions[Count - 1].size ==
+                             Desc->PhysicalStart) {
+            Info->mem_regions[Count - 1].size += Size;
+        } else if (Count < BOOT_MEM_REGIONS) {
+            Info->mem_regions[Count].base = Desc->PhysicalStart;
+            Info->mem_regions[Count].size = Size;
+            Info->mem_region_count = Count + 1;
+        }
+    }
+}
+
+// Describe the GOP framebuffer in the current mode. Only 32-bit direct
+// color formats are passed on; anything else leaves fb_base at 0 and the
+// kernel falls back to VGA text memory.
+static VOID FindFramebuffer(EFI_BOOT_SERVICES *BS, boot_info_t *Info) {
+    EFI_GUID GopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = NULL;
+
+    EFI_STATUS Status = uefi_call_wrapper(BS->LocateProtocol, 3, &GopGuid, NULL, (void **)&Gop);
+    if (EFI_ERROR(Status) || Gop == NULL || Gop->Mode == NULL || Gop->Mode->Info == NULL) {
+        Print(L"No GOP framebuffer\n\r");
+        return;
+    }
+
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Mode = Gop->Mode->Info;
+    switch (Mode->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+        Info->fb_format = BOOT_FB_RGBX;
+        break;
+    case PixelBlueGreenRedReserved8BitPerColor:
+        Info->fb_format = BOOT_FB_BGRX;
+        break;
+    default:
+        Print(L"Unsupported GOP pixel format %d\n\r", Mode->PixelFormat);
+        return;
+    }
+
+    Info->fb_base = Gop->Mode->FrameBufferBase;
+    Info->fb_size = Gop->Mode->FrameBufferSize;
+    Info->fb_width = Mode->HorizontalResolution;
+    Info->fb_height = Mode->VerticalResolution;
+    Info->fb_pitch = Mode->PixelsPerScanLine * 4;
+    Print(L"Framebuffer %dx%d at %lx\n\r", Info->fb_width, Info->fb_height, Info->fb_base);
+}
 
 // UEFI application entry point
 EFI_STATUS
 EFIAPI
 efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
+    // Everything before this is firmware time
+    BootInfo.magic = BOOT_INFO_MAGIC;
+    BootInfo.stamps.magic = BOOT_STAMPS_MAGIC;
+    BootInfo.stamps.tsc[BOOT_STAGE_LOADER] = ReadTsc();
+
     // Initialize UEFI library
     InitializeLib(ImageHandle, SystemTable);
     
@@ -69,7 +417,7 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         5,
         Root,
         &KernelFile,
-        L"kernel.bin",
+        KERNEL_FILE,
         EFI_FILE_MODE_READ,
         0
     );
@@ -79,95 +427,50 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         return Status;
     }
     
-    // Get file information to determine its size
-    UINTN FileInfoSize = 0;
-    EFI_FILE_INFO *FileInfo = NULL;
-    
-    Status = uefi_call_wrapper(
-        KernelFile->GetInfo,
-        4,
-        KernelFile,
-        &gEfiFileInfoGuid,
-        &FileInfoSize,
-        NULL
-    );
-    
-    if (Status == EFI_BUFFER_TOO_SMALL) {
-        // Allocate buffer for file info
-        Status = uefi_call_wrapper(
-            SystemTable->BootServices->AllocatePool,
-            3,
-            EfiLoaderData,
-            FileInfoSize,
-            (void **)&FileInfo
-        );
-        
-        if (EFI_ERROR(Status)) {
-            Print(L"Error allocating memory for file info: %r\n", Status);
-            return Status;
-        }
-        
-        // Get file info
-        Status = uefi_call_wrapper(
-            KernelFile->GetInfo,
-            4,
-            KernelFile,
-            &gEfiFileInfoGuid,
-            &FileInfoSize,
-            FileInfo
-        );
-        
-        if (EFI_ERROR(Status)) {
-            Print(L"Error getting file info: %r\n", Status);
-            return Status;
-        }
-    } else if (EFI_ERROR(Status)) {
-        Print(L"Error getting file info size: %r\n", Status);
+    // Read the compressed kernel, then close the file
+    UINT8 *Packed;
+    UINTN PackedSize;
+    Status = ReadFile(SystemTable->BootServices, KernelFile, &Packed, &PackedSize);
+    uefi_call_wrapper(KernelFile->Close, 1, KernelFile);
+
+    if (EFI_ERROR(Status)) {
+        Print(L"Error reading kernel file: %r\n", Status);
         return Status;
     }
-    
-    // Allocate memory for the kernel
-    UINTN Pages = (FileInfo->FileSize + 0xFFF) / 0x1000;
-    EFI_PHYSICAL_ADDRESS KernelAddress = 0x100000;  // 1MB mark
-    
-    Status = uefi_call_wrapper(
-        SystemTable->BootServices->AllocatePages,
-        4,
-        AllocateAddress,
-        EfiLoaderData,
-        Pages,
-        &KernelAddress
-    );
+
+    // Decompress it and load its segments
+    UINT8 *Elf;
+    UINTN ElfSize;
+    KernelImage Kernel;
+    Status = Decompress(SystemTable->BootServices, Packed, PackedSize, &Elf, &ElfSize);
+    if (!EFI_ERROR(Status)) {
+        Status = LoadKernel(SystemTable->BootServices, Elf, ElfSize, &Kernel);
+    }
     
     if (EFI_ERROR(Status)) {
-        Print(L"Error allocating memory for kernel: %r\n", Status);
+        Print(L"Error loading kernel: %r\n", Status);
         return Status;
     }
+    uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, Packed);
+    uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, Elf);
+    BootInfo.stamps.tsc[BOOT_STAGE_KERNEL_READ] = ReadTsc();
     
-    // Read the kernel into memory
-    UINTN KernelSize = FileInfo->FileSize;
-    
-    Status = uefi_call_wrapper(
-        KernelFile->Read,
-        3,
-        KernelFile,
-        &KernelSize,
-        (void *)KernelAddress
-    );
+    // Map the kernel at its link address
+    UINT64 *Pml4;
+    Status = BuildPageTables(SystemTable->BootServices, &Kernel, &Pml4);
     
     if (EFI_ERROR(Status)) {
-        Print(L"Error reading kernel file: %r\n", Status);
+        Print(L"Error building page tables: %r\n", Status);
         return Status;
     }
     
-    // Close the kernel file
-    uefi_call_wrapper(KernelFile->Close, 1, KernelFile);
-    
-    // Free file info
-    uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, FileInfo);
+    // Free program headers
+    uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, Kernel.Phdrs);
     
-    // Get keyboard protocol for the shell
-    EFI_SIMPLE_TEXT_INPUT_PROTOCOL *KeyboardProtocol = SystemTable->ConIn;
+    // There is no VGA text mode under UEFI, so the kernel draws its
+    // console on the GOP framebuffer. Boot services, ConIn included, are
+    // gone once the kernel runs.
+    FindFramebuffer(SystemTable->BootServices, &BootInfo);
     
     // Exit boot services
     UINTN MapKey = 0;
@@ -187,7 +490,9 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         &DescriptorVersion
     );
     
-    // Allocate memory for memory map
+    // Allocate memory for memory map, with room for the descriptors the
+    // allocation itself adds
+    MemoryMapSize += 2 * DescriptorSize;
     Status = uefi_call_wrapper(
         SystemTable->BootServices->AllocatePool,
         3,
@@ -217,6 +522,10 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         return Status;
     }
     
+    // Hand the kernel the free RAM; filling BootInfo allocates nothing,
+    // so MapKey stays valid
+    CollectMemory(MemoryMap, MemoryMapSize, DescriptorSize, &BootInfo);
+    
     // Exit boot services
     Status = uefi_call_wrapper(
         SystemTable->BootServices->ExitBootServices,
@@ -230,9 +539,15 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
         return Status;
     }
     
-    // Jump to kernel with keyboard protocol
-    KernelMain kernel = (KernelMain)KernelAddress;
-    kernel(KeyboardProtocol);
+    // Switch to the kernel's page tables; the identity map keeps this code
+    // and the firmware stack reachable
+    __asm__ volatile("mov %0, %%cr3" : : "r"(Pml4) : "memory");
+    
+    // Jump to kernel with the boot info, still reachable through the
+    // identity map
+    KernelMain kernel = (KernelMain)Kernel.Entry;
+    BootInfo.stamps.tsc[BOOT_STAGE_HANDOFF] = ReadTsc();
+    kernel(&BootInfo);
     
     // We should never get here
     return EFI_SUCCESS;
@@ -0,0 +1,164 @@
+#include "boottime.h"
+#include "io.h"
+#include "klog.h"
+#include "serial.h"
+#include "shell.h"
+#include "tsc.h"
+
+#define FW_CFG_SELECTOR  0x510
+#define FW_CFG_DATA      0x511
+#define FW_CFG_SIGNATURE 0x0000
+#define FW_CFG_FILE_DIR  0x0019
+#define BENCH_FILE       "opt/konstruct/bench-boot"
+#define DEBUG_EXIT_PORT  0xF4
+
+#define NAME_COLUMN      24
+#define TIME_COLUMN      12
+
+typedef struct {
+    const char* name;
+    uint64_t tsc;
+} stage_t;
+
+// fw_cfg directory entry; integers are big-endian
+typedef struct {
+    uint8_t size[4];
+    uint8_t select[2];
+    uint8_t reserved[2];
+    char name[56];
+} fw_cfg_file_t;
+
+static const char* const bios_stages[BOOT_LOADER_STAGES] = {
+    "boot sector", "kernel read", "kernel decompressed", "long mode"
+};
+static const char* const uefi_stages[BOOT_LOADER_STAGES] = {
+    "efi_main", "kernel.elf.lz4 loaded", "kernel entered", NULL
+};
+
+static stage_t stages[BOOT_LOADER_STAGES + BOOT_KERNEL_STAGES];
+static int stage_count = 0;
+
+void boot_stage(const char* name) {
+    if (stage_count < BOOT_LOADER_STAGES + BOOT_KERNEL_STAGES) {
+        stages[stage_count].name = name;
+        stages[stage_count].tsc = tsc_read();
+        stage_count++;
+    }
+}
+
+void boottime_init(const boot_stamps_t* loader, int uefi) {
+    const char* const* names = uefi ? uefi_stages : bios_stages;
+
+    stage_count = 0;
+    if (loader->magic == BOOT_STAMPS_MAGIC) {
+        for (int i = 0; i < BOOT_LOADER_STAGES; i++) {
+#ifndef __x86_64__
+            // Only boot32.asm writes the long-mode slot; here it is stale
+            if (i == BOOT_STAGE_LONG_MODE) {
+                break;
+            }
+#endif
+            if (names[i] && loader->tsc[i]) {
+                stages[stage_count].name = names[i];
+                stages[stage_count].tsc = loader->tsc[i];
+                stage_count++;
+            }
+        }
+    }
+    boot_stage("kernel entry");
+}
+
+static void print_right(uint32_t value, const char* unit) {
+    char text[16];
+    int len = snprintf(text, sizeof(text), "%u", value);
+
+    for (int i = len; i < TIME_COLUMN; i++) {
+        putchar(' ');
+    }
+    printf("%s%s", text, unit);
+}
+
+void boottime_print(void) {
+    uint64_t previous = 0;
+
+    printf("Boot timeline, TSC at %u MHz:\n", tsc_khz / 1000);
+    printf("  stage");
+    for (int i = 7; i < NAME_COLUMN; i++) {
+        putchar(' ');
+    }
+    puts("   since reset    since previous");
+
+    for (int i = 0; i < stage_count; i++) {
+        int column = printf("  %s", stages[i].name);
+        while (column++ < NAME_COLUMN) {
+            putchar(' ');
+        }
+        print_right((uint32_t)tsc_to_us(stages[i].tsc), " us");
+        print_right((uint32_t)tsc_to_us(stages[i].tsc - previous), " us\n");
+        previous = stages[i].tsc;
+    }
+    if (stage_count) {
+        printf("Boot to prompt: %u us\n", (uint32_t)tsc_to_us(stages[stage_count - 1].tsc));
+    }
+}
+
+static void fw_cfg_read(void* buf, uint32_t len) {
+    uint8_t* out = (uint8_t*)buf;
+
+    while (len--) {
+        *out++ = inb(FW_CFG_DATA);
+    }
+}
+
+// Look for BENCH_FILE in QEMU's fw_cfg directory. Without QEMU the
+// signature reads back as something other than "QEMU".
+static int bench_requested(void) {
+    uint8_t word[4];
+    fw_cfg_file_t file;
+
+    outw(FW_CFG_SELECTOR, FW_CFG_SIGNATURE);
+    fw_cfg_read(word, 4);
+    if (word[0] != 'Q' || word[1] != 'E' || word[2] != 'M' || word[3] != 'U') {
+        return 0;
+    }
+
+    outw(FW_CFG_SELECTOR, FW_CFG_FILE_DIR);
+    fw_cfg_read(word, 4);
+    uint32_t count = ((uint32_t)word[0] << 24) | ((uint32_t)word[1] << 16) |
+                     ((uint32_t)word[2] << 8) | word[3];
+    for (uint32_t i = 0; i < count; i++) {
+        fw_cfg_read(&file, sizeof(file));
+        file.name[sizeof(file.name) - 1] = '\0';
+        if (strcmp(file.name, BENCH_FILE) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void boottime_bench_exit(void) {
+    if (!bench_requested()) {
+        return;
+    }
+
+    putchar('\n');
+    boottime_print();
+    klog_drain();
+    while (serial_present() && serial_tx_free() < SERIAL_TX_RING) {
+        serial_poll();
+    }
+
+    // QEMU exits with status (0 << 1) | 1
+    outb(DEBUG_EXIT_PORT, 0);
+    klog(KLOG_WARN, "boottime: bench mode without isa-debug-exit at port 0x%x", DEBUG_EXIT_PORT);
+}
+
+static int boot_times_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boottime_print();
+    return 0;
+}
+
+SHELL_COMMAND(boot_times_cmd, "boot-times", "", "Show how long each boot stage took",
+              0, 0, boot_times_command);
@@ -0,0 +1,35 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include "libc/libc.h"
+#include "bootinfo.h"
+
+/*
+ * Boot timeline.
+ *
+ * Every boot stage records a TSC reading. The loader stages come from
+ * boot_stamps_t (bootinfo.h), and the kernel adds its own with
+ * boot_stage(). QEMU, and most hardware, start the TSC at reset, so the
+ * first reading also measures the firmware. The boot-times command
+ * prints each stage with the time since reset and since the previous
+ * stage.
+ *
+ * If QEMU passes the fw_cfg file opt/konstruct/bench-boot, the kernel
+ * prints the timeline once the prompt is up. It then exits QEMU through
+ * an isa-debug-exit device on port 0xF4 (`make bench-boot`).
+ */
+
+#define BOOT_KERNEL_STAGES 16
+
+// Called first thing in kernel_main; records the "kernel entry" stage
+void boottime_init(const boot_stamps_t* loader, int uefi);
+
+// Record that the stage `name` has just finished. `name` must stay valid.
+void boot_stage(const char* name);
+
+void boottime_print(void);
+
+// In bench mode, print the timeline and leave QEMU; otherwise return
+void boottime_bench_exit(void);
+
+#endif /* BOOTTIME_H */
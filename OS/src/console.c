@@ -0,0 +1,244 @@
+#include "console.h"
+#include "io.h"
+#include "lock.h"
+
+#ifdef __x86_64__
+#include "fbcon.h"
+#endif
+
+#define VGA_TEXT_PHYS    0xB8000
+#define VGA_CRTC_INDEX   0x3D4
+#define VGA_CRTC_DATA    0x3D5
+#define CRTC_CURSOR_HIGH 14
+#define CRTC_CURSOR_LOW  15
+
+#define VGA_WIDTH  80
+#define VGA_HEIGHT 25
+
+#define RING_MASK  (CONSOLE_RING_ROWS - 1)
+#define ALL_ROWS   (height == 64 ? ~0ULL : (1ULL << height) - 1)
+#define BLANK      ((uint16_t)(' ' | (CONSOLE_ATTR << 8)))
+
+// Rows are copied to VGA memory a machine word at a time
+typedef uintptr_t __attribute__((may_alias)) row_word_t;
+#define ROW_WORDS  (VGA_WIDTH * 2 / sizeof(row_word_t))
+
+static uint16_t ring[CONSOLE_RING_ROWS][CONSOLE_MAX_WIDTH] __attribute__((aligned(8)));
+static int width = VGA_WIDTH;
+static int height = VGA_HEIGHT;
+static int framebuffer = 0;         // Drawn by fbcon instead of VGA text mode
+static uint32_t top = 0;            // Ring row at the top of the live screen
+static uint32_t history = 0;        // Rows of scrollback above `top`
+static uint32_t view = 0;           // How far the view is scrolled back
+static int cursor_x = 0;
+static int cursor_y = 0;
+static uint64_t dirty = 0;          // One bit per screen row
+static uint32_t scrolled = 0;       // Lines scrolled since the last flush
+static int shown_cursor = -1;       // Where the hardware cursor was last put
+
+// Guards everything above. klog() prints from any context, so interrupts
+// are off while it is held.
+static spinlock_t console_lock = SPINLOCK_INIT("console");
+
+static uint16_t* screen_row(int y) {
+    return ring[(top + y) & RING_MASK];
+}
+
+static void clear_row(uint16_t* row) {
+    for (int i = 0; i < width; i++) {
+        row[i] = BLANK;
+    }
+}
+
+static void set_hw_cursor(int position) {
+    if (position == shown_cursor) {
+        return;
+    }
+    shown_cursor = position;
+    outb(VGA_CRTC_INDEX, CRTC_CURSOR_HIGH);
+    outb(VGA_CRTC_DATA, (position >> 8) & 0xFF);
+    outb(VGA_CRTC_INDEX, CRTC_CURSOR_LOW);
+    outb(VGA_CRTC_DATA, position & 0xFF);
+}
+
+#ifdef __x86_64__
+static void flush_framebuffer(void) {
+    uint32_t first = (top - view) & RING_MASK;
+
+    for (int y = 0; y < height; y++) {
+        if (dirty & (1ULL << y)) {
+            fbcon_draw_row(y, ring[(first + y) & RING_MASK], width);
+        }
+    }
+    dirty = 0;
+    scrolled = 0;
+    fbcon_set_cursor(view ? -1 : cursor_x, cursor_y);
+}
+#endif
+
+static void flush(void) {
+#ifdef __x86_64__
+    if (framebuffer) {
+        flush_framebuffer();
+        return;
+    }
+#endif
+
+    volatile row_word_t* vga = (volatile row_word_t*)mmio_ptr(VGA_TEXT_PHYS);
+    uint32_t first = (top - view) & RING_MASK;
+
+    for (int y = 0; y < height; y++) {
+        if (!(dirty & (1ULL << y))) {
+            continue;
+        }
+        const row_word_t* src = (const row_word_t*)ring[(first + y) & RING_MASK];
+        volatile row_word_t* dst = vga + y * ROW_WORDS;
+        for (uint32_t i = 0; i < ROW_WORDS; i++) {
+            dst[i] = src[i];
+        }
+    }
+    dirty = 0;
+    scrolled = 0;
+
+    // Park the cursor off screen while looking at scrollback
+    set_hw_cursor(view ? VGA_WIDTH * VGA_HEIGHT : cursor_y * VGA_WIDTH + cursor_x);
+}
+
+void console_flush(void) {
+    uintptr_t flags = spin_lock_irqsave(&console_lock);
+    flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+static void newline(void) {
+    cursor_x = 0;
+    if (++cursor_y < height) {
+        return;
+    }
+
+    cursor_y = height - 1;
+    top = (top + 1) & RING_MASK;
+    if (history < (uint32_t)(CONSOLE_RING_ROWS - height)) {
+        history++;
+    }
+    clear_row(screen_row(cursor_y));
+    dirty = ALL_ROWS;
+
+    // Long output still shows progress, a screenful at a time
+    if (++scrolled >= (uint32_t)height) {
+        flush();
+    }
+}
+
+static void put_char(char c) {
+    if (view) {
+        view = 0;
+        dirty = ALL_ROWS;
+    }
+
+    switch (c) {
+    case '\n':
+        newline();
+        break;
+    case '\r':
+        cursor_x = 0;
+        break;
+    case '\t':
+        // Tab is 4 spaces
+        for (int i = 0; i < 4; i++) {
+            put_char(' ');
+        }
+        break;
+    default:
+        screen_row(cursor_y)[cursor_x] = (uint16_t)((uint8_t)c | (CONSOLE_ATTR << 8));
+        dirty |= 1ULL << cursor_y;
+        if (++cursor_x == width) {
+            newline();
+        }
+        break;
+    }
+}
+
+void console_putc(char c) {
+    uintptr_t flags = spin_lock_irqsave(&console_lock);
+    put_char(c);
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_backspace(void) {
+    uintptr_t flags = spin_lock_irqsave(&console_lock);
+
+    if (cursor_x == 0) {
+        if (cursor_y == 0) {
+            spin_unlock_irqrestore(&console_lock, flags);
+            return;
+        }
+        cursor_y--;
+        cursor_x = width;
+    }
+    cursor_x--;
+    screen_row(cursor_y)[cursor_x] = BLANK;
+    dirty |= 1ULL << cursor_y;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Scrollback is kept; only the live screen is blanked
+void console_clear(void) {
+    uintptr_t flags = spin_lock_irqsave(&console_lock);
+
+    for (int y = 0; y < height; y++) {
+        clear_row(screen_row(y));
+    }
+    cursor_x = 0;
+    cursor_y = 0;
+    view = 0;
+    dirty = ALL_ROWS;
+    flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_scroll_view(int rows) {
+    uintptr_t flags = spin_lock_irqsave(&console_lock);
+    int64_t target = (int64_t)view + rows;
+
+    if (target < 0) {
+        target = 0;
+    }
+    if (target > history) {
+        target = history;
+    }
+    if ((uint32_t)target != view) {
+        view = (uint32_t)target;
+        dirty = ALL_ROWS;
+    }
+    flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+int console_height(void) {
+    return height;
+}
+
+void console_init(const boot_info_t* boot) {
+    width = VGA_WIDTH;
+    height = VGA_HEIGHT;
+    framebuffer = 0;
+#ifdef __x86_64__
+    if (fbcon_init(boot, CONSOLE_MAX_WIDTH, CONSOLE_MAX_HEIGHT, &width, &height) == 0) {
+        framebuffer = 1;
+    } else {
+        width = VGA_WIDTH;
+        height = VGA_HEIGHT;
+    }
+#else
+    (void)boot;
+#endif
+
+    for (int i = 0; i < CONSOLE_RING_ROWS; i++) {
+        clear_row(ring[i]);
+    }
+    top = 0;
+    history = 0;
+    shown_cursor = -1;
+    console_clear();
+}
@@ -0,0 +1,56 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "libc/libc.h"
+#include "bootinfo.h"
+
+/*
+ * Text console.
+ *
+ * Output goes to a back buffer in RAM, a ring of rows. Scrolling moves
+ * the ring's head and clears one row. It copies nothing. Rows that change
+ * are marked dirty, and console_flush() copies only those rows to VGA
+ * memory, a machine word at a time, and moves the hardware cursor.
+ * Nothing reads VGA memory back.
+ *
+ * The 64-bit kernel draws on the UEFI framebuffer instead when the loader
+ * passed one (fbcon.c). The screen is then as many 8x16 cells as fit,
+ * up to CONSOLE_MAX_WIDTH x CONSOLE_MAX_HEIGHT, and otherwise 80x25.
+ *
+ * Flushes happen when the shell waits for a key, and after a full screen
+ * of new lines so long output still shows progress. Anything that wants
+ * output visible sooner calls console_flush() itself.
+ *
+ * Rows that scroll off the top stay in the rest of the ring as
+ * scrollback. console_scroll_view() pages through them.
+ */
+
+#ifdef __x86_64__
+#define CONSOLE_MAX_WIDTH  160
+#define CONSOLE_MAX_HEIGHT 64       /* One dirty bit per row in a uint64_t */
+#else
+#define CONSOLE_MAX_WIDTH  80
+#define CONSOLE_MAX_HEIGHT 25
+#endif
+#define CONSOLE_RING_ROWS  256      /* Power of two, screen plus scrollback */
+
+#define CONSOLE_ATTR 0x0F           /* White on black */
+
+// boot may be NULL; without a usable framebuffer the console is VGA text
+void console_init(const boot_info_t* boot);
+void console_putc(char c);
+void console_clear(void);
+
+// Erase the character before the cursor, moving back a row if needed
+void console_backspace(void);
+
+void console_flush(void);
+
+// Rows on the screen
+int console_height(void);
+
+// Move the view `rows` further back into scrollback (negative: forward).
+// Any output returns the view to the live screen.
+void console_scroll_view(int rows);
+
+#endif /* CONSOLE_H */
@@ -0,0 +1,58 @@
+; 64-bit kernel entry, shared by the BIOS (via boot32.asm) and UEFI loaders
+[bits 64]
+
+global _start64
+global boot_info_addr
+extern kernel_main
+
+section .text
+_start64:
+    cli                         ; No IDT yet; firmware handlers may be unmapped
+    mov [boot_info_addr], rdi   ; boot_info_t from the UEFI loader, or 0
+    mov rsp, stack_top
+
+    ; Kernel GDT in the higher half, so it survives paging_init
+    lgdt [gdt_descriptor]
+    push CODE_SEG
+    mov rax, .reload_cs
+    push rax
+    retfq
+.reload_cs:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov fs, ax
+    mov gs, ax
+
+    call kernel_main
+
+.hang:
+    hlt
+    jmp .hang
+
+section .data
+align 8
+boot_info_addr:
+    dq 0
+
+gdt_start:
+    dq 0x0                      ; Null descriptor
+gdt_code:
+    dq 0x00AF9A000000FFFF       ; 64-bit code: present, ring 0, long mode
+gdt_data:
+    dq 0x00CF92000000FFFF       ; Data: present, ring 0, writable
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dq gdt_start
+
+CODE_SEG equ gdt_code - gdt_start
+DATA_SEG equ gdt_data - gdt_start
+
+section .bss
+align 16
+stack_bottom:
+    resb 16384
+stack_top:
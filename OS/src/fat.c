@@ -0,0 +1,1603 @@
+#include "fat.h"
+#include "bcache.h"
+
+#define DIRENT_SIZE     32
+#define ENTRY_END       0x00
+#define ENTRY_FREE      0xE5
+#define ENTRY_KANJI_E5  0x05    // A name really starting with 0xE5
+
+#define ATTR_LFN        0x0F
+#define ATTR_LFN_MASK   0x3F
+#define LFN_LAST        0x40
+#define LFN_ORDER_MASK  0x1F
+#define LFN_CHARS       13
+#define LFN_MAX_ENTRIES 20
+
+#define NT_LOWER_BASE   0x08
+#define NT_LOWER_EXT    0x10
+
+#define FAT_DATE_1980   0x21    // 1980-01-01: there is no clock to stamp files with
+
+#define FSINFO_FREE_COUNT 488
+#define FSINFO_NEXT_FREE  492
+
+#define HASH_DIRS       4
+#define HASH_BUCKETS    256     // Power of two
+#define HASH_ENTRIES    1024
+
+typedef struct {
+    uint8_t name[11];
+    uint8_t attr;
+    uint8_t nt_flags;
+    uint8_t create_tenths;
+    uint16_t create_time;
+    uint16_t create_date;
+    uint16_t access_date;
+    uint16_t cluster_high;
+    uint16_t write_time;
+    uint16_t write_date;
+    uint16_t cluster_low;
+    uint32_t size;
+} __attribute__((packed)) raw_dirent_t;
+
+typedef struct {
+    uint8_t order;
+    uint16_t name1[5];
+    uint8_t attr;
+    uint8_t type;
+    uint8_t checksum;
+    uint16_t name2[6];
+    uint16_t cluster;
+    uint16_t name3[2];
+} __attribute__((packed)) lfn_entry_t;
+
+// One name in a directory hash. `start` is the entry the name begins at,
+// its first long-name entry if it has any.
+typedef struct {
+    uint32_t hash;
+    uint32_t start;
+    int16_t next;
+} hash_entry_t;
+
+typedef struct {
+    fat_volume_t* vol;          // NULL if the slot is free
+    uint32_t cluster;           // The directory's first cluster
+    int complete;               // Every name is in the table, so a miss is final
+    uint32_t last_use;
+    uint32_t count;
+    int16_t buckets[HASH_BUCKETS];
+    hash_entry_t entries[HASH_ENTRIES];
+} dir_hash_t;
+
+static fat_volume_t volumes[FAT_MAX_VOLUMES];
+static int volume_count = 0;
+
+static dir_hash_t dir_hashes[HASH_DIRS];
+static uint32_t hash_clock = 0;
+
+static const uint8_t zero_sector[512];
+
+static uint16_t le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t le64(const uint8_t* p) {
+    return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+static int bytes_equal(const void* a, const void* b, size_t len) {
+    const uint8_t* x = (const uint8_t*)a;
+    const uint8_t* y = (const uint8_t*)b;
+
+    while (len--) {
+        if (*x++ != *y++) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static char upper(char c) {
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static int name_equal(const char* a, const char* b) {
+    while (*a && upper(*a) == upper(*b)) {
+        a++;
+        b++;
+    }
+    return upper(*a) == upper(*b);
+}
+
+// FNV-1a over the upper-cased name, so it agrees with name_equal()
+static uint32_t name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t)upper(*name++);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Volume I/O, all through the block cache
+
+static uint64_t sector_offset(fat_volume_t* vol, uint32_t sector) {
+    return vol->base + (uint64_t)sector * vol->sector_size;
+}
+
+static uint64_t cluster_offset(fat_volume_t* vol, uint32_t cluster) {
+    return sector_offset(vol, vol->data_start) + (uint64_t)(cluster - 2) * vol->cluster_size;
+}
+
+static int vol_read(fat_volume_t* vol, uint64_t offset, void* buf, uint32_t len) {
+    return bcache_pread(vol->dev, buf, len, offset) == (int64_t)len ? 0 : -1;
+}
+
+static int vol_write(fat_volume_t* vol, uint64_t offset, const void* buf, uint32_t len) {
+    return bcache_pwrite(vol->dev, buf, len, offset) == (int64_t)len ? 0 : -1;
+}
+
+static int valid_cluster(fat_volume_t* vol, uint32_t cluster) {
+    return cluster >= 2 && cluster < vol->cluster_count + 2;
+}
+
+static uint32_t end_of_chain(fat_volume_t* vol) {
+    return vol->type == 12 ? 0xFF8 : vol->type == 16 ? 0xFFF8 : 0x0FFFFFF8;
+}
+
+// The FAT
+
+static int get_entry(fat_volume_t* vol, uint32_t cluster, uint32_t* value) {
+    uint64_t base = sector_offset(vol, vol->fat_start);
+    uint8_t raw[4];
+
+    switch (vol->type) {
+    case 12:
+        // 12-bit entries straddle bytes, and sometimes sectors
+        if (vol_read(vol, base + cluster + cluster / 2, raw, 2) < 0) {
+            return -1;
+        }
+        *value = (cluster & 1) ? (uint32_t)le16(raw) >> 4 : le16(raw) & 0xFFFu;
+        return 0;
+    case 16:
+        if (vol_read(vol, base + (uint64_t)cluster * 2, raw, 2) < 0) {
+            return -1;
+        }
+        *value = le16(raw);
+        return 0;
+    default:
+        if (vol_read(vol, base + (uint64_t)cluster * 4, raw, 4) < 0) {
+            return -1;
+        }
+        *value = le32(raw) & 0x0FFFFFFF;
+        return 0;
+    }
+}
+
+// Update every copy of the FAT
+static int set_entry(fat_volume_t* vol, uint32_t cluster, uint32_t value) {
+    for (uint32_t i = 0; i < vol->fat_count; i++) {
+        uint64_t base = sector_offset(vol, vol->fat_start + i * vol->fat_sectors);
+        uint64_t offset;
+        uint32_t len;
+        uint8_t raw[4];
+
+        switch (vol->type) {
+        case 12: {
+            offset = base + cluster + cluster / 2;
+            len = 2;
+            if (vol_read(vol, offset, raw, 2) < 0) {
+                return -1;
+            }
+            uint16_t word = le16(raw);
+            if (cluster & 1) {
+                word = (uint16_t)((word & 0x000F) | (value << 4));
+            } else {
+                word = (uint16_t)((word & 0xF000) | (value & 0xFFF));
+            }
+            raw[0] = word & 0xFF;
+            raw[1] = word >> 8;
+            break;
+        }
+        case 16:
+            offset = base + (uint64_t)cluster * 2;
+            len = 2;
+            raw[0] = value & 0xFF;
+            raw[1] = (value >> 8) & 0xFF;
+            break;
+        default:
+            // The top four bits are reserved and must be kept
+            offset = base + (uint64_t)cluster * 4;
+            len = 4;
+            if (vol_read(vol, offset, raw, 4) < 0) {
+                return -1;
+            }
+            value = (le32(raw) & 0xF0000000) | (value & 0x0FFFFFFF);
+            raw[0] = value & 0xFF;
+            raw[1] = (value >> 8) & 0xFF;
+            raw[2] = (value >> 16) & 0xFF;
+            raw[3] = (value >> 24) & 0xFF;
+            break;
+        }
+        if (vol_write(vol, offset, raw, len) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Returns 1 with the next cluster, 0 at the end of the chain, -1 on an
+// I/O error or a link that leads off the volume
+static int next_cluster(fat_volume_t* vol, uint32_t cluster, uint32_t* next) {
+    uint32_t value;
+
+    if (get_entry(vol, cluster, &value) < 0) {
+        return -1;
+    }
+    if (value >= end_of_chain(vol)) {
+        return 0;
+    }
+    if (!valid_cluster(vol, value)) {
+        return -1;
+    }
+    *next = value;
+    return 1;
+}
+
+// The FSInfo free count goes stale with the first allocation or free.
+// Marking it unknown once is cheaper than keeping it exact.
+static void fsinfo_invalidate(fat_volume_t* vol) {
+    static const uint8_t unknown[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+
+    if (vol->fsinfo_sector == 0 || vol->fsinfo_stale) {
+        return;
+    }
+    vol->fsinfo_stale = 1;
+    vol_write(vol, sector_offset(vol, vol->fsinfo_sector) + FSINFO_FREE_COUNT, unknown, 4);
+}
+
+static int zero_cluster(fat_volume_t* vol, uint32_t cluster) {
+    uint64_t offset = cluster_offset(vol, cluster);
+
+    for (uint32_t done = 0; done < vol->cluster_size; done += sizeof(zero_sector)) {
+        if (vol_write(vol, offset + done, zero_sector, sizeof(zero_sector)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Claim a free cluster and link it after `prev`, or start a new chain if
+// `prev` is 0. Returns the cluster, or 0 if the volume is full.
+static uint32_t alloc_cluster(fat_volume_t* vol, uint32_t prev, int zero) {
+    uint32_t cluster = vol->next_free;
+
+    for (uint32_t i = 0; i < vol->cluster_count; i++, cluster++) {
+        uint32_t value;
+
+        if (!valid_cluster(vol, cluster)) {
+            cluster = 2;
+        }
+        if (get_entry(vol, cluster, &value) < 0) {
+            return 0;
+        }
+        if (value != 0) {
+            continue;
+        }
+
+        fsinfo_invalidate(vol);
+        if (zero && zero_cluster(vol, cluster) < 0) {
+            return 0;
+        }
+        if (set_entry(vol, cluster, 0x0FFFFFFF) < 0) {
+            return 0;
+        }
+        if (prev && set_entry(vol, prev, cluster) < 0) {
+            return 0;
+        }
+        vol->next_free = cluster + 1;
+        return cluster;
+    }
+    return 0;
+}
+
+static int free_chain(fat_volume_t* vol, uint32_t cluster) {
+    fsinfo_invalidate(vol);
+    for (uint32_t i = 0; valid_cluster(vol, cluster) && i < vol->cluster_count; i++) {
+        uint32_t next = 0;
+        int r = next_cluster(vol, cluster, &next);
+
+        if (set_entry(vol, cluster, 0) < 0 || r < 0) {
+            return -1;
+        }
+        if (cluster < vol->next_free) {
+            vol->next_free = cluster;
+        }
+        if (r == 0) {
+            break;
+        }
+        cluster = next;
+    }
+    return 0;
+}
+
+// Cluster chains as extents
+
+static void reset_extents(fat_file_t* f) {
+    f->extent_count = 0;
+    f->chain_complete = (f->first_cluster == 0);
+}
+
+// Follow the chain one cluster past the end of the last extent
+static int extend_chain(fat_file_t* f) {
+    fat_extent_t* last = &f->extents[f->extent_count - 1];
+    uint32_t end = last->disk_cluster + last->count - 1;
+    uint32_t next;
+
+    // A chain longer than the volume has a loop in it
+    if (last->file_cluster + last->count > f->vol->cluster_count) {
+        return -1;
+    }
+
+    int r = next_cluster(f->vol, end, &next);
+    if (r <= 0) {
+        f->chain_complete = (r == 0);
+        return r;
+    }
+    if (next == end + 1) {
+        last->count++;
+        return 0;
+    }
+
+    // With the table full, keep the last extent and carry on from it;
+    // seeking back before it walks the chain again from the start
+    if (f->extent_count == FAT_EXTENTS) {
+        f->extents[0] = *last;
+        f->extent_count = 1;
+        last = &f->extents[0];
+    }
+    fat_extent_t* e = &f->extents[f->extent_count++];
+    e->file_cluster = last->file_cluster + last->count;
+    e->disk_cluster = next;
+    e->count = 1;
+    return 0;
+}
+
+// Find where cluster `n` of the file is on disk and how many clusters
+// from there are contiguous. Returns 1, 0 past the end of the chain, or
+// -1 on error. The last extent grows until the chain turns away, so a
+// run is always reported whole.
+static int file_map(fat_file_t* f, uint32_t n, uint32_t* cluster, uint32_t* run) {
+    if (f->extent_count && n < f->extents[0].file_cluster) {
+        reset_extents(f);
+    }
+    if (f->extent_count == 0) {
+        if (f->first_cluster == 0) {
+            return 0;
+        }
+        f->extents[0].file_cluster = 0;
+        f->extents[0].disk_cluster = f->first_cluster;
+        f->extents[0].count = 1;
+        f->extent_count = 1;
+        f->chain_complete = 0;
+    }
+
+    for (;;) {
+        for (int i = 0; i < f->extent_count; i++) {
+            fat_extent_t* e = &f->extents[i];
+            int growing = (i == f->extent_count - 1) && !f->chain_complete;
+
+            if (!growing && n >= e->file_cluster && n < e->file_cluster + e->count) {
+                *cluster = e->disk_cluster + (n - e->file_cluster);
+                *run = e->count - (n - e->file_cluster);
+                return 1;
+            }
+        }
+        if (f->chain_complete) {
+            return 0;
+        }
+        if (extend_chain(f) < 0) {
+            return -1;
+        }
+    }
+}
+
+// Add a cluster to the end of the file's chain
+static int append_cluster(fat_file_t* f) {
+    fat_volume_t* vol = f->vol;
+    uint32_t tail = 0;
+
+    if (f->first_cluster) {
+        uint32_t cluster, run;
+        if (file_map(f, 0, &cluster, &run) < 0) {
+            return -1;
+        }
+        while (!f->chain_complete) {
+            if (extend_chain(f) < 0) {
+                return -1;
+            }
+        }
+        fat_extent_t* last = &f->extents[f->extent_count - 1];
+        tail = last->disk_cluster + last->count - 1;
+    }
+
+    // Directories must read as empty past their last entry
+    uint32_t cluster = alloc_cluster(vol, tail, f->directory);
+    if (cluster == 0) {
+        return -1;
+    }
+
+    if (tail == 0) {
+        f->first_cluster = cluster;
+        f->extents[0].file_cluster = 0;
+        f->extents[0].disk_cluster = cluster;
+        f->extents[0].count = 1;
+        f->extent_count = 1;
+        f->dirty = 1;
+    } else {
+        fat_extent_t* last = &f->extents[f->extent_count - 1];
+        if (cluster == tail + 1) {
+            last->count++;
+        } else {
+            if (f->extent_count == FAT_EXTENTS) {
+                f->extents[0] = *last;
+                f->extent_count = 1;
+                last = &f->extents[0];
+            }
+            fat_extent_t* e = &f->extents[f->extent_count++];
+            e->file_cluster = last->file_cluster + last->count;
+            e->disk_cluster = cluster;
+            e->count = 1;
+        }
+    }
+    f->chain_complete = 1;
+    return 0;
+}
+
+// Directory entries
+
+static int fixed_root(fat_file_t* dir) {
+    return dir->first_cluster == 0 && dir->vol->type != 32;
+}
+
+// Device offset of raw entry `index`; 1, 0 past the end, -1 on error
+static int entry_offset(fat_file_t* dir, uint32_t index, uint64_t* offset) {
+    fat_volume_t* vol = dir->vol;
+
+    if (fixed_root(dir)) {
+        if (index >= vol->root_entries) {
+            return 0;
+        }
+        *offset = sector_offset(vol, vol->root_start) + (uint64_t)index * DIRENT_SIZE;
+        return 1;
+    }
+
+    uint32_t per_cluster = vol->cluster_size / DIRENT_SIZE;
+    uint32_t cluster, run;
+    int r = file_map(dir, index / per_cluster, &cluster, &run);
+    if (r <= 0) {
+        return r;
+    }
+    *offset = cluster_offset(vol, cluster) + (index % per_cluster) * DIRENT_SIZE;
+    return 1;
+}
+
+static int read_entry(fat_file_t* dir, uint32_t index, raw_dirent_t* raw) {
+    uint64_t offset;
+    int r = entry_offset(dir, index, &offset);
+
+    if (r <= 0) {
+        return r;
+    }
+    return vol_read(dir->vol, offset, raw, DIRENT_SIZE) < 0 ? -1 : 1;
+}
+
+static uint8_t sfn_checksum(const uint8_t* name) {
+    uint8_t sum = 0;
+
+    for (int i = 0; i < 11; i++) {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    }
+    return sum;
+}
+
+static void short_name(const raw_dirent_t* raw, char* out) {
+    int n = 0;
+
+    for (int i = 0; i < 8 && raw->name[i] != ' '; i++) {
+        char c = (i == 0 && raw->name[0] == ENTRY_KANJI_E5) ? (char)0xE5 : (char)raw->name[i];
+        out[n++] = (raw->nt_flags & NT_LOWER_BASE) ? lower(c) : c;
+    }
+    if (raw->name[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && raw->name[i] != ' '; i++) {
+            char c = (char)raw->name[i];
+            out[n++] = (raw->nt_flags & NT_LOWER_EXT) ? lower(c) : c;
+        }
+    }
+    out[n] = '\0';
+}
+
+// UCS-2 characters outside ASCII come out as '?'
+static void lfn_chars(const lfn_entry_t* lfn, char* name) {
+    uint16_t chars[LFN_CHARS];
+    int order = lfn->order & LFN_ORDER_MASK;
+
+    memcpy(chars, lfn->name1, sizeof(lfn->name1));
+    memcpy(chars + 5, lfn->name2, sizeof(lfn->name2));
+    memcpy(chars + 11, lfn->name3, sizeof(lfn->name3));
+
+    for (int i = 0; i < LFN_CHARS; i++) {
+        int at = (order - 1) * LFN_CHARS + i;
+        if (chars[i] == 0x0000 || chars[i] == 0xFFFF || at >= FAT_NAME_MAX) {
+            break;
+        }
+        name[at] = chars[i] < 0x80 ? (char)chars[i] : '?';
+    }
+}
+
+// Read the next live entry at or after *index, assembling its long name.
+// On return *index is just past its short entry and *start is where the
+// entry began. Returns 1, 0 at the end of the directory, or -1.
+static int next_entry(fat_file_t* dir, uint32_t* index, fat_dirent_t* out, uint32_t* start) {
+    int lfn_next = 0;           // Order of the long-name entry expected next
+    uint8_t lfn_checksum = 0;
+    uint32_t lfn_start = 0;
+
+    for (;;) {
+        uint32_t at = (*index)++;
+        raw_dirent_t raw;
+        int r = read_entry(dir, at, &raw);
+
+        if (r <= 0) {
+            return r;
+        }
+        if (raw.name[0] == ENTRY_END) {
+            (*index)--;
+            return 0;
+        }
+        if (raw.name[0] == ENTRY_FREE) {
+            lfn_next = 0;
+            continue;
+        }
+
+        if ((raw.attr & ATTR_LFN_MASK) == ATTR_LFN) {
+            lfn_entry_t* lfn = (lfn_entry_t*)&raw;
+            int order = lfn->order & LFN_ORDER_MASK;
+
+            // Long names are stored last part first
+            if (lfn->order & LFN_LAST) {
+                memset(out->name, 0, sizeof(out->name));
+                lfn_next = order;
+                lfn_checksum = lfn->checksum;
+                lfn_start = at;
+            }
+            if (order == 0 || order > LFN_MAX_ENTRIES || order != lfn_next ||
+                lfn->checksum != lfn_checksum) {
+                lfn_next = 0;
+                continue;
+            }
+            lfn_chars(lfn, out->name);
+            lfn_next--;
+            // An orphaned long name is dropped when no 1 follows it
+            if (lfn_next == 0) {
+                lfn_next = -1;
+            }
+            continue;
+        }
+
+        if (raw.attr & FAT_ATTR_VOLUME_ID) {
+            lfn_next = 0;
+            continue;
+        }
+
+        if (lfn_next == -1 && sfn_checksum(raw.name) == lfn_checksum && out->name[0]) {
+            *start = lfn_start;
+        } else {
+            short_name(&raw, out->name);
+            *start = at;
+        }
+        out->attr = raw.attr;
+        out->size = raw.size;
+        out->cluster = raw.cluster_low;
+        if (dir->vol->type == 32) {
+            out->cluster |= (uint32_t)raw.cluster_high << 16;
+        }
+        return 1;
+    }
+}
+
+// Directory hashes
+
+static void hash_add(dir_hash_t* h, const char* name, uint32_t start) {
+    if (h->count == HASH_ENTRIES) {
+        h->complete = 0;
+        return;
+    }
+
+    hash_entry_t* e = &h->entries[h->count];
+    uint32_t bucket;
+
+    e->hash = name_hash(name);
+    e->start = start;
+    bucket = e->hash & (HASH_BUCKETS - 1);
+    e->next = h->buckets[bucket];
+    h->buckets[bucket] = (int16_t)h->count++;
+}
+
+static dir_hash_t* hash_find(fat_volume_t* vol, uint32_t cluster) {
+    for (int i = 0; i < HASH_DIRS; i++) {
+        if (dir_hashes[i].vol == vol && dir_hashes[i].cluster == cluster) {
+            dir_hashes[i].last_use = ++hash_clock;
+            return &dir_hashes[i];
+        }
+    }
+    return NULL;
+}
+
+// Hash every name in `dir`, replacing the least recently used table.
+// A directory with more names than fit is hashed in part, and lookups
+// that miss fall back to scanning it.
+static dir_hash_t* hash_build(fat_file_t* dir) {
+    dir_hash_t* h = &dir_hashes[0];
+    fat_dirent_t entry;
+    uint32_t index = 0, start;
+    int r = 0;
+
+    for (int i = 1; i < HASH_DIRS && h->vol; i++) {
+        if (!dir_hashes[i].vol || dir_hashes[i].last_use < h->last_use) {
+            h = &dir_hashes[i];
+        }
+    }
+
+    h->vol = dir->vol;
+    h->cluster = dir->first_cluster;
+    h->complete = 1;
+    h->last_use = ++hash_clock;
+    h->count = 0;
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        h->buckets[i] = -1;
+    }
+
+    while (h->complete && (r = next_entry(dir, &index, &entry, &start)) == 1) {
+        hash_add(h, entry.name, start);
+    }
+    if (h->complete && r < 0) {
+        h->vol = NULL;
+        return NULL;
+    }
+    return h;
+}
+
+// Find `name` in `dir`. Returns 1 with the entry and the raw indices of
+// its first entry (a long-name part, if it has any) and its short entry,
+// 0 if there is no such name, -1 on error.
+static int dir_find(fat_file_t* dir, const char* name, fat_dirent_t* out, uint32_t* first,
+                    uint32_t* last) {
+    dir_hash_t* h = hash_find(dir->vol, dir->first_cluster);
+    uint32_t index, start;
+    int r;
+
+    if (!h) {
+        h = hash_build(dir);
+    }
+    if (h) {
+        uint32_t hash = name_hash(name);
+
+        for (int i = h->buckets[hash & (HASH_BUCKETS - 1)]; i >= 0; i = h->entries[i].next) {
+            if (h->entries[i].hash != hash) {
+                continue;
+            }
+            index = h->entries[i].start;
+            r = next_entry(dir, &index, out, &start);
+            if (r < 0) {
+                return -1;
+            }
+            if (r == 1 && name_equal(out->name, name)) {
+                *first = start;
+                *last = index - 1;
+                return 1;
+            }
+        }
+        if (h->complete) {
+            return 0;
+        }
+    }
+
+    index = 0;
+    while ((r = next_entry(dir, &index, out, &start)) == 1) {
+        if (name_equal(out->name, name)) {
+            *first = start;
+            *last = index - 1;
+            return 1;
+        }
+    }
+    return r;
+}
+
+// As dir_find, with the device offset of the short entry
+static int dir_lookup(fat_file_t* dir, const char* name, fat_dirent_t* out, uint64_t* pos) {
+    uint32_t first, last;
+    int r = dir_find(dir, name, out, &first, &last);
+
+    return r == 1 ? entry_offset(dir, last, pos) : r;
+}
+
+// Creating entries
+
+static int valid_name_char(char c) {
+    return (uint8_t)c >= 0x20 && !strchr("\"*/:<>?\\|", c);
+}
+
+// Build the 8.3 form of `name`. Returns 0 if it is exactly that name,
+// 1 if the name needs a long-name entry with this as the base of its
+// alias, -1 if the name is not allowed.
+static int make_short_name(const char* name, uint8_t* sfn) {
+    size_t len = strlen(name);
+    const char* dot = NULL;
+    int lossy = 0;
+
+    if (len == 0 || len > FAT_NAME_MAX || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!valid_name_char(name[i])) {
+            return -1;
+        }
+        if (name[i] == '.') {
+            dot = &name[i];
+        }
+    }
+    if (dot == name) {
+        dot = NULL;
+    }
+
+    memset(sfn, ' ', 11);
+    int n = 0;
+    for (const char* p = name; *p && p != dot; p++) {
+        char c = *p;
+        if (c == ' ' || c == '.') {
+            lossy = 1;
+            continue;
+        }
+        if (strchr("+,;=[]", c)) {
+            c = '_';
+            lossy = 1;
+        }
+        if (c != upper(c)) {
+            lossy = 1;
+        }
+        if (n == 8) {
+            lossy = 1;
+            break;
+        }
+        sfn[n++] = (uint8_t)upper(c);
+    }
+    if (n == 0) {
+        sfn[n++] = '_';
+        lossy = 1;
+    }
+    if (sfn[0] == ENTRY_FREE) {
+        sfn[0] = ENTRY_KANJI_E5;
+    }
+
+    if (dot) {
+        n = 8;
+        for (const char* p = dot + 1; *p; p++) {
+            char c = *p;
+            if (c == ' ') {
+                lossy = 1;
+                continue;
+            }
+            if (strchr("+,;=[]", c)) {
+                c = '_';
+                lossy = 1;
+            }
+            if (c != upper(c)) {
+                lossy = 1;
+            }
+            if (n == 11) {
+                lossy = 1;
+                break;
+            }
+            sfn[n++] = (uint8_t)upper(c);
+        }
+    }
+    return lossy;
+}
+
+static int sfn_exists(fat_file_t* dir, const uint8_t* sfn) {
+    raw_dirent_t raw;
+    int r;
+
+    for (uint32_t index = 0; (r = read_entry(dir, index, &raw)) == 1; index++) {
+        if (raw.name[0] == ENTRY_END) {
+            return 0;
+        }
+        if (raw.name[0] != ENTRY_FREE && (raw.attr & ATTR_LFN_MASK) != ATTR_LFN &&
+            bytes_equal(raw.name, sfn, 11)) {
+            return 1;
+        }
+    }
+    return r;
+}
+
+// Turn the base into an alias no other entry has. Like Windows, try
+// "NAME~1" to "NAME~4", then put a hash of the long name in the alias so
+// a directory full of similar names does not probe every number.
+static int unique_alias(fat_file_t* dir, const char* name, uint8_t* sfn) {
+    static const char hex[] = "0123456789ABCDEF";
+    uint32_t hash = name_hash(name);
+    int base_len = 0;
+
+    while (base_len < 8 && sfn[base_len] != ' ') {
+        base_len++;
+    }
+
+    for (uint32_t n = 1; n < 1000000; n++) {
+        char digits[8];
+        int digit_count = 0;
+        int at = base_len;
+
+        if (n == 5) {
+            if (at > 2) {
+                at = 2;
+            }
+            for (int i = 0; i < 4; i++) {
+                sfn[at++] = (uint8_t)hex[(hash >> (12 - 4 * i)) & 0xF];
+            }
+            base_len = at;
+        }
+
+        for (uint32_t v = n < 5 ? n : n - 4; v; v /= 10) {
+            digits[digit_count++] = (char)('0' + v % 10);
+        }
+        if (at > 8 - 1 - digit_count) {
+            at = 8 - 1 - digit_count;
+        }
+        memset(sfn + at, ' ', 8 - at);
+        sfn[at++] = '~';
+        while (digit_count) {
+            sfn[at++] = (uint8_t)digits[--digit_count];
+        }
+
+        int r = sfn_exists(dir, sfn);
+        if (r <= 0) {
+            return r;
+        }
+    }
+    return -1;
+}
+
+// Find `count` free entries in a row, growing the directory if needed
+static int find_free(fat_file_t* dir, uint32_t count, uint32_t* first) {
+    uint32_t run = 0;
+
+    for (uint32_t index = 0;; index++) {
+        raw_dirent_t raw;
+        int r = read_entry(dir, index, &raw);
+
+        if (r < 0) {
+            return -1;
+        }
+        if (r == 0) {
+            if (fixed_root(dir) || append_cluster(dir) < 0) {
+                return -1;
+            }
+            index--;
+            continue;
+        }
+        if (raw.name[0] == ENTRY_END || raw.name[0] == ENTRY_FREE) {
+            if (++run == count) {
+                *first = index + 1 - count;
+                return 0;
+            }
+        } else {
+            run = 0;
+        }
+    }
+}
+
+static int write_entry(fat_file_t* dir, uint32_t index, const void* raw) {
+    uint64_t offset;
+
+    if (entry_offset(dir, index, &offset) <= 0) {
+        return -1;
+    }
+    return vol_write(dir->vol, offset, raw, DIRENT_SIZE);
+}
+
+static int create_entry(fat_file_t* dir, const char* name, uint8_t attr, uint64_t* pos) {
+    uint8_t sfn[11];
+    int needs_lfn = make_short_name(name, sfn);
+    uint32_t lfn_count = 0, index;
+
+    if (needs_lfn < 0) {
+        return -1;
+    }
+    if (needs_lfn) {
+        if (unique_alias(dir, name, sfn) < 0) {
+            return -1;
+        }
+        lfn_count = (uint32_t)(strlen(name) + LFN_CHARS - 1) / LFN_CHARS;
+    } else if (sfn_exists(dir, sfn) != 0) {
+        return -1;
+    }
+    if (find_free(dir, lfn_count + 1, &index) < 0) {
+        return -1;
+    }
+
+    uint8_t checksum = sfn_checksum(sfn);
+    size_t len = strlen(name);
+    for (uint32_t i = 0; i < lfn_count; i++) {
+        uint32_t order = lfn_count - i;
+        uint16_t chars[LFN_CHARS];
+        lfn_entry_t lfn;
+
+        for (uint32_t c = 0; c < LFN_CHARS; c++) {
+            size_t at = (order - 1) * LFN_CHARS + c;
+            chars[c] = at < len ? (uint8_t)name[at] : at == len ? 0x0000 : 0xFFFF;
+        }
+        memset(&lfn, 0, sizeof(lfn));
+        lfn.order = (uint8_t)(order | (i == 0 ? LFN_LAST : 0));
+        lfn.attr = ATTR_LFN;
+        lfn.checksum = checksum;
+        memcpy(lfn.name1, chars, sizeof(lfn.name1));
+        memcpy(lfn.name2, chars + 5, sizeof(lfn.name2));
+        memcpy(lfn.name3, chars + 11, sizeof(lfn.name3));
+        if (write_entry(dir, index + i, &lfn) < 0) {
+            return -1;
+        }
+    }
+
+    raw_dirent_t raw;
+    memset(&raw, 0, sizeof(raw));
+    memcpy(raw.name, sfn, 11);
+    raw.attr = attr;
+    raw.create_date = FAT_DATE_1980;
+    raw.access_date = FAT_DATE_1980;
+    raw.write_date = FAT_DATE_1980;
+    if (write_entry(dir, index + lfn_count, &raw) < 0) {
+        return -1;
+    }
+
+    dir_hash_t* h = hash_find(dir->vol, dir->first_cluster);
+    if (h) {
+        hash_add(h, name, index);
+    }
+    return entry_offset(dir, index + lfn_count, pos) == 1 ? 0 : -1;
+}
+
+// Mark raw entries `first` to `last` free. Hash entries still pointing
+// there are harmless: the name is compared on every hit.
+static int free_entries(fat_file_t* dir, uint32_t first, uint32_t last) {
+    for (uint32_t index = first; index <= last; index++) {
+        raw_dirent_t raw;
+
+        if (read_entry(dir, index, &raw) != 1) {
+            return -1;
+        }
+        raw.name[0] = ENTRY_FREE;
+        if (write_entry(dir, index, &raw) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Paths
+
+static void open_root(fat_volume_t* vol, fat_file_t* f) {
+    memset(f, 0, sizeof(*f));
+    f->vol = vol;
+    f->directory = 1;
+    f->first_cluster = vol->type == 32 ? vol->root_cluster : 0;
+    reset_extents(f);
+}
+
+static void open_entry(fat_volume_t* vol, fat_file_t* f, const fat_dirent_t* e, uint64_t pos) {
+    // ".." of a directory in the root points at cluster 0
+    if ((e->attr & FAT_ATTR_DIRECTORY) && !valid_cluster(vol, e->cluster)) {
+        open_root(vol, f);
+        return;
+    }
+    memset(f, 0, sizeof(*f));
+    f->vol = vol;
+    f->first_cluster = valid_cluster(vol, e->cluster) ? e->cluster : 0;
+    f->size = e->size;
+    f->directory = (e->attr & FAT_ATTR_DIRECTORY) != 0;
+    f->entry_pos = pos;
+    reset_extents(f);
+}
+
+static fat_volume_t* path_volume(const char** path) {
+    const char* colon = strchr(*path, ':');
+
+    if (!colon) {
+        return volume_count ? &volumes[0] : NULL;
+    }
+    for (int i = 0; i < volume_count; i++) {
+        size_t len = strlen(volumes[i].dev->name);
+        if ((size_t)(colon - *path) == len && strncmp(*path, volumes[i].dev->name, len) == 0) {
+            *path = colon + 1;
+            return &volumes[i];
+        }
+    }
+    return NULL;
+}
+
+// Walk `path` to the directory holding its last component, which is
+// copied to `leaf` (empty for the root itself)
+static int resolve_parent(const char* path, fat_file_t* dir, char* leaf) {
+    fat_volume_t* vol = path_volume(&path);
+
+    if (!vol) {
+        return -1;
+    }
+    open_root(vol, dir);
+
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+
+        const char* end = path;
+        while (*end && *end != '/') {
+            end++;
+        }
+        size_t len = (size_t)(end - path);
+        if (len > FAT_NAME_MAX) {
+            return -1;
+        }
+        memcpy(leaf, path, len);
+        leaf[len] = '\0';
+
+        const char* rest = end;
+        while (*rest == '/') {
+            rest++;
+        }
+        if (*rest == '\0') {
+            return 0;
+        }
+
+        fat_dirent_t entry;
+        uint64_t pos;
+        if (dir_lookup(dir, leaf, &entry, &pos) != 1 || !(entry.attr & FAT_ATTR_DIRECTORY)) {
+            return -1;
+        }
+        open_entry(vol, dir, &entry, pos);
+        path = rest;
+    }
+}
+
+int fat_open(const char* path, const char* mode, fat_file_t* file) {
+    fat_file_t dir;
+    char leaf[FAT_NAME_MAX + 1];
+    fat_dirent_t entry;
+    uint64_t pos;
+
+    if (resolve_parent(path, &dir, leaf) < 0 || leaf[0] == '\0') {
+        return -1;
+    }
+
+    int found = dir_lookup(&dir, leaf, &entry, &pos);
+    if (found < 0) {
+        return -1;
+    }
+    if (found) {
+        if (entry.attr & FAT_ATTR_DIRECTORY) {
+            return -1;
+        }
+        open_entry(dir.vol, file, &entry, pos);
+    }
+
+    if (mode[0] == 'r') {
+        return found ? 0 : -1;
+    }
+
+    if (!found) {
+        if (create_entry(&dir, leaf, FAT_ATTR_ARCHIVE, &pos) < 0) {
+            return -1;
+        }
+        memset(&entry, 0, sizeof(entry));
+        entry.attr = FAT_ATTR_ARCHIVE;
+        open_entry(dir.vol, file, &entry, pos);
+    } else if (entry.attr & FAT_ATTR_READ_ONLY) {
+        return -1;
+    } else if (mode[0] == 'w' && file->first_cluster) {
+        if (free_chain(dir.vol, file->first_cluster) < 0) {
+            return -1;
+        }
+        file->first_cluster = 0;
+        file->size = 0;
+        file->dirty = 1;
+        reset_extents(file);
+    } else if (mode[0] == 'w' && file->size) {
+        file->size = 0;
+        file->dirty = 1;
+    }
+    file->writable = 1;
+    dir.vol->generation++;      // Cached copies of file pages may now be stale
+    return 0;
+}
+
+int64_t fat_read(fat_file_t* file, void* buf, uint32_t len) {
+    fat_volume_t* vol = file->vol;
+    uint8_t* out = (uint8_t*)buf;
+    uint32_t done = 0;
+
+    if (file->directory) {
+        return -1;
+    }
+    if (file->pos >= file->size) {
+        return 0;
+    }
+    if (len > file->size - file->pos) {
+        len = file->size - file->pos;
+    }
+
+    // One transfer per extent
+    while (done < len) {
+        uint32_t within = file->pos % vol->cluster_size;
+        uint32_t cluster, run;
+
+        if (file_map(file, file->pos / vol->cluster_size, &cluster, &run) <= 0) {
+            return done ? (int64_t)done : -1;
+        }
+
+        uint64_t avail = (uint64_t)run * vol->cluster_size - within;
+        uint32_t chunk = len - done;
+        if (chunk > avail) {
+            chunk = (uint32_t)avail;
+        }
+        if (vol_read(vol, cluster_offset(vol, cluster) + within, out + done, chunk) < 0) {
+            return done ? (int64_t)done : -1;
+        }
+        done += chunk;
+        file->pos += chunk;
+    }
+    return done;
+}
+
+int64_t fat_write(fat_file_t* file, const void* buf, uint32_t len) {
+    fat_volume_t* vol = file->vol;
+    const uint8_t* in = (const uint8_t*)buf;
+    uint32_t done = 0;
+
+    if (!file->writable) {
+        return -1;
+    }
+    // Sizes are 32 bits
+    if (len > 0xFFFFFFFFu - file->pos) {
+        len = 0xFFFFFFFFu - file->pos;
+    }
+
+    while (done < len) {
+        uint32_t within = file->pos % vol->cluster_size;
+        uint32_t cluster, run;
+        int r = file_map(file, file->pos / vol->cluster_size, &cluster, &run);
+
+        if (r < 0) {
+            break;
+        }
+        if (r == 0) {
+            if (append_cluster(file) < 0) {
+                break;
+            }
+            continue;
+        }
+
+        uint64_t avail = (uint64_t)run * vol->cluster_size - within;
+        uint32_t chunk = len - done;
+        if (chunk > avail) {
+            chunk = (uint32_t)avail;
+        }
+        if (vol_write(vol, cluster_offset(vol, cluster) + within, in + done, chunk) < 0) {
+            break;
+        }
+        done += chunk;
+        file->pos += chunk;
+        if (file->pos > file->size) {
+            file->size = file->pos;
+            file->dirty = 1;
+        }
+    }
+    return done || len == 0 ? (int64_t)done : -1;
+}
+
+int fat_seek(fat_file_t* file, uint32_t pos) {
+    if (pos > file->size) {
+        return -1;
+    }
+    file->pos = pos;
+    return 0;
+}
+
+int fat_close(fat_file_t* file) {
+    fat_volume_t* vol = file->vol;
+    int result = 0;
+
+    if (!file->writable) {
+        return 0;
+    }
+
+    if (file->dirty) {
+        raw_dirent_t raw;
+
+        if (vol_read(vol, file->entry_pos, &raw, DIRENT_SIZE) < 0) {
+            return -1;
+        }
+        raw.size = file->size;
+        raw.cluster_low = file->first_cluster & 0xFFFF;
+        raw.cluster_high = vol->type == 32 ? (uint16_t)(file->first_cluster >> 16) : 0;
+        raw.write_date = FAT_DATE_1980;
+        raw.attr |= FAT_ATTR_ARCHIVE;
+        if (vol_write(vol, file->entry_pos, &raw, DIRENT_SIZE) < 0) {
+            result = -1;
+        }
+        file->dirty = 0;
+    }
+    if (bcache_sync(vol->dev) < 0) {
+        result = -1;
+    }
+    file->writable = 0;
+    return result;
+}
+
+int fat_truncate(fat_file_t* file, uint32_t size) {
+    fat_volume_t* vol = file->vol;
+    uint32_t keep = (uint32_t)(((uint64_t)size + vol->cluster_size - 1) / vol->cluster_size);
+
+    if (!file->writable || size > file->size) {
+        return -1;
+    }
+
+    if (keep == 0) {
+        if (file->first_cluster && free_chain(vol, file->first_cluster) < 0) {
+            return -1;
+        }
+        file->first_cluster = 0;
+    } else {
+        uint32_t cluster, run, next;
+
+        if (file_map(file, keep - 1, &cluster, &run) != 1) {
+            return -1;
+        }
+        int r = next_cluster(vol, cluster, &next);
+        if (r < 0) {
+            return -1;
+        }
+        if (r == 1 && (set_entry(vol, cluster, 0x0FFFFFFF) < 0 || free_chain(vol, next) < 0)) {
+            return -1;
+        }
+    }
+
+    file->size = size;
+    if (file->pos > size) {
+        file->pos = size;
+    }
+    file->dirty = 1;
+    reset_extents(file);
+    vol->generation++;
+    return 0;
+}
+
+int fat_remove(const char* path) {
+    fat_file_t dir;
+    char leaf[FAT_NAME_MAX + 1];
+    fat_dirent_t entry;
+    uint32_t first, last;
+
+    if (resolve_parent(path, &dir, leaf) < 0 || leaf[0] == '\0' ||
+        dir_find(&dir, leaf, &entry, &first, &last) != 1 ||
+        (entry.attr & (FAT_ATTR_DIRECTORY | FAT_ATTR_READ_ONLY))) {
+        return -1;
+    }
+
+    if (free_entries(&dir, first, last) < 0 ||
+        (valid_cluster(dir.vol, entry.cluster) && free_chain(dir.vol, entry.cluster) < 0)) {
+        return -1;
+    }
+    dir.vol->generation++;
+    return bcache_sync(dir.vol->dev) < 0 ? -1 : 0;
+}
+
+// The new entry is written in full before the old one is freed, so a
+// crash in between leaves two names for the file rather than none
+int fat_rename(const char* from, const char* to) {
+    fat_file_t src, dst;
+    char src_leaf[FAT_NAME_MAX + 1], dst_leaf[FAT_NAME_MAX + 1];
+    fat_dirent_t entry;
+    uint32_t first, last;
+    uint64_t pos;
+    raw_dirent_t raw, fresh;
+
+    if (resolve_parent(from, &src, src_leaf) < 0 || src_leaf[0] == '\0' ||
+        resolve_parent(to, &dst, dst_leaf) < 0 || dst_leaf[0] == '\0' || src.vol != dst.vol) {
+        return -1;
+    }
+    if (dir_find(&src, src_leaf, &entry, &first, &last) != 1 || read_entry(&src, last, &raw) != 1) {
+        return -1;
+    }
+    // A moved directory would need its ".." rewritten
+    if ((entry.attr & FAT_ATTR_DIRECTORY) && src.first_cluster != dst.first_cluster) {
+        return -1;
+    }
+    if (dir_lookup(&dst, dst_leaf, &entry, &pos) != 0) {
+        return -1;
+    }
+
+    // Everything but the name carries over to the new short entry
+    if (create_entry(&dst, dst_leaf, raw.attr, &pos) < 0 ||
+        vol_read(dst.vol, pos, &fresh, DIRENT_SIZE) < 0) {
+        return -1;
+    }
+    memcpy(raw.name, fresh.name, sizeof(raw.name));
+    raw.nt_flags = fresh.nt_flags;
+    if (vol_write(dst.vol, pos, &raw, DIRENT_SIZE) < 0 || free_entries(&src, first, last) < 0) {
+        return -1;
+    }
+    src.vol->generation++;
+    return bcache_sync(src.vol->dev) < 0 ? -1 : 0;
+}
+
+int fat_opendir(const char* path, fat_dir_t* dir) {
+    char leaf[FAT_NAME_MAX + 1];
+    fat_dirent_t entry;
+    uint64_t pos;
+
+    if (resolve_parent(path, &dir->dir, leaf) < 0) {
+        return -1;
+    }
+    dir->index = 0;
+    if (leaf[0] == '\0') {
+        return 0;
+    }
+    if (dir_lookup(&dir->dir, leaf, &entry, &pos) != 1 || !(entry.attr & FAT_ATTR_DIRECTORY)) {
+        return -1;
+    }
+    open_entry(dir->dir.vol, &dir->dir, &entry, pos);
+    return 0;
+}
+
+int fat_readdir(fat_dir_t* dir, fat_dirent_t* entry) {
+    uint32_t start;
+    int r;
+
+    while ((r = next_entry(&dir->dir, &dir->index, entry, &start)) == 1) {
+        if (strcmp(entry->name, ".") != 0 && strcmp(entry->name, "..") != 0) {
+            return 1;
+        }
+    }
+    return r;
+}
+
+// Mounting
+
+// Check a boot sector and fill in the volume if it is FAT
+static int mount_at(blk_device_t* dev, uint64_t base) {
+    uint8_t bs[512];
+    fat_volume_t* vol = &volumes[volume_count];
+
+    if (volume_count == FAT_MAX_VOLUMES) {
+        return -1;
+    }
+    if (bcache_pread(dev, bs, sizeof(bs), base) != sizeof(bs)) {
+        return -1;
+    }
+    if (bs[510] != 0x55 || bs[511] != 0xAA || (bs[0] != 0xEB && bs[0] != 0xE9)) {
+        return -1;
+    }
+
+    uint32_t sector_size = le16(bs + 11);
+    uint32_t per_cluster = bs[13];
+    uint32_t reserved = le16(bs + 14);
+    uint32_t fat_count = bs[16];
+    uint32_t root_entries = le16(bs + 17);
+    uint32_t total = le16(bs + 19) ? le16(bs + 19) : le32(bs + 32);
+    uint32_t fat_sectors = le16(bs + 22) ? le16(bs + 22) : le32(bs + 36);
+
+    if ((sector_size != 512 && sector_size != 1024 && sector_size != 2048 && sector_size != 4096) ||
+        per_cluster == 0 || (per_cluster & (per_cluster - 1)) || reserved == 0 ||
+        fat_count == 0 || fat_count > 2 || fat_sectors == 0 || bs[21] < 0xF0) {
+        return -1;
+    }
+
+    uint32_t root_sectors = (root_entries * DIRENT_SIZE + sector_size - 1) / sector_size;
+    uint32_t data_start = reserved + fat_count * fat_sectors + root_sectors;
+    if (total <= data_start ||
+        base + (uint64_t)total * sector_size > dev->sectors * BLK_SECTOR_SIZE) {
+        return -1;
+    }
+
+    memset(vol, 0, sizeof(*vol));
+    vol->dev = dev;
+    vol->base = base;
+    vol->sector_size = sector_size;
+    vol->cluster_size = sector_size * per_cluster;
+    vol->fat_start = reserved;
+    vol->fat_sectors = fat_sectors;
+    vol->fat_count = fat_count;
+    vol->root_start = reserved + fat_count * fat_sectors;
+    vol->root_entries = root_entries;
+    vol->data_start = data_start;
+    vol->cluster_count = (total - data_start) / per_cluster;
+    vol->next_free = 2;
+
+    // The type follows from the cluster count alone
+    if (vol->cluster_count < 4085) {
+        vol->type = 12;
+    } else if (vol->cluster_count < 65525) {
+        vol->type = 16;
+    } else {
+        vol->type = 32;
+        vol->root_cluster = le32(bs + 44);
+        if (!valid_cluster(vol, vol->root_cluster)) {
+            return -1;
+        }
+
+        uint32_t fsinfo = le16(bs + 48);
+        uint8_t sig[4];
+        if (fsinfo && fsinfo < reserved &&
+            vol_read(vol, sector_offset(vol, fsinfo), sig, 4) == 0 && le32(sig) == 0x41615252) {
+            vol->fsinfo_sector = fsinfo;
+            if (vol_read(vol, sector_offset(vol, fsinfo) + FSINFO_NEXT_FREE, sig, 4) == 0 &&
+                valid_cluster(vol, le32(sig))) {
+                vol->next_free = le32(sig);
+            }
+        }
+    }
+
+    volume_count++;
+    return 0;
+}
+
+static int mount_gpt(blk_device_t* dev) {
+    uint8_t header[512], entry[128];
+
+    if (bcache_pread(dev, header, sizeof(header), BLK_SECTOR_SIZE) != sizeof(header) ||
+        !bytes_equal(header, "EFI PART", 8)) {
+        return -1;
+    }
+
+    uint64_t table = le64(header + 72) * BLK_SECTOR_SIZE;
+    uint32_t count = le32(header + 80);
+    uint32_t entry_size = le32(header + 84);
+    if (entry_size < sizeof(entry) || count > 128) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        static const uint8_t unused[16];
+
+        if (bcache_pread(dev, entry, sizeof(entry), table + (uint64_t)i * entry_size) != sizeof(entry)) {
+            return -1;
+        }
+        if (!bytes_equal(entry, unused, 16) && mount_at(dev, le64(entry + 32) * BLK_SECTOR_SIZE) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// One volume per device: the whole disk, else the first FAT partition
+static int mount_device(blk_device_t* dev) {
+    uint8_t mbr[512];
+
+    if (mount_at(dev, 0) == 0) {
+        return 0;
+    }
+    if (bcache_pread(dev, mbr, sizeof(mbr), 0) != sizeof(mbr) || mbr[510] != 0x55 || mbr[511] != 0xAA) {
+        return -1;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        const uint8_t* part = mbr + 446 + i * 16;
+
+        switch (part[4]) {
+        case 0xEE:
+            return mount_gpt(dev);
+        case 0x01: case 0x04: case 0x06: case 0x0B: case 0x0C: case 0x0E:
+            if (mount_at(dev, (uint64_t)le32(part + 8) * BLK_SECTOR_SIZE) == 0) {
+                return 0;
+            }
+            break;
+        }
+    }
+    return -1;
+}
+
+int fat_mount_all(void) {
+    volume_count = 0;
+    memset(dir_hashes, 0, sizeof(dir_hashes));
+    for (int i = 0; i < blk_count(); i++) {
+        mount_device(blk_get(i));
+    }
+    return volume_count;
+}
+
+int fat_volume_count(void) {
+    return volume_count;
+}
+
+fat_volume_t* fat_get_volume(int index) {
+    return (index >= 0 && index < volume_count) ? &volumes[index] : NULL;
+}
+
+// fsio backend: handles index a table of open files
+
+static fsio_blocking_t fsio_fat;
+static fat_file_t fsio_files[FAT_FSIO_FILES];
+static int fsio_used[FAT_FSIO_FILES];
+
+static int fat_fsio_open(void* ctx, const char* path, const char* mode, int64_t* handle) {
+    (void)ctx;
+
+    for (int i = 0; i < FAT_FSIO_FILES; i++) {
+        if (fsio_used[i]) {
+            continue;
+        }
+        // "r+" keeps the contents like "a"; fsio tracks the position itself
+        const char* fat_mode = mode[0] == 'r' ? (mode[1] == '+' ? "a" : "r") : mode[0] == 'a' ? "a" : "w";
+        if (fat_open(path, fat_mode, &fsio_files[i]) < 0) {
+            return -1;
+        }
+        fsio_used[i] = 1;
+        *handle = i;
+        return 0;
+    }
+    return -1;
+}
+
+static int fat_fsio_close(void* ctx, int64_t handle) {
+    (void)ctx;
+    fsio_used[handle] = 0;
+    return fat_close(&fsio_files[handle]);
+}
+
+static int64_t fat_fsio_size(void* ctx, int64_t handle) {
+    (void)ctx;
+    return fsio_files[handle].size;
+}
+
+static int32_t fat_fsio_pread(void* ctx, int64_t handle, void* buf, uint32_t len, uint64_t offset) {
+    fat_file_t* file = &fsio_files[handle];
+
+    (void)ctx;
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (fat_seek(file, (uint32_t)offset) < 0) {
+        return -1;
+    }
+    return (int32_t)fat_read(file, buf, len);
+}
+
+static int32_t fat_fsio_pwrite(void* ctx, int64_t handle, const void* buf, uint32_t len, uint64_t offset) {
+    fat_file_t* file = &fsio_files[handle];
+
+    (void)ctx;
+    if (offset > file->size || fat_seek(file, (uint32_t)offset) < 0) {
+        return -1;
+    }
+    return (int32_t)fat_write(file, buf, len);
+}
+
+void fat_fsio_init(fsio_t* io) {
+    memset(&fsio_fat, 0, sizeof(fsio_fat));
+    fsio_fat.open = fat_fsio_open;
+    fsio_fat.close = fat_fsio_close;
+    fsio_fat.size = fat_fsio_size;
+    fsio_fat.pread = fat_fsio_pread;
+    fsio_fat.pwrite = fat_fsio_pwrite;
+    fsio_init(io, &fsio_blocking_backend, &fsio_fat);
+}
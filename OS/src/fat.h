@@ -0,0 +1,127 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include "libc/libc.h"
+#include "blk.h"
+
+/*
+ * FAT12/16/32 driver on top of the block cache.
+ *
+ * Volumes are found at boot on every block device, either covering the
+ * whole disk or in an MBR or GPT partition. The FAT itself is read and
+ * written through the block cache, which keeps it in memory once used.
+ *
+ * Each open file caches its cluster chain as extents, runs of clusters
+ * that are contiguous on disk. A read covering an extent is a single
+ * cache transfer, which becomes one merged disk command on a miss.
+ *
+ * Looking up a name in a directory builds a hash of the directory's
+ * entries the first time. Later lookups in that directory, and the path
+ * components that go through it, cost one probe instead of a scan.
+ *
+ * Paths are absolute within a volume and may start with a device name,
+ * as in "ahci0:/docs/readme.txt"; without one, the first volume is used.
+ * Names match without regard to case. New files get long names when
+ * their name is not a plain upper-case 8.3 name.
+ */
+
+#define FAT_NAME_MAX     255
+#define FAT_MAX_VOLUMES  4
+#define FAT_EXTENTS      16
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN    0x02
+#define FAT_ATTR_SYSTEM    0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+
+typedef struct {
+    blk_device_t* dev;
+    uint64_t base;              /* Byte offset of the volume on the device */
+    int type;                   /* 12, 16 or 32 */
+    uint32_t sector_size;
+    uint32_t cluster_size;      /* Bytes */
+    uint32_t fat_start;         /* Sectors from base */
+    uint32_t fat_sectors;
+    uint32_t fat_count;
+    uint32_t root_start;        /* Fixed root directory, FAT12/16 */
+    uint32_t root_entries;
+    uint32_t root_cluster;      /* FAT32 */
+    uint32_t data_start;
+    uint32_t cluster_count;
+    uint32_t next_free;         /* Where the next allocation scan starts */
+    uint32_t fsinfo_sector;     /* FAT32, 0 if none */
+    int fsinfo_stale;           /* Free count in FSInfo no longer matches */
+    uint32_t generation;        /* Bumped when a file is opened for writing */
+} fat_volume_t;
+
+// A run of clusters that are contiguous on disk
+typedef struct {
+    uint32_t file_cluster;      /* Index of the first cluster within the file */
+    uint32_t disk_cluster;
+    uint32_t count;
+} fat_extent_t;
+
+typedef struct {
+    char name[FAT_NAME_MAX + 1];
+    uint8_t attr;
+    uint32_t size;
+    uint32_t cluster;
+} fat_dirent_t;
+
+typedef struct {
+    fat_volume_t* vol;
+    uint32_t first_cluster;     /* 0 for an empty file or the FAT12/16 root */
+    uint32_t size;
+    uint32_t pos;
+    int directory;
+    int writable;
+    int dirty;                  /* Size or first cluster changed */
+
+    uint64_t entry_pos;         /* Device offset of the directory entry */
+
+    fat_extent_t extents[FAT_EXTENTS];
+    int extent_count;
+    int chain_complete;         /* The last extent ends the chain */
+} fat_file_t;
+
+typedef struct {
+    fat_file_t dir;
+    uint32_t index;             /* Next raw entry */
+} fat_dir_t;
+
+// Probe every block device; returns the number of volumes mounted
+int fat_mount_all(void);
+int fat_volume_count(void);
+fat_volume_t* fat_get_volume(int index);
+
+// mode "r" opens for reading, "w" creates or truncates, "a" creates if
+// missing and keeps the contents. Directories cannot be opened this way.
+int fat_open(const char* path, const char* mode, fat_file_t* file);
+int64_t fat_read(fat_file_t* file, void* buf, uint32_t len);
+int64_t fat_write(fat_file_t* file, const void* buf, uint32_t len);
+int fat_seek(fat_file_t* file, uint32_t pos);      // Up to the file's size
+int fat_close(fat_file_t* file);
+
+// Shorten a file opened for writing to `size` bytes, freeing the clusters
+// past it; the directory entry is updated on close
+int fat_truncate(fat_file_t* file, uint32_t size);
+
+// Delete a file. Directories and read-only files are refused.
+int fat_remove(const char* path);
+
+// Give a file a new name, possibly in another directory of the same
+// volume. `to` must not exist yet, which also rules out changing only
+// the case of a name. Directories can only be renamed in place.
+int fat_rename(const char* from, const char* to);
+
+int fat_opendir(const char* path, fat_dir_t* dir);
+// Returns 1 with an entry, 0 at the end, -1 on error; skips "." and ".."
+int fat_readdir(fat_dir_t* dir, fat_dirent_t* entry);
+
+// fsio backend for FAT files, with up to FAT_FSIO_FILES open at once
+#define FAT_FSIO_FILES 8
+void fat_fsio_init(fsio_t* io);
+
+#endif /* FAT_H */
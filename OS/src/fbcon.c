@@ -0,0 +1,277 @@
+#include "fbcon.h"
+#include "paging.h"
+
+#define FIRST_GLYPH    ' '
+#define LAST_GLYPH     '~'
+#define GLYPH_COUNT    (LAST_GLYPH - FIRST_GLYPH + 1)
+#define FALLBACK_GLYPH ('?' - FIRST_GLYPH)
+
+// Shadow size; a 1920x1080 mode gives 240x67 cells, clipped to this
+#define SHADOW_COLS 160
+#define SHADOW_ROWS 64
+
+#define FG_RGB      0xFFFFFF        // CONSOLE_ATTR: white on black
+#define BG_RGB      0x000000
+#define CURSOR_ROWS 2               // Underline height in pixels
+
+// A cell row is 8 pixels, 32 bytes: four 64-bit stores. Scanlines are
+// only 4-byte aligned in general, which x86 allows.
+typedef uint64_t __attribute__((may_alias, aligned(4))) fb_word_t;
+#define CELL_WORDS (FBCON_CELL_WIDTH * 4 / sizeof(uint64_t))
+
+// Public-domain 8x8 font, LSB is the leftmost pixel. Each row is drawn
+// twice to fill a 16-pixel cell.
+static const uint8_t font8x8[GLYPH_COUNT][8] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // ' '
+    { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },   // '!'
+    { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '"'
+    { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },   // '#'
+    { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },   // '$'
+    { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },   // '%'
+    { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },   // '&'
+    { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '\''
+    { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },   // '('
+    { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },   // ')'
+    { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },   // '*'
+    { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },   // '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ','
+    { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },   // '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // '.'
+    { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },   // '/'
+    { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },   // '0'
+    { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },   // '1'
+    { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },   // '2'
+    { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },   // '3'
+    { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },   // '4'
+    { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },   // '5'
+    { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },   // '6'
+    { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },   // '7'
+    { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },   // '8'
+    { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },   // '9'
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // ':'
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ';'
+    { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },   // '<'
+    { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },   // '='
+    { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },   // '>'
+    { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },   // '?'
+    { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },   // '@'
+    { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },   // 'A'
+    { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },   // 'B'
+    { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },   // 'C'
+    { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },   // 'D'
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },   // 'E'
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },   // 'F'
+    { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },   // 'G'
+    { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },   // 'H'
+    { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'I'
+    { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },   // 'J'
+    { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },   // 'K'
+    { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },   // 'L'
+    { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },   // 'M'
+    { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },   // 'N'
+    { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },   // 'O'
+    { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },   // 'P'
+    { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },   // 'Q'
+    { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },   // 'R'
+    { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },   // 'S'
+    { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'T'
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },   // 'U'
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // 'V'
+    { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },   // 'W'
+    { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },   // 'X'
+    { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },   // 'Y'
+    { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },   // 'Z'
+    { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },   // '['
+    { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },   // '\\'
+    { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },   // ']'
+    { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },   // '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },   // '_'
+    { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '`'
+    { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },   // 'a'
+    { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },   // 'b'
+    { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },   // 'c'
+    { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },   // 'd'
+    { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },   // 'e'
+    { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },   // 'f'
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // 'g'
+    { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },   // 'h'
+    { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'i'
+    { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },   // 'j'
+    { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },   // 'k'
+    { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'l'
+    { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },   // 'm'
+    { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },   // 'n'
+    { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },   // 'o'
+    { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },   // 'p'
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },   // 'q'
+    { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },   // 'r'
+    { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },   // 's'
+    { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },   // 't'
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },   // 'u'
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // 'v'
+    { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },   // 'w'
+    { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },   // 'x'
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // 'y'
+    { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },   // 'z'
+    { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },   // '{'
+    { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },   // '|'
+    { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },   // '}'
+    { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '~'
+};
+
+static uint64_t atlas[GLYPH_COUNT][FBCON_CELL_HEIGHT][CELL_WORDS];
+static uint64_t cursor_row[CELL_WORDS];
+
+static uint8_t* fb = NULL;
+static uint32_t pitch = 0;
+static uint16_t shown[SHADOW_ROWS][SHADOW_COLS];   // Cells as last drawn
+static int cursor_x = -1;
+static int cursor_y = 0;
+static int cursor_drawn = 0;
+
+static uint32_t pixel(uint32_t format, uint32_t rgb) {
+    if (format == BOOT_FB_RGBX) {
+        return ((rgb & 0xFF) << 16) | (rgb & 0xFF00) | ((rgb >> 16) & 0xFF);
+    }
+    return rgb;
+}
+
+static uint64_t pixel_pair(uint32_t left, uint32_t right) {
+    return ((uint64_t)right << 32) | left;
+}
+
+static void build_atlas(uint32_t format) {
+    uint32_t fg = pixel(format, FG_RGB);
+    uint32_t bg = pixel(format, BG_RGB);
+
+    for (int g = 0; g < GLYPH_COUNT; g++) {
+        for (int r = 0; r < FBCON_CELL_HEIGHT; r++) {
+            uint8_t bits = font8x8[g][r / 2];
+            for (uint32_t w = 0; w < CELL_WORDS; w++) {
+                uint32_t left = (bits >> (w * 2)) & 1 ? fg : bg;
+                uint32_t right = (bits >> (w * 2 + 1)) & 1 ? fg : bg;
+                atlas[g][r][w] = pixel_pair(left, right);
+            }
+        }
+    }
+    for (uint32_t w = 0; w < CELL_WORDS; w++) {
+        cursor_row[w] = pixel_pair(fg, fg);
+    }
+}
+
+static volatile fb_word_t* cell_line(int x, int y, int line) {
+    return (volatile fb_word_t*)(fb + (uint64_t)(y * FBCON_CELL_HEIGHT + line) * pitch +
+                                 x * FBCON_CELL_WIDTH * 4);
+}
+
+static void draw_cell(int x, int y, uint16_t cell) {
+    uint8_t c = cell & 0xFF;
+    int g = c >= FIRST_GLYPH && c <= LAST_GLYPH ? c - FIRST_GLYPH : FALLBACK_GLYPH;
+
+    for (int r = 0; r < FBCON_CELL_HEIGHT; r++) {
+        volatile fb_word_t* dst = cell_line(x, y, r);
+        const uint64_t* src = atlas[g][r];
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = src[3];
+    }
+}
+
+static void draw_cursor(int x, int y) {
+    for (int r = FBCON_CELL_HEIGHT - CURSOR_ROWS; r < FBCON_CELL_HEIGHT; r++) {
+        volatile fb_word_t* dst = cell_line(x, y, r);
+        for (uint32_t w = 0; w < CELL_WORDS; w++) {
+            dst[w] = cursor_row[w];
+        }
+    }
+}
+
+void fbcon_draw_row(int y, const uint16_t* cells, int cols) {
+    uint16_t* row = shown[y];
+
+    for (int x = 0; x < cols; x++) {
+        if (row[x] == cells[x]) {
+            continue;
+        }
+        row[x] = cells[x];
+        draw_cell(x, y, cells[x]);
+        if (x == cursor_x && y == cursor_y) {
+            cursor_drawn = 0;
+        }
+    }
+}
+
+void fbcon_set_cursor(int x, int y) {
+    if (cursor_drawn) {
+        if (x == cursor_x && y == cursor_y) {
+            return;
+        }
+        draw_cell(cursor_x, cursor_y, shown[cursor_y][cursor_x]);
+        cursor_drawn = 0;
+    }
+    cursor_x = x;
+    cursor_y = y;
+    if (x >= 0) {
+        draw_cursor(x, y);
+        cursor_drawn = 1;
+    }
+}
+
+int fbcon_init(const boot_info_t* info, int max_cols, int max_rows, int* cols, int* rows) {
+    if (info == NULL || info->fb_base == 0 ||
+        (info->fb_format != BOOT_FB_RGBX && info->fb_format != BOOT_FB_BGRX)) {
+        return -1;
+    }
+
+    uint64_t bytes = (uint64_t)info->fb_height * info->fb_pitch;
+    if (info->fb_pitch < info->fb_width * 4 || bytes > info->fb_size) {
+        return -1;
+    }
+
+    // Map it on its own, so the pages can be write-combining; the direct
+    // map's large pages are write-back
+    uint64_t offset = info->fb_base & (PAGE_SIZE - 1);
+    uint64_t flags = PTE_WRITABLE | PTE_GLOBAL | (paging_info.pat ? PTE_WRITE_COMBINE : 0);
+    for (uint64_t at = 0; at < offset + bytes; at += PAGE_SIZE) {
+        if (paging_map(&kernel_space, FRAMEBUFFER_VMA + at, info->fb_base - offset + at, flags) != 0) {
+            return -1;
+        }
+    }
+    fb = (uint8_t*)(FRAMEBUFFER_VMA + offset);
+    pitch = info->fb_pitch;
+    build_atlas(info->fb_format);
+
+    // Blank the whole screen once, margins included; after this only
+    // changed cells are drawn
+    uint64_t blank = atlas[0][0][0];
+    for (uint32_t line = 0; line < info->fb_height; line++) {
+        volatile fb_word_t* dst = (volatile fb_word_t*)(fb + (uint64_t)line * pitch);
+        for (uint32_t w = 0; w < info->fb_width / 2; w++) {
+            dst[w] = blank;
+        }
+    }
+    for (int y = 0; y < SHADOW_ROWS; y++) {
+        for (int x = 0; x < SHADOW_COLS; x++) {
+            shown[y][x] = ' ';
+        }
+    }
+    cursor_x = -1;
+    cursor_drawn = 0;
+
+    *cols = info->fb_width / FBCON_CELL_WIDTH;
+    *rows = info->fb_height / FBCON_CELL_HEIGHT;
+    if (*cols > max_cols) {
+        *cols = max_cols;
+    }
+    if (*cols > SHADOW_COLS) {
+        *cols = SHADOW_COLS;
+    }
+    if (*rows > max_rows) {
+        *rows = max_rows;
+    }
+    if (*rows > SHADOW_ROWS) {
+        *rows = SHADOW_ROWS;
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "libc/libc.h"
+#include "bootinfo.h"
+
+/*
+ * Text drawn on a linear 32-bit framebuffer (64-bit kernel only).
+ *
+ * Cells are 8x16 pixels. At init every printable character is rasterized
+ * once into a glyph atlas, already in the framebuffer's pixel format, so
+ * drawing a cell is 16 rows of four 64-bit stores and no bit tests.
+ *
+ * The framebuffer is mapped write-combining when the CPU has a PAT. The
+ * driver never reads it back: it keeps a shadow of the cells on screen
+ * and redraws only the ones that changed.
+ */
+
+#define FBCON_CELL_WIDTH  8
+#define FBCON_CELL_HEIGHT 16
+
+// Map the framebuffer and build the atlas. On success returns 0 and the
+// size of the text grid, capped at max_cols x max_rows.
+int fbcon_init(const boot_info_t* info, int max_cols, int max_rows, int* cols, int* rows);
+
+// Draw text row y from VGA-style cells (character in the low byte);
+// only cells that differ from what is on screen are touched
+void fbcon_draw_row(int y, const uint16_t* cells, int cols);
+
+// Underline cursor; x < 0 hides it
+void fbcon_set_cursor(int x, int y);
+
+#endif /* FBCON_H */
@@ -0,0 +1,110 @@
+#include "gdt.h"
+
+#define GDT_ENTRIES 7               // Null, 4 segments, and a TSS (two slots on x86_64)
+
+#ifdef __x86_64__
+typedef struct {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+#else
+typedef struct {
+    uint32_t link;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t unused[22];            // Task-switch state we never use
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+#endif
+
+typedef struct {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed)) gdt_pointer_t;
+
+static uint64_t gdt[GDT_ENTRIES] __attribute__((aligned(16)));
+static tss_t tss __attribute__((aligned(16)));
+
+// Flat segments; only the access byte and the long-mode bit differ
+#ifdef __x86_64__
+static const uint64_t segments[4] = {
+    0x00AF9A000000FFFFULL,          // Kernel code, long mode
+    0x00CF92000000FFFFULL,          // Kernel data
+    0x00CFF2000000FFFFULL,          // User data
+    0x00AFFA000000FFFFULL,          // User code, long mode
+};
+#else
+static const uint64_t segments[4] = {
+    0x00CF9A000000FFFFULL,          // Kernel code
+    0x00CF92000000FFFFULL,          // Kernel data
+    0x00CFFA000000FFFFULL,          // User code
+    0x00CFF2000000FFFFULL,          // User data
+};
+#endif
+
+static void set_tss_descriptor(void) {
+    uint64_t base = (uintptr_t)&tss;
+    uint64_t limit = sizeof(tss) - 1;
+
+    gdt[5] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+             (0x89ULL << 40) |      // Present, available TSS
+             ((limit >> 16) << 48) | (((base >> 24) & 0xFF) << 56);
+#ifdef __x86_64__
+    gdt[6] = base >> 32;
+#endif
+}
+
+void gdt_init(void) {
+    gdt_pointer_t pointer;
+
+    memset(gdt, 0, sizeof(gdt));
+    memset(&tss, 0, sizeof(tss));
+    for (int i = 0; i < 4; i++) {
+        gdt[i + 1] = segments[i];
+    }
+    tss.iomap_base = sizeof(tss);   // No I/O bitmap: ring 3 gets no ports
+#ifndef __x86_64__
+    tss.ss0 = KERNEL_DATA_SELECTOR;
+#endif
+    set_tss_descriptor();
+
+    pointer.limit = sizeof(gdt) - 1;
+    pointer.base = (uintptr_t)gdt;
+    __asm__ volatile("lgdt %0" : : "m"(pointer));
+
+    // The kernel selectors keep their values, but reload them so the
+    // hidden descriptor caches come from this table
+#ifdef __x86_64__
+    __asm__ volatile("pushq %0\n"
+                     "leaq 1f(%%rip), %%rax\n"
+                     "pushq %%rax\n"
+                     "lretq\n"
+                     "1:\n"
+                     : : "i"(KERNEL_CODE_SELECTOR) : "rax", "memory");
+#else
+    __asm__ volatile("ljmp %0, $1f\n"
+                     "1:\n"
+                     : : "i"(KERNEL_CODE_SELECTOR) : "memory");
+#endif
+    __asm__ volatile("mov %0, %%ds\n"
+                     "mov %0, %%es\n"
+                     "mov %0, %%fs\n"
+                     "mov %0, %%gs\n"
+                     "mov %0, %%ss\n"
+                     : : "r"((uint16_t)KERNEL_DATA_SELECTOR) : "memory");
+    __asm__ volatile("ltr %0" : : "r"((uint16_t)TSS_SELECTOR));
+}
+
+void gdt_set_kernel_stack(uintptr_t top) {
+#ifdef __x86_64__
+    tss.rsp[0] = top;
+#else
+    tss.esp0 = top;
+#endif
+}
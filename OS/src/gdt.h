@@ -0,0 +1,35 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "libc/libc.h"
+
+/*
+ * Kernel GDT with user segments and a TSS.
+ *
+ * The slots are ordered the way the fast system-call instructions need
+ * them. SYSRET (x86_64) takes user SS and CS from the two slots above
+ * STAR's base, data first. SYSEXIT (i386) takes user CS and SS from the
+ * two slots above the kernel's, code first. So the user selectors are
+ * swapped between the two kernels.
+ *
+ * The TSS only provides the stack the CPU switches to when an interrupt
+ * arrives in ring 3.
+ */
+
+#define KERNEL_CODE_SELECTOR 0x08
+#define KERNEL_DATA_SELECTOR 0x10
+#ifdef __x86_64__
+#define USER_DATA_SELECTOR   (0x18 | 3)
+#define USER_CODE_SELECTOR   (0x20 | 3)
+#else
+#define USER_CODE_SELECTOR   (0x18 | 3)
+#define USER_DATA_SELECTOR   (0x20 | 3)
+#endif
+#define TSS_SELECTOR         0x28
+
+void gdt_init(void);
+
+// Stack for interrupts taken in ring 3
+void gdt_set_kernel_stack(uintptr_t top);
+
+#endif /* GDT_H */
@@ -0,0 +1,245 @@
+#include "interrupts.h"
+#include "io.h"
+#include "gdt.h"
+
+extern void print_char(char c);    // kernel.c
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+
+#define PIC_EOI      0x20
+#define PIC_READ_ISR 0x0B
+
+#define GATE_INTERRUPT       0x8E    // Present, ring 0, interrupt gate
+
+#define IDT_ENTRIES 256
+
+// Gate layout differs between protected and long mode
+#ifdef __x86_64__
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+} __attribute__((packed)) idt_gate_t;
+#else
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type;
+    uint16_t offset_high;
+} __attribute__((packed)) idt_gate_t;
+#endif
+
+typedef struct {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed)) idt_pointer_t;
+
+// What the CPU pushes; sp and ss only on a change of privilege on i386
+struct interrupt_frame {
+    uintptr_t ip;
+    uintptr_t cs;
+    uintptr_t flags;
+    uintptr_t sp;
+    uintptr_t ss;
+};
+
+typedef unsigned int uword_t __attribute__((mode(__word__)));
+
+static idt_gate_t idt[IDT_ENTRIES] __attribute__((aligned(16)));
+
+static struct {
+    irq_handler_t handler;
+    void* ctx;
+    uint32_t count;
+} irqs[IRQ_LINES];
+
+static void pic_mask(int irq, int masked) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    uint8_t bit = 1 << (irq & 7);
+    uint8_t mask = inb(port);
+
+    outb(port, masked ? (mask | bit) : (mask & ~bit));
+}
+
+// IRQ 7 and 15 also fire spuriously; a real one is set in the ISR
+IRQ_HANDLER static int pic_spurious(int irq) {
+    if (irq == 7) {
+        outb(PIC1_COMMAND, PIC_READ_ISR);
+        return !(inb(PIC1_COMMAND) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC2_COMMAND, PIC_READ_ISR);
+        if (!(inb(PIC2_COMMAND) & 0x80)) {
+            outb(PIC1_COMMAND, PIC_EOI);    // The master still saw the cascade
+            return 1;
+        }
+    }
+    return 0;
+}
+
+IRQ_HANDLER static void irq_dispatch(int irq) {
+    if (pic_spurious(irq)) {
+        return;
+    }
+
+    irqs[irq].count++;
+    if (irqs[irq].handler) {
+        irqs[irq].handler(irq, irqs[irq].ctx);
+    }
+
+    // The device has been acknowledged, so a level-triggered line is low again
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+#define IRQ_STUB(n)                                                     \
+    __attribute__((interrupt)) IRQ_HANDLER                              \
+    static void irq_stub_##n(struct interrupt_frame* frame) {           \
+        (void)frame;                                                    \
+        irq_dispatch(n);                                                \
+    }
+
+IRQ_STUB(0)  IRQ_STUB(1)  IRQ_STUB(2)  IRQ_STUB(3)
+IRQ_STUB(4)  IRQ_STUB(5)  IRQ_STUB(6)  IRQ_STUB(7)
+IRQ_STUB(8)  IRQ_STUB(9)  IRQ_STUB(10) IRQ_STUB(11)
+IRQ_STUB(12) IRQ_STUB(13) IRQ_STUB(14) IRQ_STUB(15)
+
+static void (* const irq_stubs[IRQ_LINES])(struct interrupt_frame*) = {
+    irq_stub_0,  irq_stub_1,  irq_stub_2,  irq_stub_3,
+    irq_stub_4,  irq_stub_5,  irq_stub_6,  irq_stub_7,
+    irq_stub_8,  irq_stub_9,  irq_stub_10, irq_stub_11,
+    irq_stub_12, irq_stub_13, irq_stub_14, irq_stub_15
+};
+
+static fault_handler_t fault_handler = NULL;
+
+IRQ_HANDLER static void fault_dispatch(int vector, uintptr_t error, struct interrupt_frame* frame) {
+    int user = (frame->cs & 3) == 3;
+
+    if (fault_handler) {
+        fault_handler(vector, error, frame->ip, user);
+    }
+    if (!user || !fault_handler) {
+        // Nothing to return to; print_char is all that is safe here
+        static const char message[] = "\nKernel fault, halted\n";
+        for (const char* c = message; *c; c++) {
+            print_char(*c);
+        }
+        while (1) {
+            __asm__ volatile("cli; hlt");
+        }
+    }
+}
+
+#define FAULT_STUB(n)                                                   \
+    __attribute__((interrupt)) IRQ_HANDLER                              \
+    static void fault_stub_##n(struct interrupt_frame* frame) {         \
+        fault_dispatch(n, 0, frame);                                    \
+    }
+
+#define FAULT_STUB_ERROR(n)                                             \
+    __attribute__((interrupt)) IRQ_HANDLER                              \
+    static void fault_stub_##n(struct interrupt_frame* frame, uword_t error) { \
+        fault_dispatch(n, error, frame);                                \
+    }
+
+FAULT_STUB(0)  FAULT_STUB(6)
+FAULT_STUB_ERROR(12) FAULT_STUB_ERROR(13) FAULT_STUB_ERROR(14)
+
+// Handlers for vectors with an error code take it as a second argument,
+// so gates take the handler's address rather than one function type
+static void idt_set_gate(int vector, uintptr_t offset) {
+    idt_gate_t* gate = &idt[vector];
+
+    memset(gate, 0, sizeof(*gate));
+    gate->offset_low = offset & 0xFFFF;
+    gate->selector = KERNEL_CODE_SELECTOR;
+    gate->type = GATE_INTERRUPT;
+#ifdef __x86_64__
+    gate->offset_mid = (offset >> 16) & 0xFFFF;
+    gate->offset_high = (uint32_t)(offset >> 32);
+#else
+    gate->offset_high = offset >> 16;
+#endif
+}
+
+// Move the PICs off the CPU exception vectors and mask every line
+static void pic_remap(void) {
+    outb(PIC1_COMMAND, 0x11);       // ICW1: edge/level from ELCR, expect ICW4
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, IRQ_BASE_VECTOR);
+    outb(PIC2_DATA, IRQ_BASE_VECTOR + 8);
+    outb(PIC1_DATA, 0x04);          // Slave on IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);          // 8086 mode
+    outb(PIC2_DATA, 0x01);
+
+    outb(PIC1_DATA, 0xFF & ~(1 << 2));  // Leave the cascade open
+    outb(PIC2_DATA, 0xFF);
+}
+
+void interrupts_init(void) {
+    idt_pointer_t pointer;
+
+    memset(idt, 0, sizeof(idt));
+    memset(irqs, 0, sizeof(irqs));
+    for (int i = 0; i < IRQ_LINES; i++) {
+        idt_set_gate(IRQ_BASE_VECTOR + i, (uintptr_t)irq_stubs[i]);
+    }
+    idt_set_gate(FAULT_DIVIDE, (uintptr_t)fault_stub_0);
+    idt_set_gate(FAULT_INVALID_OP, (uintptr_t)fault_stub_6);
+    idt_set_gate(FAULT_STACK, (uintptr_t)fault_stub_12);
+    idt_set_gate(FAULT_PROTECTION, (uintptr_t)fault_stub_13);
+    idt_set_gate(FAULT_PAGE, (uintptr_t)fault_stub_14);
+
+    pic_remap();
+
+    pointer.limit = sizeof(idt) - 1;
+    pointer.base = (uintptr_t)idt;
+    __asm__ volatile("lidt %0" : : "m"(pointer));
+
+    irq_enable();
+}
+
+int irq_register(int irq, irq_handler_t handler, void* ctx) {
+    if (irq < 0 || irq >= IRQ_LINES || irq == 2 || irqs[irq].handler) {
+        return -1;
+    }
+
+    irq_disable();
+    irqs[irq].handler = handler;
+    irqs[irq].ctx = ctx;
+    pic_mask(irq, 0);
+    irq_enable();
+    return 0;
+}
+
+void irq_unregister(int irq) {
+    if (irq < 0 || irq >= IRQ_LINES || irq == 2) {
+        return;
+    }
+
+    irq_disable();
+    pic_mask(irq, 1);
+    irqs[irq].handler = NULL;
+    irqs[irq].ctx = NULL;
+    irq_enable();
+}
+
+uint32_t irq_count(int irq) {
+    return (irq >= 0 && irq < IRQ_LINES) ? irqs[irq].count : 0;
+}
+
+void fault_set_handler(fault_handler_t handler) {
+    fault_handler = handler;
+}
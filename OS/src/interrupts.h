@@ -0,0 +1,62 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+#include "libc/libc.h"
+
+/*
+ * IDT and legacy PIC setup. The PICs are remapped to vectors 0x20-0x2F
+ * and every line starts masked; drivers unmask the ones they register.
+ * The keyboard stays polled, so IRQ1 is never unmasked.
+ *
+ * Handlers run in interrupt context with only the general registers
+ * saved, so they must be declared IRQ_HANDLER and should do no more
+ * than acknowledge the device and latch its status.
+ */
+
+#define IRQ_BASE_VECTOR 0x20
+#define IRQ_LINES       16
+
+#define IRQ_HANDLER __attribute__((target("general-regs-only")))
+
+typedef void (*irq_handler_t)(int irq, void* ctx);
+
+/*
+ * CPU exceptions: divide error, invalid opcode, stack and general
+ * protection faults, page faults. `user` is set when the fault was
+ * raised in ring 3. The handler runs with interrupts off. Returning from
+ * a user fault retries the faulting instruction; a kernel fault halts
+ * once the handler returns. Without one, every fault halts the kernel.
+ */
+#define FAULT_DIVIDE      0
+#define FAULT_INVALID_OP  6
+#define FAULT_STACK       12
+#define FAULT_PROTECTION  13
+#define FAULT_PAGE        14
+
+typedef void (*fault_handler_t)(int vector, uintptr_t error, uintptr_t ip, int user);
+
+void interrupts_init(void);
+
+// Returns -1 if the line is out of range or already taken
+int irq_register(int irq, irq_handler_t handler, void* ctx);
+void irq_unregister(int irq);
+
+// Interrupts taken per line since boot
+uint32_t irq_count(int irq);
+
+void fault_set_handler(fault_handler_t handler);
+
+static inline void irq_enable(void) {
+    __asm__ volatile("sti" : : : "memory");
+}
+
+static inline void irq_disable(void) {
+    __asm__ volatile("cli" : : : "memory");
+}
+
+// Sleep until the next interrupt; `sti; hlt` cannot lose a wakeup
+static inline void cpu_wait_irq(void) {
+    __asm__ volatile("sti; hlt" : : : "memory");
+}
+
+#endif /* INTERRUPTS_H */
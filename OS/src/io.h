@@ -0,0 +1,82 @@
+#ifndef IO_H
+#define IO_H
+
+#include "libc/libc.h"
+
+#ifdef __x86_64__
+#include "paging.h"
+#endif
+
+// Byte port I/O, defined in kernel.c
+unsigned char inb(unsigned short port);
+void outb(unsigned short port, unsigned char data);
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t result;
+    __asm__ volatile("inw %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static inline void outw(uint16_t port, uint16_t data) {
+    __asm__ volatile("outw %0, %1" : : "a"(data), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t result;
+    __asm__ volatile("inl %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static inline void outl(uint16_t port, uint32_t data) {
+    __asm__ volatile("outl %0, %1" : : "a"(data), "Nd"(port));
+}
+
+// Move `count` 16-bit words between a port and memory
+static inline void insw(uint16_t port, void* buf, uint32_t count) {
+    __asm__ volatile("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* buf, uint32_t count) {
+    __asm__ volatile("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+// Keep the compiler from moving memory accesses across an MMIO doorbell
+static inline void io_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+/*
+ * Physical addresses for DMA and MMIO. The 32-bit kernel runs with
+ * paging off; the 64-bit kernel reaches MMIO through the direct map and
+ * DMA buffers must live in the kernel image or the direct map, both of
+ * which are physically contiguous.
+ */
+#ifdef __x86_64__
+static inline uint64_t dma_phys(const void* ptr) {
+    return paging_translate(&kernel_space, (uint64_t)ptr);
+}
+
+static inline volatile void* mmio_ptr(uint64_t phys) {
+    return (volatile void*)phys_to_virt(phys);
+}
+#else
+static inline uint64_t dma_phys(const void* ptr) {
+    return (uint64_t)(uintptr_t)ptr;
+}
+
+static inline volatile void* mmio_ptr(uint64_t phys) {
+    return (volatile void*)(uintptr_t)phys;
+}
+#endif
+
+#endif /* IO_H */
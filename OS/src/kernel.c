@@ -2,16 +2,31 @@
 // Include our libc
 #include "libc/libc.h"
 
-// Define a constant for the video memory address
-#define VIDEO_MEMORY 0xb8000
-// Define colors
-#define WHITE_ON_BLACK 0x0f
-#define RED_ON_BLACK 0x04
-#define GREEN_ON_BLACK 0x02
+#include "interrupts.h"
+#include "console.h"
+#include "tsc.h"
+#include "blk.h"
+#include "bcache.h"
+#include "fat.h"
+#include "serial.h"
+#include "klog.h"
+#include "shell.h"
+#include "boottime.h"
+#include "gdt.h"
+#include "syscall.h"
+#include "process.h"
+#include "sched.h"
+#include "pipe.h"
+#include "lock.h"
 
-// Screen dimensions
-#define SCREEN_WIDTH 80
-#define SCREEN_HEIGHT 25
+#ifdef __x86_64__
+#include "paging.h"
+#include "pagecache.h"
+#include "vma.h"
+
+extern uint64_t boot_info_addr;     // entry64.asm
+static boot_info_t boot_info;
+#endif
 
 // Keyboard port definitions
 #define KEYBOARD_DATA_PORT 0x60
@@ -22,19 +37,34 @@
 #define KEY_BACKSPACE 0x0E
 #define KEY_UP 0x48
 #define KEY_DOWN 0x50
+#define KEY_PAGE_UP 0x49
+#define KEY_PAGE_DOWN 0x51
 #define KEY_EXTENDED 0xE0
 
+// Keys from read_key() that are not characters
+#define INPUT_UP        0x100
+#define INPUT_DOWN      0x101
+#define INPUT_PAGE_UP   0x102
+#define INPUT_PAGE_DOWN 0x103
+
 // Command buffer size and history settings
 #define CMD_BUFFER_SIZE 256
 #define HISTORY_SIZE 10
 
+// disk-bench: 4 KiB reads with up to BENCH_DEPTH in flight
+#define BENCH_DEPTH 32
+#define BENCH_IOS 2048
+#define BENCH_SECTORS 8
+
+// Chunk size for cat and cp
+#define FILE_BUFFER_SIZE 4096
+
 // Function prototypes for kernel-specific functions
-void clear_screen(void);
 void print_char(char c);
-void handle_command(void);
 void print_prompt(void);
 char read_scan_code(void);
-void update_cursor(void);
+int read_key(void);
+void erase_char(void);
 unsigned char inb(unsigned short port);
 void outb(unsigned short port, unsigned char data);
 char scancode_to_ascii(char scancode);
@@ -44,8 +74,6 @@ void clear_command_line(void);
 void set_command_line(const char* cmd);
 
 // Global variables
-int cursor_x = 0;
-int cursor_y = 0;
 char cmd_buffer[CMD_BUFFER_SIZE];
 int cmd_pos = 0;
 
@@ -55,15 +83,97 @@ int history_count = 0;        // Number of commands in history
 int history_position = -1;    // Current position in history when browsing
 int history_index = 0;        // Index where next command will be stored
 
+// Guards the command line and history. A command runs on a copy of its
+// line, without the lock, so it may print or sleep.
+static spinlock_t line_lock = SPINLOCK_INIT("shell line");
+
 // Flag for extended key sequences
 int extended_key = 0;
 
+// Progress through an ANSI escape sequence from the serial line
+int serial_escape = 0;
+int serial_last_cr = 0;
+
+// disk-bench requests and their buffers
+blk_request_t bench_requests[BENCH_DEPTH];
+unsigned char bench_buffers[BENCH_DEPTH][BENCH_SECTORS * BLK_SECTOR_SIZE] __attribute__((aligned(4096)));
+
+// Shared by cat and cp
+unsigned char file_buffer[FILE_BUFFER_SIZE];
+
+#ifdef MLIBC_HEAPPROF
+// Heap profiler timestamps; tsc_read() itself is inline
+static uint64_t heap_clock(void) {
+    return tsc_read();
+}
+#endif
+
+// MLibc's heap lock hooks. malloc() never nests, so one saved flags
+// word is enough.
+static spinlock_t heap_spinlock = SPINLOCK_INIT("heap");
+static uintptr_t heap_flags;
+
+void heap_lock(void) {
+    uintptr_t flags = spin_lock_irqsave(&heap_spinlock);
+    heap_flags = flags;
+}
+
+void heap_unlock(void) {
+    spin_unlock_irqrestore(&heap_spinlock, heap_flags);
+}
+
 // Function attribute to ensure this is placed at the start of the binary
 __attribute__((section(".text.start")))
 // Kernel main function
 void kernel_main(void) {
+    const boot_info_t* boot = NULL;
+
+#ifdef __x86_64__
+    // The loader's boot info is only reachable through its identity map,
+    // so copy it before paging_init() drops that
+    if (boot_info_addr != 0 && ((boot_info_t*)boot_info_addr)->magic == BOOT_INFO_MAGIC) {
+        boot_info = *(boot_info_t*)boot_info_addr;
+        boot = &boot_info;
+        boottime_init(&boot_info.stamps, 1);
+    } else {
+        boottime_init((const boot_stamps_t*)BOOT_STAMPS_PHYS, 0);
+    }
+
+    // Replace the loader's page tables before touching video memory
+    paging_init(boot);
+    boot_stage("paging");
+#else
+    boottime_init((const boot_stamps_t*)BOOT_STAMPS_PHYS, 0);
+#endif
+
     // Clear the screen
-    clear_screen();
+    console_init(boot);
+    boot_stage("console");
+
+    // Interrupts first, so disk drivers can claim their lines
+    gdt_init();
+    interrupts_init();
+    if (serial_init() == 0) {
+        klog(KLOG_INFO, "serial: COM1 at 115200 baud");
+    }
+    boot_stage("interrupts, serial");
+    tsc_init();
+    klog(KLOG_INFO, "tsc: %u kHz", tsc_khz);
+#ifdef MLIBC_HEAPPROF
+    heapprof_set_clock(heap_clock);
+#endif
+    boot_stage("tsc calibrated");
+    syscall_init();             // The vDSO clock needs tsc_khz
+    process_init();
+    ata_init();
+    boot_stage("ata");
+    ahci_init();
+    boot_stage("ahci");
+    bcache_init();
+    klog(KLOG_INFO, "fat: %d volumes", fat_mount_all());
+    boot_stage("fat mounted");
+    sched_init();
+    shell_init();
     
     // Print a welcome message using our new libc functions
     printf("Welcome to Konstruct v0.1!\n");
@@ -78,25 +188,16 @@ void kernel_main(void) {
     
     // Print the initial prompt
     print_prompt();
+    boot_stage("shell prompt");
+    boottime_bench_exit();
     
     // Main shell loop
     while (1) {
-        char scancode = read_scan_code();
+        static char line[CMD_BUFFER_SIZE];
+        int key = read_key();
         
-        // Check if this is an extended key sequence
-        if (scancode == KEY_EXTENDED) {
-            extended_key = 1;
-            continue;
-        }
-        
-        // Make sure it's a key press, not a key release
-        if (scancode & 0x80) {
-            extended_key = 0;  // Reset extended key flag
-            continue;          // Skip key releases
-        }
-        
-        // Handle special keys
-        if (scancode == KEY_ENTER) {
+        spin_lock(&line_lock);
+        if (key == '\n') {
             putchar('\n');
             cmd_buffer[cmd_pos] = '\0';  // Null terminate the command
             
@@ -105,48 +206,41 @@ void kernel_main(void) {
                 add_to_history(cmd_buffer);
             }
             
-            handle_command();
+            strcpy(line, cmd_buffer);
             cmd_pos = 0;  // Reset buffer position
             history_position = -1;  // Reset history position
+            spin_unlock(&line_lock);
+
+            shell_execute(line);
             print_prompt();
+            continue;
         } 
-        else if (scancode == KEY_BACKSPACE && cmd_pos > 0) {
-            cmd_pos--;
-            cursor_x--;
-            if (cursor_x < 0) {
-                cursor_x = SCREEN_WIDTH - 1;
-                cursor_y--;
+        else if (key == '\b') {
+            if (cmd_pos > 0) {
+                cmd_pos--;
+                erase_char();
             }
-            // Print a space to clear the character
-            char* video_memory = (char*) VIDEO_MEMORY;
-            int offset = 2 * (cursor_y * SCREEN_WIDTH + cursor_x);
-            video_memory[offset] = ' ';
-            video_memory[offset + 1] = WHITE_ON_BLACK;
-            update_cursor();
         }
-        else if (extended_key && scancode == KEY_UP) {
+        else if (key == INPUT_UP) {
             // Navigate history upward (older commands)
             navigate_history(1);
-            extended_key = 0;
         }
-        else if (extended_key && scancode == KEY_DOWN) {
+        else if (key == INPUT_DOWN) {
             // Navigate history downward (newer commands)
             navigate_history(-1);
-            extended_key = 0;
         }
-        else if (!extended_key) {  // Only process regular keys, not extended
-            // Convert scan code to ASCII and add to buffer if it's a printable character
-            char ascii = scancode_to_ascii(scancode);
-            if (ascii && cmd_pos < CMD_BUFFER_SIZE - 1) {
-                cmd_buffer[cmd_pos++] = ascii;
-                putchar(ascii);
-            }
+        else if (key == INPUT_PAGE_UP) {
+            // Page back through scrollback
+            console_scroll_view(console_height() / 2);
         }
-        
-        // Reset extended key flag if it was used
-        if (extended_key) {
-            extended_key = 0;
+        else if (key == INPUT_PAGE_DOWN) {
+            console_scroll_view(-(console_height() / 2));
+        }
+        else if (key >= ' ' && key < 0x7F && cmd_pos < CMD_BUFFER_SIZE - 1) {
+            cmd_buffer[cmd_pos++] = (char)key;
+            putchar(key);
         }
+        spin_unlock(&line_lock);
     }
 }
 
@@ -167,6 +261,9 @@ char scancode_to_ascii(char scancode) {
 
 // Read a scan code from the keyboard
 char read_scan_code(void) {
+    // Show everything printed so far before waiting
+    console_flush();
+
     // Wait for a key to be pressed
     while (!(inb(KEYBOARD_STATUS_PORT) & 1));
     
@@ -174,6 +271,104 @@ char read_scan_code(void) {
     return inb(KEYBOARD_DATA_PORT);
 }
 
+// Translate a scan code; 0 for releases, prefixes and unmapped keys
+static int keyboard_key(char scancode) {
+    int extended = extended_key;
+
+    extended_key = 0;
+    if (scancode == (char)KEY_EXTENDED) {
+        extended_key = 1;
+        return 0;
+    }
+    if (scancode & 0x80) {
+        return 0;           // Key release
+    }
+    if (extended) {
+        switch (scancode) {
+        case KEY_UP:        return INPUT_UP;
+        case KEY_DOWN:      return INPUT_DOWN;
+        case KEY_PAGE_UP:   return INPUT_PAGE_UP;
+        case KEY_PAGE_DOWN: return INPUT_PAGE_DOWN;
+        default:            return 0;
+        }
+    }
+    if (scancode == KEY_ENTER) {
+        return '\n';
+    }
+    if (scancode == KEY_BACKSPACE) {
+        return '\b';
+    }
+    return scancode_to_ascii(scancode);
+}
+
+// Translate a byte from a serial terminal. Enter may arrive as CR, LF or
+// CRLF; arrows and paging keys arrive as ESC [ A, B, 5~ and 6~.
+static int serial_key(int c) {
+    int last_cr = serial_last_cr;
+
+    serial_last_cr = c == '\r';
+    if (serial_escape == 1) {
+        serial_escape = c == '[' ? 2 : 0;
+        return 0;
+    }
+    if (serial_escape == 2) {
+        serial_escape = 0;
+        switch (c) {
+        case 'A': return INPUT_UP;
+        case 'B': return INPUT_DOWN;
+        case '5': serial_escape = 3; return 0;
+        case '6': serial_escape = 4; return 0;
+        default:  return 0;
+        }
+    }
+    if (serial_escape >= 3) {
+        int key = serial_escape == 3 ? INPUT_PAGE_UP : INPUT_PAGE_DOWN;
+        serial_escape = 0;
+        return c == '~' ? key : 0;
+    }
+
+    switch (c) {
+    case 0x1B:
+        serial_escape = 1;
+        return 0;
+    case '\r':
+        return '\n';
+    case '\n':
+        return last_cr ? 0 : '\n';
+    case 0x7F:
+    case '\b':
+        return '\b';
+    default:
+        return c >= ' ' && c < 0x7F ? c : 0;
+    }
+}
+
+// Wait for the next key from the keyboard or the serial line: a
+// character, '\n', '\b' or one of the INPUT_ codes. The kernel log is
+// drained while waiting.
+int read_key(void) {
+    while (1) {
+        klog_drain();
+        console_flush();
+
+        if (inb(KEYBOARD_STATUS_PORT) & 1) {
+            int key = keyboard_key((char)inb(KEYBOARD_DATA_PORT));
+            if (key) {
+                return key;
+            }
+            continue;
+        }
+
+        int c = serial_getc();
+        if (c >= 0) {
+            int key = serial_key(c);
+            if (key) {
+                return key;
+            }
+        }
+    }
+}
+
 // Low-level port I/O functions
 unsigned char inb(unsigned short port) {
     unsigned char result;
@@ -185,7 +380,8 @@ void outb(unsigned short port, unsigned char data) {
     __asm__("out %%al, %%dx" : : "a" (data), "d" (port));
 }
 
-// Add a command to history
+// Add a command to history. The caller holds line_lock, as for the
+// functions below.
 void add_to_history(const char* cmd) {
     // Don't add empty commands or duplicates of the last command
     if (cmd[0] == '\0' || (history_count > 0 && strcmp(cmd, history[(history_index + HISTORY_SIZE - 1) % HISTORY_SIZE]) == 0)) {
@@ -228,26 +424,14 @@ void navigate_history(int direction) {
 
 // Clear the current command line
 void clear_command_line(void) {
-    // Calculate the prompt length (e.g., "MyOS> ")
-    int prompt_len = 6;  // Length of "MyOS> "
-    
-    // Move cursor back to start of command
-    cursor_x = prompt_len;
-    
-    // Clear the existing command text
-    char* video_memory = (char*) VIDEO_MEMORY;
+    // Erase the command text back to the prompt
     for (int i = 0; i < cmd_pos; i++) {
-        int offset = 2 * (cursor_y * SCREEN_WIDTH + cursor_x + i);
-        video_memory[offset] = ' ';
-        video_memory[offset + 1] = WHITE_ON_BLACK;
+        erase_char();
     }
     
     // Reset command buffer
     memset(cmd_buffer, 0, CMD_BUFFER_SIZE);
     cmd_pos = 0;
-    
-    // Update cursor position
-    update_cursor();
 }
 
 // Set the command line to a specific command
@@ -263,88 +447,520 @@ void set_command_line(const char* cmd) {
     print_string(cmd);
 }
 
-// Handle a command
-void handle_command(void) {
-    if (cmd_buffer[0] == 0) {
-        // Empty command, do nothing
-        return;
+static int clear_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    console_clear();
+    return 0;
+}
+
+static int version_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    puts("MyOS version 0.1 with basic libc");
+    return 0;
+}
+
+static int echo_command(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        printf(i > 1 ? " %s" : "%s", argv[i]);
     }
+    putchar('\n');
+    return 0;
+}
+
+static int mem_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    // Test memory allocation
+    char* mem1 = (char*)malloc(16);
+    char* mem2 = (char*)malloc(32);
     
-    // Compare against known commands
-    if (strcmp(cmd_buffer, "help") == 0) {
-        puts("Available commands:");
-        puts("  help     - Display this help message");
-        puts("  clear    - Clear the screen");
-        puts("  version  - Display the OS version");
-        puts("  echo     - Echo the given text");
-        puts("  mem      - Test memory allocation");
-    }
-    else if (strcmp(cmd_buffer, "clear") == 0) {
-        clear_screen();
-        cursor_x = 0;
-        cursor_y = 0;
-    }
-    else if (strcmp(cmd_buffer, "version") == 0) {
-        puts("MyOS version 0.1 with basic libc");
-    }
-    else if (strncmp(cmd_buffer, "echo ", 5) == 0) {
-        // Echo the text after "echo "
-        puts(cmd_buffer + 5);
-    }
-    else if (strcmp(cmd_buffer, "mem") == 0) {
-        // Test memory allocation
-        char* mem1 = (char*)malloc(16);
-        char* mem2 = (char*)malloc(32);
-        
-        if (mem1 && mem2) {
-            strcpy(mem1, "Hello, ");
-            strcpy(mem2, "world!");
-            
-            printf("Memory test: %s%s\n", mem1, mem2);
-            printf("Memory addresses: mem1=%x, mem2=%x\n", (unsigned int)mem1, (unsigned int)mem2);
-            
-            free(mem1);
-            free(mem2);
+    if (!mem1 || !mem2) {
+        puts("Memory allocation failed!");
+        return -1;
+    }
+    strcpy(mem1, "Hello, ");
+    strcpy(mem2, "world!");
+    
+    printf("Memory test: %s%s\n", mem1, mem2);
+    printf("Memory addresses: mem1=%x, mem2=%x\n", (unsigned int)(uintptr_t)mem1, (unsigned int)(uintptr_t)mem2);
+    
+    free(mem1);
+    free(mem2);
+    return 0;
+}
+
+#ifdef MLIBC_HEAPPROF
+static void print_left(const char* text, int width) {
+    int column = printf("%s", text);
+
+    while (column++ < width) {
+        putchar(' ');
+    }
+}
+#endif
+
+static void print_right(uint32_t value, int width) {
+    char text[12];
+    int len = snprintf(text, sizeof(text), "%u", value);
+
+    while (len++ < width) {
+        putchar(' ');
+    }
+    printf("%s", text);
+}
+
+static int meminfo_command(int argc, char** argv) {
+    heap_stats_t heap;
+
+    (void)argc;
+    (void)argv;
+    heap_get_stats(&heap);
+
+    printf("Heap: %u bytes, %u carved (%u%%)\n", heap.heap_size, heap.heap_used,
+           heap.heap_used * 100 / heap.heap_size);
+    printf("Live: %u blocks, %u bytes requested, %u in blocks\n",
+           heap.live_blocks, heap.live_bytes, heap.block_bytes);
+    printf("Free lists: %u bytes, %u%% of the carved heap\n", heap.free_bytes,
+           heap.heap_used ? heap.free_bytes * 100 / heap.heap_used : 0);
+    printf("Allocations: %u, frees: %u, failed: %u\n", heap.allocs, heap.frees, heap.failed);
+
+    puts("Block size       live   free");
+    for (int i = 0; i < HEAP_CLASSES; i++) {
+        if (heap.class_live[i] || heap.class_free[i]) {
+            print_right(1u << (HEAP_MIN_CLASS + i), 10);
+            print_right(heap.class_live[i], 11);
+            print_right(heap.class_free[i], 7);
+            putchar('\n');
+        }
+    }
+
+#ifdef MLIBC_HEAPPROF
+    heapprof_bucket_t buckets[HEAPPROF_BUCKETS];
+    heapprof_histogram(buckets);
+
+    // Bucket 0 is malloc(0), bucket n covers [2^(n-1), 2^n) bytes
+    puts("Request size     allocs   live");
+    for (int i = 0; i < HEAPPROF_BUCKETS; i++) {
+        if (!buckets[i].allocs) {
+            continue;
+        }
+        char line[24];
+        if (i == 0) {
+            snprintf(line, sizeof(line), "  0");
+        } else {
+            snprintf(line, sizeof(line), "  %u-%u", 1u << (i - 1), (1u << i) - 1);
+        }
+        print_left(line, 16);
+        print_right(buckets[i].allocs, 7);
+        print_right(buckets[i].live, 7);
+        putchar('\n');
+    }
+#endif
+    return 0;
+}
+
+#ifdef MLIBC_HEAPPROF
+static int memtop_command(int argc, char** argv) {
+    static heapprof_site_t sites[HEAPPROF_SITES + 1];
+    uint32_t limit = 10;
+
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        heapprof_reset();
+        return 0;
+    }
+    if (argc > 1) {
+        limit = (uint32_t)atoi(argv[1]);
+    }
+
+    // Sort by live bytes, then by bytes ever allocated
+    uint32_t count = heapprof_sites(sites, HEAPPROF_SITES + 1);
+    for (uint32_t i = 1; i < count; i++) {
+        heapprof_site_t site = sites[i];
+        uint32_t at = i;
+        while (at > 0 && (sites[at - 1].live_bytes < site.live_bytes ||
+                          (sites[at - 1].live_bytes == site.live_bytes &&
+                           sites[at - 1].total_bytes < site.total_bytes))) {
+            sites[at] = sites[at - 1];
+            at--;
+        }
+        sites[at] = site;
+    }
+
+    uint64_t now = heapprof_now();
+    puts("Caller      allocs   live  live bytes   peak bytes  avg life us   avg age us");
+    for (uint32_t i = 0; i < count && i < limit; i++) {
+        heapprof_site_t* site = &sites[i];
+        uint64_t life = site->frees ? udiv64(site->lifetime_total, site->frees) : 0;
+        uint64_t age = site->live_blocks ? now - udiv64(site->live_born, site->live_blocks) : 0;
+        char line[12];
+
+        if (site->caller) {
+            snprintf(line, sizeof(line), "%x", (uint32_t)site->caller);
         } else {
-            puts("Memory allocation failed!");
+            snprintf(line, sizeof(line), "(other)");
         }
+        print_left(line, 8);
+        print_right(site->allocs, 10);
+        print_right(site->live_blocks, 7);
+        print_right(site->live_bytes, 12);
+        print_right(site->peak_bytes, 13);
+        print_right((uint32_t)tsc_to_us(life), 13);
+        print_right((uint32_t)tsc_to_us(age), 13);
+        putchar('\n');
     }
-    else {
-        printf("Unknown command: %s\n", cmd_buffer);
-        puts("Type 'help' for available commands.");
+    if (count > limit) {
+        printf("%u more sites\n", count - limit);
     }
+    return 0;
 }
+#else
+static int memtop_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    puts("memtop: heap profiler not built in (MLIBC_HEAPPROF)");
+    return -1;
+}
+#endif
 
-// Print the shell prompt
-void print_prompt(void) {
-    printf("MyOS> ");
+SHELL_COMMAND(clear_cmd, "clear", "", "Clear the screen", 0, 0, clear_command);
+SHELL_COMMAND(version_cmd, "version", "", "Display the OS version", 0, 0, version_command);
+SHELL_COMMAND(echo_cmd, "echo", "[text]", "Echo the given text", 0, SHELL_MAX_ARGS - 1, echo_command);
+SHELL_COMMAND(mem_cmd, "mem", "", "Test memory allocation", 0, 0, mem_command);
+SHELL_COMMAND(meminfo_cmd, "meminfo", "", "Show heap usage and fragmentation", 0, 0, meminfo_command);
+SHELL_COMMAND(memtop_cmd, "memtop", "[count|reset]", "Show the call sites holding the most heap",
+              0, 1, memtop_command);
+
+#ifdef __x86_64__
+static int vm_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    printf("Memory: %u MiB, direct map %u GiB in %s pages\n",
+           (unsigned int)(paging_info.memory_bytes >> 20),
+           (unsigned int)(paging_info.direct_map_bytes >> 30),
+           paging_info.huge_pages ? "1 GiB" : "2 MiB");
+    printf("Frames: %u free of %u\n",
+           (unsigned int)paging_info.frames_free, (unsigned int)paging_info.frames_total);
+    printf("PCID: %s, INVPCID: %s, NX: %s\n",
+           paging_info.pcid ? "on" : "off", paging_info.invpcid ? "yes" : "no",
+           paging_info.nx ? "on" : "off");
+    if (boot_info.fb_base != 0) {
+        printf("Framebuffer: %ux%u, %s\n", boot_info.fb_width, boot_info.fb_height,
+               paging_info.pat ? "write-combining" : "no PAT");
+    }
+    printf("Page cache: %u pages, %u mapped, %u hits, %u misses, %u evictions\n",
+           pagecache_pages(), pagecache_mapped(), pagecache_stats.hits,
+           pagecache_stats.misses, pagecache_stats.evictions);
+    printf("User faults: %u, %u cached pages mapped, %u copied on write, %u zero-filled, %u read privately\n",
+           vm_stats.faults, vm_stats.file_maps, vm_stats.cow_copies, vm_stats.zero_fills,
+           vm_stats.private_reads);
+    return 0;
 }
 
-// Update the hardware cursor position
-void update_cursor(void) {
-    unsigned short position = cursor_y * SCREEN_WIDTH + cursor_x;
-    
-    // Tell the VGA controller we are setting the cursor
-    outb(0x3D4, 14);  // High byte
-    outb(0x3D5, position >> 8);
-    outb(0x3D4, 15);  // Low byte
-    outb(0x3D5, position & 0xFF);
+SHELL_COMMAND(vm_cmd, "vm", "", "Show paging setup", 0, 0, vm_command);
+#endif
+
+// Read BENCH_IOS blocks, sequentially or at random, keeping the queue
+// full. Returns the elapsed time in microseconds.
+static uint64_t bench_run(blk_device_t* dev, int random, uint32_t* errors) {
+    uint32_t blocks = dev->sectors / BENCH_SECTORS > 0xFFFFFFFF ?
+                      0xFFFFFFFF : (uint32_t)(dev->sectors / BENCH_SECTORS);
+    uint32_t seed = 2463534242u;
+    int issued = 0;
+    int retired = 0;
+
+    *errors = 0;
+    uint64_t start = tsc_read();
+
+    while (retired < BENCH_IOS) {
+        // Refill every free slot in one batch so neighbours can merge
+        blk_plug(dev);
+        while (issued < BENCH_IOS && issued - retired < BENCH_DEPTH) {
+            blk_request_t* req = &bench_requests[issued % BENCH_DEPTH];
+            uint32_t block = issued % blocks;
+
+            if (random) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                block = seed % blocks;
+            }
+
+            memset(req, 0, sizeof(*req));
+            req->op = BLK_READ;
+            req->lba = (uint64_t)block * BENCH_SECTORS;
+            req->count = BENCH_SECTORS;
+            req->buf = bench_buffers[issued % BENCH_DEPTH];
+            if (blk_submit(dev, req) < 0) {
+                req->status = -1;
+            }
+            issued++;
+        }
+        blk_unplug(dev);
+
+        // Wait for the oldest, then retire whatever finished behind it
+        blk_wait(dev, &bench_requests[retired % BENCH_DEPTH]);
+        while (retired < issued && bench_requests[retired % BENCH_DEPTH].status != BLK_PENDING) {
+            if (bench_requests[retired % BENCH_DEPTH].status < 0) {
+                (*errors)++;
+            }
+            retired++;
+        }
+    }
+
+    uint64_t us = tsc_to_us(tsc_read() - start);
+    return us ? us : 1;
 }
 
-// Function to clear the screen
-void clear_screen(void) {
-    char* video_memory = (char*) VIDEO_MEMORY;
-    
-    // The screen has 25 rows and 80 columns
-    for (int i = 0; i < SCREEN_HEIGHT * SCREEN_WIDTH * 2; i += 2) {
-        video_memory[i] = ' ';  // Character
-        video_memory[i+1] = WHITE_ON_BLACK; // Attribute
+static int disk_bench_command(int argc, char** argv) {
+    const char* modes[2] = { "sequential", "random" };
+    const char* name = argc > 1 ? argv[1] : NULL;
+    blk_device_t* dev = name ? blk_find(name) : blk_get(0);
+
+    if (!dev) {
+        puts(name ? "No such block device" : "No block devices found");
+        return -1;
     }
-    
-    // Reset cursor position
-    cursor_x = 0;
-    cursor_y = 0;
-    update_cursor();
+    if (dev->sectors < BENCH_SECTORS) {
+        puts("Device too small");
+        return -1;
+    }
+
+    printf("%s: %u MiB, %u slots, %s completion\n", dev->name,
+           (unsigned int)(dev->sectors >> 11), (unsigned int)dev->slots,
+           dev->irq_driven ? "interrupt" : "polled");
+    printf("%u reads of 4 KiB, queue depth %u\n", BENCH_IOS, BENCH_DEPTH);
+
+    for (int random = 0; random < 2; random++) {
+        uint32_t merges = dev->stats.merges;
+        uint32_t commands = dev->stats.commands;
+        uint32_t errors;
+
+        // Show progress now, and keep the flush out of the timing
+        console_flush();
+        uint64_t us = bench_run(dev, random, &errors);
+
+        printf("  %s: %u IOPS, %u MB/s, %u commands, %u merges, %u errors\n", modes[random],
+               (unsigned int)udiv64((uint64_t)BENCH_IOS * 1000000, (uint32_t)us),
+               (unsigned int)udiv64((uint64_t)BENCH_IOS * BENCH_SECTORS * BLK_SECTOR_SIZE, (uint32_t)us),
+               (unsigned int)(dev->stats.commands - commands),
+               (unsigned int)(dev->stats.merges - merges), (unsigned int)errors);
+    }
+    return 0;
+}
+
+SHELL_COMMAND(disk_bench_cmd, "disk-bench", "[dev]", "Measure sequential and random read IOPS",
+              0, 1, disk_bench_command);
+
+static int cache_command(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "sync") == 0) {
+        int result = bcache_sync(NULL);
+        puts(result == 0 ? "Dirty blocks written" : "Write-back failed");
+        return result;
+    }
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        bcache_reset_stats();
+        return 0;
+    }
+    if (argc > 1) {
+        puts("Usage: cache [sync|reset]");
+        return -1;
+    }
+
+    uint32_t lookups = bcache_stats.hits + bcache_stats.misses;
+    printf("Block cache: %u of %u frames used, %u dirty\n",
+           bcache_frames(), BCACHE_MAX_FRAMES, bcache_dirty());
+    printf("Hits: %u, misses: %u, hit ratio %u%%\n", bcache_stats.hits, bcache_stats.misses,
+           lookups ? (unsigned int)udiv64(bcache_stats.hits * 100ULL, lookups) : 0);
+    printf("Readahead: %u blocks, %u used\n", bcache_stats.readahead, bcache_stats.readahead_used);
+    printf("Evictions: %u, write-backs: %u, errors: %u\n",
+           bcache_stats.evictions, bcache_stats.writebacks, bcache_stats.errors);
+
+    // Bucket 0 is under 1 us, bucket n covers [2^(n-1), 2^n) us
+    puts("Latency:");
+    for (int i = 0; i < BCACHE_LATENCY_BUCKETS; i++) {
+        if (!bcache_stats.latency[i]) {
+            continue;
+        }
+        if (i == 0) {
+            printf("  < 1 us: %u\n", bcache_stats.latency[i]);
+        } else if (i == BCACHE_LATENCY_BUCKETS - 1) {
+            printf("  >= %u us: %u\n", 1u << (i - 1), bcache_stats.latency[i]);
+        } else {
+            printf("  %u-%u us: %u\n", 1u << (i - 1), (1u << i) - 1, bcache_stats.latency[i]);
+        }
+    }
+    return 0;
+}
+
+SHELL_COMMAND(cache_cmd, "cache", "[sync|reset]", "Show block cache statistics", 0, 1, cache_command);
+
+static int ls_command(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "/";
+    fat_dir_t dir;
+    fat_dirent_t entry;
+    int result;
+
+    if (fat_volume_count() == 0) {
+        puts("No FAT volumes");
+        return -1;
+    }
+    if (fat_opendir(path, &dir) < 0) {
+        printf("ls: %s: not found\n", path);
+        return -1;
+    }
+    while ((result = fat_readdir(&dir, &entry)) == 1) {
+        if (entry.attr & FAT_ATTR_DIRECTORY) {
+            printf("  <DIR>      %s\n", entry.name);
+        } else {
+            printf("  %u\t%s\n", entry.size, entry.name);
+        }
+    }
+    if (result < 0) {
+        puts("ls: read error");
+    }
+    return result < 0 ? -1 : 0;
+}
+
+// Copy standard input to standard output, passing pipe pages on whole
+static int cat_input(pipe_t* in, pipe_t* out) {
+    pipe_page_t* page;
+    uint32_t offset, len;
+
+    while ((page = pipe_take(in, &offset, &len))) {
+        int result = 0;
+        if (out) {
+            result = pipe_splice(out, page, offset, len);
+        } else {
+            for (uint32_t i = 0; i < len; i++) {
+                putchar(page->data[offset + i]);
+            }
+        }
+        pipe_page_put(page);
+        if (result < 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int cat_command(int argc, char** argv) {
+    thread_t* self = sched_current();
+    fat_file_t file;
+    int64_t n = 0;
+
+    if (argc < 2) {
+        if (!self->in) {
+            puts("cat: no input; give a path or pipe into it");
+            return -1;
+        }
+        return cat_input(self->in, self->out);
+    }
+
+    const char* path = argv[1];
+    if (fat_open(path, "r", &file) < 0) {
+        printf("cat: %s: not found\n", path);
+        return -1;
+    }
+    if (self->out) {
+        // Read straight into pipe pages. file_buffer is shared, and the
+        // reader may run whenever the pipe fills.
+        pipe_page_t* page;
+        while ((page = pipe_page_alloc())) {
+            n = fat_read(&file, page->data, PIPE_PAGE_SIZE);
+            if (n > 0 && pipe_splice(self->out, page, 0, (uint32_t)n) < 0) {
+                n = 0;
+            }
+            pipe_page_put(page);
+            if (n <= 0) {
+                break;
+            }
+        }
+    } else {
+        while ((n = fat_read(&file, file_buffer, FILE_BUFFER_SIZE)) > 0) {
+            for (int64_t i = 0; i < n; i++) {
+                putchar(file_buffer[i]);
+            }
+        }
+    }
+    if (n < 0) {
+        puts("cat: read error");
+    }
+    fat_close(&file);
+    return n < 0 ? -1 : 0;
+}
+
+static int cp_command(int argc, char** argv) {
+    const char* src = argv[1];
+    const char* dst = argv[2];
+    fat_file_t in, out;
+    int64_t n;
+
+    (void)argc;
+    if (fat_open(src, "r", &in) < 0) {
+        printf("cp: %s: not found\n", src);
+        return -1;
+    }
+    if (fat_open(dst, "w", &out) < 0) {
+        printf("cp: cannot create %s\n", dst);
+        fat_close(&in);
+        return -1;
+    }
+    while ((n = fat_read(&in, file_buffer, FILE_BUFFER_SIZE)) > 0) {
+        if (fat_write(&out, file_buffer, (uint32_t)n) != n) {
+            n = -1;
+            break;
+        }
+    }
+    if (n < 0) {
+        puts("cp: I/O error");
+    }
+    fat_close(&in);
+    if (fat_close(&out) < 0) {
+        puts("cp: write-back failed");
+        n = -1;
+    }
+    return n < 0 ? -1 : 0;
+}
+
+SHELL_COMMAND(ls_cmd, "ls", "[path]", "List a directory on a FAT volume", 0, 1, ls_command);
+SHELL_COMMAND(cat_cmd, "cat", "[path]", "Print a file, or standard input", 0, 1, cat_command);
+SHELL_COMMAND(cp_cmd, "cp", "<src> <dst>", "Copy a file", 2, 2, cp_command);
+
+static int log_command(int argc, char** argv) {
+    const char* arg = argc > 1 ? argv[1] : "";
+    klog_stats_t log;
+    serial_stats_t line;
+
+    if (arg[0] >= '0' && arg[0] <= '3' && arg[1] == '\0') {
+        klog_set_console_level(arg[0] - '0');
+        return 0;
+    }
+    if (arg[0]) {
+        puts("Usage: log [0-3]");
+        return -1;
+    }
+
+    klog_get_stats(&log);
+    printf("Log: %u records, %u dropped, %u written; console shows level %d and below\n",
+           log.logged, log.dropped, log.drained, klog_console_level());
+    if (!serial_present()) {
+        puts("Serial: no UART");
+        return 0;
+    }
+    serial_get_stats(&line);
+    printf("Serial: %u bytes out, %u in, %u dropped, %u interrupts\n",
+           line.tx_bytes, line.rx_bytes, line.rx_dropped, line.interrupts);
+    return 0;
+}
+
+SHELL_COMMAND(log_cmd, "log", "[level]", "Show log statistics, or set the console log level (0-3)",
+              0, 1, log_command);
+
+void print_prompt(void) {
+    printf("MyOS> ");
 }
 
 // Function to print a string
@@ -355,58 +971,26 @@ void print_string(const char* string) {
     }
 }
 
-// Function to print a single character
+// Function to print a single character, used by the libc. Everything
+// printed is mirrored to the serial line.
 void print_char(char c) {
-    char* video_memory = (char*) VIDEO_MEMORY;
-    
-    // Handle special characters
-    if (c == '\n') {
-        cursor_x = 0;
-        cursor_y++;
-    } 
-    else if (c == '\r') {
-        cursor_x = 0;
-    }
-    else if (c == '\t') {
-        // Tab is 4 spaces
-        for (int i = 0; i < 4; i++) {
-            print_char(' ');
-        }
-    }
-    else {
-        // Calculate the position in video memory
-        int offset = 2 * (cursor_y * SCREEN_WIDTH + cursor_x);
-        
-        // Write the character
-        video_memory[offset] = c;
-        video_memory[offset + 1] = WHITE_ON_BLACK;
-        
-        // Update cursor position
-        cursor_x++;
-        if (cursor_x >= SCREEN_WIDTH) {
-            cursor_x = 0;
-            cursor_y++;
-        }
+    // Inside a pipeline, output is the next command's input
+    pipe_t* out = sched_current()->out;
+    if (out) {
+        pipe_write(out, &c, 1);
+        return;
     }
-    
-    // Handle scrolling if we're past the bottom of the screen
-    if (cursor_y >= SCREEN_HEIGHT) {
-        // Scroll the screen up by one line
-        for (int i = 0; i < (SCREEN_HEIGHT - 1) * SCREEN_WIDTH * 2; i++) {
-            video_memory[i] = video_memory[i + SCREEN_WIDTH * 2];
-        }
-        
-        // Clear the last line
-        for (int i = (SCREEN_HEIGHT - 1) * SCREEN_WIDTH * 2; 
-             i < SCREEN_HEIGHT * SCREEN_WIDTH * 2; i += 2) {
-            video_memory[i] = ' ';
-            video_memory[i + 1] = WHITE_ON_BLACK;
-        }
-        
-        // Move cursor up one row
-        cursor_y = SCREEN_HEIGHT - 1;
+    console_putc(c);
+    if (c == '\n') {
+        serial_putc('\r');
     }
-    
-    // Update the hardware cursor
-    update_cursor();
+    serial_putc(c);
+}
+
+// Erase the character before the cursor on the screen and the terminal
+void erase_char(void) {
+    console_backspace();
+    serial_putc('\b');
+    serial_putc(' ');
+    serial_putc('\b');
 }
@@ -0,0 +1,135 @@
+#include "klog.h"
+#include "console.h"
+#include "serial.h"
+#include "tsc.h"
+
+#define SLOT_MASK (KLOG_SLOTS - 1)
+#define LINE_MAX  (KLOG_TEXT + 24)
+
+typedef struct {
+    volatile uint32_t seq;      // Claim position + 1 once the record is complete
+    int level;
+    uint64_t tsc;
+    char text[KLOG_TEXT];
+} record_t;
+
+static record_t ring[KLOG_SLOTS];
+static uint32_t head = 0;       // Next position to claim
+static uint32_t tail = 0;       // Next position to drain
+static int console_level = KLOG_WARN;
+static klog_stats_t stats;
+
+static const char level_names[] = "EWID";
+
+void klog(int level, const char* format, ...) {
+    uint64_t now = tsc_read();
+    uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+    // Claim a slot. The drain frees slots in order, so the ring is full
+    // when the head is a whole ring ahead of the tail.
+    do {
+        if (pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= KLOG_SLOTS) {
+            __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    record_t* rec = &ring[pos & SLOT_MASK];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(rec->text, KLOG_TEXT, format, ap);
+    va_end(ap);
+    rec->level = level < KLOG_ERR ? KLOG_ERR : level > KLOG_DEBUG ? KLOG_DEBUG : level;
+    rec->tsc = now;
+
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&stats.logged, 1, __ATOMIC_RELAXED);
+}
+
+// Decimal, padded on the left to `width`; printf has no field widths
+static uint32_t put_padded(char* out, uint32_t value, int width, char pad) {
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    uint32_t len = 0;
+    for (int i = n; i < width; i++) {
+        out[len++] = pad;
+    }
+    while (n) {
+        out[len++] = digits[--n];
+    }
+    return len;
+}
+
+// "[    1.234567] W text", seconds since the TSC started counting
+static uint32_t format_line(char* line, const record_t* rec) {
+    uint64_t us = tsc_to_us(rec->tsc);
+    uint64_t secs = udiv64(us, 1000000);
+    uint32_t len = 0;
+
+    line[len++] = '[';
+    len += put_padded(line + len, (uint32_t)secs, 5, ' ');
+    line[len++] = '.';
+    len += put_padded(line + len, (uint32_t)(us - secs * 1000000), 6, '0');
+    line[len++] = ']';
+    line[len++] = ' ';
+    line[len++] = level_names[rec->level];
+    line[len++] = ' ';
+    for (const char* s = rec->text; *s && len < LINE_MAX; s++) {
+        line[len++] = *s;
+    }
+    return len;
+}
+
+int klog_drain(void) {
+    char line[LINE_MAX];
+    int drained = 0;
+
+    while (1) {
+        record_t* rec = &ring[tail & SLOT_MASK];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            break;
+        }
+
+        uint32_t len = format_line(line, rec);
+        if (serial_present()) {
+            if (serial_tx_free() < len + 2) {
+                break;              // Try again once the line has drained
+            }
+            serial_write(line, len);
+            serial_write("\r\n", 2);
+        }
+        if (rec->level <= console_level) {
+            for (uint32_t i = 0; i < len; i++) {
+                console_putc(line[i]);
+            }
+            console_putc('\n');
+        }
+
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        drained++;
+    }
+
+    stats.drained += drained;
+    return drained;
+}
+
+void klog_set_console_level(int level) {
+    console_level = level;
+}
+
+int klog_console_level(void) {
+    return console_level;
+}
+
+void klog_get_stats(klog_stats_t* out) {
+    out->logged = __atomic_load_n(&stats.logged, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+    out->drained = stats.drained;
+}
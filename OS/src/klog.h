@@ -0,0 +1,50 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include "libc/libc.h"
+
+/*
+ * Kernel log.
+ *
+ * klog() formats a record into a fixed ring and returns. It takes no
+ * lock and never touches a device, so it is safe on hot paths and can
+ * run with any number of other producers: a slot is claimed with one
+ * compare-and-swap on the head and published by storing its sequence
+ * number. When the ring is full the new record is dropped and counted.
+ *
+ * klog_drain() is the only consumer. It runs where the shell idles and
+ * copies records, in order, to the serial port and to the console. A
+ * record is written to serial only once the TX ring has room for all of
+ * it, so a slow line delays the log instead of the caller.
+ *
+ * Interrupt handlers (IRQ_HANDLER) must not call klog(); they latch
+ * status for the poll routine, which can log.
+ */
+
+#define KLOG_ERR   0
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+
+#define KLOG_SLOTS 256              /* Power of two */
+#define KLOG_TEXT  112              /* Bytes of text per record, NUL included */
+
+typedef struct {
+    uint32_t logged;
+    uint32_t dropped;           /* Ring was full */
+    uint32_t drained;
+} klog_stats_t;
+
+void klog(int level, const char* format, ...);
+
+// Returns the number of records written out
+int klog_drain(void);
+
+// Records at or below `level` go to the console; serial gets everything.
+// The default is KLOG_WARN.
+void klog_set_console_level(int level);
+int klog_console_level(void);
+
+void klog_get_stats(klog_stats_t* stats);
+
+#endif /* KLOG_H */
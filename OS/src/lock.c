@@ -0,0 +1,267 @@
+#include "lock.h"
+#include "shell.h"
+#include "tsc.h"
+
+#define LOCKSTAT_MAX   64           // Rows lockstat sorts; the rest are left out
+
+static lock_stats_t* all_locks = NULL;
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("pause" : : : "memory");
+}
+
+// Lock-free push, so a lock can register from any context
+IRQ_HANDLER static void lock_register(lock_stats_t* stats) {
+    if (__atomic_exchange_n(&stats->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    lock_stats_t* head = __atomic_load_n(&all_locks, __ATOMIC_RELAXED);
+    do {
+        stats->next = head;
+    } while (!__atomic_compare_exchange_n(&all_locks, &head, stats, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Called holding the lock exclusively
+IRQ_HANDLER static void note_acquired(lock_stats_t* stats, uint64_t wait_start) {
+    if (!stats->registered) {
+        lock_register(stats);
+    }
+    if (wait_start) {
+        stats->contended++;
+        stats->wait_cycles += tsc_read() - wait_start;
+    }
+    stats->acquired_at = tsc_read();
+}
+
+IRQ_HANDLER static void note_released(lock_stats_t* stats) {
+    uint64_t held = tsc_read() - stats->acquired_at;
+
+    stats->hold_cycles += held;
+    if (held > stats->max_hold_cycles) {
+        stats->max_hold_cycles = held;
+    }
+}
+
+IRQ_HANDLER void spin_lock(spinlock_t* lock) {
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    uint64_t wait_start = 0;
+
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        wait_start = tsc_read();
+        while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+    }
+    lock->stats.acquires++;
+    note_acquired(&lock->stats, wait_start);
+}
+
+IRQ_HANDLER int spin_trylock(spinlock_t* lock) {
+    uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    uint32_t expected = owner;
+
+    // Only take a ticket if it would be served at once
+    if (!__atomic_compare_exchange_n(&lock->next, &expected, owner + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock->stats.acquires++;
+    note_acquired(&lock->stats, 0);
+    return 1;
+}
+
+IRQ_HANDLER void spin_unlock(spinlock_t* lock) {
+    note_released(&lock->stats);
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+// Readers share the lock, so their counters are bumped atomically and
+// their hold times are not tracked
+IRQ_HANDLER void read_lock(rwlock_t* lock) {
+    int waited = 0;
+
+    if (!lock->stats.registered) {
+        lock_register(&lock->stats);
+    }
+    while (1) {
+        int32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (state >= 0 && !__atomic_load_n(&lock->writers_waiting, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&lock->state, &state, state + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        waited = 1;
+        cpu_relax();
+    }
+    __atomic_fetch_add(&lock->stats.acquires, 1, __ATOMIC_RELAXED);
+    if (waited) {
+        __atomic_fetch_add(&lock->stats.contended, 1, __ATOMIC_RELAXED);
+    }
+}
+
+IRQ_HANDLER void read_unlock(rwlock_t* lock) {
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+}
+
+IRQ_HANDLER void write_lock(rwlock_t* lock) {
+    uint64_t wait_start = 0;
+    int32_t idle = 0;
+
+    __atomic_fetch_add(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&lock->state, &idle, -1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (!wait_start) {
+            wait_start = tsc_read();
+        }
+        idle = 0;
+        cpu_relax();
+    }
+    __atomic_fetch_sub(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    lock->stats.write_acquires++;
+    note_acquired(&lock->stats, wait_start);
+}
+
+IRQ_HANDLER void write_unlock(rwlock_t* lock) {
+    note_released(&lock->stats);
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+}
+
+IRQ_HANDLER uint32_t read_seqcount_begin(const volatile uint32_t* seq) {
+    uint32_t start;
+
+    while ((start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+    return start;
+}
+
+IRQ_HANDLER int read_seqcount_retry(const volatile uint32_t* seq, uint32_t start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+IRQ_HANDLER void write_seqcount_begin(volatile uint32_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+IRQ_HANDLER void write_seqcount_end(volatile uint32_t* seq) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+}
+
+IRQ_HANDLER uint32_t read_seqbegin(const seqlock_t* lock) {
+    return read_seqcount_begin(&lock->seq);
+}
+
+IRQ_HANDLER int read_seqretry(seqlock_t* lock, uint32_t start) {
+    if (read_seqcount_retry(&lock->seq, start)) {
+        __atomic_fetch_add(&lock->lock.stats.retries, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+IRQ_HANDLER void write_seqlock(seqlock_t* lock) {
+    spin_lock(&lock->lock);
+    write_seqcount_begin(&lock->seq);
+}
+
+IRQ_HANDLER void write_sequnlock(seqlock_t* lock) {
+    write_seqcount_end(&lock->seq);
+    spin_unlock(&lock->lock);
+}
+
+lock_stats_t* lock_stats_list(void) {
+    return __atomic_load_n(&all_locks, __ATOMIC_ACQUIRE);
+}
+
+void lock_stats_reset(void) {
+    for (lock_stats_t* stats = lock_stats_list(); stats; stats = stats->next) {
+        stats->acquires = 0;
+        stats->write_acquires = 0;
+        stats->contended = 0;
+        stats->retries = 0;
+        stats->wait_cycles = 0;
+        stats->hold_cycles = 0;
+        stats->max_hold_cycles = 0;
+    }
+}
+
+static void print_cell(const char* text, int width) {
+    int column = printf("%s", text);
+
+    while (column++ < width) {
+        putchar(' ');
+    }
+}
+
+static void print_number(uint64_t value, int width) {
+    char text[16];
+
+    snprintf(text, sizeof(text), "%u", (unsigned int)value);
+    print_cell(text, width);
+}
+
+// Locks that cost the most waiting come first
+static int lockstat_command(int argc, char** argv) {
+    static const char* const kinds[] = { "spin", "rw", "seq" };
+    lock_stats_t* rows[LOCKSTAT_MAX];
+    int count = 0;
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            puts("Usage: lockstat [reset]");
+            return -1;
+        }
+        lock_stats_reset();
+        return 0;
+    }
+
+    for (lock_stats_t* stats = lock_stats_list(); stats && count < LOCKSTAT_MAX; stats = stats->next) {
+        int at = count++;
+        while (at > 0 && rows[at - 1]->wait_cycles < stats->wait_cycles) {
+            rows[at] = rows[at - 1];
+            at--;
+        }
+        rows[at] = stats;
+    }
+
+    print_cell("Lock", 14);
+    print_cell("Kind", 6);
+    print_cell("Taken", 10);
+    print_cell("Waited", 8);
+    print_cell("Avg wait", 10);
+    print_cell("Avg hold", 10);
+    print_cell("Max hold", 10);
+    printf("Retries\n");
+    for (int i = 0; i < count; i++) {
+        lock_stats_t* stats = rows[i];
+        uint32_t exclusive = stats->kind == LOCK_RW ? stats->write_acquires : stats->acquires;
+
+        print_cell(stats->name, 14);
+        print_cell(kinds[stats->kind], 6);
+        if (stats->kind == LOCK_RW) {
+            char text[24];
+            snprintf(text, sizeof(text), "%ur/%uw", stats->acquires, stats->write_acquires);
+            print_cell(text, 10);
+        } else {
+            print_number(stats->acquires, 10);
+        }
+        print_number(stats->contended, 8);
+        print_number(stats->contended ? udiv64(stats->wait_cycles, stats->contended) : 0, 10);
+        print_number(exclusive ? udiv64(stats->hold_cycles, exclusive) : 0, 10);
+        print_number(stats->max_hold_cycles, 10);
+        printf("%u\n", stats->retries);
+    }
+    if (count == 0) {
+        puts("No lock taken yet");
+    }
+    puts("Times in TSC cycles");
+    return 0;
+}
+
+SHELL_COMMAND(lockstat_cmd, "lockstat", "[reset]", "Show lock contention and hold times", 0, 1,
+              lockstat_command);
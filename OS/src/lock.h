@@ -0,0 +1,135 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include "libc/libc.h"
+#include "interrupts.h"
+
+/*
+ * Locks for data that interrupt handlers, or one day other CPUs, share.
+ *
+ * spinlock_t is a ticket lock: each acquirer takes the next ticket and
+ * waits for `owner` to reach it, so waiters get in in arrival order.
+ * Data an interrupt handler also touches needs the _irqsave variants.
+ * They disable interrupts before taking the lock and restore the old
+ * state after releasing it. Otherwise a handler could spin forever on
+ * the lock its own CPU holds. Nobody may sleep (sched.h) holding a
+ * spinlock.
+ *
+ * rwlock_t admits many readers or one writer. A waiting writer holds
+ * new readers off, so writers are not starved.
+ *
+ * seqlock_t is for small, read-mostly data such as the clock. Writers
+ * serialize on a spinlock and bump a sequence number before and after
+ * the update. Readers take no lock: they copy the data and retry if the
+ * sequence was odd or changed meanwhile:
+ *
+ *     do {
+ *         seq = read_seqbegin(&lock);
+ *         copy = data;
+ *     } while (read_seqretry(&lock, seq));
+ *
+ * The seqcount_ functions do the same on a bare sequence number, for
+ * data whose readers cannot reach the spinlock, like the vDSO page.
+ *
+ * The lock functions are built IRQ_HANDLER, so interrupt handlers may
+ * call them. A seqlock whose writer is a handler must have every other
+ * writer disable interrupts around its update. Its readers need not:
+ * a handler that interrupts one finishes its write before the reader
+ * resumes, and the reader then retries.
+ *
+ * Every lock is named and keeps statistics (lock_stats_t): how often it
+ * was taken, how often it had to wait and for how long, and how long it
+ * was held, on average and at most. A lock joins the list `lockstat`
+ * prints the first time it is taken. Define locks with the initializers:
+ *
+ *     static spinlock_t table_lock = SPINLOCK_INIT("table");
+ */
+
+#define LOCK_SPIN  0
+#define LOCK_RW    1
+#define LOCK_SEQ   2
+
+typedef struct lock_stats {
+    const char* name;
+    int kind;                   /* LOCK_SPIN, LOCK_RW or LOCK_SEQ */
+    int registered;
+    uint32_t acquires;          /* Read acquires for an rwlock, writes for a seqlock */
+    uint32_t write_acquires;    /* rwlock only */
+    uint32_t contended;         /* Acquires that had to wait */
+    uint32_t retries;           /* seqlock reads that raced a writer */
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;       /* Exclusive holds only */
+    uint64_t max_hold_cycles;
+    uint64_t acquired_at;
+    struct lock_stats* next;
+} lock_stats_t;
+
+typedef struct {
+    volatile uint32_t next;     /* Next ticket to hand out */
+    volatile uint32_t owner;    /* Ticket now being served */
+    lock_stats_t stats;
+} spinlock_t;
+
+typedef struct {
+    volatile int32_t state;     /* Readers inside, or -1 for a writer */
+    volatile uint32_t writers_waiting;
+    lock_stats_t stats;
+} rwlock_t;
+
+typedef struct {
+    volatile uint32_t seq;      /* Odd while a write is in progress */
+    spinlock_t lock;
+} seqlock_t;
+
+#define LOCK_STATS_INIT(lock_name, lock_kind) { .name = (lock_name), .kind = (lock_kind) }
+#define SPINLOCK_INIT(name) { .stats = LOCK_STATS_INIT(name, LOCK_SPIN) }
+#define RWLOCK_INIT(name)   { .stats = LOCK_STATS_INIT(name, LOCK_RW) }
+#define SEQLOCK_INIT(name)  { .lock = { .stats = LOCK_STATS_INIT(name, LOCK_SEQ) } }
+
+void spin_lock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+int spin_trylock(spinlock_t* lock);                 // 1 if taken
+
+static inline uintptr_t irq_save(void) {
+    uintptr_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uintptr_t flags) {
+    if (flags & 0x200) {        // IF
+        irq_enable();
+    }
+}
+
+static inline uintptr_t spin_lock_irqsave(spinlock_t* lock) {
+    uintptr_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uintptr_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void read_lock(rwlock_t* lock);
+void read_unlock(rwlock_t* lock);
+void write_lock(rwlock_t* lock);
+void write_unlock(rwlock_t* lock);
+
+uint32_t read_seqcount_begin(const volatile uint32_t* seq);
+int read_seqcount_retry(const volatile uint32_t* seq, uint32_t start);
+void write_seqcount_begin(volatile uint32_t* seq);
+void write_seqcount_end(volatile uint32_t* seq);
+
+uint32_t read_seqbegin(const seqlock_t* lock);
+int read_seqretry(seqlock_t* lock, uint32_t start);    // Counts the retries
+void write_seqlock(seqlock_t* lock);
+void write_sequnlock(seqlock_t* lock);
+
+// Every lock taken so far, most recently registered first
+lock_stats_t* lock_stats_list(void);
+void lock_stats_reset(void);
+
+#endif /* LOCK_H */
@@ -0,0 +1,178 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+/*
+ * LZ4 frame decoder for the boot paths.
+ *
+ * The kernel images on disk are LZ4 frames written by tools/lz4pack. A
+ * frame is a header, a run of blocks and an end mark:
+ *
+ *     magic 0x184D2204 | FLG | BD | [content size] | HC
+ *     block size (bit 31: stored raw) | block data [| block checksum]
+ *     ...
+ *     0
+ *
+ * A compressed block is a run of sequences. Each sequence is a token
+ * byte (literal count in the high nibble, match length minus 4 in the
+ * low one; 15 means more length bytes follow, each added until one is
+ * below 255), the literals, and then a little-endian 16-bit offset back
+ * into the output where the match is copied from. The last sequence
+ * stops after its literals.
+ *
+ * The UEFI loader and lz4pack's self-check use this decoder; the BIOS
+ * path has the same loop in assembly (lz4stub.asm). Checksums are
+ * skipped, not verified, and dictionary frames are not supported. Like
+ * bootinfo.h this sits next to the EFI headers, so it uses plain C
+ * types only.
+ */
+
+#define LZ4_FRAME_MAGIC     0x184D2204
+#define LZ4_FLG_VERSION     0x40
+#define LZ4_FLG_BLOCK_INDEP 0x20
+#define LZ4_FLG_BLOCK_SUM   0x10
+#define LZ4_FLG_SIZE        0x08
+#define LZ4_FLG_CONTENT_SUM 0x04
+#define LZ4_FLG_DICT_ID     0x01
+#define LZ4_BLOCK_STORED    0x80000000u
+#define LZ4_MIN_MATCH       4
+
+static inline unsigned int lz4_read32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// Decode one compressed block into dst. Matches may reach `history`
+// bytes back before dst, into earlier blocks of a frame whose blocks are
+// linked. Bytes written, or -1 if the block is malformed or does not fit
+// in dst_len bytes.
+static inline long lz4_decompress_block(const unsigned char* src, unsigned long src_len,
+                                        unsigned char* dst, unsigned long dst_len,
+                                        unsigned long history) {
+    const unsigned char* end = src + src_len;
+    unsigned long out = 0;
+
+    while (src < end) {
+        unsigned int token = *src++;
+        unsigned long len = token >> 4;
+
+        if (len == 15) {
+            unsigned int more;
+            do {
+                if (src >= end) {
+                    return -1;
+                }
+                more = *src++;
+                len += more;
+            } while (more == 255);
+        }
+        if (len > (unsigned long)(end - src) || len > dst_len - out) {
+            return -1;
+        }
+        for (unsigned long i = 0; i < len; i++) {
+            dst[out + i] = src[i];
+        }
+        src += len;
+        out += len;
+        if (src == end) {
+            break;
+        }
+
+        if (end - src < 2) {
+            return -1;
+        }
+        unsigned long offset = src[0] | (src[1] << 8);
+        src += 2;
+        if (offset == 0 || offset > out + history) {
+            return -1;
+        }
+
+        len = token & 15;
+        if (len == 15) {
+            unsigned int more;
+            do {
+                if (src >= end) {
+                    return -1;
+                }
+                more = *src++;
+                len += more;
+            } while (more == 255);
+        }
+        len += LZ4_MIN_MATCH;
+        if (len > dst_len - out) {
+            return -1;
+        }
+        // Byte by byte: a match may overlap the bytes it produces
+        for (unsigned long i = 0; i < len; i++) {
+            dst[out + i] = dst[out - offset + i];
+        }
+        out += len;
+    }
+    return (long)out;
+}
+
+// Length of the frame header, or 0 if src does not start with one we
+// can decode
+static inline unsigned long lz4_frame_header_len(const unsigned char* src, unsigned long src_len) {
+    if (src_len < 7 || lz4_read32(src) != LZ4_FRAME_MAGIC ||
+        (src[4] & 0xC0) != LZ4_FLG_VERSION || (src[4] & LZ4_FLG_DICT_ID)) {
+        return 0;
+    }
+    unsigned long len = 7 + ((src[4] & LZ4_FLG_SIZE) ? 8 : 0);
+    return len <= src_len ? len : 0;
+}
+
+// The decompressed size recorded in the frame header, or 0 if it has none
+static inline unsigned long long lz4_frame_content_size(const unsigned char* src, unsigned long src_len) {
+    if (!lz4_frame_header_len(src, src_len) || !(src[4] & LZ4_FLG_SIZE)) {
+        return 0;
+    }
+    return lz4_read32(src + 6) | ((unsigned long long)lz4_read32(src + 10) << 32);
+}
+
+// Decode a whole frame into dst. Bytes written, or -1 on a malformed
+// frame or one that does not fit in dst_len bytes.
+static inline long lz4_decompress_frame(const unsigned char* src, unsigned long src_len,
+                                        unsigned char* dst, unsigned long dst_len) {
+    unsigned long pos = lz4_frame_header_len(src, src_len);
+    unsigned long block_sum, linked;
+    unsigned long out = 0;
+
+    if (!pos) {
+        return -1;
+    }
+    block_sum = (src[4] & LZ4_FLG_BLOCK_SUM) ? 4 : 0;
+    linked = !(src[4] & LZ4_FLG_BLOCK_INDEP);
+    while (1) {
+        if (src_len - pos < 4) {
+            return -1;
+        }
+        unsigned int size = lz4_read32(src + pos);
+        pos += 4;
+        if (size == 0) {
+            return (long)out;
+        }
+
+        unsigned long len = size & ~LZ4_BLOCK_STORED;
+        if (len > src_len - pos || block_sum > src_len - pos - len) {
+            return -1;
+        }
+        if (size & LZ4_BLOCK_STORED) {
+            if (len > dst_len - out) {
+                return -1;
+            }
+            for (unsigned long i = 0; i < len; i++) {
+                dst[out + i] = src[pos + i];
+            }
+            out += len;
+        } else {
+            long done = lz4_decompress_block(src + pos, len, dst + out, dst_len - out,
+                                             linked ? out : 0);
+            if (done < 0) {
+                return -1;
+            }
+            out += (unsigned long)done;
+        }
+        pos += len + block_sum;
+    }
+}
+
+#endif /* LZ4_H */
@@ -0,0 +1,110 @@
+; LZ4 decompressor for the BIOS boot path.
+; The image boot.asm reads is this stub followed by the kernel as an LZ4
+; frame (tools/lz4pack, format in lz4.h). boot.asm jumps here in 32-bit
+; protected mode; the stub decodes the frame to the kernel's link
+; address and jumps there. Checksums are skipped, not verified.
+[bits 32]
+[org 0x10000]                   ; KERNEL_BUFFER in boot.asm
+
+KERNEL_OFFSET equ 0x100000      ; Where the kernel is linked (linker.ld)
+VGA_TEXT equ 0xb8000
+
+LZ4_FRAME_MAGIC equ 0x184d2204
+LZ4_FLG_BLOCK_SUM equ 0x10
+LZ4_FLG_SIZE equ 0x08
+
+; Boot timeline (boot_stamps_t in bootinfo.h); stage 2 is the handoff
+BOOT_STAMPS equ 0x600
+BOOT_STAGE_HANDOFF equ 2
+
+start:
+    cld
+    mov esi, frame
+    cmp dword [esi], LZ4_FRAME_MAGIC
+    jne bad_frame
+    mov al, [esi + 4]
+    mov [FLAGS], al
+    add esi, 7                  ; Magic, FLG, BD and the header checksum
+    test al, LZ4_FLG_SIZE
+    jz .blocks
+    add esi, 8                  ; Content size
+.blocks:
+    mov edi, KERNEL_OFFSET
+
+.block:
+    lodsd                       ; Block size; 0 ends the frame
+    test eax, eax
+    jz .done
+    btr eax, 31                 ; Stored without compression?
+    jnc .compressed
+    mov ecx, eax
+    rep movsb
+    jmp .next
+
+.compressed:
+    lea ebx, [esi + eax]        ; End of the block
+.sequence:
+    movzx edx, byte [esi]       ; Token: literal count, match length - 4
+    inc esi
+    mov eax, edx
+    shr eax, 4
+    cmp eax, 15
+    jne .literals
+    call add_length
+.literals:
+    mov ecx, eax
+    rep movsb
+    cmp esi, ebx
+    jae .next                   ; The last sequence stops after its literals
+
+    movzx ebp, word [esi]       ; Match offset
+    add esi, 2
+    mov eax, edx
+    and eax, 15
+    cmp eax, 15
+    jne .match
+    call add_length
+.match:
+    lea ecx, [eax + 4]
+    push esi
+    mov esi, edi
+    sub esi, ebp
+    rep movsb                   ; Byte by byte, so an overlapping match repeats
+    pop esi
+    jmp .sequence
+
+.next:
+    test byte [FLAGS], LZ4_FLG_BLOCK_SUM
+    jz .block
+    add esi, 4
+    jmp .block
+
+.done:
+    rdtsc
+    mov [BOOT_STAMPS + 8 + BOOT_STAGE_HANDOFF * 8], eax
+    mov [BOOT_STAMPS + 12 + BOOT_STAGE_HANDOFF * 8], edx
+    jmp KERNEL_OFFSET           ; Jump to the kernel
+
+; Add the extra length bytes at esi to eax: each is added, and a 255
+; means another follows
+add_length:
+    movzx ecx, byte [esi]
+    inc esi
+    add eax, ecx
+    cmp ecx, 255
+    je add_length
+    ret
+
+; Not a frame we can read: say so in the corner of the screen and stop
+bad_frame:
+    mov dword [VGA_TEXT], 0x4f5a4f4c        ; "LZ4!", white on red
+    mov dword [VGA_TEXT + 4], 0x4f214f34
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+FLAGS db 0                      ; The frame's FLG byte
+
+; The kernel's LZ4 frame is appended here
+frame:
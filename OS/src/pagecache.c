@@ -0,0 +1,176 @@
+#include "pagecache.h"
+#include "paging.h"
+
+#define HASH_BITS 9
+#define HASH_SIZE (1 << HASH_BITS)
+
+typedef struct cached_page {
+    const fat_volume_t* vol;    // NULL while the slot is free
+    uint32_t cluster;
+    uint32_t index;
+    uint32_t generation;
+    uint64_t phys;
+    uint32_t maps;
+    int referenced;             // Clock bit, set on each lookup
+    int retired;                // Out of the key hash; freed at its last unmap
+    struct cached_page* key_next;
+    struct cached_page* phys_next;
+} cached_page_t;
+
+pagecache_stats_t pagecache_stats;
+
+static cached_page_t pages[PAGECACHE_PAGES];
+static cached_page_t* by_key[HASH_SIZE];
+static cached_page_t* by_phys[HASH_SIZE];
+static uint32_t page_count = 0;
+static uint32_t mapped_count = 0;
+static uint32_t clock_hand = 0;
+
+static uint32_t key_hash(const fat_volume_t* vol, uint32_t cluster, uint32_t index) {
+    uint32_t key = cluster ^ (index * 0x9E3779B1u) ^ (uint32_t)((uintptr_t)vol >> 4);
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint32_t phys_hash(uint64_t phys) {
+    return ((uint32_t)(phys >> 12) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void unlink_key(cached_page_t* page) {
+    cached_page_t** link = &by_key[key_hash(page->vol, page->cluster, page->index)];
+
+    while (*link && *link != page) {
+        link = &(*link)->key_next;
+    }
+    if (*link) {
+        *link = page->key_next;
+    }
+    page->retired = 1;
+}
+
+static void release(cached_page_t* page) {
+    cached_page_t** link = &by_phys[phys_hash(page->phys)];
+
+    if (!page->retired) {
+        unlink_key(page);
+    }
+    while (*link && *link != page) {
+        link = &(*link)->phys_next;
+    }
+    if (*link) {
+        *link = page->phys_next;
+    }
+    frame_free(page->phys);
+    memset(page, 0, sizeof(*page));
+    page_count--;
+}
+
+// A free slot, evicting an unmapped page if there is none. Two sweeps:
+// the first clears the referenced bits it passes.
+static cached_page_t* alloc_slot(void) {
+    for (uint32_t scanned = 0; scanned < 2 * PAGECACHE_PAGES; scanned++) {
+        cached_page_t* page = &pages[clock_hand];
+
+        clock_hand = (clock_hand + 1) % PAGECACHE_PAGES;
+        if (!page->vol) {
+            return page;
+        }
+        if (page->maps) {
+            continue;
+        }
+        if (page->referenced) {
+            page->referenced = 0;
+            continue;
+        }
+        release(page);
+        pagecache_stats.evictions++;
+        return page;
+    }
+    return NULL;
+}
+
+static cached_page_t* lookup(const fat_file_t* file, uint32_t index) {
+    cached_page_t* page = by_key[key_hash(file->vol, file->first_cluster, index)];
+
+    while (page && (page->vol != file->vol || page->cluster != file->first_cluster ||
+                    page->index != index)) {
+        page = page->key_next;
+    }
+    if (page && page->generation != file->vol->generation) {
+        // The file may have been rewritten since this copy was read
+        if (page->maps) {
+            unlink_key(page);
+        } else {
+            release(page);
+        }
+        page = NULL;
+    }
+    return page;
+}
+
+uint64_t pagecache_get(fat_file_t* file, uint32_t index) {
+    cached_page_t* page = lookup(file, index);
+
+    if (page) {
+        pagecache_stats.hits++;
+    } else {
+        page = alloc_slot();
+        if (!page) {
+            pagecache_stats.full++;
+            return 0;
+        }
+
+        // A short read at the end of the file leaves the rest zeroed
+        uint64_t phys = frame_alloc();
+        if (!phys) {
+            return 0;
+        }
+        if (fat_seek(file, index * (uint32_t)PAGE_SIZE) < 0 ||
+            fat_read(file, phys_to_virt(phys), (uint32_t)PAGE_SIZE) < 0) {
+            frame_free(phys);
+            return 0;
+        }
+        pagecache_stats.misses++;
+
+        page->vol = file->vol;
+        page->cluster = file->first_cluster;
+        page->index = index;
+        page->generation = file->vol->generation;
+        page->phys = phys;
+        page->key_next = by_key[key_hash(page->vol, page->cluster, index)];
+        by_key[key_hash(page->vol, page->cluster, index)] = page;
+        page->phys_next = by_phys[phys_hash(phys)];
+        by_phys[phys_hash(phys)] = page;
+        page_count++;
+    }
+
+    if (page->maps++ == 0) {
+        mapped_count++;
+    }
+    page->referenced = 1;
+    return page->phys;
+}
+
+void pagecache_put(uint64_t phys) {
+    cached_page_t* page = by_phys[phys_hash(phys)];
+
+    while (page && page->phys != phys) {
+        page = page->phys_next;
+    }
+    if (!page || page->maps == 0) {
+        return;
+    }
+    if (--page->maps == 0) {
+        mapped_count--;
+        if (page->retired) {
+            release(page);
+        }
+    }
+}
+
+uint32_t pagecache_pages(void) {
+    return page_count;
+}
+
+uint32_t pagecache_mapped(void) {
+    return mapped_count;
+}
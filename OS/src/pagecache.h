@@ -0,0 +1,44 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include "libc/libc.h"
+#include "fat.h"
+
+/*
+ * Page cache for mapped files (x86_64).
+ *
+ * Pages of the files processes run from are read once, through the
+ * block cache, into frames of their own. They are kept here keyed by
+ * (volume, first cluster, page). Every mapping of a page gets the same
+ * frame: read-only text is shared outright, and writable data is shared
+ * until the first write copies it (vma.c).
+ *
+ * A page stays cached after its last mapping goes, so the next run of a
+ * program starts without reading the disk. When the cache is full, an
+ * unmapped page is evicted in clock order. Opening any file for writing
+ * bumps its volume's generation, which retires every cached page from
+ * that volume; pages still mapped are freed at their last unmap.
+ */
+
+#define PAGECACHE_PAGES   1024      /* 4 MiB */
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;            /* Pages read in */
+    uint32_t evictions;
+    uint32_t full;              /* Lookups that found every page mapped */
+} pagecache_stats_t;
+
+extern pagecache_stats_t pagecache_stats;
+
+// Frame holding page `index` of `file`, counted as one more mapping.
+// 0 if the read fails or every cached page is mapped.
+uint64_t pagecache_get(fat_file_t* file, uint32_t index);
+
+// Drop a mapping taken with pagecache_get()
+void pagecache_put(uint64_t phys);
+
+uint32_t pagecache_pages(void);
+uint32_t pagecache_mapped(void);    // Pages with at least one mapping
+
+#endif /* PAGECACHE_H */
@@ -0,0 +1,474 @@
+#include "paging.h"
+#include "io.h"
+
+// Bounds of the kernel image, from the linker script
+extern char __kernel_start[];
+extern char __kernel_end[];
+
+#define CR4_PGE      (1ULL << 7)
+#define CR4_PCIDE    (1ULL << 17)
+#define CR3_NOFLUSH  (1ULL << 63)
+#define PCID_COUNT   4096
+
+#define INVPCID_ADDRESS 0
+#define INVPCID_SINGLE  1
+#define INVPCID_ALL     2
+
+#define FOUR_GIB 0x100000000ULL
+
+#define MSR_EFER        0xC0000080
+#define EFER_NXE        (1ULL << 11)
+
+#define MSR_PAT         0x277
+#define PAT_WC          0x01ULL
+#define PAT_ENTRY_WC    4           // Reached with PTE_PAT alone, unused by reset-time mappings
+
+address_space_t kernel_space;
+paging_info_t paging_info;
+tlb_shootdown_t tlb_shootdown_hook = NULL;
+
+static address_space_t* current_space = &kernel_space;
+static int direct_map_ready = 0;
+static uint16_t next_pcid = 1;
+
+#define LOW_MEMORY_END 0x100000ULL   // Frame 0 means failure, and BIOS data lives below 1 MiB
+
+// Physical memory not yet handed out, sorted by address
+typedef struct {
+    uint64_t next;
+    uint64_t end;
+} frame_region_t;
+
+static frame_region_t regions[BOOT_MEM_REGIONS];
+static int region_count = 0;
+static uint64_t free_frames = 0;    // Stack of freed frames, linked through the frames
+
+static inline uint64_t read_cr3(void) {
+    uint64_t value;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint64_t value) {
+    __asm__ volatile("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* regs) {
+    __asm__ volatile("cpuid"
+                     : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static inline void invlpg(uint64_t virt) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static inline void invpcid(uint64_t type, uint16_t pcid, uint64_t virt) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, virt };
+    __asm__ volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(0x70, reg);
+    return inb(0x71);
+}
+
+// Until paging_init switches CR3, tables are reached through the
+// loader's identity map of low memory
+static uint64_t* table_at(uint64_t phys) {
+    if (direct_map_ready) {
+        return (uint64_t*)phys_to_virt(phys);
+    }
+    return (uint64_t*)(uintptr_t)phys;
+}
+
+// Add [base, end) to the free regions, trimmed to whole pages above
+// LOW_MEMORY_END and kept in address order, so early page tables come
+// from low memory the loader's identity map covers
+static void add_region(uint64_t base, uint64_t end) {
+    base = (base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+    if (base < LOW_MEMORY_END) {
+        base = LOW_MEMORY_END;
+    }
+    if (end <= base || region_count == BOOT_MEM_REGIONS) {
+        return;
+    }
+
+    int i = region_count++;
+    for (; i > 0 && regions[i - 1].next > base; i--) {
+        regions[i] = regions[i - 1];
+    }
+    regions[i].next = base;
+    regions[i].end = end;
+}
+
+// Memory sizes the BIOS leaves in CMOS: 64 KiB units above 16 MiB, and
+// (QEMU) above 4 GiB. Older machines only report KiB above 1 MiB.
+static void detect_memory_cmos(uint64_t kernel_phys_end) {
+    uint64_t below = (cmos_read(0x34) | (cmos_read(0x35) << 8)) * 0x10000ULL;
+    uint64_t above = (cmos_read(0x5b) | (cmos_read(0x5c) << 8) |
+                      ((uint64_t)cmos_read(0x5d) << 16)) * 0x10000ULL;
+
+    if (below) {
+        below += 0x1000000;
+    } else {
+        below = 0x100000 + (cmos_read(0x30) | (cmos_read(0x31) << 8)) * 1024ULL;
+    }
+
+    add_region(kernel_phys_end, below);
+    add_region(FOUR_GIB, FOUR_GIB + above);
+}
+
+// The UEFI loader has already left out everything it loaded, so its
+// conventional-memory list is free as it stands
+static void detect_memory_efi(const boot_info_t* boot) {
+    uint32_t count = boot->mem_region_count < BOOT_MEM_REGIONS ? boot->mem_region_count : BOOT_MEM_REGIONS;
+
+    for (uint32_t i = 0; i < count; i++) {
+        add_region(boot->mem_regions[i].base, boot->mem_regions[i].base + boot->mem_regions[i].size);
+    }
+}
+
+static void detect_memory(const boot_info_t* boot, uint64_t kernel_phys_end) {
+    if (boot && boot->mem_region_count > 0) {
+        detect_memory_efi(boot);
+    } else {
+        detect_memory_cmos(kernel_phys_end);
+    }
+
+    paging_info.memory_bytes = 0;
+    paging_info.frames_total = 0;
+    for (int i = 0; i < region_count; i++) {
+        paging_info.frames_total += (regions[i].end - regions[i].next) / PAGE_SIZE;
+        if (regions[i].end > paging_info.memory_bytes) {
+            paging_info.memory_bytes = regions[i].end;
+        }
+    }
+    paging_info.frames_free = paging_info.frames_total;
+}
+
+uint64_t frame_alloc(void) {
+    uint64_t phys = 0;
+
+    if (free_frames) {
+        phys = free_frames;
+        free_frames = *(uint64_t*)phys_to_virt(phys);
+    } else {
+        for (int i = 0; i < region_count; i++) {
+            if (regions[i].next < regions[i].end) {
+                phys = regions[i].next;
+                regions[i].next += PAGE_SIZE;
+                break;
+            }
+        }
+    }
+
+    if (!phys) {
+        return 0;
+    }
+
+    memset(table_at(phys), 0, PAGE_SIZE);
+    paging_info.frames_free--;
+    return phys;
+}
+
+void frame_free(uint64_t phys) {
+    *(uint64_t*)phys_to_virt(phys) = free_frames;
+    free_frames = phys;
+    paging_info.frames_free++;
+}
+
+// Follow `entry` to the next-level table, creating it if asked.
+// Fails on a large page, which has no table below it.
+static uint64_t* next_table(uint64_t* entry, int create, uint64_t flags) {
+    if (!(*entry & PTE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+        uint64_t phys = frame_alloc();
+        if (!phys) {
+            return NULL;
+        }
+        *entry = phys | PTE_PRESENT | PTE_WRITABLE | (flags & PTE_USER);
+    } else if (*entry & PTE_LARGE) {
+        return NULL;
+    } else if (flags & PTE_USER) {
+        *entry |= PTE_USER;
+    }
+    return table_at(*entry & PTE_ADDR_MASK);
+}
+
+// Page-table entry for `virt` at the level mapping pages of 1 << stop bytes
+static uint64_t* walk(const address_space_t* as, uint64_t virt, int stop, int create, uint64_t flags) {
+    uint64_t* table = as->pml4;
+
+    for (int shift = 39; shift > stop; shift -= 9) {
+        table = next_table(&table[(virt >> shift) & 0x1FF], create, flags);
+        if (!table) {
+            return NULL;
+        }
+    }
+    return &table[(virt >> stop) & 0x1FF];
+}
+
+static int map_large(address_space_t* as, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    uint64_t* entry = walk(as, virt, size == HUGE_PAGE_SIZE ? 30 : 21, 1, flags);
+    if (!entry) {
+        return -1;
+    }
+    *entry = phys | flags | PTE_PRESENT | PTE_LARGE;
+    return 0;
+}
+
+int paging_map(address_space_t* as, uint64_t virt, uint64_t phys, uint64_t flags) {
+    // Without EFER.NXE bit 63 is reserved and would fault
+    if (!paging_info.nx) {
+        flags &= ~PTE_NX;
+    }
+
+    uint64_t* pte = walk(as, virt, 12, 1, flags);
+    if (!pte) {
+        return -1;
+    }
+
+    int replaced = (*pte & PTE_PRESENT) != 0;
+    *pte = (phys & PTE_ADDR_MASK) | flags | PTE_PRESENT;
+    if (replaced) {
+        tlb_flush_page(as, virt);
+    }
+    return 0;
+}
+
+int paging_unmap(address_space_t* as, uint64_t virt) {
+    uint64_t* pte = walk(as, virt, 12, 0, 0);
+    if (!pte || !(*pte & PTE_PRESENT)) {
+        return -1;
+    }
+
+    *pte = 0;
+    tlb_flush_page(as, virt);
+    return 0;
+}
+
+uint64_t paging_entry(const address_space_t* as, uint64_t virt) {
+    uint64_t* pte = walk(as, virt, 12, 0, 0);
+    return pte ? *pte : 0;
+}
+
+uint64_t paging_translate(const address_space_t* as, uint64_t virt) {
+    uint64_t* table = as->pml4;
+
+    for (int shift = 39; shift >= 12; shift -= 9) {
+        uint64_t entry = table[(virt >> shift) & 0x1FF];
+        if (!(entry & PTE_PRESENT)) {
+            return PAGING_NO_MAPPING;
+        }
+        if (shift == 12 || (entry & PTE_LARGE)) {
+            uint64_t offset_mask = (1ULL << shift) - 1;
+            return (entry & PTE_ADDR_MASK & ~offset_mask) | (virt & offset_mask);
+        }
+        table = table_at(entry & PTE_ADDR_MASK);
+    }
+    return PAGING_NO_MAPPING;
+}
+
+void paging_init(const boot_info_t* boot) {
+    uint32_t regs[4];
+    address_space_t loader;
+
+    // Where the boot loader put the kernel, from its page tables
+    loader.pml4 = (uint64_t*)(uintptr_t)(read_cr3() & PTE_ADDR_MASK);
+    uint64_t virt_start = (uint64_t)__kernel_start & ~(LARGE_PAGE_SIZE - 1);
+    uint64_t virt_end = ((uint64_t)__kernel_end + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    uint64_t phys_start = paging_translate(&loader, virt_start);
+
+    detect_memory(boot, phys_start + (virt_end - virt_start));
+
+    cpuid(0, 0, regs);
+    uint32_t max_leaf = regs[0];
+    cpuid(1, 0, regs);
+    paging_info.pcid = (regs[2] >> 17) & 1;
+    paging_info.pat = (regs[3] >> 16) & 1;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, regs);
+        paging_info.invpcid = (regs[1] >> 10) & 1;
+    }
+    cpuid(0x80000001, 0, regs);
+    paging_info.huge_pages = (regs[3] >> 26) & 1;
+    paging_info.nx = (regs[3] >> 20) & 1;
+    if (paging_info.nx) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+    }
+
+    kernel_space.pml4_phys = frame_alloc();
+    kernel_space.pml4 = table_at(kernel_space.pml4_phys);
+    kernel_space.pcid = 0;
+    kernel_space.stale = 0;
+
+    // Direct map of all memory and at least the low 4 GiB, which holds
+    // the legacy devices and the PCI hole
+    uint64_t step = paging_info.huge_pages ? HUGE_PAGE_SIZE : LARGE_PAGE_SIZE;
+    uint64_t top = (paging_info.memory_bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (top < FOUR_GIB) {
+        top = FOUR_GIB;
+    }
+    for (uint64_t phys = 0; phys < top; phys += step) {
+        map_large(&kernel_space, DIRECT_MAP_BASE + phys, phys, step,
+                  PTE_WRITABLE | PTE_GLOBAL);
+    }
+    paging_info.direct_map_bytes = top;
+
+    // Kernel image
+    for (uint64_t virt = virt_start; virt < virt_end; virt += LARGE_PAGE_SIZE) {
+        map_large(&kernel_space, virt, phys_start + (virt - virt_start), LARGE_PAGE_SIZE,
+                  PTE_WRITABLE | PTE_GLOBAL);
+    }
+
+    // Nothing maps through PAT entry 4 yet, so it can change before the
+    // CR3 load flushes the TLB
+    if (paging_info.pat) {
+        uint64_t pat = rdmsr(MSR_PAT) & ~(0xFFULL << (PAT_ENTRY_WC * 8));
+        __asm__ volatile("wbinvd" : : : "memory");
+        wrmsr(MSR_PAT, pat | (PAT_WC << (PAT_ENTRY_WC * 8)));
+    }
+
+    write_cr3(kernel_space.pml4_phys);
+    direct_map_ready = 1;
+    kernel_space.pml4 = table_at(kernel_space.pml4_phys);
+
+    uint64_t cr4 = read_cr4() | CR4_PGE;
+    if (paging_info.pcid) {
+        cr4 |= CR4_PCIDE;
+    }
+    write_cr4(cr4);
+}
+
+// The kernel half (PML4 slots 256-511) is shared by reference, so it
+// must not gain new top-level slots after paging_init
+int address_space_create(address_space_t* as) {
+    uint64_t phys = frame_alloc();
+    if (!phys) {
+        return -1;
+    }
+
+    as->pml4_phys = phys;
+    as->pml4 = table_at(phys);
+    for (int i = 256; i < 512; i++) {
+        as->pml4[i] = kernel_space.pml4[i];
+    }
+
+    // A recycled PCID may still tag the previous owner's translations
+    as->pcid = 0;
+    as->stale = 1;
+    if (paging_info.pcid) {
+        as->pcid = next_pcid;
+        next_pcid = next_pcid % (PCID_COUNT - 1) + 1;
+    }
+    return 0;
+}
+
+// Free the tables below `table` and, at the last level, the frames mapped
+static void free_tables(uint64_t* table, int level) {
+    for (int i = 0; i < 512; i++) {
+        uint64_t entry = table[i];
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+        if (level > 1 && !(entry & PTE_LARGE)) {
+            free_tables(table_at(entry & PTE_ADDR_MASK), level - 1);
+        }
+        if (level > 1 || (entry & (PTE_USER | PTE_SHARED)) == PTE_USER) {
+            frame_free(entry & PTE_ADDR_MASK);
+        }
+    }
+}
+
+void address_space_destroy(address_space_t* as) {
+    if (as == current_space) {
+        address_space_switch(&kernel_space);
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (as->pml4[i] & PTE_PRESENT) {
+            free_tables(table_at(as->pml4[i] & PTE_ADDR_MASK), 3);
+            frame_free(as->pml4[i] & PTE_ADDR_MASK);
+        }
+    }
+    frame_free(as->pml4_phys);
+    as->pml4 = NULL;
+    as->pml4_phys = 0;
+}
+
+// With PCIDs the switch keeps the TLB entries of every address space
+void address_space_switch(address_space_t* as) {
+    uint64_t cr3 = as->pml4_phys;
+
+    if (paging_info.pcid) {
+        cr3 |= as->pcid;
+        if (!as->stale) {
+            cr3 |= CR3_NOFLUSH;
+        }
+    }
+    as->stale = 0;
+
+    write_cr3(cr3);
+    current_space = as;
+}
+
+void tlb_flush_page(address_space_t* as, uint64_t virt) {
+    // Kernel-half pages are global and present in every address space
+    if (as == current_space || (virt >> 63)) {
+        invlpg(virt);
+    } else if (paging_info.invpcid) {
+        invpcid(INVPCID_ADDRESS, as->pcid, virt);
+    } else {
+        as->stale = 1;
+    }
+
+    if (tlb_shootdown_hook) {
+        tlb_shootdown_hook(as, virt, 1);
+    }
+}
+
+void tlb_flush_space(address_space_t* as) {
+    if (paging_info.invpcid) {
+        invpcid(INVPCID_SINGLE, as->pcid, 0);
+    } else if (as == current_space) {
+        write_cr3(as->pml4_phys | as->pcid);
+    } else {
+        as->stale = 1;
+    }
+
+    if (tlb_shootdown_hook) {
+        tlb_shootdown_hook(as, 0, ~0ULL);
+    }
+}
+
+void tlb_flush_all(void) {
+    if (paging_info.invpcid) {
+        invpcid(INVPCID_ALL, 0, 0);
+    } else {
+        // Toggling PGE drops every entry, global ones included
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    }
+
+    if (tlb_shootdown_hook) {
+        tlb_shootdown_hook(NULL, 0, ~0ULL);
+    }
+}
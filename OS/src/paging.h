@@ -0,0 +1,106 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "libc/libc.h"
+#include "bootinfo.h"
+
+/*
+ * x86_64 page-table manager.
+ *
+ * All physical memory is mapped at DIRECT_MAP_BASE using 1 GiB pages
+ * where the CPU has them, 2 MiB pages otherwise. The kernel image is
+ * mapped at KERNEL_VMA with 2 MiB pages. Both are global, so they stay
+ * in the TLB across address-space switches. Everything else is mapped
+ * with 4 KiB pages through paging_map().
+ */
+
+#define KERNEL_VMA       0xFFFFFFFF80000000ULL
+#define DIRECT_MAP_BASE  0xFFFF800000000000ULL
+#define FRAMEBUFFER_VMA  0xFFFFC00000000000ULL  /* Above a 64 TiB direct map */
+
+#define PAGE_SIZE        0x1000ULL
+#define LARGE_PAGE_SIZE  0x200000ULL
+#define HUGE_PAGE_SIZE   0x40000000ULL
+
+#define PTE_PRESENT   0x001ULL
+#define PTE_WRITABLE  0x002ULL
+#define PTE_USER      0x004ULL
+#define PTE_PWT       0x008ULL
+#define PTE_PCD       0x010ULL
+#define PTE_ACCESSED  0x020ULL
+#define PTE_DIRTY     0x040ULL
+#define PTE_LARGE     0x080ULL      /* 2 MiB (PD) or 1 GiB (PDPT) page */
+#define PTE_PAT       0x080ULL      /* Same bit in a 4 KiB PTE: selects PAT entries 4-7 */
+#define PTE_GLOBAL    0x100ULL
+#define PTE_COW       0x200ULL      /* Software: read-only until written, then copied */
+#define PTE_SHARED    0x400ULL      /* Software: frame owned elsewhere, never freed with the space */
+#define PTE_NX        (1ULL << 63)
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+// 4 KiB pages only. paging_init() sets PAT entry 4 to write-combining
+// when the CPU has a PAT; check paging_info.pat before relying on it.
+#define PTE_WRITE_COMBINE PTE_PAT
+
+#define PAGING_NO_MAPPING (~0ULL)
+
+#define phys_to_virt(phys) ((void*)((uint64_t)(phys) + DIRECT_MAP_BASE))
+#define virt_to_phys(virt) ((uint64_t)(virt) - DIRECT_MAP_BASE)  /* Direct-map addresses only */
+
+typedef struct {
+    uint64_t* pml4;         /* Through the direct map */
+    uint64_t pml4_phys;
+    uint16_t pcid;          /* 0 for the kernel, or when PCIDs are unsupported */
+    int stale;              /* PCID may hold old translations; flush on next switch */
+} address_space_t;
+
+typedef struct {
+    uint64_t memory_bytes;      /* Highest physical address detected */
+    uint64_t direct_map_bytes;
+    uint64_t frames_total;
+    uint64_t frames_free;
+    int huge_pages;             /* 1 GiB pages used for the direct map */
+    int pcid;                   /* CR4.PCIDE enabled */
+    int invpcid;
+    int pat;                    /* PTE_WRITE_COMBINE gives write-combining */
+    int nx;                     /* EFER.NXE enabled; PTE_NX is dropped without it */
+} paging_info_t;
+
+extern address_space_t kernel_space;
+extern paging_info_t paging_info;
+
+// `boot` is the UEFI loader's boot info, whose memory map gives the free
+// RAM; on the BIOS path it is NULL and the sizes come from CMOS
+void paging_init(const boot_info_t* boot);
+
+// Physical frames, 4 KiB each; frame_alloc returns 0 when memory runs out
+uint64_t frame_alloc(void);
+void frame_free(uint64_t phys);
+
+int paging_map(address_space_t* as, uint64_t virt, uint64_t phys, uint64_t flags);
+int paging_unmap(address_space_t* as, uint64_t virt);
+uint64_t paging_translate(const address_space_t* as, uint64_t virt);
+
+// The 4 KiB page-table entry for `virt`, or 0 if there is none
+uint64_t paging_entry(const address_space_t* as, uint64_t virt);
+
+// New address spaces share the kernel half of kernel_space
+int address_space_create(address_space_t* as);
+void address_space_switch(address_space_t* as);
+
+// Frees the user half: its tables and every user page mapped in it,
+// except pages marked PTE_SHARED.
+void address_space_destroy(address_space_t* as);
+
+/*
+ * TLB invalidation. Every flush is also passed to tlb_shootdown_hook so
+ * SMP code can forward it to CPUs that may have `as` loaded; the
+ * default hook does nothing.
+ */
+typedef void (*tlb_shootdown_t)(const address_space_t* as, uint64_t virt, uint64_t pages);
+extern tlb_shootdown_t tlb_shootdown_hook;
+
+void tlb_flush_page(address_space_t* as, uint64_t virt);
+void tlb_flush_space(address_space_t* as);
+void tlb_flush_all(void);
+
+#endif /* PAGING_H */
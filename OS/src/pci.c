@@ -0,0 +1,72 @@
+#include "pci.h"
+#include "io.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+static uint32_t config_address(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(device & 0x1F) << 11) |
+           ((uint32_t)(function & 0x7) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, device, function, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, device, function, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+static void fill_device(uint8_t bus, uint8_t device, uint8_t function, uint32_t id, pci_device_t* out) {
+    uint32_t class_reg = pci_read32(bus, device, function, PCI_CLASS_REVISION);
+
+    out->bus = bus;
+    out->device = device;
+    out->function = function;
+    out->vendor_id = id & 0xFFFF;
+    out->device_id = id >> 16;
+    out->class_code = class_reg >> 24;
+    out->subclass = (class_reg >> 16) & 0xFF;
+    out->prog_if = (class_reg >> 8) & 0xFF;
+    out->irq_line = pci_read32(bus, device, function, PCI_INTERRUPT_LINE) & 0xFF;
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if, int index, pci_device_t* out) {
+    for (int bus = 0; bus < 256; bus++) {
+        for (int device = 0; device < 32; device++) {
+            int functions = 1;
+
+            for (int function = 0; function < functions; function++) {
+                uint32_t id = pci_read32(bus, device, function, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    continue;
+                }
+                if (function == 0 && (pci_read32(bus, device, 0, PCI_HEADER_TYPE) & 0x00800000)) {
+                    functions = 8;
+                }
+
+                fill_device(bus, device, function, id, out);
+                if (out->class_code == class_code && out->subclass == subclass &&
+                    out->prog_if == prog_if && index-- == 0) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+uint32_t pci_bar(const pci_device_t* dev, int bar) {
+    return pci_read32(dev->bus, dev->device, dev->function, PCI_BAR0 + bar * 4);
+}
+
+void pci_enable_dma(const pci_device_t* dev) {
+    uint32_t command = pci_read32(dev->bus, dev->device, dev->function, PCI_COMMAND);
+
+    command |= PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    command &= ~PCI_COMMAND_INTX_OFF;
+    command &= 0xFFFF;      // Writing the status half would clear its error bits
+    pci_write32(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+}
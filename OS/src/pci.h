@@ -0,0 +1,43 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "libc/libc.h"
+
+// PCI configuration space through the legacy 0xCF8/0xCFC mechanism
+
+#define PCI_VENDOR_ID      0x00
+#define PCI_COMMAND        0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+#define PCI_COMMAND_INTX_OFF    0x0400
+
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t irq_line;       /* 0xFF when firmware routed none */
+} pci_device_t;
+
+uint32_t pci_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+void pci_write32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+
+// Find the `index`th function with this class; returns -1 if there is none
+int pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if, int index, pci_device_t* out);
+
+uint32_t pci_bar(const pci_device_t* dev, int bar);
+
+// Turn on memory decoding and bus mastering and let INTx through
+void pci_enable_dma(const pci_device_t* dev);
+
+#endif /* PCI_H */
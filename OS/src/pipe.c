@@ -0,0 +1,339 @@
+#include "pipe.h"
+#include "shell.h"
+#include "tsc.h"
+
+#ifdef __x86_64__
+#include "paging.h"
+#endif
+
+#define YES_LINE_MAX 256
+#define COUNT_DEFAULT_MIB 64     /* `yes` never stops, so count always does */
+
+pipe_stats_t pipe_stats;
+
+static pipe_t pipes[PIPE_MAX];
+static pipe_page_t pool[PIPE_POOL_PAGES];
+static pipe_page_t* free_pages = NULL;
+static int pool_ready = 0;
+static wait_queue_t pool_wait;
+
+#ifndef __x86_64__
+static uint8_t page_pool[PIPE_POOL_PAGES][PIPE_PAGE_SIZE] __attribute__((aligned(4096)));
+#endif
+
+static void pool_init(void) {
+    for (int i = PIPE_POOL_PAGES - 1; i >= 0; i--) {
+#ifndef __x86_64__
+        pool[i].data = page_pool[i];
+#endif
+        pool[i].next_free = free_pages;
+        free_pages = &pool[i];
+    }
+    pool_ready = 1;
+}
+
+pipe_page_t* pipe_page_alloc(void) {
+    if (!pool_ready) {
+        pool_init();
+    }
+    while (!free_pages) {
+        wait_queue_sleep(&pool_wait);
+    }
+
+    pipe_page_t* page = free_pages;
+#ifdef __x86_64__
+    // Frames are taken on first use and kept
+    if (!page->data) {
+        uint64_t phys = frame_alloc();
+        if (!phys) {
+            return NULL;
+        }
+        page->data = phys_to_virt(phys);
+    }
+#endif
+    free_pages = page->next_free;
+    page->refs = 1;
+    return page;
+}
+
+void pipe_page_get(pipe_page_t* page) {
+    page->refs++;
+}
+
+void pipe_page_put(pipe_page_t* page) {
+    if (--page->refs == 0) {
+        page->next_free = free_pages;
+        free_pages = page;
+        wait_queue_wake(&pool_wait);
+    }
+}
+
+pipe_t* pipe_create(void) {
+    for (int i = 0; i < PIPE_MAX; i++) {
+        pipe_t* pipe = &pipes[i];
+        if (!pipe->reader_open && !pipe->writer_open) {
+            memset(pipe, 0, sizeof(*pipe));
+            pipe->reader_open = 1;
+            pipe->writer_open = 1;
+            return pipe;
+        }
+    }
+    return NULL;
+}
+
+static pipe_slot_t* slot_at(pipe_t* pipe, uint32_t i) {
+    return &pipe->ring[(pipe->head + i) % PIPE_RING];
+}
+
+// Drop the first slot, waking a writer waiting for room
+static void pop_slot(pipe_t* pipe) {
+    pipe->head = (pipe->head + 1) % PIPE_RING;
+    pipe->count--;
+    wait_queue_wake(&pipe->write_wait);
+}
+
+void pipe_close_read(pipe_t* pipe) {
+    while (pipe->count) {
+        pipe_page_put(slot_at(pipe, 0)->page);
+        pop_slot(pipe);
+    }
+    pipe->reader_open = 0;
+    wait_queue_wake(&pipe->write_wait);
+}
+
+void pipe_close_write(pipe_t* pipe) {
+    pipe->writer_open = 0;
+    wait_queue_wake(&pipe->read_wait);
+}
+
+// The reader of our output has gone. There are no signals to stop the
+// writer as SIGPIPE would, so close its input instead: a filter then
+// sees end of file at its next read and exits, and so on up the line.
+static void broken_pipe(pipe_t* pipe) {
+    thread_t* self = sched_current();
+
+    if (self->out == pipe && self->in) {
+        pipe_close_read(self->in);
+        self->in = NULL;
+    }
+}
+
+// Wait for a free slot. 0 once there is one, -1 if the reader has gone.
+static int wait_for_room(pipe_t* pipe) {
+    while (pipe->reader_open && pipe->count == PIPE_RING) {
+        pipe_stats.writer_sleeps++;
+        wait_queue_sleep(&pipe->write_wait);
+    }
+    if (!pipe->reader_open) {
+        broken_pipe(pipe);
+        return -1;
+    }
+    return 0;
+}
+
+// Wait for data. 0 once there is some, -1 at end of file or once our own
+// read end has been closed.
+static int wait_for_data(pipe_t* pipe) {
+    while (pipe->reader_open && pipe->writer_open && pipe->count == 0) {
+        pipe_stats.reader_sleeps++;
+        wait_queue_sleep(&pipe->read_wait);
+    }
+    return pipe->reader_open && pipe->count ? 0 : -1;
+}
+
+int pipe_write(pipe_t* pipe, const void* buf, uint32_t len) {
+    const uint8_t* from = buf;
+    uint32_t written = 0;
+
+    while (written < len) {
+        pipe_slot_t* tail = pipe->count ? slot_at(pipe, pipe->count - 1) : NULL;
+        uint32_t end = tail ? tail->offset + tail->len : PIPE_PAGE_SIZE;
+
+        if (!pipe->reader_open) {
+            broken_pipe(pipe);
+            break;
+        }
+        if (!tail || tail->spliced || end == PIPE_PAGE_SIZE) {
+            if (wait_for_room(pipe) < 0) {
+                break;
+            }
+            pipe_page_t* page = pipe_page_alloc();
+            if (!page) {
+                break;
+            }
+            // The reader may have closed while we slept for the page
+            if (!pipe->reader_open) {
+                pipe_page_put(page);
+                broken_pipe(pipe);
+                break;
+            }
+            tail = slot_at(pipe, pipe->count++);
+            tail->page = page;
+            tail->offset = 0;
+            tail->len = 0;
+            tail->spliced = 0;
+            end = 0;
+        }
+
+        uint32_t chunk = PIPE_PAGE_SIZE - end;
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+        memcpy(tail->page->data + end, from + written, chunk);
+        tail->len += chunk;
+        written += chunk;
+        wait_queue_wake(&pipe->read_wait);
+    }
+
+    pipe_stats.copied += written;
+    return written || len == 0 ? (int)written : -1;
+}
+
+int pipe_splice(pipe_t* pipe, pipe_page_t* page, uint32_t offset, uint32_t len) {
+    if (wait_for_room(pipe) < 0) {
+        return -1;
+    }
+
+    pipe_slot_t* slot = slot_at(pipe, pipe->count++);
+    pipe_page_get(page);
+    slot->page = page;
+    slot->offset = offset;
+    slot->len = len;
+    slot->spliced = 1;
+    pipe_stats.spliced += len;
+    wait_queue_wake(&pipe->read_wait);
+    return 0;
+}
+
+int pipe_read(pipe_t* pipe, void* buf, uint32_t len) {
+    uint8_t* to = buf;
+    uint32_t done = 0;
+
+    if (len == 0 || wait_for_data(pipe) < 0) {
+        return 0;
+    }
+    while (done < len && pipe->count) {
+        pipe_slot_t* slot = slot_at(pipe, 0);
+        uint32_t chunk = slot->len < len - done ? slot->len : len - done;
+
+        memcpy(to + done, slot->page->data + slot->offset, chunk);
+        slot->offset += chunk;
+        slot->len -= chunk;
+        done += chunk;
+        if (slot->len == 0) {
+            pipe_page_put(slot->page);
+            pop_slot(pipe);
+        }
+    }
+    return (int)done;
+}
+
+pipe_page_t* pipe_take(pipe_t* pipe, uint32_t* offset, uint32_t* len) {
+    if (wait_for_data(pipe) < 0) {
+        return NULL;
+    }
+
+    pipe_slot_t* slot = slot_at(pipe, 0);
+    pipe_page_t* page = slot->page;
+    *offset = slot->offset;
+    *len = slot->len;
+    pop_slot(pipe);
+    return page;
+}
+
+// The text, repeated to fill one page, handed to the pipe over and over
+// without a copy until the reader exits
+static int yes_command(int argc, char** argv) {
+    pipe_t* out = sched_current()->out;
+    char line[YES_LINE_MAX];
+    uint32_t len = 0;
+
+    if (!out) {
+        puts("yes: output is not a pipe");
+        return -1;
+    }
+    if (argc < 2) {
+        line[len++] = 'y';
+    }
+    for (int i = 1; i < argc; i++) {
+        uint32_t word = strlen(argv[i]);
+        if (len + word + 2 > sizeof(line)) {
+            puts("yes: text too long");
+            return -1;
+        }
+        if (i > 1) {
+            line[len++] = ' ';
+        }
+        memcpy(line + len, argv[i], word);
+        len += word;
+    }
+    line[len++] = '\n';
+
+    pipe_page_t* page = pipe_page_alloc();
+    if (!page) {
+        puts("yes: out of memory");
+        return -1;
+    }
+    uint32_t bytes = 0;
+    while (bytes + len <= PIPE_PAGE_SIZE) {
+        memcpy(page->data + bytes, line, len);
+        bytes += len;
+    }
+    while (pipe_splice(out, page, 0, bytes) == 0) {
+    }
+    pipe_page_put(page);
+    return 0;
+}
+
+// Drain the first `mib` MiB of standard input, or all of it if it ends
+// sooner, and report the time per slot taken. Only input that was all
+// copied gets a byte rate: a spliced page is handed over by reference,
+// so bytes per second would count references, not data moved.
+static int count_command(int argc, char** argv) {
+    pipe_t* in = sched_current()->in;
+    int mib = argc > 1 ? atoi(argv[1]) : COUNT_DEFAULT_MIB;
+    uint64_t limit = (uint64_t)mib << 20;
+    uint64_t bytes = 0;
+    uint32_t slots = 0;
+    pipe_stats_t before = pipe_stats;
+    uint32_t switches = sched_stats.switches;
+    pipe_page_t* page;
+    uint32_t offset, len;
+
+    if (!in) {
+        puts("count: input is not a pipe");
+        return -1;
+    }
+    if (mib <= 0) {
+        printf("count: bad size %s\n", argv[1]);
+        return -1;
+    }
+
+    uint64_t start = tsc_read();
+    while (bytes < limit && (page = pipe_take(in, &offset, &len))) {
+        bytes += len;
+        slots++;
+        pipe_page_put(page);
+    }
+    uint64_t us = tsc_to_us(tsc_read() - start);
+    uint32_t spliced_kib = (uint32_t)((pipe_stats.spliced - before.spliced) >> 10);
+
+    printf("%u KiB in %u slots", (unsigned int)(bytes >> 10), slots);
+    if (us && slots) {
+        printf(", %u us, %u ns per slot", (unsigned int)us, (unsigned int)udiv64(us * 1000, slots));
+        if (pipe_stats.spliced == before.spliced) {
+            // Bytes per microsecond are MB/s
+            uint32_t mb_s = (uint32_t)udiv64(bytes, us > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)us);
+            printf(", %u MB/s copied", (unsigned int)mb_s);
+        }
+    }
+    printf("\n");
+    printf("  %u KiB passed as pages, %u KiB copied, %u context switches\n", spliced_kib,
+           (unsigned int)((pipe_stats.copied - before.copied) >> 10), sched_stats.switches - switches);
+    return 0;
+}
+
+SHELL_COMMAND(yes_cmd, "yes", "[text]", "Write a line over and over into a pipe", 0, SHELL_MAX_ARGS - 1,
+              yes_command);
+SHELL_COMMAND(count_cmd, "count", "[mib]", "Drain the first mib MiB piped in (default 64) and time it",
+              0, 1, count_command);
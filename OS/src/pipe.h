@@ -0,0 +1,97 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "libc/libc.h"
+#include "sched.h"
+
+/*
+ * Pipes between kernel threads.
+ *
+ * A pipe is a ring of PIPE_RING slots, each a run of bytes in a
+ * page-sized buffer. pipe_write() copies into the last slot's page while
+ * it has room and then starts a new page. pipe_splice() instead hands a
+ * reference to a page the writer filled itself: the reader sees the same
+ * memory, nothing is copied, and the writer must leave the page alone
+ * until every reference is dropped. On the read side pipe_read() copies
+ * out, and pipe_take() passes the slot's page reference on to the reader.
+ *
+ * Only kernel code that owns a pipe page can splice. A user program's
+ * write() goes through pipe_write() and is copied, however large and
+ * well aligned it is: user frames carry no reference count, so the pipe
+ * could not hold one past the writer's next store or exit.
+ *
+ * A full pipe puts its writer to sleep and an empty one its reader (see
+ * sched.h); each wakes the other. Reading after the write end closes
+ * drains what is left and then returns end of file. Writing after the
+ * read end closes fails, and closes the writer's own input as well, so
+ * a filter in the middle of a pipeline stops when its reader does.
+ *
+ * Pages come from a shared pool of PIPE_POOL_PAGES, backed by page
+ * frames on the 64-bit kernel and a static array on the 32-bit one.
+ */
+
+#define PIPE_PAGE_SIZE   4096
+#define PIPE_RING        16
+#define PIPE_MAX         8
+#define PIPE_POOL_PAGES  64
+
+typedef struct pipe_page {
+    uint8_t* data;
+    int refs;
+    struct pipe_page* next_free;
+} pipe_page_t;
+
+typedef struct {
+    pipe_page_t* page;
+    uint32_t offset;
+    uint32_t len;
+    int spliced;                /* Not ours to append to */
+} pipe_slot_t;
+
+typedef struct pipe {
+    pipe_slot_t ring[PIPE_RING];
+    uint32_t head;
+    uint32_t count;
+    int reader_open;
+    int writer_open;
+    wait_queue_t read_wait;
+    wait_queue_t write_wait;
+} pipe_t;
+
+typedef struct {
+    uint64_t copied;            /* Bytes through pipe_write() */
+    uint64_t spliced;           /* Bytes handed over as pages */
+    uint32_t reader_sleeps;
+    uint32_t writer_sleeps;
+} pipe_stats_t;
+
+extern pipe_stats_t pipe_stats;
+
+// Both ends open. NULL if PIPE_MAX pipes are in use.
+pipe_t* pipe_create(void);
+
+// The pipe is freed once both ends are closed
+void pipe_close_read(pipe_t* pipe);
+void pipe_close_write(pipe_t* pipe);
+
+// Bytes written, or -1 if the read end closed before any were
+int pipe_write(pipe_t* pipe, const void* buf, uint32_t len);
+
+// Queue [offset, offset + len) of `page`, taking a reference. -1 if the
+// read end is closed.
+int pipe_splice(pipe_t* pipe, pipe_page_t* page, uint32_t offset, uint32_t len);
+
+// Bytes read, waiting for at least one; 0 at end of file
+int pipe_read(pipe_t* pipe, void* buf, uint32_t len);
+
+// The next slot's page, with its reference; release it with
+// pipe_page_put(). NULL at end of file.
+pipe_page_t* pipe_take(pipe_t* pipe, uint32_t* offset, uint32_t* len);
+
+// A page with one reference, waiting for one to come free if need be.
+// NULL if no memory can back it.
+pipe_page_t* pipe_page_alloc(void);
+void pipe_page_get(pipe_page_t* page);
+void pipe_page_put(pipe_page_t* page);
+
+#endif /* PIPE_H */
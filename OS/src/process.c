@@ -0,0 +1,539 @@
+#include "process.h"
+#include "fat.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "shell.h"
+#include "syscall.h"
+#include "tsc.h"
+
+#ifdef __x86_64__
+#include "paging.h"
+#include "vma.h"
+#endif
+
+// Minimal ELF definitions for static executables of the kernel's own class
+#define ELF_MAGIC      0x464C457F  // "\x7fELF"
+#define ET_EXEC        2
+#define PT_LOAD        1
+#define PF_X           1
+#define PF_W           2
+#define PF_R           4
+#define ELF_MAX_PHDRS  16
+
+// Page-fault error code bits
+#define PF_ERROR_WRITE 0x02
+#define PF_ERROR_FETCH 0x10
+
+#ifdef __x86_64__
+#define ELF_CLASS      2
+#define ELF_MACHINE    62          // EM_X86_64
+
+typedef struct {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint64_t e_entry;
+    uint64_t e_phoff;
+    uint64_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} elf_ehdr_t;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_flags;
+    uint64_t p_offset;
+    uint64_t p_vaddr;
+    uint64_t p_paddr;
+    uint64_t p_filesz;
+    uint64_t p_memsz;
+    uint64_t p_align;
+} elf_phdr_t;
+#else
+#define ELF_CLASS      1
+#define ELF_MACHINE    3           // EM_386
+
+typedef struct {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} elf_ehdr_t;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} elf_phdr_t;
+#endif
+
+#define USER_PAGE_SIZE     0x1000
+#define KERNEL_STACK_SIZE  16384
+#define BENCH_CALLS        10000   // Also in syscall64.asm and syscall32.asm
+
+typedef struct {
+    const char* name;
+    int pid;
+    int running;
+    fat_file_t file;            // Open while the process runs; its pages map in on demand
+    int file_open;
+#ifdef __x86_64__
+    vm_t vm;
+#endif
+} process_t;
+
+static process_t current;
+static int next_pid = 1;
+static uint8_t kernel_stack[KERNEL_STACK_SIZE] __attribute__((aligned(16)));
+
+// Kernel stack pointer at process_enter(), where process_return() resumes
+uintptr_t process_saved_sp = 0;
+
+// Enter ring 3 at `entry` with the stack at `sp`. Returns the value
+// passed to process_return(). Callee-saved registers are kept on the
+// kernel stack; the user starts with every other register cleared.
+// Both are in syscall64.asm, or syscall32.asm for the i386 kernel.
+int process_enter(uintptr_t entry, uintptr_t sp);
+void process_return(int code) __attribute__((noreturn));
+
+// User code of the null system call benchmark, next to process_enter()
+extern const uint8_t null_bench_start[];
+extern const uint8_t null_bench_end[];
+
+#ifdef __x86_64__
+static uint32_t vm_prot(uint32_t flags) {
+    return VM_READ | ((flags & PF_W) ? VM_WRITE : 0) | ((flags & PF_X) ? VM_EXEC : 0);
+}
+
+// User pages are not mapped in the kernel's own view; reach them
+// through the direct map, a page at a time. Faulting the page in first
+// gives the kernel a private copy it may write, whatever the area's
+// protection.
+static void* user_ptr(uintptr_t virt) {
+    if (vm_fault(&current.vm, virt, VM_WRITE | VM_FORCE) < 0) {
+        return NULL;
+    }
+    return phys_to_virt(paging_translate(&current.vm.space, virt));
+}
+
+// An anonymous area over [start, end), zero until touched
+static int map_user(uintptr_t start, uintptr_t end, uint32_t prot) {
+    start &= ~(uintptr_t)(USER_PAGE_SIZE - 1);
+    end = (end + USER_PAGE_SIZE - 1) & ~(uintptr_t)(USER_PAGE_SIZE - 1);
+    return vm_map(&current.vm, start, end, vm_prot(prot), 0, start);
+}
+#else
+static void* user_ptr(uintptr_t virt) {
+    return (void*)virt;
+}
+
+static int map_user(uintptr_t start, uintptr_t end, uint32_t prot) {
+    (void)start;
+    (void)end;
+    (void)prot;
+    return 0;
+}
+#endif
+
+// Copy `len` bytes to user memory, or zero it if `src` is NULL
+static int fill_user(uintptr_t virt, const void* src, uintptr_t len) {
+    const uint8_t* from = src;
+
+    while (len) {
+        uintptr_t chunk = USER_PAGE_SIZE - (virt & (USER_PAGE_SIZE - 1));
+        void* to = user_ptr(virt);
+
+        if (!to) {
+            return -1;
+        }
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (from) {
+            memcpy(to, from, chunk);
+            from += chunk;
+        } else {
+            memset(to, 0, chunk);
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+#ifdef __x86_64__
+// Nothing is read yet: the segment becomes an area backed by the file,
+// and its pages come in through the page cache as they are touched.
+// That needs the file offset and address to agree modulo the page size,
+// which any linker's default layout gives.
+static const char* load_segment(const elf_phdr_t* phdr) {
+    uintptr_t vaddr = (uintptr_t)phdr->p_vaddr;
+    uintptr_t start = vaddr & ~(uintptr_t)(USER_PAGE_SIZE - 1);
+    uintptr_t end = (vaddr + (uintptr_t)phdr->p_memsz + USER_PAGE_SIZE - 1) &
+                    ~(uintptr_t)(USER_PAGE_SIZE - 1);
+
+    if ((phdr->p_offset & (USER_PAGE_SIZE - 1)) != (vaddr & (USER_PAGE_SIZE - 1))) {
+        return "segment not page-aligned in the file";
+    }
+    if (vm_map(&current.vm, start, end, vm_prot(phdr->p_flags), phdr->p_offset - (vaddr - start),
+               vaddr + (uintptr_t)phdr->p_filesz) < 0) {
+        return "overlapping segments";
+    }
+    return NULL;
+}
+#else
+static int read_user(fat_file_t* file, uintptr_t virt, uintptr_t len) {
+    while (len) {
+        uintptr_t chunk = USER_PAGE_SIZE - (virt & (USER_PAGE_SIZE - 1));
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (fat_read(file, user_ptr(virt), (uint32_t)chunk) != (int64_t)chunk) {
+            return -1;
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Without paging there is nothing to fault on: read the segment now
+static const char* load_segment(const elf_phdr_t* phdr) {
+    uintptr_t vaddr = (uintptr_t)phdr->p_vaddr;
+
+    if (fat_seek(&current.file, (uint32_t)phdr->p_offset) < 0 ||
+        read_user(&current.file, vaddr, (uintptr_t)phdr->p_filesz) < 0) {
+        return "truncated segment";
+    }
+    fill_user(vaddr + (uintptr_t)phdr->p_filesz, NULL, (uintptr_t)(phdr->p_memsz - phdr->p_filesz));
+    return NULL;
+}
+#endif
+
+static int in_user_range(uintptr_t start, uintptr_t len, uintptr_t top) {
+    return start >= USER_BASE && start <= top && len <= top - start;
+}
+
+// Returns NULL, or why the file cannot run
+static const char* load_elf(fat_file_t* file, uintptr_t* entry) {
+    elf_ehdr_t header;
+    elf_phdr_t phdrs[ELF_MAX_PHDRS];
+    int segments = 0;
+
+    if (fat_read(file, &header, sizeof(header)) != sizeof(header) ||
+        *(uint32_t*)header.e_ident != ELF_MAGIC || header.e_ident[4] != ELF_CLASS ||
+        header.e_machine != ELF_MACHINE || header.e_type != ET_EXEC ||
+        header.e_phentsize != sizeof(elf_phdr_t)) {
+        return "not a static executable for this kernel";
+    }
+    if (header.e_phnum > ELF_MAX_PHDRS) {
+        return "too many program headers";
+    }
+
+    uint32_t phdr_bytes = header.e_phnum * sizeof(elf_phdr_t);
+    if (fat_seek(file, (uint32_t)header.e_phoff) < 0 ||
+        fat_read(file, phdrs, phdr_bytes) != (int64_t)phdr_bytes) {
+        return "truncated program headers";
+    }
+
+    for (int i = 0; i < header.e_phnum; i++) {
+        elf_phdr_t* phdr = &phdrs[i];
+        uintptr_t vaddr = (uintptr_t)phdr->p_vaddr;
+
+        if (phdr->p_type != PT_LOAD) {
+            continue;
+        }
+        if (phdr->p_filesz > phdr->p_memsz ||
+            !in_user_range(vaddr, (uintptr_t)phdr->p_memsz, USER_TOP)) {
+            return "segment outside user memory";
+        }
+        const char* error = load_segment(phdr);
+        if (error) {
+            return error;
+        }
+        segments++;
+    }
+
+    if (segments == 0) {
+        return "no loadable segments";
+    }
+    if (!in_user_range((uintptr_t)header.e_entry, 0, USER_TOP)) {
+        return "entry point outside user memory";
+    }
+    *entry = (uintptr_t)header.e_entry;
+    return NULL;
+}
+
+// argc, argv, an empty environment and the auxiliary vector, with the
+// strings above them. Returns the initial stack pointer, or 0 if the
+// stack cannot be backed.
+static uintptr_t build_stack(int argc, char** argv) {
+    uintptr_t words[1 + SHELL_MAX_ARGS + 2 + 6];
+    uintptr_t sp = USER_STACK_TOP;
+    int n = 0;
+
+    words[n++] = argc;
+    for (int i = 0; i < argc; i++) {
+        uintptr_t len = strlen(argv[i]) + 1;
+        sp -= len;
+        if (fill_user(sp, argv[i], len) < 0) {
+            return 0;
+        }
+        words[n++] = sp;
+    }
+    words[n++] = 0;             // End of argv
+    words[n++] = 0;             // End of envp
+    words[n++] = AT_SYSINFO_EHDR;
+#ifdef __x86_64__
+    words[n++] = VDSO_BASE;
+#else
+    words[n++] = (uintptr_t)vdso_data;
+#endif
+    words[n++] = AT_PAGESZ;
+    words[n++] = USER_PAGE_SIZE;
+    words[n++] = AT_NULL;
+    words[n++] = 0;
+
+    // The ABI wants the stack 16-byte aligned at the entry point
+    sp = (sp - n * sizeof(uintptr_t)) & ~(uintptr_t)15;
+    if (fill_user(sp, words, n * sizeof(uintptr_t)) < 0) {
+        return 0;
+    }
+    return sp;
+}
+
+static void process_destroy(void) {
+#ifdef __x86_64__
+    vm_destroy(&current.vm);
+#endif
+    if (current.file_open) {
+        fat_close(&current.file);
+        current.file_open = 0;
+    }
+    vdso_data->pid = 0;
+    current.name = NULL;
+}
+
+// The file, if any, is current.file, already open
+static int process_create(const char* name) {
+#ifdef __x86_64__
+    if (vm_create(&current.vm, current.file_open ? &current.file : NULL) < 0) {
+        return -1;
+    }
+    // The vDSO page is the kernel's: PTE_SHARED keeps it from being freed
+    uint64_t vdso_phys = paging_translate(&kernel_space, (uintptr_t)vdso_data);
+    if (paging_map(&current.vm.space, VDSO_BASE, vdso_phys, PTE_USER | PTE_NX | PTE_SHARED) < 0 ||
+        map_user(USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP, PF_R | PF_W) < 0) {
+        vm_destroy(&current.vm);
+        return -1;
+    }
+#endif
+    current.name = name;
+    current.pid = next_pid++;
+    vdso_data->pid = current.pid;
+    return 0;
+}
+
+static int process_start(uintptr_t entry, int argc, char** argv) {
+    uintptr_t sp = build_stack(argc, argv);
+    int code;
+
+    if (!sp) {
+        printf("%s: out of memory\n", current.name);
+        process_destroy();
+        return PROCESS_KILLED;
+    }
+#ifdef __x86_64__
+    address_space_switch(&current.vm.space);
+#endif
+    current.running = 1;
+    code = process_enter(entry, sp);
+    current.running = 0;
+    irq_enable();               // A fault comes back with interrupts off
+#ifdef __x86_64__
+    address_space_switch(&kernel_space);
+#endif
+
+    process_destroy();
+    return code;
+}
+
+int process_run(const char* path, int argc, char** argv, int* code) {
+    uintptr_t entry = 0;
+    const char* error;
+
+    if (argc > SHELL_MAX_ARGS) {
+        printf("run: too many arguments\n");
+        return -1;
+    }
+    // One kernel stack, one process: a pipeline may hold only one
+    if (current.name) {
+        printf("run: %s is already running\n", current.name);
+        return -1;
+    }
+    if (fat_open(path, "r", &current.file) < 0) {
+        printf("run: %s: not found\n", path);
+        return -1;
+    }
+    current.file_open = 1;
+    if (process_create(path) < 0) {
+        fat_close(&current.file);
+        current.file_open = 0;
+        printf("run: out of memory\n");
+        return -1;
+    }
+    error = load_elf(&current.file, &entry);
+    if (error) {
+        printf("run: %s: %s\n", path, error);
+        process_destroy();
+        return -1;
+    }
+    *code = process_start(entry, argc, argv);
+    return 0;
+}
+
+void process_exit(int code) {
+    process_return(code);
+}
+
+int process_check_buffer(uintptr_t addr, uintptr_t len, int write) {
+    if (!current.running || !in_user_range(addr, len, USER_STACK_TOP)) {
+        return -1;
+    }
+#ifdef __x86_64__
+    // Fault the pages in now, so the kernel never takes the fault itself
+    for (uintptr_t page = addr & ~(USER_PAGE_SIZE - 1); page < addr + len; page += USER_PAGE_SIZE) {
+        if (vm_fault(&current.vm, page, write ? VM_WRITE : VM_READ) < 0) {
+            return -1;
+        }
+    }
+#else
+    (void)write;
+#endif
+    return 0;
+}
+
+static const char* fault_name(int vector) {
+    switch (vector) {
+    case FAULT_DIVIDE:     return "divide error";
+    case FAULT_INVALID_OP: return "invalid opcode";
+    case FAULT_STACK:      return "stack fault";
+    case FAULT_PROTECTION: return "general protection fault";
+    case FAULT_PAGE:       return "page fault";
+    default:               return "exception";
+    }
+}
+
+// Addresses are printed as their low 32 bits; printf has no 64-bit format
+static void process_fault(int vector, uintptr_t error, uintptr_t ip, int user) {
+    uintptr_t address = 0;
+
+    if (vector == FAULT_PAGE) {
+        __asm__ volatile("mov %%cr2, %0" : "=r"(address));
+    }
+    if (!user || !current.running) {
+        printf("\n%s in the kernel at %x, error %x, address %x\n", fault_name(vector),
+               (unsigned int)ip, (unsigned int)error, (unsigned int)address);
+        return;
+    }
+#ifdef __x86_64__
+    // Demand paging: fill the page in and retry the instruction. Reading
+    // it may wait on the disk, so let interrupts in meanwhile.
+    if (vector == FAULT_PAGE) {
+        uint32_t access = (error & PF_ERROR_WRITE) ? VM_WRITE :
+                          (error & PF_ERROR_FETCH) ? VM_EXEC : VM_READ;
+        irq_enable();
+        int result = vm_fault(&current.vm, address, access);
+        irq_disable();
+        if (result == 0) {
+            return;
+        }
+    }
+#endif
+
+    printf("%s: %s at %x, error %x, address %x\n", current.name, fault_name(vector),
+           (unsigned int)ip, (unsigned int)error, (unsigned int)address);
+    process_return(PROCESS_KILLED);
+}
+
+void process_init(void) {
+    syscall_set_kernel_stack((uintptr_t)(kernel_stack + KERNEL_STACK_SIZE));
+    fault_set_handler(process_fault);
+}
+
+static int run_command(int argc, char** argv) {
+    int code;
+
+    if (process_run(argv[1], argc - 1, argv + 1, &code) < 0) {
+        return -1;
+    }
+    printf("[exit %d]\n", code);
+    return code == 0 ? 0 : -1;
+}
+
+// Cycles for a SYSCALL/SYSRET or SYSENTER/SYSEXIT round trip that
+// does nothing in the kernel, timed from ring 3
+static int syscall_bench_command(int argc, char** argv) {
+    uintptr_t size = null_bench_end - null_bench_start;
+    uint32_t cycles;
+
+    (void)argc;
+    if (current.name) {
+        printf("syscall-bench: %s is already running\n", current.name);
+        return -1;
+    }
+    if (process_create(argv[0]) < 0) {
+        puts("syscall-bench: out of memory");
+        return -1;
+    }
+    if (map_user(USER_BASE, USER_BASE + size, PF_R | PF_X) < 0) {
+        process_destroy();
+        puts("syscall-bench: out of memory");
+        return -1;
+    }
+    fill_user(USER_BASE, null_bench_start, size);
+
+    int code = process_start(USER_BASE, 1, argv);
+    if (code == PROCESS_KILLED) {
+        return -1;
+    }
+    cycles = (uint32_t)code;
+
+#ifdef __x86_64__
+    printf("%u null system calls (SYSCALL/SYSRET):\n", BENCH_CALLS);
+#else
+    printf("%u null system calls (SYSENTER/SYSEXIT):\n", BENCH_CALLS);
+#endif
+    printf("  %u cycles per call", (unsigned int)udiv64(cycles, BENCH_CALLS));
+    if (tsc_khz) {
+        printf(", %u ns", (unsigned int)udiv64(udiv64((uint64_t)cycles * 1000000, tsc_khz), BENCH_CALLS));
+    }
+    printf("\n");
+    return 0;
+}
+
+SHELL_COMMAND(run_cmd, "run", "<path> [args]", "Run an ELF program in user mode",
+              1, SHELL_MAX_ARGS - 1, run_command);
+SHELL_COMMAND(syscall_bench_cmd, "syscall-bench", "", "Measure the cost of an empty system call",
+              0, 0, syscall_bench_command);
@@ -0,0 +1,57 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "libc/libc.h"
+
+/*
+ * User-mode processes loaded from static ELF executables.
+ *
+ * One process runs at a time, in the foreground: process_run() loads
+ * it, drops to ring 3 and returns its exit code once it calls SYS_EXIT
+ * or faults. In a shell pipeline its standard output is the pipe, and
+ * it may sleep in SYS_WRITE while the next command catches up. Each
+ * PT_LOAD segment must lie in [USER_BASE, USER_TOP); link programs at
+ * USER_BASE.
+ *
+ * On x86_64 every process gets its own address space (vma.h). Segments
+ * are mapped with their ELF permissions but read in only as their pages
+ * are touched, data and stack are no-execute, and the vDSO page is
+ * mapped read-only at VDSO_BASE. The executable stays open while the
+ * process runs.
+ *
+ * The i386 kernel runs with paging off, so processes share physical
+ * memory with it between USER_BASE and USER_TOP and are only kept out
+ * of I/O ports; a bad pointer can still corrupt the kernel. Their
+ * segments are read in whole before they start.
+ *
+ * The initial stack has the System V layout described in sysabi.h,
+ * USER_STACK_SIZE bytes below USER_STACK_TOP.
+ */
+
+#define USER_BASE        0x1000000
+#define USER_STACK_SIZE  0x10000
+#ifdef __x86_64__
+#define VDSO_BASE        0x7FFFFFFFF000ULL
+#define USER_STACK_TOP   VDSO_BASE
+#define USER_TOP         (USER_STACK_TOP - USER_STACK_SIZE)
+#else
+#define USER_STACK_TOP   0x2000000
+#define USER_TOP         (USER_STACK_TOP - USER_STACK_SIZE)
+#endif
+
+#define PROCESS_KILLED   (-128)     /* Exit code of a process that faulted */
+
+void process_init(void);
+
+// Load and run `path` with argv[0..argc-1], storing its exit code.
+// Returns -1, after printing why, if the file cannot be loaded.
+int process_run(const char* path, int argc, char** argv, int* code);
+
+// For system calls: leave the running process with `code`
+void process_exit(int code) __attribute__((noreturn));
+
+// 0 if the process may read [addr, addr + len), or write it if `write`
+// is set. The pages are made present, so the kernel can then use them.
+int process_check_buffer(uintptr_t addr, uintptr_t len, int write);
+
+#endif /* PROCESS_H */
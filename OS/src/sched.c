@@ -0,0 +1,190 @@
+#include "sched.h"
+#include "interrupts.h"
+#include "klog.h"
+
+#define THREAD_FREE      0
+#define THREAD_RUNNABLE  1
+#define THREAD_SLEEPING  2
+
+sched_stats_t sched_stats;
+
+static thread_t threads[SCHED_MAX_THREADS + 1];    // [0] is the boot thread
+static uint8_t stacks[SCHED_MAX_THREADS][SCHED_STACK_SIZE] __attribute__((aligned(16)));
+static thread_t* current = &threads[0];             // Valid before sched_init()
+static wait_queue_t run_queue;
+static int next_id = 1;
+
+// Save the flags, the callee-saved registers and the stack pointer in
+// `*save`, then resume whatever was saved in `sp`. Each thread keeps its
+// own interrupt flag: one that sleeps in a system call has it clear.
+void sched_switch(uintptr_t* save, uintptr_t sp);
+
+#define INITIAL_FLAGS 0x202     // IF set
+
+#ifdef __x86_64__
+#define SAVED_REGS 7
+__asm__(".text\n"
+        ".globl sched_switch\n"
+        "sched_switch:\n"
+        "    pushfq\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    popfq\n"
+        "    ret\n");
+#else
+#define SAVED_REGS 5
+__asm__(".text\n"
+        ".globl sched_switch\n"
+        "sched_switch:\n"
+        "    pushfl\n"
+        "    pushl %ebp\n"
+        "    pushl %ebx\n"
+        "    pushl %esi\n"
+        "    pushl %edi\n"
+        "    movl 24(%esp), %eax\n"
+        "    movl %esp, (%eax)\n"
+        "    movl 28(%esp), %esp\n"
+        "    popl %edi\n"
+        "    popl %esi\n"
+        "    popl %ebx\n"
+        "    popl %ebp\n"
+        "    popfl\n"
+        "    ret\n");
+#endif
+
+static void enqueue(wait_queue_t* queue, thread_t* thread) {
+    thread->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = thread;
+    } else {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+}
+
+static thread_t* dequeue(wait_queue_t* queue) {
+    thread_t* thread = queue->head;
+
+    if (thread) {
+        queue->head = thread->next;
+        if (!queue->head) {
+            queue->tail = NULL;
+        }
+    }
+    return thread;
+}
+
+// Switch to the next runnable thread. The caller has already queued the
+// current one wherever it belongs.
+static void schedule(void) {
+    thread_t* next = dequeue(&run_queue);
+
+    if (!next) {
+        // Nothing can wake a thread but another thread
+        klog(KLOG_ERR, "sched: every thread is asleep");
+        while (1) {
+            __asm__ volatile("cli; hlt");
+        }
+    }
+    if (next == current) {
+        return;
+    }
+
+    thread_t* prev = current;
+    current = next;
+    sched_stats.switches++;
+    sched_switch(&prev->sp, next->sp);
+}
+
+void sched_init(void) {
+    memset(threads, 0, sizeof(threads));
+    memset(&run_queue, 0, sizeof(run_queue));
+    memset(&sched_stats, 0, sizeof(sched_stats));
+    threads[0].state = THREAD_RUNNABLE;
+    current = &threads[0];
+    next_id = 1;
+}
+
+thread_t* sched_current(void) {
+    return current;
+}
+
+static void thread_start(void) {
+    current->entry(current->arg);
+    thread_exit();
+}
+
+thread_t* thread_create(void (*entry)(void* arg), void* arg) {
+    for (int i = 1; i <= SCHED_MAX_THREADS; i++) {
+        thread_t* thread = &threads[i];
+        if (thread->state != THREAD_FREE) {
+            continue;
+        }
+
+        // The first switch pops zeroed registers and the flags, and
+        // returns into thread_start(), which finds a fake return address
+        // above it where a call would have left one
+        uintptr_t* top = (uintptr_t*)(stacks[i - 1] + SCHED_STACK_SIZE);
+        uintptr_t* sp = top - 2 - SAVED_REGS;
+        memset(sp, 0, (2 + SAVED_REGS) * sizeof(uintptr_t));
+        top[-2] = (uintptr_t)thread_start;
+        top[-3] = INITIAL_FLAGS;
+
+        thread->sp = (uintptr_t)sp;
+        thread->state = THREAD_RUNNABLE;
+        thread->id = next_id++;
+        thread->entry = entry;
+        thread->arg = arg;
+        thread->stack = stacks[i - 1];
+        thread->in = current->in;
+        thread->out = current->out;
+        enqueue(&run_queue, thread);
+        sched_stats.created++;
+        return thread;
+    }
+    return NULL;
+}
+
+void thread_exit(void) {
+    // The stack stays in use until the switch; nothing runs in between
+    // that could hand it out again
+    current->state = THREAD_FREE;
+    schedule();
+    while (1) {
+    }
+}
+
+void sched_yield(void) {
+    if (run_queue.head) {
+        enqueue(&run_queue, current);
+        schedule();
+    }
+}
+
+void wait_queue_sleep(wait_queue_t* queue) {
+    current->state = THREAD_SLEEPING;
+    enqueue(queue, current);
+    sched_stats.sleeps++;
+    schedule();
+}
+
+void wait_queue_wake(wait_queue_t* queue) {
+    thread_t* thread;
+
+    while ((thread = dequeue(queue))) {
+        thread->state = THREAD_RUNNABLE;
+        enqueue(&run_queue, thread);
+    }
+}
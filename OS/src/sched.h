@@ -0,0 +1,75 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "libc/libc.h"
+
+/*
+ * Cooperative kernel threads.
+ *
+ * The shell runs on the boot thread. thread_create() starts another on a
+ * stack from a fixed pool; it runs when the current thread blocks,
+ * yields or exits. There is no preemption and one CPU, so a thread owns
+ * the machine between those points and needs no locks against other
+ * threads. Interrupt handlers must not touch wait queues.
+ *
+ * A thread waits for a condition with
+ *
+ *     while (!condition) {
+ *         wait_queue_sleep(&queue);
+ *     }
+ *
+ * and whoever makes it true calls wait_queue_wake(). The run queue is
+ * FIFO, so woken threads run in the order they were woken.
+ *
+ * Each thread has its own standard input and output (pipe.h). NULL means
+ * the keyboard and the console.
+ */
+
+#define SCHED_MAX_THREADS  8
+#define SCHED_STACK_SIZE   16384
+
+struct pipe;
+
+typedef struct thread {
+    uintptr_t sp;               /* Saved while switched out */
+    int state;
+    int id;
+    void (*entry)(void* arg);
+    void* arg;
+    uint8_t* stack;             /* NULL for the boot thread */
+    struct pipe* in;
+    struct pipe* out;
+    struct thread* next;        /* On the run queue or a wait queue */
+} thread_t;
+
+typedef struct {
+    thread_t* head;
+    thread_t* tail;
+} wait_queue_t;
+
+typedef struct {
+    uint32_t switches;
+    uint32_t sleeps;
+    uint32_t created;
+} sched_stats_t;
+
+extern sched_stats_t sched_stats;
+
+void sched_init(void);
+
+thread_t* sched_current(void);
+
+// Start `entry(arg)` on a new thread with the creator's input and output.
+// It runs once the creator blocks or yields. NULL if every stack is taken.
+thread_t* thread_create(void (*entry)(void* arg), void* arg);
+
+// Returning from the entry function does the same
+void thread_exit(void) __attribute__((noreturn));
+
+// Let every other runnable thread run once
+void sched_yield(void);
+
+void wait_queue_sleep(wait_queue_t* queue);
+void wait_queue_wake(wait_queue_t* queue);      // Every sleeper
+
+#endif /* SCHED_H */
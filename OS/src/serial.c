@@ -0,0 +1,216 @@
+#include "serial.h"
+#include "interrupts.h"
+#include "io.h"
+#include "lock.h"
+
+// Register offsets from the base port
+#define UART_DATA    0              // RBR/THR, divisor low with DLAB
+#define UART_IER     1              // Divisor high with DLAB
+#define UART_IIR     2              // FCR on write
+#define UART_LCR     3
+#define UART_MCR     4
+#define UART_LSR     5
+#define UART_MSR     6
+
+#define IER_RX       0x01
+#define IER_TX       0x02
+#define IIR_NONE     0x01           // No interrupt pending
+#define FCR_ENABLE   0xC7           // Enable and clear both FIFOs, RX trigger at 14 bytes
+#define LCR_DLAB     0x80
+#define LCR_8N1      0x03
+#define MCR_RUN      0x0B           // DTR, RTS, OUT2 (gates INTR onto the ISA line)
+#define MCR_LOOPBACK 0x1E
+#define LSR_DATA     0x01
+#define LSR_THRE     0x20
+
+#define FIFO_DEPTH   16
+#define DIVISOR      1              // 115200 baud
+
+#define TX_MASK      (SERIAL_TX_RING - 1)
+#define RX_MASK      (SERIAL_RX_RING - 1)
+
+static char tx_ring[SERIAL_TX_RING];
+static char rx_ring[SERIAL_RX_RING];
+
+// Free-running indices. The head of each ring has one writer and the
+// tail one reader; main context and the interrupt handler never share
+// a side.
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+static int present = 0;
+static int irq_driven = 0;
+static uint8_t ier = 0;
+
+// The handler updates the counters while `log` may be copying them.
+// Every writer runs with interrupts off, so writers never meet.
+static serial_stats_t stats;
+static seqlock_t stats_lock = SEQLOCK_INIT("serial stats");
+
+static void reg_write(int reg, uint8_t value) {
+    outb(SERIAL_COM1 + reg, value);
+}
+
+static uint8_t reg_read(int reg) {
+    return inb(SERIAL_COM1 + reg);
+}
+
+// Refill the TX FIFO once it has drained, and ask for an interrupt when
+// it drains again only while the ring has more
+IRQ_HANDLER static void tx_fill(void) {
+    if (reg_read(UART_LSR) & LSR_THRE) {
+        for (int i = 0; i < FIFO_DEPTH && tx_tail != tx_head; i++) {
+            reg_write(UART_DATA, tx_ring[tx_tail & TX_MASK]);
+            tx_tail++;
+        }
+    }
+
+    uint8_t want = 0;
+    if (irq_driven) {
+        want = tx_tail != tx_head ? IER_RX | IER_TX : IER_RX;
+    }
+    if (want != ier) {
+        ier = want;
+        reg_write(UART_IER, ier);
+    }
+}
+
+// Loop until the UART deasserts its line; the PIC is edge-triggered and
+// would not see a second interrupt raised while the first is pending
+IRQ_HANDLER static void service(uint32_t interrupts) {
+    uint32_t received = 0, dropped = 0;
+    uint8_t iir;
+
+    do {
+        while (reg_read(UART_LSR) & LSR_DATA) {
+            char c = (char)reg_read(UART_DATA);
+            if (rx_head - rx_tail < SERIAL_RX_RING) {
+                rx_ring[rx_head & RX_MASK] = c;
+                rx_head++;
+                received++;
+            } else {
+                dropped++;
+            }
+        }
+        tx_fill();
+        reg_read(UART_MSR);
+        iir = reg_read(UART_IIR);
+    } while (!(iir & IIR_NONE));
+
+    write_seqlock(&stats_lock);
+    stats.rx_bytes += received;
+    stats.rx_dropped += dropped;
+    stats.interrupts += interrupts;
+    write_sequnlock(&stats_lock);
+}
+
+IRQ_HANDLER static void serial_irq(int irq, void* ctx) {
+    (void)irq;
+    (void)ctx;
+    service(1);
+}
+
+void serial_poll(void) {
+    if (!present) {
+        return;
+    }
+    uintptr_t flags = irq_save();
+    service(0);
+    irq_restore(flags);
+}
+
+uint32_t serial_tx_free(void) {
+    return present ? SERIAL_TX_RING - (tx_head - tx_tail) : 0;
+}
+
+uint32_t serial_write(const char* buf, uint32_t len) {
+    uint32_t room = serial_tx_free();
+    uint32_t n = len < room ? len : room;
+
+    for (uint32_t i = 0; i < n; i++) {
+        tx_ring[(tx_head + i) & TX_MASK] = buf[i];
+    }
+    if (n == 0) {
+        return 0;
+    }
+    tx_head += n;
+
+    // Start the FIFO if it sat idle; after that the THRE interrupt keeps
+    // it going. Callers may already have interrupts off, so the old state
+    // is restored rather than interrupts turned back on.
+    uintptr_t flags = irq_save();
+    write_seqlock(&stats_lock);
+    stats.tx_bytes += n;
+    write_sequnlock(&stats_lock);
+    tx_fill();
+    irq_restore(flags);
+    return n;
+}
+
+void serial_putc(char c) {
+    if (!present) {
+        return;
+    }
+    while (serial_write(&c, 1) == 0) {
+        serial_poll();
+    }
+}
+
+int serial_getc(void) {
+    if (!present) {
+        return -1;
+    }
+    if (!irq_driven) {
+        serial_poll();
+    }
+    if (rx_tail == rx_head) {
+        return -1;
+    }
+    char c = rx_ring[rx_tail & RX_MASK];
+    rx_tail++;
+    return (uint8_t)c;
+}
+
+void serial_get_stats(serial_stats_t* out) {
+    uint32_t seq;
+
+    do {
+        seq = read_seqbegin(&stats_lock);
+        *out = stats;
+    } while (read_seqretry(&stats_lock, seq));
+}
+
+int serial_present(void) {
+    return present;
+}
+
+int serial_init(void) {
+    reg_write(UART_IER, 0);
+    reg_write(UART_LCR, LCR_DLAB);
+    reg_write(UART_DATA, DIVISOR & 0xFF);
+    reg_write(UART_IER, DIVISOR >> 8);
+    reg_write(UART_LCR, LCR_8N1);
+    reg_write(UART_IIR, FCR_ENABLE);
+
+    // A byte sent in loopback mode must come back, or nothing is there
+    reg_write(UART_MCR, MCR_LOOPBACK);
+    reg_write(UART_DATA, 0xAE);
+    if (reg_read(UART_DATA) != 0xAE) {
+        return -1;
+    }
+    reg_write(UART_MCR, MCR_RUN);
+
+    memset(&stats, 0, sizeof(stats));
+    tx_head = tx_tail = 0;
+    rx_head = rx_tail = 0;
+    ier = 0;
+    present = 1;
+    irq_driven = irq_register(SERIAL_IRQ, serial_irq, NULL) == 0;
+    if (irq_driven) {
+        ier = IER_RX;
+        reg_write(UART_IER, ier);
+    }
+    return 0;
+}
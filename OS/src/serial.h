@@ -0,0 +1,47 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "libc/libc.h"
+
+/*
+ * 16550 UART on COM1, 115200 8N1.
+ *
+ * Both directions go through rings in RAM. The interrupt handler moves
+ * received bytes into the RX ring and refills the 16-byte TX FIFO from
+ * the TX ring each time it empties, so writers only copy into RAM. If
+ * IRQ4 cannot be claimed, serial_poll() does the same work and is called
+ * wherever the kernel waits.
+ */
+
+#define SERIAL_COM1    0x3F8
+#define SERIAL_IRQ     4
+#define SERIAL_TX_RING 4096         /* Powers of two */
+#define SERIAL_RX_RING 256
+
+typedef struct {
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;        /* RX ring was full */
+    uint32_t interrupts;
+} serial_stats_t;
+
+// Returns -1 if there is no UART at COM1
+int serial_init(void);
+int serial_present(void);
+
+// Queue up to len bytes without waiting; returns how many were queued
+uint32_t serial_write(const char* buf, uint32_t len);
+uint32_t serial_tx_free(void);
+
+// Queue one byte, waiting for room. Does nothing without a UART.
+void serial_putc(char c);
+
+// Next received byte, or -1
+int serial_getc(void);
+
+// Service the UART by hand; needed only when it has no interrupt
+void serial_poll(void);
+
+void serial_get_stats(serial_stats_t* stats);
+
+#endif /* SERIAL_H */
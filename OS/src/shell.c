@@ -0,0 +1,287 @@
+#include "shell.h"
+#include "klog.h"
+#include "pipe.h"
+#include "sched.h"
+
+#define SLOT_MASK     (SHELL_HASH_SLOTS - 1)
+#define MAX_COMMANDS  (SHELL_HASH_SLOTS / 2)
+#define HELP_COLUMN   28            // Widest "name usage" that still lines up
+
+extern const shell_command_t __shell_commands_start[];
+extern const shell_command_t __shell_commands_end[];
+
+static const shell_command_t* slots[SHELL_HASH_SLOTS];
+static uint32_t slot_hashes[SHELL_HASH_SLOTS];
+static const shell_command_t* sorted[MAX_COMMANDS];    // By name, for help
+static int command_count = 0;
+
+// FNV-1a
+static uint32_t name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const shell_command_t* shell_find(const char* name) {
+    uint32_t hash = name_hash(name);
+
+    for (uint32_t i = hash & SLOT_MASK; slots[i]; i = (i + 1) & SLOT_MASK) {
+        if (slot_hashes[i] == hash && strcmp(slots[i]->name, name) == 0) {
+            return slots[i];
+        }
+    }
+    return NULL;
+}
+
+void shell_init(void) {
+    memset(slots, 0, sizeof(slots));
+    command_count = 0;
+
+    for (const shell_command_t* cmd = __shell_commands_start; cmd < __shell_commands_end; cmd++) {
+        if (command_count == MAX_COMMANDS) {
+            klog(KLOG_ERR, "shell: more than %d commands, %s left out", MAX_COMMANDS, cmd->name);
+            continue;
+        }
+        if (shell_find(cmd->name)) {
+            klog(KLOG_WARN, "shell: %s defined twice", cmd->name);
+            continue;
+        }
+
+        uint32_t hash = name_hash(cmd->name);
+        uint32_t i = hash & SLOT_MASK;
+        while (slots[i]) {
+            i = (i + 1) & SLOT_MASK;
+        }
+        slots[i] = cmd;
+        slot_hashes[i] = hash;
+
+        int at = command_count++;
+        while (at > 0 && strcmp(sorted[at - 1]->name, cmd->name) > 0) {
+            sorted[at] = sorted[at - 1];
+            at--;
+        }
+        sorted[at] = cmd;
+    }
+}
+
+int shell_tokenize(char* line, char** argv, int max_args) {
+    char* in = line;
+    int argc = 0;
+
+    while (1) {
+        while (*in == ' ' || *in == '\t') {
+            in++;
+        }
+        if (*in == '\0') {
+            break;
+        }
+        if (argc == max_args) {
+            return -1;
+        }
+
+        // Words are copied down over their quotes and escapes
+        char* out = in;
+        int quoted = 0;
+        argv[argc++] = out;
+        while (*in && (quoted || (*in != ' ' && *in != '\t'))) {
+            if (*in == '"') {
+                quoted = !quoted;
+                in++;
+                continue;
+            }
+            if (*in == '\\' && in[1]) {
+                in++;
+            }
+            *out++ = *in++;
+        }
+        if (quoted) {
+            return -1;
+        }
+        if (*in) {
+            in++;
+        }
+        *out = '\0';
+    }
+
+    argv[argc] = NULL;
+    return argc;
+}
+
+static void print_usage(const shell_command_t* cmd) {
+    printf("Usage: %s%s%s\n", cmd->name, cmd->usage[0] ? " " : "", cmd->usage);
+}
+
+typedef struct {
+    const shell_command_t* cmd;
+    int argc;
+    char* argv[SHELL_MAX_ARGS + 1];
+    int result;
+} shell_stage_t;
+
+static int stages_running = 0;
+static wait_queue_t pipeline_done;
+
+// Tokenize and look up one command. 1 for an empty line, -1 after
+// printing why the line cannot run.
+static int prepare(char* line, shell_stage_t* stage) {
+    stage->argc = shell_tokenize(line, stage->argv, SHELL_MAX_ARGS);
+    if (stage->argc < 0) {
+        puts("Unmatched quote or too many arguments");
+        return -1;
+    }
+    if (stage->argc == 0) {
+        return 1;
+    }
+
+    stage->cmd = shell_find(stage->argv[0]);
+    if (!stage->cmd) {
+        printf("Unknown command: %s\n", stage->argv[0]);
+        puts("Type 'help' for available commands.");
+        return -1;
+    }
+    if (stage->argc - 1 < stage->cmd->min_args || stage->argc - 1 > stage->cmd->max_args) {
+        print_usage(stage->cmd);
+        return -1;
+    }
+    return 0;
+}
+
+// Cut the line at each '|' outside quotes. Returns the number of
+// commands, or -1 for more than SHELL_MAX_STAGES.
+static int split_pipeline(char* line, char** commands) {
+    int count = 1;
+    int quoted = 0;
+
+    commands[0] = line;
+    for (char* c = line; *c; c++) {
+        if (*c == '\\' && c[1]) {
+            c++;
+        } else if (*c == '"') {
+            quoted = !quoted;
+        } else if (*c == '|' && !quoted) {
+            if (count == SHELL_MAX_STAGES) {
+                return -1;
+            }
+            *c = '\0';
+            commands[count++] = c + 1;
+        }
+    }
+    return count;
+}
+
+// A stage closes its ends of the pipes on the way out, which is what
+// tells its neighbours to stop
+static void stage_main(void* arg) {
+    shell_stage_t* stage = arg;
+    thread_t* self = sched_current();
+
+    stage->result = stage->cmd->handler(stage->argc, stage->argv);
+    if (self->in) {
+        pipe_close_read(self->in);
+    }
+    if (self->out) {
+        pipe_close_write(self->out);
+    }
+    stages_running--;
+    wait_queue_wake(&pipeline_done);
+}
+
+static int run_pipeline(shell_stage_t* stages, int count) {
+    pipe_t* pipes[SHELL_MAX_STAGES - 1];
+
+    for (int i = 0; i < count - 1; i++) {
+        pipes[i] = pipe_create();
+        if (!pipes[i]) {
+            while (i-- > 0) {
+                pipe_close_read(pipes[i]);
+                pipe_close_write(pipes[i]);
+            }
+            puts("Too many pipes open");
+            return -1;
+        }
+    }
+
+    // Nothing runs until this thread sleeps, so every stage is wired up
+    // before the first one starts
+    for (int i = 0; i < count; i++) {
+        thread_t* thread = thread_create(stage_main, &stages[i]);
+
+        stages_running++;
+        if (!thread) {
+            // Close its ends as if it had run and exited at once
+            puts("Too many threads running");
+            stages[i].result = -1;
+            if (i > 0) {
+                pipe_close_read(pipes[i - 1]);
+            }
+            if (i < count - 1) {
+                pipe_close_write(pipes[i]);
+            }
+            stages_running--;
+            continue;
+        }
+        thread->in = i > 0 ? pipes[i - 1] : NULL;
+        thread->out = i < count - 1 ? pipes[i] : NULL;
+    }
+
+    while (stages_running) {
+        wait_queue_sleep(&pipeline_done);
+    }
+    return stages[count - 1].result;
+}
+
+int shell_execute(char* line) {
+    char* commands[SHELL_MAX_STAGES];
+    shell_stage_t stages[SHELL_MAX_STAGES];
+    int count = split_pipeline(line, commands);
+
+    if (count < 0) {
+        printf("At most %d commands in a pipeline\n", SHELL_MAX_STAGES);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        int status = prepare(commands[i], &stages[i]);
+        if (status > 0 && count > 1) {
+            puts("Empty command in pipeline");
+            return -1;
+        }
+        if (status != 0) {
+            return status < 0 ? -1 : 0;
+        }
+    }
+
+    if (count == 1) {
+        return stages[0].cmd->handler(stages[0].argc, stages[0].argv);
+    }
+    return run_pipeline(stages, count);
+}
+
+static int help_command(int argc, char** argv) {
+    if (argc > 1) {
+        const shell_command_t* cmd = shell_find(argv[1]);
+        if (!cmd) {
+            printf("help: no command %s\n", argv[1]);
+            return -1;
+        }
+        print_usage(cmd);
+        printf("  %s\n", cmd->help);
+        return 0;
+    }
+
+    puts("Available commands:");
+    for (int i = 0; i < command_count; i++) {
+        const shell_command_t* cmd = sorted[i];
+        int column = printf("  %s%s%s", cmd->name, cmd->usage[0] ? " " : "", cmd->usage);
+        while (column++ < HELP_COLUMN) {
+            putchar(' ');
+        }
+        printf(" - %s\n", cmd->help);
+    }
+    return 0;
+}
+
+SHELL_COMMAND(help_cmd, "help", "[command]", "Display this help message", 0, 1, help_command);
@@ -0,0 +1,64 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include "libc/libc.h"
+
+/*
+ * Shell builtins.
+ *
+ * A command is a shell_command_t defined with SHELL_COMMAND() next to
+ * the code that implements it. The definitions land in the
+ * .shell_commands section, and the linker scripts gather them between
+ * __shell_commands_start and __shell_commands_end, so adding a command
+ * touches no central list.
+ *
+ * shell_init() indexes the section in an open-addressed hash table keyed
+ * by name. A lookup hashes the name once and almost always probes one
+ * slot, however many commands there are. help is generated from the
+ * table.
+ *
+ * Lines are split into argv on spaces and tabs. Double quotes group
+ * words, and a backslash takes the next character literally. The
+ * dispatcher checks the argument count against the command's limits
+ * and prints its usage when they are not met.
+ *
+ * `cmd1 | cmd2` runs each command on its own thread (sched.h), with a
+ * pipe (pipe.h) from one's output to the next one's input, and waits for
+ * all of them. printf() output goes into the thread's pipe; a command
+ * that reads input takes it from sched_current()->in. The pipeline's
+ * result is the last command's.
+ */
+
+#define SHELL_MAX_ARGS   16
+#define SHELL_MAX_STAGES 4          /* Commands in one pipeline */
+#define SHELL_HASH_SLOTS 128        /* Power of two, at least twice the commands */
+
+typedef int (*shell_handler_t)(int argc, char** argv);
+
+typedef struct {
+    const char* name;
+    const char* usage;          /* Arguments, for help; "" if none */
+    const char* help;
+    int min_args;               /* Not counting argv[0] */
+    int max_args;
+    shell_handler_t handler;
+} shell_command_t;
+
+#define SHELL_COMMAND(symbol, name, usage, help, min_args, max_args, handler)    \
+    static const shell_command_t symbol                                         \
+        __attribute__((used, section(".shell_commands"), aligned(sizeof(void*)))) = \
+        { name, usage, help, min_args, max_args, handler }
+
+void shell_init(void);
+
+// Split `line` in place. argv needs room for max_args + 1 pointers; the
+// last is NULL. Returns argc, or -1 for too many words or an open quote.
+int shell_tokenize(char* line, char** argv, int max_args);
+
+const shell_command_t* shell_find(const char* name);
+
+// Tokenize and run a line. Returns the handler's result, 0 for an empty
+// line, or -1 if the line does not name a command or fits none.
+int shell_execute(char* line);
+
+#endif /* SHELL_H */
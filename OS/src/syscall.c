@@ -0,0 +1,165 @@
+#include "syscall.h"
+#include "gdt.h"
+#include "io.h"
+#include "lock.h"
+#include "pipe.h"
+#include "process.h"
+#include "sched.h"
+#include "tsc.h"
+
+extern void print_char(char c);    // kernel.c
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+#define MSR_EFER         0xC0000080
+#define MSR_STAR         0xC0000081
+#define MSR_LSTAR        0xC0000082
+#define MSR_FMASK        0xC0000084
+
+#define EFER_SCE         (1ULL << 0)
+#define FMASK_TF_IF_DF   0x700ULL   // Entered with interrupts off and DF clear
+
+typedef intptr_t (*syscall_fn_t)(uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3);
+
+static uint8_t vdso_page[4096] __attribute__((aligned(4096)));
+vdso_data_t* const vdso_data = (vdso_data_t*)vdso_page;
+
+#ifdef __x86_64__
+// Used by syscall_entry (syscall64.asm)
+uintptr_t syscall_kernel_sp = 0;
+uintptr_t syscall_user_sp = 0;
+#endif
+
+void syscall_entry(void);      // syscall64.asm
+void sysenter_entry(void);     // syscall32.asm
+intptr_t syscall_dispatch(uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t num);
+
+static intptr_t sys_exit(uintptr_t code, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    process_exit((int)code);
+    return 0;
+}
+
+static intptr_t sys_write(uintptr_t fd, uintptr_t buf, uintptr_t len, uintptr_t a3) {
+    const char* data = (const char*)buf;
+
+    (void)a3;
+    if (fd != 1 && fd != 2) {
+        return SYS_EBADF;
+    }
+    if (process_check_buffer(buf, len, 0) < 0) {
+        return SYS_EFAULT;
+    }
+    // In a pipeline standard output is a pipe; standard error stays on
+    // the console
+    pipe_t* out = sched_current()->out;
+    if (fd == 1 && out) {
+        int written = pipe_write(out, data, (uint32_t)len);
+        return written < 0 ? SYS_EPIPE : written;
+    }
+    for (uintptr_t i = 0; i < len; i++) {
+        print_char(data[i]);
+    }
+    return (intptr_t)len;
+}
+
+static intptr_t sys_getpid(uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    (void)a0;
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    return vdso_data->pid;
+}
+
+static intptr_t sys_now_ns(uintptr_t out, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    if (process_check_buffer(out, sizeof(uint64_t), 1) < 0) {
+        return SYS_EFAULT;
+    }
+    uint64_t ns;
+    while (1) {
+        uint32_t seq = read_seqcount_begin(&vdso_data->seq);
+        ns = vdso_tsc_to_ns(vdso_data, tsc_read());
+        if (!read_seqcount_retry(&vdso_data->seq, seq)) {
+            break;
+        }
+    }
+    *(uint64_t*)out = ns;
+    return 0;
+}
+
+static intptr_t sys_null(uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    (void)a0;
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    return 0;
+}
+
+static const syscall_fn_t syscalls[SYS_COUNT] = {
+    [SYS_EXIT] = sys_exit,
+    [SYS_WRITE] = sys_write,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_NOW_NS] = sys_now_ns,
+    [SYS_NULL] = sys_null,
+};
+
+intptr_t syscall_dispatch(uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t num) {
+    if (num >= SYS_COUNT) {
+        return SYS_ENOSYS;
+    }
+    return syscalls[num](a0, a1, a2, a3);
+}
+
+// Largest shift, for precision, that keeps the multiplier in 32 bits
+static void vdso_init(void) {
+    uint32_t shift = 32;
+    uint64_t mult = 0;
+
+    if (tsc_khz) {
+        mult = udiv64(1000000ULL << shift, tsc_khz);
+        while (mult > 0xFFFFFFFF) {
+            shift--;
+            mult = udiv64(1000000ULL << shift, tsc_khz);
+        }
+    }
+
+    memset(vdso_page, 0, sizeof(vdso_page));
+    vdso_data->magic = VDSO_MAGIC;
+
+    // Set once, before any process runs, so nothing serializes writers.
+    // The sequence count is part of the vDSO ABI and readers check it.
+    write_seqcount_begin(&vdso_data->seq);
+    vdso_data->tsc_mult = (uint32_t)mult;
+    vdso_data->tsc_shift = shift;
+    write_seqcount_end(&vdso_data->seq);
+}
+
+void syscall_init(void) {
+    vdso_init();
+
+#ifdef __x86_64__
+    // SYSRET loads user SS from STAR[63:48] + 8 and CS from + 16
+    wrmsr(MSR_STAR, ((uint64_t)KERNEL_DATA_SELECTOR << 48) | ((uint64_t)KERNEL_CODE_SELECTOR << 32));
+    wrmsr(MSR_LSTAR, (uintptr_t)syscall_entry);
+    wrmsr(MSR_FMASK, FMASK_TF_IF_DF);
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+#else
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CODE_SELECTOR);
+    wrmsr(MSR_SYSENTER_EIP, (uintptr_t)sysenter_entry);
+#endif
+}
+
+void syscall_set_kernel_stack(uintptr_t top) {
+    gdt_set_kernel_stack(top);
+#ifdef __x86_64__
+    syscall_kernel_sp = top;
+#else
+    wrmsr(MSR_SYSENTER_ESP, top);
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "libc/libc.h"
+#include "libc/sysabi.h"
+
+/*
+ * Fast system-call entry. The x86_64 kernel takes SYSCALL and returns
+ * with SYSRET; the i386 kernel takes SYSENTER and returns with SYSEXIT.
+ * Neither goes through the IDT, so an empty call is a stack switch, a
+ * table lookup and the return. Numbers and registers are in sysabi.h.
+ *
+ * The entry stubs switch to the stack set with syscall_set_kernel_stack()
+ * and run the handler with interrupts on. There is one CPU and at most
+ * one process, so the user stack pointer is parked in a global rather
+ * than behind SWAPGS.
+ *
+ * The vDSO page is filled in here: the clock scale comes from the TSC
+ * calibration, so syscall_init() must run after tsc_init().
+ */
+
+void syscall_init(void);
+
+// Kernel stack for system calls and for interrupts taken in ring 3
+void syscall_set_kernel_stack(uintptr_t top);
+
+// Kernel view of the vDSO page; a whole, page-aligned page
+extern vdso_data_t* const vdso_data;
+
+#endif /* SYSCALL_H */
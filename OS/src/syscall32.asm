@@ -0,0 +1,109 @@
+; System call and process entry for the i386 kernel: the SYSENTER entry
+; point, the switch to ring 3 and back, and the user code of the null
+; system call benchmark. syscall64.asm has the x86_64 versions.
+[bits 32]
+
+global sysenter_entry
+global process_enter
+global process_return
+global null_bench_start
+global null_bench_end
+extern syscall_dispatch
+extern process_saved_sp
+
+KERNEL_DATA_SELECTOR equ 0x10     ; gdt.h
+USER_CODE_SELECTOR   equ 0x18 | 3
+USER_DATA_SELECTOR   equ 0x20 | 3
+SYS_EXIT             equ 0        ; sysabi.h
+SYS_NULL             equ 4
+BENCH_CALLS          equ 10000    ; process.c
+
+section .text
+; The CPU loads esp from MSR_SYSENTER_ESP; the caller left its own in
+; ecx and its return address in edx, which SYSEXIT takes back
+sysenter_entry:
+    push ecx
+    push edx
+    sti
+    push eax
+    push 0
+    push edi
+    push esi
+    push ebx
+    call syscall_dispatch
+    add esp, 20
+    cli
+    pop edx
+    pop ecx
+    sysexit
+
+; int process_enter(uintptr_t entry, uintptr_t sp), as in syscall64.asm.
+; Ring 3 data segments must be loaded before IRET, which would otherwise
+; clear them.
+process_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [process_saved_sp], esp
+    mov eax, [esp + 20]
+    mov ecx, [esp + 24]
+    mov dx, USER_DATA_SELECTOR
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    push USER_DATA_SELECTOR
+    push ecx
+    push 0x202                  ; IF set
+    push USER_CODE_SELECTOR
+    push eax
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iret
+
+; void process_return(int code)
+process_return:
+    mov eax, [esp + 4]
+    mov esp, [process_saved_sp]
+    mov dx, KERNEL_DATA_SELECTOR
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+section .rodata
+; As in syscall64.asm, with SYSENTER: ebp holds the return address for edx
+null_bench_start:
+    call .here
+.here:
+    pop ebp
+    add ebp, .resume - .here
+    rdtsc
+    mov esi, eax
+    mov edi, BENCH_CALLS
+.call:
+    mov eax, SYS_NULL
+    mov ecx, esp
+    mov edx, ebp
+    sysenter
+.resume:
+    dec edi
+    jnz .call
+    rdtsc
+    sub eax, esi
+    mov ebx, eax
+    mov eax, SYS_EXIT
+    mov ecx, esp
+    sysenter
+null_bench_end:
@@ -0,0 +1,113 @@
+; System call and process entry for the 64-bit kernel: the SYSCALL entry
+; point, the switch to ring 3 and back, and the user code of the null
+; system call benchmark. syscall32.asm has the i386 versions.
+[bits 64]
+
+global syscall_entry
+global process_enter
+global process_return
+global null_bench_start
+global null_bench_end
+extern syscall_dispatch
+extern syscall_kernel_sp
+extern syscall_user_sp
+extern process_saved_sp
+
+USER_DATA_SELECTOR equ 0x18 | 3 ; gdt.h
+USER_CODE_SELECTOR equ 0x20 | 3
+SYS_EXIT           equ 0        ; sysabi.h
+SYS_NULL           equ 4
+BENCH_CALLS        equ 10000    ; process.c
+
+section .text
+; rcx and r11 hold the return rip and rflags. Caller-saved registers
+; are cleared on the way out so no kernel values leak to user mode.
+syscall_entry:
+    mov [rel syscall_user_sp], rsp
+    mov rsp, [rel syscall_kernel_sp]
+    push qword [rel syscall_user_sp]
+    push rcx
+    push r11
+    push rbp                    ; Keeps the stack 16-byte aligned for the call
+    sti
+    mov rcx, r10
+    mov r8, rax
+    call syscall_dispatch
+    cli
+    pop rbp
+    pop r11
+    pop rcx
+    pop rsp
+    xor edi, edi
+    xor esi, esi
+    xor edx, edx
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    o64 sysret
+
+; int process_enter(uintptr_t entry, uintptr_t sp): enter ring 3 at
+; entry with the stack at sp. Returns the value passed to
+; process_return(). Callee-saved registers are kept on the kernel stack;
+; the user starts with every other register cleared.
+process_enter:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rel process_saved_sp], rsp
+    push USER_DATA_SELECTOR
+    push rsi
+    push 0x202                  ; IF set
+    push USER_CODE_SELECTOR
+    push rdi
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    xor r11d, r11d
+    xor r12d, r12d
+    xor r13d, r13d
+    xor r14d, r14d
+    xor r15d, r15d
+    iretq
+
+; void process_return(int code)
+process_return:
+    mov rsp, [rel process_saved_sp]
+    mov eax, edi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
+
+section .rodata
+; BENCH_CALLS empty system calls between two TSC reads; exits with the
+; cycles taken. Position-independent, copied to USER_BASE.
+null_bench_start:
+    rdtsc
+    mov ebx, eax
+    mov ebp, edx
+    mov r12d, BENCH_CALLS
+.call:
+    mov eax, SYS_NULL
+    syscall
+    dec r12d
+    jnz .call
+    rdtsc
+    sub eax, ebx
+    mov edi, eax
+    mov eax, SYS_EXIT
+    syscall
+null_bench_end:
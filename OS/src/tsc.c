@@ -0,0 +1,29 @@
+#include "tsc.h"
+#include "io.h"
+
+#define PIT_CHANNEL2  0x42
+#define PIT_COMMAND   0x43
+#define PIT_GATE_PORT 0x61
+#define PIT_HZ        1193182
+#define CALIBRATE_MS  10
+
+uint32_t tsc_khz = 0;
+
+// Count TSC ticks while PIT channel 2 counts down CALIBRATE_MS in mode 0.
+// Its output shows up in bit 5 of port 0x61 when the count reaches zero.
+void tsc_init(void) {
+    uint16_t count = PIT_HZ / (1000 / CALIBRATE_MS);
+    uint8_t gate = inb(PIT_GATE_PORT);
+
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);    // Gate on, speaker off
+    outb(PIT_COMMAND, 0xB0);                       // Channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    uint64_t start = tsc_read();
+    while (!(inb(PIT_GATE_PORT) & 0x20));
+    uint64_t end = tsc_read();
+
+    outb(PIT_GATE_PORT, gate);
+    tsc_khz = (uint32_t)udiv64(end - start, CALIBRATE_MS);
+}
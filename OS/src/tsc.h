@@ -0,0 +1,41 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include "libc/libc.h"
+
+// Time-stamp counter, calibrated against the PIT at boot
+
+extern uint32_t tsc_khz;
+
+void tsc_init(void);
+
+static inline uint64_t tsc_read(void) {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// 64-by-32-bit division; the 32-bit kernel has no libgcc for `/` on uint64_t
+static inline uint64_t udiv64(uint64_t n, uint32_t d) {
+#ifdef __x86_64__
+    return n / d;
+#else
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t low = (uint32_t)n;
+    uint32_t q_high = 0;
+    uint32_t rem;
+
+    if (high >= d) {
+        q_high = high / d;
+        high %= d;
+    }
+    __asm__("divl %4" : "=a"(low), "=d"(rem) : "a"(low), "d"(high), "rm"(d));
+    return ((uint64_t)q_high << 32) | low;
+#endif
+}
+
+static inline uint64_t tsc_to_us(uint64_t cycles) {
+    return tsc_khz ? udiv64(cycles * 1000, tsc_khz) : 0;
+}
+
+#endif /* TSC_H */
@@ -0,0 +1,183 @@
+#include "vma.h"
+#include "pagecache.h"
+
+vm_stats_t vm_stats;
+
+static uint64_t zero_frame = 0;    // Never written; every mapping is read-only
+
+int vm_create(vm_t* vm, fat_file_t* file) {
+    if (!zero_frame) {
+        zero_frame = frame_alloc();
+        if (!zero_frame) {
+            return -1;
+        }
+    }
+    memset(vm, 0, sizeof(*vm));
+    vm->file = file;
+    return address_space_create(&vm->space);
+}
+
+int vm_map(vm_t* vm, uintptr_t start, uintptr_t end, uint32_t prot,
+           uint64_t offset, uintptr_t file_end) {
+    if (vm->count == VMA_MAX || start >= end) {
+        return -1;
+    }
+    for (int i = 0; i < vm->count; i++) {
+        if (start < vm->areas[i].end && vm->areas[i].start < end) {
+            return -1;
+        }
+    }
+
+    vma_t* vma = &vm->areas[vm->count++];
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->offset = offset;
+    vma->file_end = file_end;
+    return 0;
+}
+
+static vma_t* find_area(vm_t* vm, uintptr_t addr) {
+    for (int i = 0; i < vm->count; i++) {
+        if (addr >= vm->areas[i].start && addr < vm->areas[i].end) {
+            return &vm->areas[i];
+        }
+    }
+    return NULL;
+}
+
+static uint64_t page_flags(const vma_t* vma) {
+    return PTE_USER | ((vma->prot & VM_WRITE) ? PTE_WRITABLE : 0) |
+           ((vma->prot & VM_EXEC) ? 0 : PTE_NX);
+}
+
+// A frame of the area's own, mapped with its full permissions
+static int map_private(vm_t* vm, const vma_t* vma, uintptr_t page, uint64_t phys) {
+    if (paging_map(&vm->space, page, phys, page_flags(vma)) < 0) {
+        frame_free(phys);
+        return -1;
+    }
+    return 0;
+}
+
+// A frame owned elsewhere: never writable here, and copied on write in
+// a writable area
+static int map_shared(vm_t* vm, const vma_t* vma, uintptr_t page, uint64_t phys) {
+    uint64_t flags = (page_flags(vma) & ~PTE_WRITABLE) | PTE_SHARED;
+
+    if (vma->prot & VM_WRITE) {
+        flags |= PTE_COW;
+    }
+    return paging_map(&vm->space, page, phys, flags);
+}
+
+// A private copy of `bytes` of file data, from the page cache when it
+// has room, with the rest of the page zeroed
+static int fill_private(vm_t* vm, const vma_t* vma, uintptr_t page, uint32_t index, uint32_t bytes) {
+    uint64_t phys = frame_alloc();
+
+    if (!phys) {
+        return -1;
+    }
+    uint64_t cached = pagecache_get(vm->file, index);
+    if (cached) {
+        memcpy(phys_to_virt(phys), phys_to_virt(cached), bytes);
+        pagecache_put(cached);
+    } else if (fat_seek(vm->file, index * (uint32_t)PAGE_SIZE) < 0 ||
+               fat_read(vm->file, phys_to_virt(phys), bytes) != (int64_t)bytes) {
+        frame_free(phys);
+        return -1;
+    }
+    vm_stats.private_reads++;
+    return map_private(vm, vma, page, phys);
+}
+
+// Give the area its own copy of a shared frame. The shared frame's
+// reference is dropped only once the copy is mapped.
+static int break_cow(vm_t* vm, const vma_t* vma, uintptr_t page, uint64_t old) {
+    uint64_t phys = frame_alloc();
+
+    if (!phys) {
+        return -1;
+    }
+    if (old != zero_frame) {
+        memcpy(phys_to_virt(phys), phys_to_virt(old), PAGE_SIZE);
+    }
+    if (map_private(vm, vma, page, phys) < 0) {
+        return -1;
+    }
+    if (old != zero_frame) {
+        pagecache_put(old);
+        vm_stats.cow_copies++;
+    } else {
+        vm_stats.zero_fills++;
+    }
+    return 0;
+}
+
+int vm_fault(vm_t* vm, uintptr_t addr, uint32_t access) {
+    vma_t* vma = find_area(vm, addr);
+    uintptr_t page = addr & ~(uintptr_t)(PAGE_SIZE - 1);
+    int write = (access & VM_WRITE) != 0;
+
+    if (!vma) {
+        return -1;
+    }
+    if (!(access & VM_FORCE) && (access & ~vma->prot & (VM_READ | VM_WRITE | VM_EXEC))) {
+        return -1;
+    }
+
+    uint64_t pte = paging_entry(&vm->space, page);
+    if (pte & PTE_PRESENT) {
+        // A shared frame is never written in place: the kernel filling a
+        // read-only page gets a private copy too
+        if (write && (pte & PTE_SHARED)) {
+            return break_cow(vm, vma, page, pte & PTE_ADDR_MASK);
+        }
+        return 0;
+    }
+    vm_stats.faults++;
+
+    uint32_t index = (uint32_t)((vma->offset + (page - vma->start)) >> 12);
+    if (page + PAGE_SIZE <= vma->file_end) {
+        uint64_t phys = pagecache_get(vm->file, index);
+        if (phys) {
+            vm_stats.file_maps++;
+            int result = write ? break_cow(vm, vma, page, phys) : map_shared(vm, vma, page, phys);
+            if (result < 0) {
+                pagecache_put(phys);
+                return -1;
+            }
+            return 0;
+        }
+        // The cache is full of mapped pages: read a private copy
+        return fill_private(vm, vma, page, index, PAGE_SIZE);
+    }
+    if (page < vma->file_end) {
+        return fill_private(vm, vma, page, index, (uint32_t)(vma->file_end - page));
+    }
+
+    if (write) {
+        uint64_t phys = frame_alloc();
+        if (!phys) {
+            return -1;
+        }
+        vm_stats.zero_fills++;
+        return map_private(vm, vma, page, phys);
+    }
+    return map_shared(vm, vma, page, zero_frame);
+}
+
+void vm_destroy(vm_t* vm) {
+    for (int i = 0; i < vm->count; i++) {
+        for (uintptr_t page = vm->areas[i].start; page < vm->areas[i].end; page += PAGE_SIZE) {
+            uint64_t pte = paging_entry(&vm->space, page);
+            if ((pte & (PTE_PRESENT | PTE_SHARED)) == (PTE_PRESENT | PTE_SHARED) &&
+                (pte & PTE_ADDR_MASK) != zero_frame) {
+                pagecache_put(pte & PTE_ADDR_MASK);
+            }
+        }
+    }
+    address_space_destroy(&vm->space);
+    vm->count = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include "libc/libc.h"
+#include "fat.h"
+#include "paging.h"
+
+/*
+ * Demand-paged user address spaces (x86_64).
+ *
+ * A vm_t is an address space plus a short list of areas (VMAs), each a
+ * page-aligned range with its protection and, optionally, a run of file
+ * bytes behind it. Mapping an area maps nothing yet. The first touch of
+ * each page faults, and vm_fault() fills that one page in:
+ *
+ * - A page wholly inside the file data maps the page cache's frame
+ *   (pagecache.h). Read-only areas share it for good. Writable areas
+ *   map it read-only with PTE_COW and copy it on the first write.
+ * - The page holding the last file byte is copied at once, since the
+ *   rest of it must read as zeroes.
+ * - Pages past the file data, and anonymous areas, map one shared zero
+ *   frame until they are written.
+ *
+ * So starting a program costs the pages it touches, not its size, and
+ * a second run finds its text already in memory.
+ */
+
+#define VMA_MAX    16
+
+#define VM_READ    0x01
+#define VM_WRITE   0x02
+#define VM_EXEC    0x04
+#define VM_FORCE   0x08     /* vm_fault: the kernel is filling the page; skip the protection check */
+
+typedef struct {
+    uintptr_t start;        /* Page-aligned */
+    uintptr_t end;
+    uint32_t prot;          /* VM_READ | VM_WRITE | VM_EXEC */
+    uint64_t offset;        /* File offset of `start` */
+    uintptr_t file_end;     /* File data covers [start, file_end); start for none */
+} vma_t;
+
+typedef struct {
+    address_space_t space;
+    fat_file_t* file;       /* Behind every file area; NULL if there are none */
+    vma_t areas[VMA_MAX];
+    int count;
+} vm_t;
+
+typedef struct {
+    uint32_t faults;
+    uint32_t file_maps;     /* Page-cache frames mapped */
+    uint32_t cow_copies;
+    uint32_t zero_fills;    /* Private zeroed pages */
+    uint32_t private_reads; /* Private copies read in: last file pages, or a full cache */
+} vm_stats_t;
+
+extern vm_stats_t vm_stats;
+
+int vm_create(vm_t* vm, fat_file_t* file);
+
+// Returns -1 if the area overlaps another or the list is full
+int vm_map(vm_t* vm, uintptr_t start, uintptr_t end, uint32_t prot,
+           uint64_t offset, uintptr_t file_end);
+
+// Make `addr` accessible for `access`. Returns -1 if no area allows it,
+// or if memory runs out.
+int vm_fault(vm_t* vm, uintptr_t addr, uint32_t access);
+
+// Unmap everything and free the address space
+void vm_destroy(vm_t* vm);
+
+#endif /* VMA_H */
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Runs the hosted FAT test on a FAT12, a FAT16 and a FAT32 image. Each
+# image is formatted by mkfs.fat and filled by mcopy; after fattest has
+# changed it through fat.c, fsck.fat must find nothing to repair and
+# mtools must read back the tree fattest expects.
+#
+#   test/fat.sh <fattest>
+
+FATTEST=${1:-test/fattest}
+
+for tool in mkfs.fat mcopy fsck.fat; do
+    if ! command -v $tool > /dev/null 2>&1; then
+        echo "fat.sh: $tool not found; install dosfstools and mtools" >&2
+        exit 1
+    fi
+done
+
+# mtools refuses images whose geometry it does not recognise
+MTOOLS_SKIP_CHECK=1
+export MTOOLS_SKIP_CHECK
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+"$FATTEST" seed "$WORK/seed" || exit 1
+
+# FAT type, then the image size in KiB
+for volume in "12 4096" "16 32768" "32 65536"; do
+    set -- $volume
+    img="$WORK/fat$1.img"
+    rm -rf "$WORK/expected" "$WORK/got"
+
+    mkfs.fat -C -F "$1" "$img" "$2" > /dev/null || exit 1
+    mcopy -s -i "$img" "$WORK"/seed/* ::/ || exit 1
+
+    if ! "$FATTEST" run "$img" "$WORK/expected"; then
+        echo "FAT$1: fattest failed"
+        exit 1
+    fi
+    if ! fsck.fat -n "$img"; then
+        echo "FAT$1: fsck.fat found errors"
+        exit 1
+    fi
+    mcopy -s -n -i "$img" '::*' "$WORK/got/" || exit 1
+    if ! diff -r "$WORK/expected" "$WORK/got"; then
+        echo "FAT$1: mtools reads back a different tree"
+        exit 1
+    fi
+    echo "FAT$1: ok"
+done
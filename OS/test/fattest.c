@@ -0,0 +1,602 @@
+// Hosted FAT test. fat.c, the block cache and the block layer run on a
+// RAM disk loaded from an image that mkfs.fat and mcopy built. The test
+// reads the seeded files back, then creates, renames, extends, truncates
+// and deletes files, checking every file and directory against a model
+// after each step. The image and the model's tree are written out, and
+// fat.sh compares them with what fsck.fat and mtools see.
+//
+//   fattest seed <dir>               write the files to copy into an image
+//   fattest run <image> <expected>   run the test and update the image
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fat.h"
+#include "bcache.h"
+#include "klog.h"
+#include "paging.h"
+
+#define MODEL_FILES 512
+#define MODEL_DIRS  4
+#define PATH_MAX_LEN 160
+
+#define MANY_FILES  200         // Enough names for "many" to span clusters
+#define MANY_EXTRA  60
+
+typedef struct {
+    char path[PATH_MAX_LEN];
+    uint8_t* data;
+    uint32_t size;
+    int live;
+} model_file_t;
+
+typedef struct {
+    const char* path;
+    uint32_t size;
+} seed_t;
+
+static const seed_t seeds[] = {
+    { "small.txt",           100 },
+    { "empty.txt",           0 },
+    { "Long File Name.dat",  10000 },
+    { "docs/readme.txt",     3000 },
+    { "docs/Big Binary.bin", 300000 },
+};
+
+#define SEED_COUNT (int)(sizeof(seeds) / sizeof(seeds[0]))
+
+static model_file_t model[MODEL_FILES];
+static int model_count = 0;
+static char dirs[MODEL_DIRS][PATH_MAX_LEN] = { "docs", "many" };
+static int dir_count = 2;
+static const char* step = "mount";
+
+static uint8_t* disk;
+static size_t disk_size;
+static uint32_t ram_done;       // Slots whose command has been copied
+static blk_device_t ram;
+
+// What the kernel normally provides
+
+uint32_t tsc_khz = 0;
+
+void klog(int level, const char* format, ...) {
+    va_list ap;
+
+    if (level > KLOG_WARN) {
+        return;
+    }
+    va_start(ap, format);
+    fprintf(stderr, "klog: ");
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+}
+
+// Block-cache frames; phys_to_virt() adds DIRECT_MAP_BASE back
+uint64_t frame_alloc(void) {
+    void* frame = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+
+    return frame ? (uint64_t)(uintptr_t)frame - DIRECT_MAP_BASE : 0;
+}
+
+void ml_heap_lock(void) {
+}
+
+void ml_heap_unlock(void) {
+}
+
+void ml_print_char(char c) {
+    putchar(c);
+}
+
+static void fail(const char* format, ...) {
+    va_list ap;
+
+    va_start(ap, format);
+    fprintf(stderr, "fattest: %s: ", step);
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+// RAM disk. Commands are copied when they start and reported on the
+// next poll, like a polled controller.
+
+static int ram_start(blk_device_t* dev, int slot, blk_command_t* cmd) {
+    uint8_t* at = disk + cmd->lba * BLK_SECTOR_SIZE;
+
+    (void)dev;
+    for (blk_request_t* req = cmd->reqs; req; req = req->next) {
+        size_t len = (size_t)req->count * BLK_SECTOR_SIZE;
+
+        if (cmd->op == BLK_READ) {
+            memcpy(req->buf, at, len);
+        } else {
+            memcpy(at, req->buf, len);
+        }
+        at += len;
+    }
+    ram_done |= 1u << slot;
+    return 0;
+}
+
+static void ram_poll(blk_device_t* dev) {
+    uint32_t done = ram_done;
+
+    ram_done = 0;
+    for (int slot = 0; done; slot++) {
+        if (done & (1u << slot)) {
+            done &= ~(1u << slot);
+            blk_complete(dev, slot, 0);
+        }
+    }
+}
+
+static const blk_ops_t ram_ops = {
+    ram_start,
+    ram_poll
+};
+
+// File contents are a stream keyed by a name, so the seed files and the
+// test agree on them without sharing anything
+
+static void fill(const char* key, uint32_t offset, uint8_t* buf, uint32_t len) {
+    uint64_t seed = 0xCBF29CE484222325ULL;
+
+    for (const char* p = key; *p; p++) {
+        seed = (seed ^ (uint8_t)*p) * 0x100000001B3ULL;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        uint64_t x = seed + (offset + i) * 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 31)) * 0xBF58476D1CE4E5B9ULL;
+        buf[i] = (uint8_t)(x >> 56);
+    }
+}
+
+static void many_name(char* path, const char* prefix, int i) {
+    snprintf(path, PATH_MAX_LEN, "many/%s%03d.txt", prefix, i);
+}
+
+// The model
+
+static model_file_t* model_find(const char* path) {
+    for (int i = 0; i < model_count; i++) {
+        if (model[i].live && strcmp(model[i].path, path) == 0) {
+            return &model[i];
+        }
+    }
+    return NULL;
+}
+
+static model_file_t* model_add(const char* path, uint32_t size) {
+    if (model_count == MODEL_FILES) {
+        fail("model full");
+    }
+    model_file_t* f = &model[model_count++];
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    f->data = malloc(size ? size : 1);
+    f->size = size;
+    f->live = 1;
+    fill(path, 0, f->data, size);
+    return f;
+}
+
+static model_file_t* model_get(const char* path) {
+    model_file_t* f = model_find(path);
+
+    if (!f) {
+        fail("%s is not in the model", path);
+    }
+    return f;
+}
+
+static void fat_path(char* out, const char* path) {
+    snprintf(out, PATH_MAX_LEN + 1, "/%.*s", PATH_MAX_LEN - 1, path);
+}
+
+// Checks through fat.c
+
+static void check_file(const model_file_t* f) {
+    char path[PATH_MAX_LEN + 1];
+    static uint8_t buf[1 << 19];
+    fat_file_t file;
+    uint32_t got = 0;
+
+    fat_path(path, f->path);
+    if (fat_open(path, "r", &file) < 0) {
+        fail("cannot open %s", f->path);
+    }
+    if (file.size != f->size) {
+        fail("%s is %u bytes, expected %u", f->path, file.size, f->size);
+    }
+
+    // Odd chunk sizes, so reads start and end inside clusters
+    for (uint32_t chunk = 1; got < f->size; chunk = chunk * 3 + 7) {
+        int64_t n = fat_read(&file, buf + got, chunk);
+        if (n <= 0) {
+            fail("read of %s stopped at %u of %u bytes", f->path, got, f->size);
+        }
+        got += (uint32_t)n;
+    }
+    if (fat_read(&file, buf, 1) != 0) {
+        fail("read past the end of %s", f->path);
+    }
+    if (memcmp(buf, f->data, f->size) != 0) {
+        fail("%s does not hold what was written", f->path);
+    }
+    fat_close(&file);
+}
+
+// Every name in the directory is in the model and the other way round
+static void check_dir(const char* dir) {
+    char path[PATH_MAX_LEN + 1];
+    char full[PATH_MAX_LEN * 2];
+    size_t dir_len = strlen(dir);
+    fat_dir_t d;
+    fat_dirent_t entry;
+    int listed = 0, expected = 0;
+    int r;
+
+    fat_path(path, dir);
+    if (fat_opendir(path, &d) < 0) {
+        fail("cannot open directory /%s", dir);
+    }
+    while ((r = fat_readdir(&d, &entry)) == 1) {
+        snprintf(full, sizeof(full), "%s%s%s", dir, dir_len ? "/" : "", entry.name);
+        int is_dir = 0;
+        for (int i = 0; i < dir_count; i++) {
+            is_dir |= strcmp(dirs[i], full) == 0;
+        }
+        if (is_dir != ((entry.attr & FAT_ATTR_DIRECTORY) != 0) || (!is_dir && !model_find(full))) {
+            fail("unexpected entry %s in /%s", entry.name, dir);
+        }
+        listed++;
+    }
+    if (r < 0) {
+        fail("error listing /%s", dir);
+    }
+
+    for (int i = 0; i < model_count; i++) {
+        const char* slash = strrchr(model[i].path, '/');
+        size_t parent = slash ? (size_t)(slash - model[i].path) : 0;
+        expected += model[i].live && parent == dir_len && strncmp(model[i].path, dir, dir_len) == 0;
+    }
+    for (int i = 0; i < dir_count; i++) {
+        expected += dir_len == 0 && !strchr(dirs[i], '/');
+    }
+    if (listed != expected) {
+        fail("/%s lists %d names, expected %d", dir, listed, expected);
+    }
+}
+
+static void check_all(void) {
+    char path[PATH_MAX_LEN + 1];
+    fat_file_t file;
+
+    for (int i = 0; i < model_count; i++) {
+        if (model[i].live) {
+            check_file(&model[i]);
+        } else if (!model_find(model[i].path)) {
+            fat_path(path, model[i].path);
+            if (fat_open(path, "r", &file) == 0) {
+                fail("%s is still there", model[i].path);
+            }
+        }
+    }
+    check_dir("");
+    for (int i = 0; i < dir_count; i++) {
+        check_dir(dirs[i]);
+    }
+}
+
+// Changes through fat.c, mirrored in the model
+
+static void write_all(fat_file_t* file, const char* name, const uint8_t* data, uint32_t len) {
+    uint32_t done = 0;
+
+    for (uint32_t chunk = 5; done < len; chunk = chunk * 2 + 1) {
+        uint32_t n = len - done < chunk ? len - done : chunk;
+        if (fat_write(file, data + done, n) != (int64_t)n) {
+            fail("write to %s failed at %u of %u bytes", name, done, len);
+        }
+        done += n;
+    }
+}
+
+static void create(const char* path, uint32_t size) {
+    char fpath[PATH_MAX_LEN + 1];
+    fat_file_t file;
+
+    model_file_t* f = model_add(path, size);
+    fat_path(fpath, path);
+    if (fat_open(fpath, "w", &file) < 0) {
+        fail("cannot create %s", path);
+    }
+    write_all(&file, path, f->data, size);
+    if (fat_close(&file) < 0) {
+        fail("close of %s failed", path);
+    }
+}
+
+static void rename_ok(const char* from, const char* to) {
+    char ffrom[PATH_MAX_LEN + 1], fto[PATH_MAX_LEN + 1];
+    size_t from_len = strlen(from);
+
+    fat_path(ffrom, from);
+    fat_path(fto, to);
+    if (fat_rename(ffrom, fto) < 0) {
+        fail("rename %s to %s failed", from, to);
+    }
+
+    // A directory takes the files under it along
+    for (int i = 0; i < dir_count; i++) {
+        if (strcmp(dirs[i], from) == 0) {
+            snprintf(dirs[i], sizeof(dirs[i]), "%s", to);
+        }
+    }
+    for (int i = 0; i < model_count; i++) {
+        char* path = model[i].path;
+        if (strcmp(path, from) == 0) {
+            snprintf(path, sizeof(model[i].path), "%s", to);
+        } else if (strncmp(path, from, from_len) == 0 && path[from_len] == '/') {
+            char rest[PATH_MAX_LEN];
+            snprintf(rest, sizeof(rest), "%s", path + from_len);
+            snprintf(path, sizeof(model[i].path), "%s%s", to, rest);
+        }
+    }
+}
+
+static void rename_fails(const char* from, const char* to) {
+    char ffrom[PATH_MAX_LEN + 1], fto[PATH_MAX_LEN + 1];
+
+    fat_path(ffrom, from);
+    fat_path(fto, to);
+    if (fat_rename(ffrom, fto) == 0) {
+        fail("rename %s to %s should have failed", from, to);
+    }
+}
+
+static void open_append(const char* path, fat_file_t* file) {
+    char fpath[PATH_MAX_LEN + 1];
+
+    fat_path(fpath, path);
+    if (fat_open(fpath, "a", file) < 0) {
+        fail("cannot open %s for writing", path);
+    }
+}
+
+// Append `len` bytes of the stream keyed by "<path>+"
+static void extend(const char* path, uint32_t len) {
+    model_file_t* f = model_get(path);
+    char key[PATH_MAX_LEN + 2];
+    fat_file_t file;
+
+    snprintf(key, sizeof(key), "%s+", path);
+    f->data = realloc(f->data, f->size + len);
+    fill(key, f->size, f->data + f->size, len);
+
+    open_append(path, &file);
+    if (fat_seek(&file, f->size) < 0) {
+        fail("cannot seek to the end of %s", path);
+    }
+    write_all(&file, path, f->data + f->size, len);
+    f->size += len;
+    if (fat_close(&file) < 0) {
+        fail("close of %s failed", path);
+    }
+}
+
+static void truncate_to(const char* path, uint32_t size) {
+    model_file_t* f = model_get(path);
+    fat_file_t file;
+
+    open_append(path, &file);
+    if (fat_truncate(&file, f->size + 1) == 0) {
+        fail("truncating %s past its end worked", path);
+    }
+    if (fat_truncate(&file, size) < 0) {
+        fail("cannot truncate %s to %u bytes", path, size);
+    }
+    f->size = size;
+    if (fat_close(&file) < 0) {
+        fail("close of %s failed", path);
+    }
+}
+
+// "w" on an existing file empties it before the write
+static void rewrite(const char* path, uint32_t size) {
+    model_file_t* f = model_get(path);
+    char fpath[PATH_MAX_LEN + 1];
+    fat_file_t file;
+
+    f->data = realloc(f->data, size ? size : 1);
+    fill("rewrite", 0, f->data, size);
+    f->size = size;
+
+    fat_path(fpath, path);
+    if (fat_open(fpath, "w", &file) < 0) {
+        fail("cannot reopen %s", path);
+    }
+    write_all(&file, path, f->data, size);
+    if (fat_close(&file) < 0) {
+        fail("close of %s failed", path);
+    }
+}
+
+static void remove_ok(const char* path) {
+    char fpath[PATH_MAX_LEN + 1];
+
+    fat_path(fpath, path);
+    if (fat_remove(fpath) < 0) {
+        fail("cannot remove %s", path);
+    }
+    model_get(path)->live = 0;
+}
+
+static void remove_fails(const char* path) {
+    char fpath[PATH_MAX_LEN + 1];
+
+    fat_path(fpath, path);
+    if (fat_remove(fpath) == 0) {
+        fail("removing %s should have failed", path);
+    }
+}
+
+// Host files
+
+static void write_host(const char* root, const char* path, const uint8_t* data, uint32_t size) {
+    char full[PATH_MAX_LEN * 2];
+    FILE* out;
+
+    snprintf(full, sizeof(full), "%s/%s", root, path);
+    out = fopen(full, "wb");
+    if (!out || fwrite(data, 1, size, out) != size || fclose(out) != 0) {
+        fail("cannot write %s", full);
+    }
+}
+
+static void make_host_dirs(const char* root) {
+    char full[PATH_MAX_LEN * 2];
+
+    mkdir(root, 0755);
+    for (int i = 0; i < dir_count; i++) {
+        snprintf(full, sizeof(full), "%s/%.*s", root, PATH_MAX_LEN - 1, dirs[i]);
+        if (mkdir(full, 0755) < 0) {
+            fail("cannot create %s", full);
+        }
+    }
+}
+
+static void seed_all(void) {
+    char path[PATH_MAX_LEN];
+
+    for (int i = 0; i < SEED_COUNT; i++) {
+        model_add(seeds[i].path, seeds[i].size);
+    }
+    for (int i = 0; i < MANY_FILES; i++) {
+        many_name(path, "f", i);
+        model_add(path, (uint32_t)(i * 37) % 700);
+    }
+}
+
+static void write_tree(const char* root) {
+    make_host_dirs(root);
+    for (int i = 0; i < model_count; i++) {
+        if (model[i].live) {
+            write_host(root, model[i].path, model[i].data, model[i].size);
+        }
+    }
+}
+
+static void load_image(const char* name) {
+    FILE* in = fopen(name, "rb");
+
+    if (!in || fseek(in, 0, SEEK_END) != 0) {
+        fail("cannot open %s", name);
+    }
+    disk_size = (size_t)ftell(in);
+    disk = malloc(disk_size);
+    rewind(in);
+    if (!disk || fread(disk, 1, disk_size, in) != disk_size) {
+        fail("cannot read %s", name);
+    }
+    fclose(in);
+
+    snprintf(ram.name, sizeof(ram.name), "ram0");
+    ram.sectors = disk_size / BLK_SECTOR_SIZE;
+    ram.max_sectors = 256;
+    ram.max_segments = 32;
+    ram.slots = 4;
+    ram.ops = &ram_ops;
+    bcache_init();
+    if (blk_register(&ram) < 0 || fat_mount_all() != 1) {
+        fail("no FAT volume in %s", name);
+    }
+}
+
+static void save_image(const char* name) {
+    FILE* out = fopen(name, "wb");
+
+    if (bcache_sync(NULL) < 0) {
+        fail("bcache_sync failed");
+    }
+    if (!out || fwrite(disk, 1, disk_size, out) != disk_size || fclose(out) != 0) {
+        fail("cannot write %s", name);
+    }
+}
+
+static void run(void) {
+    char path[PATH_MAX_LEN], to[PATH_MAX_LEN];
+
+    step = "read";
+    check_all();
+
+    step = "create";
+    create("Created With A Long Name.txt", 5000);
+    create("docs/new.bin", 70000);
+    for (int i = 0; i < MANY_EXTRA; i++) {
+        many_name(path, "g", i);
+        create(path, (uint32_t)(i * 53) % 900);
+    }
+    check_all();
+
+    step = "rename";
+    rename_ok("small.txt", "docs/Moved Small.txt");
+    rename_ok("Long File Name.dat", "renamed.dat");
+    rename_ok("many/f010.txt", "many/f010 renamed.txt");
+    rename_fails("renamed.dat", "docs/readme.txt");
+    rename_fails("missing.txt", "found.txt");
+    rename_fails("docs", "many/docs");
+    rename_ok("docs", "Documents");
+    check_all();
+
+    step = "extend";
+    extend("Documents/readme.txt", 20000);
+    extend("empty.txt", 1);
+    extend("many/f050.txt", 4096);
+    check_all();
+
+    step = "truncate";
+    truncate_to("Documents/Big Binary.bin", 123457);
+    extend("Documents/Big Binary.bin", 1000);
+    truncate_to("renamed.dat", 0);
+    rewrite("many/f020.txt", 10);
+    check_all();
+
+    step = "delete";
+    for (int i = 0; i < MANY_FILES; i += 3) {
+        many_name(path, "f", i);
+        remove_ok(path);
+    }
+    remove_ok("Documents/new.bin");
+    remove_fails("Documents");
+    remove_fails("missing.txt");
+    for (int i = 0; i < 5; i++) {
+        snprintf(to, sizeof(to), "many/created after delete %d.txt", i);
+        create(to, 1000 + i);
+    }
+    check_all();
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "seed") == 0) {
+        seed_all();
+        write_tree(argv[2]);
+        return 0;
+    }
+    if (argc == 4 && strcmp(argv[1], "run") == 0) {
+        seed_all();
+        load_image(argv[2]);
+        run();
+        save_image(argv[2]);
+        write_tree(argv[3]);
+        return 0;
+    }
+    fprintf(stderr, "usage: fattest seed <dir> | fattest run <image> <expected>\n");
+    return 2;
+}
@@ -0,0 +1,20 @@
+#ifndef TEST_LIBC_H
+#define TEST_LIBC_H
+
+/*
+ * Stands in for the kernel's "libc/libc.h" in the hosted FAT test. The
+ * kernel sources are built like MLibc's hosted library (MLIBC_HOSTED,
+ * names prefixed with ml_) and get MLibc itself; the test program is an
+ * ordinary Linux program and only needs the types the headers use.
+ */
+
+#ifdef MLIBC_HOSTED
+#include "../../../MLibc/src/libc.h"
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "../../../MLibc/src/fsio.h"
+#endif
+
+#endif /* TEST_LIBC_H */
@@ -0,0 +1,352 @@
+// Hosted lock test. lock.c runs on host threads, which share the locks
+// the way a second CPU would. It checks that the ticket lock excludes
+// and serves in arrival order, that spin_trylock only takes a free lock,
+// that the reader-writer lock admits readers together and holds them
+// off behind a waiting writer, and that seqlock readers never keep a
+// torn copy. The _irqsave variants are left out: cli faults in user mode.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lock.h"
+
+#define THREADS     4
+#define ROUNDS      100000
+#define SEQ_WORDS   8           // Wider than any single store
+
+uint32_t tsc_khz = 0;
+
+void ml_heap_lock(void) {
+}
+
+void ml_heap_unlock(void) {
+}
+
+void ml_print_char(char c) {
+    putchar(c);
+}
+
+// lockstat pulls in MLibc's stdio, whose input side reads the keyboard
+char ml_read_scan_code(void) {
+    return 0;
+}
+
+char ml_scancode_to_ascii(char scancode) {
+    (void)scancode;
+    return 0;
+}
+
+static const char* step = "";
+
+static void fail(const char* what) {
+    fprintf(stderr, "locktest: %s: %s\n", step, what);
+    exit(1);
+}
+
+static void start(pthread_t* thread, void* (*fn)(void*), void* arg) {
+    if (pthread_create(thread, NULL, fn, arg) != 0) {
+        fail("cannot start a thread");
+    }
+}
+
+// Yield until `*value` reaches `want`
+static void wait_for(volatile uint32_t* value, uint32_t want) {
+    while (__atomic_load_n(value, __ATOMIC_ACQUIRE) != want) {
+        sched_yield();
+    }
+}
+
+static void pause_ms(int ms) {
+    struct timespec t = { 0, ms * 1000000L };
+    nanosleep(&t, NULL);
+}
+
+// Ticket lock
+
+static spinlock_t spin = SPINLOCK_INIT("test spin");
+static uint64_t spin_counter;
+
+// Waiters are served strictly in turn, so on a host with fewer CPUs
+// than threads each handover can cost a time slice once a queue forms.
+// Workers wait, yielding, for the lock to look free before queueing.
+static void* spin_worker(void* arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        while (__atomic_load_n(&spin.next, __ATOMIC_RELAXED) != __atomic_load_n(&spin.owner, __ATOMIC_RELAXED)) {
+            sched_yield();
+        }
+        spin_lock(&spin);
+        spin_counter++;
+        spin_unlock(&spin);
+    }
+    return NULL;
+}
+
+static int order[2];
+static volatile uint32_t order_count;
+
+static void* spin_queued(void* arg) {
+    spin_lock(&spin);
+    order[order_count++] = (int)(intptr_t)arg;
+    spin_unlock(&spin);
+    return NULL;
+}
+
+static void test_spin(void) {
+    pthread_t threads[THREADS];
+
+    step = "spin";
+    for (int i = 0; i < THREADS; i++) {
+        start(&threads[i], spin_worker, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (spin_counter != (uint64_t)THREADS * ROUNDS) {
+        fail("increments were lost");
+    }
+    if (spin.stats.acquires != THREADS * ROUNDS) {
+        fail("acquires miscounted");
+    }
+
+    // Two waiters queue behind the holder and are served in ticket order
+    step = "spin order";
+    spin_lock(&spin);
+    uint32_t held = spin.next;
+    start(&threads[0], spin_queued, (void*)1);
+    wait_for(&spin.next, held + 1);
+    start(&threads[1], spin_queued, (void*)2);
+    wait_for(&spin.next, held + 2);
+    spin_unlock(&spin);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    if (order_count != 2 || order[0] != 1 || order[1] != 2) {
+        fail("waiters were not served in arrival order");
+    }
+    if (spin.stats.contended < 2) {
+        fail("waits were not counted");
+    }
+
+    step = "spin_trylock";
+    spin_lock(&spin);
+    if (spin_trylock(&spin)) {
+        fail("took a held lock");
+    }
+    spin_unlock(&spin);
+    if (!spin_trylock(&spin)) {
+        fail("could not take a free lock");
+    }
+    if (spin.next != spin.owner + 1) {
+        fail("took a ticket it was not served");
+    }
+    spin_unlock(&spin);
+}
+
+// Reader-writer lock
+
+static rwlock_t rw = RWLOCK_INIT("test rw");
+static volatile uint64_t rw_pair[2];
+static volatile uint32_t readers_in;
+static volatile uint32_t late_reader_in;
+
+static void* rw_writer(void* arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS / 10; i++) {
+        write_lock(&rw);
+        rw_pair[0]++;
+        rw_pair[1]++;
+        write_unlock(&rw);
+    }
+    return NULL;
+}
+
+static void* rw_reader(void* arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS / 10; i++) {
+        read_lock(&rw);
+        if (rw_pair[0] != rw_pair[1]) {
+            fail("a reader saw a writer's half-done update");
+        }
+        read_unlock(&rw);
+    }
+    return NULL;
+}
+
+static void* rw_holder(void* arg) {
+    (void)arg;
+    read_lock(&rw);
+    __atomic_fetch_add(&readers_in, 1, __ATOMIC_RELEASE);
+    return NULL;            // Released by the main thread
+}
+
+static void* rw_blocked_writer(void* arg) {
+    (void)arg;
+    write_lock(&rw);
+    if (late_reader_in) {
+        fail("a new reader got in ahead of a waiting writer");
+    }
+    write_unlock(&rw);
+    return NULL;
+}
+
+static void* rw_late_reader(void* arg) {
+    (void)arg;
+    read_lock(&rw);
+    late_reader_in = 1;
+    read_unlock(&rw);
+    return NULL;
+}
+
+static void test_rw(void) {
+    pthread_t threads[THREADS];
+
+    step = "rwlock";
+    start(&threads[0], rw_writer, NULL);
+    for (int i = 1; i < THREADS; i++) {
+        start(&threads[i], rw_reader, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (rw.stats.write_acquires != ROUNDS / 10 || rw.stats.acquires != (THREADS - 1) * (ROUNDS / 10)) {
+        fail("acquires miscounted");
+    }
+
+    // Two readers hold the lock at once
+    step = "rwlock sharing";
+    start(&threads[0], rw_holder, NULL);
+    start(&threads[1], rw_holder, NULL);
+    wait_for(&readers_in, 2);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    if (rw.state != 2) {
+        fail("readers did not share the lock");
+    }
+
+    // A writer waits for them, and a reader arriving after the writer
+    // waits for the writer
+    step = "rwlock writer preference";
+    start(&threads[0], rw_blocked_writer, NULL);
+    wait_for(&rw.writers_waiting, 1);
+    start(&threads[1], rw_late_reader, NULL);
+    pause_ms(20);
+    if (late_reader_in) {
+        fail("a new reader got in while a writer waited");
+    }
+    read_unlock(&rw);
+    read_unlock(&rw);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    if (!late_reader_in || rw.state != 0) {
+        fail("the lock did not come free");
+    }
+}
+
+// Seqlock
+
+static seqlock_t seq = SEQLOCK_INIT("test seq");
+static volatile uint64_t seq_data[SEQ_WORDS];
+static volatile uint32_t seq_done;
+
+static void* seq_writer(void* arg) {
+    (void)arg;
+    for (uint64_t value = 1; value <= ROUNDS; value++) {
+        write_seqlock(&seq);
+        for (int i = 0; i < SEQ_WORDS; i++) {
+            seq_data[i] = value;
+        }
+        write_sequnlock(&seq);
+    }
+    seq_done = 1;
+    return NULL;
+}
+
+static void* seq_reader(void* arg) {
+    uint64_t copy[SEQ_WORDS];
+    uint64_t last = 0;
+    uint32_t* retries = arg;
+
+    while (!seq_done) {
+        uint32_t start;
+        do {
+            start = read_seqbegin(&seq);
+            for (int i = 0; i < SEQ_WORDS; i++) {
+                copy[i] = seq_data[i];
+            }
+        } while (read_seqretry(&seq, start) && ++*retries);
+
+        for (int i = 1; i < SEQ_WORDS; i++) {
+            if (copy[i] != copy[0]) {
+                fail("a reader kept a torn copy");
+            }
+        }
+        if (copy[0] < last) {
+            fail("a reader went back in time");
+        }
+        last = copy[0];
+    }
+    return NULL;
+}
+
+static void test_seq(void) {
+    pthread_t threads[THREADS];
+    uint32_t retries[THREADS] = { 0 };
+    uint32_t total = 0;
+
+    // A write between a reader's begin and retry is caught
+    step = "seqlock retry";
+    uint32_t begun = read_seqbegin(&seq);
+    write_seqlock(&seq);
+    write_sequnlock(&seq);
+    if (!read_seqretry(&seq, begun)) {
+        fail("a write in between went unnoticed");
+    }
+    if (read_seqretry(&seq, read_seqbegin(&seq))) {
+        fail("a read with no write in between retried");
+    }
+
+    step = "seqlock";
+    start(&threads[0], seq_writer, NULL);
+    for (int i = 1; i < THREADS; i++) {
+        start(&threads[i], seq_reader, &retries[i]);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += retries[i];
+    }
+    if (seq.seq != 2 * (ROUNDS + 1) || seq.lock.stats.acquires != ROUNDS + 1) {
+        fail("writes miscounted");
+    }
+    if (seq.lock.stats.retries != total + 1) {
+        fail("retries miscounted");
+    }
+    printf("seqlock: %u reader retries\n", total);
+}
+
+static void test_list(void) {
+    int found = 0;
+
+    step = "lock list";
+    for (lock_stats_t* stats = lock_stats_list(); stats; stats = stats->next) {
+        found |= (stats == &spin.stats) | (stats == &rw.stats) << 1 | (stats == &seq.lock.stats) << 2;
+    }
+    if (found != 7) {
+        fail("a lock is missing from the list");
+    }
+    lock_stats_reset();
+    if (spin.stats.acquires || rw.stats.write_acquires || seq.lock.stats.retries) {
+        fail("reset left counts behind");
+    }
+}
+
+int main(void) {
+    test_spin();
+    test_rw();
+    test_seq();
+    test_list();
+    puts("locks: ok");
+    return 0;
+}
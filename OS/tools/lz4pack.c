@@ -0,0 +1,281 @@
+// Compress a kernel image into an LZ4 frame for the boot loaders.
+//
+//     lz4pack <input> <output>
+//
+// Built for the host by the OS Makefile. The frame is standard (`lz4 -d`
+// reads it back) with the content size in its header, which the UEFI
+// loader allocates by. Load time, not packing time, is what counts, so
+// the match finder searches long hash chains and looks one byte ahead
+// before taking a match. The result is decoded again with the loaders'
+// own decoder (src/lz4.h) and compared before it is written.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define BLOCK_MAX     (4u << 20)    // BD 7
+#define WINDOW        65535         // Farthest a match offset reaches
+#define HASH_BITS     16
+#define CHAIN_DEPTH   1024          // Candidates tried per position
+#define LAST_LITERALS 5             // The format ends every block with literals
+#define MATCH_LIMIT   12            // No match starts this close to the end
+
+typedef struct {
+    uint32_t len;
+    uint32_t offset;
+} match_t;
+
+static uint32_t head[1 << HASH_BITS];   // Last position + 1 with each hash
+static uint32_t* chain;                 // Previous position + 1 with the same hash
+
+static uint32_t read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t hash4(const uint8_t* p) {
+    return (read32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void insert(const uint8_t* block, uint32_t pos) {
+    uint32_t h = hash4(block + pos);
+
+    chain[pos] = head[h];
+    head[h] = pos + 1;
+}
+
+// Longest earlier match for the bytes at pos, ending by `limit`
+static match_t find_match(const uint8_t* block, uint32_t pos, uint32_t limit) {
+    match_t best = { 0, 0 };
+    uint32_t candidate = head[hash4(block + pos)];
+
+    for (int depth = 0; candidate && depth < CHAIN_DEPTH; depth++) {
+        uint32_t from = candidate - 1;
+        if (pos - from > WINDOW) {
+            break;
+        }
+
+        uint32_t len = 0;
+        while (pos + len < limit && block[from + len] == block[pos + len]) {
+            len++;
+        }
+        if (len > best.len) {
+            best.len = len;
+            best.offset = pos - from;
+        }
+        candidate = chain[from];
+    }
+    if (best.len < LZ4_MIN_MATCH) {
+        best.len = 0;
+    }
+    return best;
+}
+
+static uint8_t* put_length(uint8_t* out, uint32_t len) {
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (uint8_t)len;
+    return out;
+}
+
+// One sequence: literals [from, from + literals), then the match if any
+static uint8_t* put_sequence(uint8_t* out, const uint8_t* from, uint32_t literals, match_t match) {
+    uint32_t match_code = match.len ? match.len - LZ4_MIN_MATCH : 0;
+    uint8_t* token = out++;
+
+    *token = (uint8_t)(((literals < 15 ? literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literals >= 15) {
+        out = put_length(out, literals - 15);
+    }
+    memcpy(out, from, literals);
+    out += literals;
+    if (match.len) {
+        *out++ = (uint8_t)match.offset;
+        *out++ = (uint8_t)(match.offset >> 8);
+        if (match_code >= 15) {
+            out = put_length(out, match_code - 15);
+        }
+    }
+    return out;
+}
+
+// Compress one block; returns the compressed size
+static uint32_t compress_block(const uint8_t* block, uint32_t len, uint8_t* out) {
+    uint8_t* start = out;
+    uint32_t anchor = 0;            // First byte not yet emitted
+    uint32_t pos = 0;
+
+    memset(head, 0, sizeof(head));
+    if (len > MATCH_LIMIT) {
+        uint32_t last_start = len - MATCH_LIMIT;
+        uint32_t limit = len - LAST_LITERALS;
+
+        while (pos < last_start) {
+            match_t match = find_match(block, pos, limit);
+            insert(block, pos);
+            if (!match.len) {
+                pos++;
+                continue;
+            }
+
+            // Lazy matching: a longer match one byte on is worth a literal
+            if (pos + 1 < last_start) {
+                match_t next = find_match(block, pos + 1, limit);
+                if (next.len > match.len) {
+                    pos++;
+                    continue;
+                }
+            }
+
+            out = put_sequence(out, block + anchor, pos - anchor, match);
+            for (uint32_t i = 1; i < match.len && pos + i < last_start; i++) {
+                insert(block, pos + i);
+            }
+            pos += match.len;
+            anchor = pos;
+        }
+    }
+
+    match_t none = { 0, 0 };
+    out = put_sequence(out, block + anchor, len - anchor, none);
+    return (uint32_t)(out - start);
+}
+
+// xxHash32, for the header checksum byte
+#define XXH_P1 2654435761u
+#define XXH_P2 2246822519u
+#define XXH_P3 3266489917u
+#define XXH_P4 668265263u
+#define XXH_P5 374761393u
+
+static uint32_t rotl(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+static uint32_t xxh32(const uint8_t* p, size_t len) {
+    const uint8_t* end = p + len;
+    uint32_t h;
+
+    if (len >= 16) {
+        uint32_t v[4] = { XXH_P1 + XXH_P2, XXH_P2, 0, 0u - XXH_P1 };
+        while (end - p >= 16) {
+            for (int i = 0; i < 4; i++) {
+                v[i] = rotl(v[i] + read32(p) * XXH_P2, 13) * XXH_P1;
+                p += 4;
+            }
+        }
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    } else {
+        h = XXH_P5;
+    }
+    h += (uint32_t)len;
+    while (end - p >= 4) {
+        h = rotl(h + read32(p) * XXH_P3, 17) * XXH_P4;
+        p += 4;
+    }
+    while (p < end) {
+        h = rotl(h + *p++ * XXH_P5, 11) * XXH_P1;
+    }
+    h ^= h >> 15;
+    h *= XXH_P2;
+    h ^= h >> 13;
+    h *= XXH_P3;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = malloc(size ? (size_t)size : 1);
+    if (size < 0 || !data || fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *len = (size_t)size;
+    return data;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: lz4pack <input> <output>\n");
+        return 1;
+    }
+
+    size_t len;
+    uint8_t* input = read_file(argv[1], &len);
+    if (!input) {
+        fprintf(stderr, "lz4pack: cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    // Incompressible blocks are stored, so this bounds the output
+    size_t blocks = len / BLOCK_MAX + 1;
+    uint8_t* frame = malloc(15 + blocks * (4 + BLOCK_MAX + BLOCK_MAX / 255 + 16) + 4);
+    chain = malloc((len < BLOCK_MAX ? len : BLOCK_MAX) * sizeof(uint32_t) + 1);
+    if (!frame || !chain) {
+        fprintf(stderr, "lz4pack: out of memory\n");
+        return 1;
+    }
+
+    uint8_t* out = frame;
+    write32(out, LZ4_FRAME_MAGIC);
+    out[4] = LZ4_FLG_VERSION | LZ4_FLG_BLOCK_INDEP | LZ4_FLG_SIZE;
+    out[5] = 7 << 4;
+    write32(out + 6, (uint32_t)len);
+    write32(out + 10, (uint32_t)((uint64_t)len >> 32));
+    out[14] = (uint8_t)(xxh32(out + 4, 10) >> 8);
+    out += 15;
+
+    for (size_t pos = 0; pos < len; pos += BLOCK_MAX) {
+        uint32_t block_len = len - pos < BLOCK_MAX ? (uint32_t)(len - pos) : BLOCK_MAX;
+        uint32_t packed = compress_block(input + pos, block_len, out + 4);
+
+        if (packed >= block_len) {
+            memcpy(out + 4, input + pos, block_len);
+            write32(out, block_len | LZ4_BLOCK_STORED);
+            out += 4 + block_len;
+        } else {
+            write32(out, packed);
+            out += 4 + packed;
+        }
+    }
+    write32(out, 0);
+    out += 4;
+    size_t frame_len = (size_t)(out - frame);
+
+    uint8_t* check = malloc(len ? len : 1);
+    if (!check || lz4_decompress_frame(frame, frame_len, check, len) != (long)len ||
+        memcmp(check, input, len) != 0) {
+        fprintf(stderr, "lz4pack: %s does not decompress back to %s\n", argv[2], argv[1]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[2], "wb");
+    if (!file || fwrite(frame, 1, frame_len, file) != frame_len || fclose(file) != 0) {
+        fprintf(stderr, "lz4pack: cannot write %s\n", argv[2]);
+        return 1;
+    }
+    printf("lz4pack: %s %u -> %u bytes (%u%%)\n", argv[2], (unsigned int)len,
+           (unsigned int)frame_len, len ? (unsigned int)(frame_len * 100 / len) : 100);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#include "libc.h"
+
+// Sample user-mode program: prints its arguments and reads the clock
+// through the vDSO. Built by `make user`, run with `run /HELLO.ELF`.
+int main(int argc, char** argv) {
+    uint64_t start = now_ns();
+
+    printf("Hello from pid %d\n", getpid());
+    for (int i = 0; i < argc; i++) {
+        printf("argv[%d] = %s\n", i, argv[i]);
+    }
+    printf("Startup to here: %u ns\n", (unsigned int)(now_ns() - start));
+    return 0;
+}